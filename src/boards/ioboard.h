@@ -46,13 +46,89 @@ SOFTWARE.
 #define CONFIG_USBCLK_DIV              1 /* Fusb = Fsys/(2 ^ USB_div) */
 
 /* Set up PLL0 for 52MHz operation; Fpll = (Fclk * PLL_mul) / PLL_div
-   All we need to do is multiply by 13/3. */
+   All we need to do is multiply by 13/3. For 66MHz operation (the UC3C
+   maximum), multiply by 11/2 instead; all peripheral timing is derived from
+   CONFIG_MAIN_HZ. */
 #define CONFIG_PLL0_MUL                13u
 #define CONFIG_PLL0_DIV                3u
 
 
-#define CONFIG_MAIN_HZ                 ((uint32_t)(BOARD_OSC0_HZ * \
-                                        CONFIG_PLL0_MUL / CONFIG_PLL0_DIV))
+/* Not cast, so it can be used in #if expressions */
+#define CONFIG_MAIN_HZ                 (BOARD_OSC0_HZ * CONFIG_PLL0_MUL / \
+                                        CONFIG_PLL0_DIV)
+
+#if CONFIG_MAIN_HZ > 66000000u
+#error "CONFIG_MAIN_HZ must not exceed 66MHz"
+#endif
+
+/* Main loop frame rate; must be 1000, 2000 or 4000Hz. Every driver tick
+   procedure is called once per frame. */
+#define CONFIG_FRAME_HZ                1000u
+
+#if CONFIG_FRAME_HZ != 1000u && CONFIG_FRAME_HZ != 2000u && \
+        CONFIG_FRAME_HZ != 4000u
+#error "CONFIG_FRAME_HZ must be 1000, 2000 or 4000"
+#endif
+
+/* Number of COUNT cycles per frame */
+#define CONFIG_FRAME_CYCLES            (CONFIG_MAIN_HZ / CONFIG_FRAME_HZ)
+
+/* Number of COUNT cycles per microsecond */
+#define CONFIG_US_CYCLES               (CONFIG_MAIN_HZ / 1000000u)
+
+/* Convert a duration in nanoseconds to a (truncated) number of cycles */
+#define Cycles_from_ns(ns)             ((uint32_t)(((uint64_t)(ns) * \
+                                        CONFIG_MAIN_HZ) / 1000000000u))
+
+/* Convert a duration in milliseconds to a number of frames */
+#define Frames_from_ms(ms)             ((ms) * (CONFIG_FRAME_HZ / 1000u))
+
+/*
+Set to 1 to have I2C and SPI transfers signal completion via TWIM/PDCA
+interrupts rather than being polled each frame. Queued I2C commands and
+chained SPI init transactions then start as soon as the last one completes.
+*/
+#define CONFIG_PDCA_EVENTS             0
+
+/*
+Set to 1 to read every 8kHz MPU-6000 sample from its FIFO and decimate them
+to the frame rate on-board, or 0 to read one register snapshot per frame.
+*/
+#define CONFIG_MPU6000_FIFO            1
+
+/*
+Set to 1 to start each MPU-6000 read from its data-ready interrupt (on
+MPU6000_INT_PIN), timestamping the sample at the interrupt, or 0 to start
+reads from the main loop. Only enable this once MPU6000_INT_PIN is known to
+be wired to the MPU-6000's INT output; otherwise no read ever starts.
+*/
+#define CONFIG_MPU6000_DRDY            0
+
+/*
+Set to 1 to send the MPU-6000's delta-angle and delta-velocity over each
+frame, integrated from every FIFO sample with coning and sculling correction,
+in place of its filtered accel/gyro readings. Requires CONFIG_MPU6000_FIFO.
+*/
+#define CONFIG_MPU6000_DELTAS          0
+
+/*
+MPU-6000 decimation filter chain, used with CONFIG_MPU6000_FIFO unless
+CONFIG_MPU6000_DELTAS is set (see filter.h): set CONFIG_MPU6000_CIC to 1 to
+decimate with a CIC filter rather than the 64-tap FIR (a shorter delay, but
+much weaker anti-aliasing -- see mpu6000.c), and CONFIG_MPU6000_LPF_HZ or
+CONFIG_MPU6000_NOTCH_HZ to add a biquad low-pass or notch at that frequency
+(below half the frame rate) after it; 0 to disable.
+*/
+#define CONFIG_MPU6000_CIC             0
+#define CONFIG_MPU6000_LPF_HZ          0
+#define CONFIG_MPU6000_NOTCH_HZ        0
+
+/*
+Set to 1 to analyse the MPU-6000's accelerometer spectrum on-board and send
+its peak frequencies and band energies a few times a second (see
+vibration.h).
+*/
+#define CONFIG_MPU6000_VIBRATION       0
 
 /* UC3C1512 - TQFP100 / IOBOARD      / Software function pin assignments
  *
@@ -87,21 +163,21 @@ SOFTWARE.
  * 031: GPIO023: PA23
  * 032: GPIO024: PA24
  * 033: GPIO025: PA25
- * 042: GPIO051: PB19 / SPI1.MOSI     / MPU6000_MOSI[1]
- * 043: GPIO052: PB20 / SPI1.MISO     / MPU6000_MISO[1]
- * 044: GPIO053: PB21 / SPI1.CLK      / MPU6000_CLK[1]
- * 045: GPIO054: PB22 / SPI1.CS3#     / MPU6000_CS[1]
+ * 042: GPIO051: PB19 / SPI1.MOSI     / SPI1_SPI_MOSI_PIN[1]
+ * 043: GPIO052: PB20 / SPI1.MISO     / SPI1_SPI_MISO_PIN[1]
+ * 044: GPIO053: PB21 / SPI1.CLK      / SPI1_SPI_CLK_PIN[1]
+ * 045: GPIO054: PB22 / SPI1.CS3#     / MPU6000_SPI_CS_PIN[1]
  * 046: GPIO055: PB23 / SPI1.EN       / MPU6000_ENABLE_PIN
  * 047: GPIO062: PB30 / CLK_12        / OSC0
  * 048: GPIO063: PB31
  * 049: GPIO064: PC00 / I2C1.EN       / MS5611_ENABLE_PIN
  * 050: GPIO065: PC01 / I2C0.EN       / HMC5883_ENABLE_PIN
- * 051: GPIO066: PC02 / I2C0.SDA      / HMC5883_TWI_TWD_PIN[0]
- * 052: GPIO067: PC03 / I2C0.SCL      / HMC5883_TWD_TWCK_PIN[0]
- * 055: GPIO068: PC04 / I2C1.SDA      / MS5611_TWI_TWD_PIN[0]
- * 056: GPIO069: PC05 / I2C1.SCL      / MS5611_TWI_TWCK_PIN[0]
- * 057: GPIO070: PC06 / I2C2.SDA      / MS4525_TWI_TWD_PIN[4]
- * 058: GPIO071: PC07 / I2C2.SCL      / MS4525_TWI_TWCK_PIN[4]
+ * 051: GPIO066: PC02 / I2C0.SDA      / I2C0_TWI_TWD_PIN[0]
+ * 052: GPIO067: PC03 / I2C0.SCL      / I2C0_TWI_TWCK_PIN[0]
+ * 055: GPIO068: PC04 / I2C1.SDA      / I2C1_TWI_TWD_PIN[0]
+ * 056: GPIO069: PC05 / I2C1.SCL      / I2C1_TWI_TWCK_PIN[0]
+ * 057: GPIO070: PC06 / I2C2.SDA      / I2C2_TWI_TWD_PIN[4]
+ * 058: GPIO071: PC07 / I2C2.SCL      / I2C2_TWI_TWCK_PIN[4]
  * 059: GPIO075: PC11 / MCU_PWM.PWM3  / PWM_3_PIN[0]
  * 060: GPIO076: PC12 / I2C2.EN       / MS4525_ENABLE_PIN
  * 061: GPIO077: PC13 / MCU_PWM.PWM2  / PWM_2_PIN[0]
@@ -162,78 +238,82 @@ SOFTWARE.
 #define GPS_USART_IRQ                  AVR32_USART1_IRQ
 #define GPS_USART_IRQ_GROUP            AVR32_USART1_IRQ_GROUP
 
-#define PDCA_CHANNEL_GPS_TX            0
-#define PDCA_CHANNEL_GPS_RX            1
+/* PDCA channels are allocated at init; see drivers/pdcachannel.h */
 #define GPS_USART_PDCA_PID_TX          AVR32_PDCA_PID_USART1_TX
 #define GPS_USART_PDCA_PID_RX          AVR32_PDCA_PID_USART1_RX
 
 #define GPS_ENABLE_PIN                 109
 
-/* I2C connection to the MS4525 pitot sensor */
-#define MS4525_DEVICE_ADDR             0x28u
+/*
+I2C buses; each is driven by one TWIM and PDCA channel pair, shared by all
+the devices attached to it (see drivers/i2cbus.h).
+*/
+#define I2C0_TWI                       (&AVR32_TWIM0)
+#define I2C0_TWI_TWD_PIN               66
+#define I2C0_TWI_TWD_FUNCTION          0
+#define I2C0_TWI_TWCK_PIN              67
+#define I2C0_TWI_TWCK_FUNCTION         0
 
-#define MS4525_TWI                     (&AVR32_TWIM2)
-#define MS4525_TWI_TWD_PIN             70
-#define MS4525_TWI_TWD_FUNCTION        4
-#define MS4525_TWI_TWCK_PIN            71
-#define MS4525_TWI_TWCK_FUNCTION       4
+#define I2C0_TWI_PDCA_PID_TX           AVR32_TWIM0_PDCA_ID_TX
+#define I2C0_TWI_PDCA_PID_RX           AVR32_TWIM0_PDCA_ID_RX
 
-#define PDCA_CHANNEL_MS4525_TX         6
-#define PDCA_CHANNEL_MS4525_RX         7
-#define MS4525_TWI_PDCA_PID_TX         AVR32_TWIM2_PDCA_ID_TX
-#define MS4525_TWI_PDCA_PID_RX         AVR32_TWIM2_PDCA_ID_RX
+#define I2C1_TWI                       (&AVR32_TWIM1)
+#define I2C1_TWI_TWD_PIN               68
+#define I2C1_TWI_TWD_FUNCTION          0
+#define I2C1_TWI_TWCK_PIN              69
+#define I2C1_TWI_TWCK_FUNCTION         0
 
-#define MS4525_ENABLE_PIN              76
+#define I2C1_TWI_PDCA_PID_TX           AVR32_TWIM1_PDCA_ID_TX
+#define I2C1_TWI_PDCA_PID_RX           AVR32_TWIM1_PDCA_ID_RX
 
-/* I2C connection to the HMC5883 magnetometer */
-#define HMC5883_DEVICE_ADDR            0x1Eu
+#define I2C2_TWI                       (&AVR32_TWIM2)
+#define I2C2_TWI_TWD_PIN               70
+#define I2C2_TWI_TWD_FUNCTION          4
+#define I2C2_TWI_TWCK_PIN              71
+#define I2C2_TWI_TWCK_FUNCTION         4
 
-#define HMC5883_TWI                    (&AVR32_TWIM0)
-#define HMC5883_TWI_TWD_PIN            66
-#define HMC5883_TWI_TWD_FUNCTION       0
-#define HMC5883_TWI_TWCK_PIN           67
-#define HMC5883_TWI_TWCK_FUNCTION      0
+#define I2C2_TWI_PDCA_PID_TX           AVR32_TWIM2_PDCA_ID_TX
+#define I2C2_TWI_PDCA_PID_RX           AVR32_TWIM2_PDCA_ID_RX
 
-#define PDCA_CHANNEL_HMC5883_TX        2
-#define PDCA_CHANNEL_HMC5883_RX        3
-#define HMC5883_TWI_PDCA_PID_TX        AVR32_TWIM0_PDCA_ID_TX
-#define HMC5883_TWI_PDCA_PID_RX        AVR32_TWIM0_PDCA_ID_RX
+/*
+SPI bus; driven by one SPIM and PDCA channel pair, shared by the devices on
+its chip-selects (see drivers/spibus.h).
+*/
+#define SPI1_SPI                       (&AVR32_SPI1)
+#define SPI1_SPI_MISO_PIN              52
+#define SPI1_SPI_MISO_FUNCTION         1
+#define SPI1_SPI_MOSI_PIN              51
+#define SPI1_SPI_MOSI_FUNCTION         1
+#define SPI1_SPI_CLK_PIN               53
+#define SPI1_SPI_CLK_FUNCTION          1
 
+#define SPI1_SPI_PDCA_PID_TX           AVR32_SPI1_PDCA_ID_TX
+#define SPI1_SPI_PDCA_PID_RX           AVR32_SPI1_PDCA_ID_RX
+
+/* I2C connection to the MS4525 pitot sensor */
+#define MS4525_DEVICE_ADDR             0x28u
+#define MS4525_I2C_BUS                 (&i2c_bus[2])
+#define MS4525_ENABLE_PIN              76
+
+/* I2C connection to the HMC5883 magnetometer */
+#define HMC5883_DEVICE_ADDR            0x1Eu
+#define HMC5883_I2C_BUS                (&i2c_bus[0])
 #define HMC5883_ENABLE_PIN             65
 
 /* I2C connection to the MS5611 barometric pressure sensor */
 #define MS5611_DEVICE_ADDR             0x77u /* 0x76 if CS tied to VDD */
-
-#define MS5611_TWI                     (&AVR32_TWIM1)
-#define MS5611_TWI_TWD_PIN             68
-#define MS5611_TWI_TWD_FUNCTION        0
-#define MS5611_TWI_TWCK_PIN            69
-#define MS5611_TWI_TWCK_FUNCTION       0
-
-#define PDCA_CHANNEL_MS5611_TX         4
-#define PDCA_CHANNEL_MS5611_RX         5
-#define MS5611_TWI_PDCA_PID_TX         AVR32_TWIM1_PDCA_ID_TX
-#define MS5611_TWI_PDCA_PID_RX         AVR32_TWIM1_PDCA_ID_RX
-
+#define MS5611_I2C_BUS                 (&i2c_bus[1])
 #define MS5611_ENABLE_PIN              64
 
 /* SPI connection to the MPU6000 accelerometer/gyroscope */
-#define MPU6000_SPI                    (&AVR32_SPI1)
-#define MPU6000_SPI_MISO_PIN           52
-#define MPU6000_SPI_MISO_FUNCTION      1
-#define MPU6000_SPI_MOSI_PIN           51
-#define MPU6000_SPI_MOSI_FUNCTION      1
-#define MPU6000_SPI_CLK_PIN            53
-#define MPU6000_SPI_CLK_FUNCTION       1
+#define MPU6000_SPI_BUS                (&spi_bus[0])
+#define MPU6000_SPI_CS                 3u
 #define MPU6000_SPI_CS_PIN             54
 #define MPU6000_SPI_CS_FUNCTION        1
 
-#define PDCA_CHANNEL_MPU6000_TX        14
-#define PDCA_CHANNEL_MPU6000_RX        13
-#define MPU6000_SPI_PDCA_PID_TX        AVR32_SPI1_PDCA_ID_TX
-#define MPU6000_SPI_PDCA_PID_RX        AVR32_SPI1_PDCA_ID_RX
-
 #define MPU6000_ENABLE_PIN             55
+/* Unconfirmed -- see CONFIG_MPU6000_DRDY */
+#define MPU6000_INT_PIN                63
 
 /* GPIO and ADC definitions */
 #define GPIN_0_PIN                     32
@@ -257,7 +337,6 @@ SOFTWARE.
 
 #define GP_ADC                         (&AVR32_ADCIFA)
 #define GP_ADC_SYSCLK                  SYSCLK_ADCIFA
-#define PDCA_CHANNEL_ADC_RX            8
 #define ADC_PDCA_PID_RX                AVR32_PDCA_PID_ADCIFA_CH0_RX
 
 /* PWM pin definitions */
@@ -287,9 +366,11 @@ SOFTWARE.
 #define CPU_USART_RXD_FUNCTION         4
 #define CPU_USART_IRQ                  AVR32_USART0_IRQ
 #define CPU_USART_IRQ_GROUP            AVR32_USART0_IRQ_GROUP
+/* A complete CPU packet must be sent within each frame at this rate. This
+   is set by the CPU, so it doesn't depend on CONFIG_MAIN_HZ; the USART
+   divisor is derived from both in comms.h. */
+#define CPU_USART_BAUD                 2604166u
 
-#define PDCA_CHANNEL_CPU_TX            9
-#define PDCA_CHANNEL_CPU_RX            10
 #define CPU_USART_PDCA_PID_TX          AVR32_PDCA_PID_USART0_TX
 #define CPU_USART_PDCA_PID_RX          AVR32_PDCA_PID_USART0_RX
 
@@ -304,8 +385,6 @@ SOFTWARE.
 #define AUX_USART_IRQ                  AVR32_USART4_IRQ
 #define AUX_USART_IRQ_GROUP            AVR32_USART4_IRQ_GROUP
 
-#define PDCA_CHANNEL_AUX_TX            11
-#define PDCA_CHANNEL_AUX_RX            12
 #define AUX_USART_PDCA_PID_TX          AVR32_PDCA_PID_USART4_TX
 #define AUX_USART_PDCA_PID_RX          AVR32_PDCA_PID_USART4_RX
 
@@ -194,8 +194,6 @@
 #define GPS_USART_IRQ_GROUP              AVR32_USART0_IRQ_GROUP
 #define GPS_USART_SYSCLK                 SYSCLK_USART0
 
-#define PDCA_CHANNEL_GPS_TX              0
-#define PDCA_CHANNEL_GPS_RX              1
 #define GPS_USART_PDCA_PID_TX            AVR32_PDCA_PID_USART0_TX
 #define GPS_USART_PDCA_PID_RX            AVR32_PDCA_PID_USART0_RX
 
@@ -211,8 +209,6 @@
 #define MS5611_TWI_TWCK_FUNCTION         4
 #define MS5611_TWI_SYSCLK                SYSCLK_TWIM2
 
-#define PDCA_CHANNEL_MS5611_TX           2
-#define PDCA_CHANNEL_MS5611_RX           3
 #define MS5611_TWI_PDCA_PID_TX           AVR32_TWIM2_PDCA_ID_TX
 #define MS5611_TWI_PDCA_PID_RX           AVR32_TWIM2_PDCA_ID_RX
 
@@ -228,8 +224,6 @@
 #define MPU6050_TWI_TWCK_FUNCTION        0
 #define MPU6050_TWI_SYSCLK               SYSCLK_TWIM1
 
-#define PDCA_CHANNEL_MPU6050_TX          4
-#define PDCA_CHANNEL_MPU6050_RX          5
 #define MPU6050_TWI_PDCA_PID_TX          AVR32_TWIM1_PDCA_ID_TX
 #define MPU6050_TWI_PDCA_PID_RX          AVR32_TWIM1_PDCA_ID_RX
 
@@ -245,8 +239,6 @@
 #define HMC5883_TWI_TWCK_FUNCTION        0
 #define HMC5883_TWI_SYSCLK               SYSCLK_TWIM0
 
-#define PDCA_CHANNEL_HMC5883_TX          6
-#define PDCA_CHANNEL_HMC5883_RX          7
 #define HMC5883_TWI_PDCA_PID_TX          AVR32_TWIM0_PDCA_ID_TX
 #define HMC5883_TWI_PDCA_PID_RX          AVR32_TWIM0_PDCA_ID_RX
 
@@ -274,7 +266,6 @@
 
 #define GP_ADC                           (&AVR32_ADCIFA)
 #define GP_ADC_SYSCLK                    SYSCLK_ADCIFA
-#define PDCA_CHANNEL_ADC_RX              8
 #define ADC_PDCA_PID_RX                  AVR32_PDCA_PID_ADCIFA_CH0_RX
 
 /* PWM pin definitions */
@@ -300,8 +291,6 @@
 #define CPU_USART_IRQ_GROUP              AVR32_USART1_IRQ_GROUP
 #define CPU_USART_SYSCLK                 SYSCLK_USART1
 
-#define PDCA_CHANNEL_CPU_TX              9
-#define PDCA_CHANNEL_CPU_RX              10
 #define CPU_USART_PDCA_PID_TX            AVR32_PDCA_PID_USART1_TX
 #define CPU_USART_PDCA_PID_RX            AVR32_PDCA_PID_USART1_RX
 
@@ -317,8 +306,6 @@
 #define AUX_USART_IRQ_GROUP              AVR32_USART2_IRQ_GROUP
 #define AUX_USART_SYSCLK                 SYSCLK_USART2
 
-#define PDCA_CHANNEL_AUX_TX              11
-#define PDCA_CHANNEL_AUX_RX              12
 #define AUX_USART_PDCA_PID_TX            AVR32_PDCA_PID_USART2_TX
 #define AUX_USART_PDCA_PID_RX            AVR32_PDCA_PID_USART2_RX
 
@@ -0,0 +1,143 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <asf.h>
+#include <stddef.h>
+#include <string.h>
+#include "hal.h"
+#include "fcsassert.h"
+#include "crc32.h"
+#include "calibration.h"
+
+/* The bootloader's configuration words are at the end of the user page */
+#define CALIBRATION_STORE_MAX_LEN (512u - 8u)
+
+#define CALIBRATION_SCALE_ONE (1 << CALIBRATION_SCALE_FRAC_BITS)
+#define CALIBRATION_BIAS_ONE (1 << CALIBRATION_BIAS_FRAC_BITS)
+
+inline static int32_t calibration_poly(const int32_t coeffs[], int32_t x);
+
+inline static int32_t calibration_poly(const int32_t coeffs[], int32_t x) {
+    int32_t i, p = coeffs[CALIBRATION_THERMAL_TERMS - 1u];
+
+    /* Horner's method, with x in Q15 */
+    for (i = CALIBRATION_THERMAL_TERMS - 2; i >= 0; i--) {
+        p = (int32_t)(((int64_t)p * x) >> CALIBRATION_THERMAL_X_BITS) +
+            coeffs[i];
+    }
+
+    return p;
+}
+
+bool calibration_load_thermal(enum calibration_sensor_t sensor,
+struct calibration_thermal_t *cal) {
+    fcs_assert(sensor < CALIBRATION_SENSORS && cal);
+    fcs_assert(sizeof(struct calibration_store_t) <=
+               CALIBRATION_STORE_MAX_LEN);
+
+    struct calibration_store_t store;
+    const struct calibration_thermal_t *stored;
+
+    memcpy(&store, Hal_user_page(), sizeof(store));
+    memset(cal, 0, sizeof(*cal));
+
+    if (store.magic != CALIBRATION_MAGIC ||
+            store.version != CALIBRATION_VERSION ||
+            store.crc != fcs_crc32((const uint8_t *)&store,
+                                   offsetof(struct calibration_store_t, crc),
+                                   0xFFFFFFFFu)) {
+        return false;
+    }
+
+    stored = &store.thermal[sensor];
+    if (stored->temp_min > stored->temp_ref ||
+            stored->temp_ref > stored->temp_max) {
+        return false;
+    }
+
+    memcpy(cal, stored, sizeof(*cal));
+    return true;
+}
+
+void calibration_thermal_eval(const struct calibration_thermal_t *cal,
+int16_t temp, struct calibration_thermal_comp_t *comp) {
+    fcs_assert(cal && comp);
+
+    int32_t x;
+    uint32_t i;
+
+    if (temp < cal->temp_min) {
+        temp = cal->temp_min;
+    } else if (temp > cal->temp_max) {
+        temp = cal->temp_max;
+    }
+    x = (int32_t)temp - cal->temp_ref;
+
+    for (i = 0; i < CALIBRATION_IMU_AXES; i++) {
+        comp->bias[i] = calibration_poly(cal->axis[i].bias, x);
+        comp->scale[i] = CALIBRATION_SCALE_ONE +
+                         calibration_poly(cal->axis[i].scale, x);
+    }
+}
+
+int16_t calibration_thermal_apply(
+const struct calibration_thermal_comp_t *comp, uint32_t axis,
+int16_t value) {
+    fcs_assert(comp && axis < CALIBRATION_IMU_AXES);
+
+    int64_t v;
+
+    v = ((int64_t)value * CALIBRATION_BIAS_ONE - comp->bias[axis]) *
+        comp->scale[axis];
+    v = (v + ((int64_t)1 << (CALIBRATION_BIAS_FRAC_BITS +
+                             CALIBRATION_SCALE_FRAC_BITS - 1u))) >>
+        (CALIBRATION_BIAS_FRAC_BITS + CALIBRATION_SCALE_FRAC_BITS);
+
+    if (v > INT16_MAX) {
+        return INT16_MAX;
+    } else if (v < INT16_MIN) {
+        return INT16_MIN;
+    } else {
+        return (int16_t)v;
+    }
+}
+
+int32_t calibration_thermal_apply_sum(
+const struct calibration_thermal_comp_t *comp, uint32_t axis, int32_t sum,
+uint32_t samples) {
+    fcs_assert(comp && axis < CALIBRATION_IMU_AXES);
+
+    int64_t v;
+
+    v = ((int64_t)sum - (int64_t)comp->bias[axis] * samples) *
+        comp->scale[axis];
+    v = (v + ((int64_t)1 << (CALIBRATION_SCALE_FRAC_BITS - 1u))) >>
+        CALIBRATION_SCALE_FRAC_BITS;
+
+    if (v > INT32_MAX) {
+        return INT32_MAX;
+    } else if (v < INT32_MIN) {
+        return INT32_MIN;
+    } else {
+        return (int32_t)v;
+    }
+}
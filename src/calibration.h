@@ -0,0 +1,122 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CALIBRATION_H_
+#define _CALIBRATION_H_
+
+/*
+Sensor calibration, stored in the flash user page and applied on-board
+before readings are logged.
+
+The store is a struct calibration_store_t at the start of the user page, in
+the board's (big-endian) byte order, written when the board is programmed
+(e.g. with the user page option of the DFU or JTAG tools). The last 8 bytes
+of the page belong to the bootloader, so the store must not reach them. It's
+only used if its magic, version and CRC32 (over everything before the crc
+field, as for the packet logs) are correct; otherwise no correction is
+applied.
+
+Thermal calibration models each axis' bias and scale error as a polynomial
+in the sensor's temperature reading t:
+  x = (clamp(t, temp_min, temp_max) - temp_ref) / 2^15
+  bias(x) = sum(bias[k] * x^k), in raw LSB with CALIBRATION_BIAS_FRAC_BITS
+            fractional bits
+  scale(x) = 1 + sum(scale[k] * x^k) / 2^CALIBRATION_SCALE_FRAC_BITS
+  corrected = (raw - bias(x)) * scale(x)
+Temperatures are in the sensor's raw units, and clamped to the range the
+calibration was fitted over so the polynomials aren't extrapolated. Each
+coefficient times 2^15 must fit in an int32.
+
+The polynomials are evaluated by calibration_thermal_eval when the
+temperature changes, so applying them per reading is a multiply and shift
+per axis.
+*/
+
+#define CALIBRATION_MAGIC 0x43414c31u /* "CAL1" */
+#define CALIBRATION_VERSION 1u
+
+#define CALIBRATION_THERMAL_TERMS 4u /* up to cubic */
+#define CALIBRATION_THERMAL_X_BITS 15u
+#define CALIBRATION_BIAS_FRAC_BITS 8u
+#define CALIBRATION_SCALE_FRAC_BITS 24u
+
+/* Accel XYZ then gyro XYZ, in the sensor's axes */
+#define CALIBRATION_IMU_AXES 6u
+
+enum calibration_sensor_t {
+    CALIBRATION_MPU6000 = 0,
+    CALIBRATION_SENSORS
+};
+
+struct calibration_thermal_axis_t {
+    /* Coefficients in increasing order of x */
+    int32_t bias[CALIBRATION_THERMAL_TERMS];
+    int32_t scale[CALIBRATION_THERMAL_TERMS];
+};
+
+struct calibration_thermal_t {
+    int16_t temp_ref;
+    int16_t temp_min;
+    int16_t temp_max;
+    uint16_t reserved;
+    struct calibration_thermal_axis_t axis[CALIBRATION_IMU_AXES];
+};
+
+struct calibration_store_t {
+    uint32_t magic;
+    uint32_t version;
+    struct calibration_thermal_t thermal[CALIBRATION_SENSORS];
+    uint32_t crc;
+};
+
+/* Corrections at the current temperature */
+struct calibration_thermal_comp_t {
+    int32_t bias[CALIBRATION_IMU_AXES]; /* raw LSB, Q8 */
+    int32_t scale[CALIBRATION_IMU_AXES]; /* Q24 */
+};
+
+/*
+Copy sensor's thermal calibration from the store to cal, returning true; if
+the store isn't valid, returns false and leaves cal zeroed.
+*/
+bool calibration_load_thermal(enum calibration_sensor_t sensor,
+struct calibration_thermal_t *cal);
+
+/* Set comp to the corrections for temperature reading temp */
+void calibration_thermal_eval(const struct calibration_thermal_t *cal,
+int16_t temp, struct calibration_thermal_comp_t *comp);
+
+/* Correct a single raw reading of axis, saturating to the int16 range */
+int16_t calibration_thermal_apply(
+const struct calibration_thermal_comp_t *comp, uint32_t axis,
+int16_t value);
+
+/*
+Correct the sum of samples raw readings of axis, with
+CALIBRATION_BIAS_FRAC_BITS fractional bits (e.g. an inertial delta),
+saturating to the int32 range
+*/
+int32_t calibration_thermal_apply_sum(
+const struct calibration_thermal_comp_t *comp, uint32_t axis, int32_t sum,
+uint32_t samples);
+
+#endif
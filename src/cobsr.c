@@ -34,7 +34,7 @@ SOFTWARE.
 #include "fcsassert.h"
 
 struct cobsr_encode_result cobsr_encode(uint8_t *dst_buf_ptr,
-size_t dst_buf_len, const uint8_t * src_ptr, size_t src_len) {
+uint32_t dst_buf_len, const uint8_t * src_ptr, uint32_t src_len) {
     /* Asserts ensure that the main loop terminates, and that buffers do not
     overlap */
     fcs_assert(dst_buf_ptr);
@@ -121,7 +121,7 @@ size_t dst_buf_len, const uint8_t * src_ptr, size_t src_len) {
 
 
 struct cobsr_decode_result cobsr_decode(uint8_t *dst_buf_ptr,
-size_t dst_buf_len, const uint8_t * src_ptr, size_t src_len) {
+uint32_t dst_buf_len, const uint8_t * src_ptr, uint32_t src_len) {
     /* Asserts ensure that the main loop terminates, and that buffers do not
     overlap */
     fcs_assert(dst_buf_ptr);
@@ -138,8 +138,6 @@ size_t dst_buf_len, const uint8_t * src_ptr, size_t src_len) {
     size_t              remaining_input_bytes;
     size_t              remaining_output_bytes;
     uint8_t             num_output_bytes;
-    uint8_t             src_byte;
-    size_t              i;
     uint8_t             len_code;
 
     for (;;) {
@@ -21,13 +21,16 @@ SOFTWARE.
 */
 
 #include <asf.h>
-#include <avr32/io.h>
+#include "hal.h"
 #include <compiler.h>
 #include <string.h>
 #include <board.h>
 #include "fcsassert.h"
+#include "main.h"
 #include "comms.h"
+#include "drivers/pdcachannel.h"
 #include "cobsr.h"
+#include "timesync.h"
 #include "peripherals/pwm.h"
 #include "peripherals/ubx_gps.h"
 #include "plog/parameter.h"
@@ -37,7 +40,57 @@ SOFTWARE.
 See https://github.com/bendyer/uav/wiki/IO-Board-Design
 */
 
-#define TELEMETRY_INTERVAL 500u
+#define TELEMETRY_INTERVAL Frames_from_ms(500u)
+#define TELEMETRY_CHUNK_INTERVAL Frames_from_ms(50u)
+#define TELEMETRY_CHUNK_LEN 60u
+#define TELEMETRY_CHUNKS 4u
+
+#if TELEMETRY_CHUNK_LEN * TELEMETRY_CHUNKS > TX_BUF_LEN
+#error "Telemetry chunks don't fit in TX_BUF_LEN"
+#endif
+
+/*
+The CPU packet must be fully transmitted before the next frame starts; each
+byte takes 10 bit periods on the wire.
+*/
+#if CPU_PACKET_LEN * 10u * CONFIG_FRAME_HZ > CPU_USART_ACTUAL_BAUD
+#error "CPU_USART_BAUD is too low to send a packet every frame"
+#endif
+
+/* Both ends must be within 2% of the nominal rate for reliable reception */
+#if Cpu_usart_baud_error(CPU_USART_ACTUAL_BAUD) * 50u > CPU_USART_BAUD
+#error "CPU_USART_BAUD can't be generated accurately from CONFIG_MAIN_HZ"
+#endif
+
+/*
+Worst case of the parameters added straight to the CPU log in one frame --
+each driver adds at most one set of readings per frame, each with its sample
+time. Keep this in step with the drivers. Everything else (forwarded
+telemetry and deferred parameters) is only added if it fits, and there must
+always be room for the largest deferred parameter, so the queue drains.
+*/
+#define CPU_LOG_WORST_CASE_LEN (FCS_LOG_MIN_LENGTH + \
+    /* gp.c: GP_IN */ \
+    Cpu_parameter_len(1u, 1u) + \
+    /* pwm.c: CONTROL_POS, CONTROL_MODE */ \
+    Cpu_parameter_len(2u, 3u) + Cpu_parameter_len(1u, 1u) + \
+    /* comms.c: IO_STATUS; timesync.c: IO_TIME */ \
+    Cpu_parameter_len(2u, 2u) + Cpu_parameter_len(4u, 2u) + \
+    /* mpu6000.c: ACCELEROMETER_XYZ, GYROSCOPE_XYZ (or the deltas) */ \
+    2u * (Cpu_parameter_len(2u, 3u) + CPU_SAMPLE_TIME_LEN) + \
+    /* ms5611.c: PRESSURE_TEMP; ms4525.c: PITOT */ \
+    2u * (Cpu_parameter_len(2u, 2u) + CPU_SAMPLE_TIME_LEN) + \
+    /* hmc5883.c: MAGNETOMETER_XYZ */ \
+    Cpu_parameter_len(2u, 3u) + CPU_SAMPLE_TIME_LEN + \
+    /* ubx_gps.c: GPS_INFO, GPS_POSITION_LLA, GPS_VELOCITY_NED */ \
+    Cpu_parameter_len(1u, 3u) + Cpu_parameter_len(4u, 3u) + \
+    Cpu_parameter_len(2u, 3u) + 2u * CPU_SAMPLE_TIME_LEN)
+#define CPU_LOG_DEFERRED_MAX_LEN \
+    Cpu_parameter_len(4u, FCS_PARAMETER_NUM_VALUES_MAX)
+
+#if CPU_LOG_WORST_CASE_LEN + CPU_LOG_DEFERRED_MAX_LEN > CPU_LOG_MAX_LENGTH
+#error "The worst-case CPU log doesn't fit in CPU_PACKET_LEN"
+#endif
 
 
 struct connection_t cpu_conn;
@@ -59,10 +112,15 @@ static enum fcs_parameter_type_t cpu_feed_params[] = {
     FCS_PARAMETER_LAST  /* terminator */
 };
 
-static void comms_process_conn_rx(struct connection_t *conn,
-uint32_t channel_id);
+/* Low-rate parameters waiting for space in the CPU log */
+static struct fcs_parameter_t comms_deferred[COMMS_DEFERRED_MAX];
+static uint32_t comms_deferred_count;
+
+static void comms_process_conn_rx(struct connection_t *conn);
 static bool comms_process_conn_read(struct connection_t *conn,
 uint32_t bytes_avail);
+static void comms_add_deferred(void);
+static void comms_limit_cpu_log(void);
 
 /*
 FIXME: Internal fcs_parameter functions -- work out a better way of exposing
@@ -135,7 +193,7 @@ void comms_set_cpu_status(uint32_t cycles_used) {
 
 	static uint32_t max_proportion_used = 0;
 	struct fcs_parameter_t param;
-    uint32_t cycles_per_tick = CONFIG_MAIN_HZ / 1000,
+    uint32_t cycles_per_tick = CONFIG_FRAME_CYCLES,
              proportion_used = (255u * cycles_used) / cycles_per_tick;
     if (proportion_used > max_proportion_used) {
         max_proportion_used = proportion_used;
@@ -152,6 +210,130 @@ void comms_set_cpu_status(uint32_t cycles_used) {
 	(void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
 }
 
+void comms_set_sample_time(enum fcs_parameter_type_t type, uint8_t device_id,
+uint32_t sample_t) {
+    fcs_assert(type != FCS_PARAMETER_INVALID && type < FCS_PARAMETER_LAST);
+
+    struct fcs_parameter_t param;
+    int32_t offset_us;
+
+    /*
+    Completion is detected by polling, so the offset is normally within the
+    current frame; clamp anything else to fit in 16 bits.
+    */
+    offset_us = Frame_offset_us(sample_t);
+    if (offset_us > INT16_MAX) {
+        offset_us = INT16_MAX;
+    } else if (offset_us < INT16_MIN) {
+        offset_us = INT16_MIN;
+    }
+
+    fcs_parameter_set_header(&param, FCS_VALUE_SIGNED, 16u, 2u);
+    fcs_parameter_set_type(&param, FCS_PARAMETER_SAMPLE_TIME);
+    fcs_parameter_set_device_id(&param, device_id);
+    param.data.i16[0] = swap_i16((int16_t)type);
+    param.data.i16[1] = swap_i16((int16_t)offset_us);
+    (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
+}
+
+void comms_set_device_health(enum fcs_parameter_type_t type,
+const struct device_health_t *health) {
+    fcs_assert(type != FCS_PARAMETER_INVALID && type < FCS_PARAMETER_LAST);
+    fcs_assert(health);
+
+    struct fcs_parameter_t param;
+    uint32_t max_gap_ms;
+
+    if (cpu_conn.last_tx_packet_tick % COMMS_HEALTH_PERIOD != type) {
+        return;
+    }
+
+    max_gap_ms = health->max_gap / (CONFIG_FRAME_HZ / 1000u);
+
+    fcs_parameter_set_header(&param, FCS_VALUE_UNSIGNED, 16u, 4u);
+    fcs_parameter_set_type(&param, FCS_PARAMETER_DEVICE_HEALTH);
+    fcs_parameter_set_device_id(&param, (uint8_t)type);
+    param.data.u16[0] = swap_u16(health->error_count);
+    param.data.u16[1] = swap_u16(health->timeout_count);
+    param.data.u16[2] = swap_u16(health->power_cycle_count);
+    param.data.u16[3] = swap_u16(max_gap_ms < UINT16_MAX ?
+                                 (uint16_t)max_gap_ms : UINT16_MAX);
+    (void)comms_defer_parameter(&param);
+}
+
+void comms_set_device_recovery(enum fcs_parameter_type_t type,
+uint16_t reset_count, uint16_t clear_count, uint16_t power_cycle_count) {
+    fcs_assert(type != FCS_PARAMETER_INVALID && type < FCS_PARAMETER_LAST);
+
+    struct fcs_parameter_t param;
+
+    if (cpu_conn.last_tx_packet_tick % COMMS_HEALTH_PERIOD !=
+            (type + COMMS_HEALTH_PERIOD / 2u) % COMMS_HEALTH_PERIOD) {
+        return;
+    }
+
+    fcs_parameter_set_header(&param, FCS_VALUE_UNSIGNED, 16u, 3u);
+    fcs_parameter_set_type(&param, FCS_PARAMETER_DEVICE_RECOVERY);
+    fcs_parameter_set_device_id(&param, (uint8_t)type);
+    param.data.u16[0] = swap_u16(reset_count);
+    param.data.u16[1] = swap_u16(clear_count);
+    param.data.u16[2] = swap_u16(power_cycle_count);
+    (void)comms_defer_parameter(&param);
+}
+
+bool comms_defer_parameter(const struct fcs_parameter_t *param) {
+    fcs_assert(param);
+
+    if (comms_deferred_count == COMMS_DEFERRED_MAX) {
+        return false;
+    }
+
+    memcpy(&comms_deferred[comms_deferred_count++], param, sizeof(*param));
+    return true;
+}
+
+static void comms_add_deferred(void) {
+    uint32_t i, sent;
+    size_t length;
+
+    for (sent = 0; sent < comms_deferred_count; sent++) {
+        length = _extract_length(comms_deferred[sent].header);
+        if (cpu_conn.out_log.length + length > CPU_LOG_MAX_LENGTH) {
+            break;
+        }
+        (void)fcs_log_add_parameter(&cpu_conn.out_log,
+                                    &comms_deferred[sent]);
+    }
+
+    for (i = sent; i < comms_deferred_count; i++) {
+        memcpy(&comms_deferred[i - sent], &comms_deferred[i],
+               sizeof(comms_deferred[i]));
+    }
+    comms_deferred_count -= sent;
+}
+
+/*
+Drop whole parameters from the end of the CPU log until it fits in a packet.
+The per-frame parameters are sized to fit (see comms.c), so this should
+never have any effect, but fcs_log_serialize asserts on logs which don't.
+*/
+static void comms_limit_cpu_log(void) {
+    size_t i, length;
+
+    if (cpu_conn.out_log.length <= CPU_LOG_MAX_LENGTH) {
+        return;
+    }
+
+    for (i = FCS_LOG_MIN_LENGTH; i < cpu_conn.out_log.length; i += length) {
+        length = _extract_length(cpu_conn.out_log.data[i]);
+        if (!length || i + length > CPU_LOG_MAX_LENGTH) {
+            break;
+        }
+    }
+
+    cpu_conn.out_log.length = i;
+}
+
 void comms_init(void) {
     static usart_options_t usart_options;
     uint32_t result;
@@ -168,7 +350,7 @@ void comms_init(void) {
     gpio_configure_pin(CPU_RESET_PIN, GPIO_DIR_OUTPUT | GPIO_INIT_LOW);
 
     /* Configure CPU USART */
-    usart_options.baudrate = 2604166u;
+    usart_options.baudrate = CPU_USART_BAUD;
     usart_options.charlength = 8u;
     usart_options.paritytype = USART_NO_PARITY;
     usart_options.stopbits = USART_1_STOPBIT;
@@ -176,6 +358,14 @@ void comms_init(void) {
     result = usart_init_rs232(CPU_USART, &usart_options, CONFIG_MAIN_HZ);
     fcs_assert(result == USART_SUCCESS);
 
+#if CPU_USART_OVER_X8
+    /* 8x oversampling gets closer to the CPU's baud rate -- see comms.h */
+    CPU_USART->mr |= AVR32_USART_MR_OVER_MASK;
+    CPU_USART->brgr =
+        ((CPU_USART_DIV_X8 >> 3u) << AVR32_USART_BRGR_CD_OFFSET) |
+        ((CPU_USART_DIV_X8 & 0x7u) << AVR32_USART_BRGR_FP_OFFSET);
+#endif
+
     /* Configure AUX USART */
     usart_options.baudrate = 57600u;
     usart_options.charlength = 8u;
@@ -185,14 +375,30 @@ void comms_init(void) {
     result = usart_init_rs232(AUX_USART, &usart_options, CONFIG_MAIN_HZ);
     fcs_assert(result == USART_SUCCESS);
 
+    /*
+    Allocate the CPU channels first, so the PDCA serves them ahead of every
+    other peripheral's
+    */
+    cpu_conn.tx_pdca_num =
+        pdca_channel_alloc(CPU_USART_PDCA_PID_TX, AVR32_PDCA_BYTE);
+    cpu_conn.rx_pdca_num =
+        pdca_channel_alloc(CPU_USART_PDCA_PID_RX, AVR32_PDCA_BYTE);
+    gcs_conn.tx_pdca_num =
+        pdca_channel_alloc(AUX_USART_PDCA_PID_TX, AVR32_PDCA_BYTE);
+    gcs_conn.rx_pdca_num =
+        pdca_channel_alloc(AUX_USART_PDCA_PID_RX, AVR32_PDCA_BYTE);
+
 	fcs_log_init(&cpu_conn.out_log, FCS_LOG_TYPE_MEASUREMENT, 0);
     fcs_log_init(&cpu_conn.in_log, FCS_LOG_TYPE_COMBINED, 0);
 	fcs_log_init(&gcs_conn.out_log, FCS_LOG_TYPE_COMBINED, 0);
 	fcs_log_init(&gcs_conn.in_log, FCS_LOG_TYPE_COMBINED, 0);
+
+    timesync_init();
 }
 
 void comms_tick(void) {
     size_t packet_len, i, j, param_len;
+    uint32_t telemetry_tick;
     enum fcs_parameter_type_t param_type;
     struct fcs_parameter_t param;
     volatile avr32_pdca_channel_t *pdca_channel;
@@ -200,12 +406,12 @@ void comms_tick(void) {
     fcs_assert(FCS_LOG_MIN_LENGTH <= cpu_conn.out_log.length &&
                cpu_conn.out_log.length <= FCS_LOG_MAX_LENGTH);
 
-    g_t[0] = Get_system_register(AVR32_COUNT);
+    g_t[0] = Hal_count();
 
     /*
     Turn LED1 on if we haven't seen each of the sensors updated this second
     */
-    if (cpu_conn.last_tx_packet_tick % 150 == 0) {
+    if (cpu_conn.last_tx_packet_tick % Frames_from_ms(150u) == 0) {
         if (sensor_status.updated == (UPDATED_ACCEL | UPDATED_BARO |
                                       UPDATED_MAG | UPDATED_GPS |
                                       UPDATED_PITOT)) {
@@ -216,20 +422,23 @@ void comms_tick(void) {
         sensor_status.updated = 0;
     }
 
-    comms_process_conn_rx(&cpu_conn, PDCA_CHANNEL_CPU_RX);
+    comms_process_conn_rx(&cpu_conn);
+
+    g_t[1] = Hal_count() - g_t[0];
 
-    g_t[1] = Get_system_register(AVR32_COUNT) - g_t[0];
+    comms_process_conn_rx(&gcs_conn);
 
-    comms_process_conn_rx(&gcs_conn, PDCA_CHANNEL_AUX_RX);
+    g_t[2] = Hal_count() - g_t[0];
 
-    g_t[2] = Get_system_register(AVR32_COUNT) - g_t[0];
+    /* Add the IO clock and process any sync request from the CPU */
+    timesync_tick();
 
     /*
     If there's a waypoint or path update in the telemetry log, add that to the
     measurement log.
 
     Also add the latest reference pressure and altitude from the telemetry log
-    to the measurement log.
+    to the measurement log, if there's room.
     */
     fcs_assert(FCS_LOG_MIN_LENGTH <= gcs_conn.out_log.length &&
                gcs_conn.out_log.length <= FCS_LOG_MAX_LENGTH);
@@ -245,7 +454,9 @@ void comms_tick(void) {
 
         for (j = 0; j < 100u && cpu_feed_params[j] != FCS_PARAMETER_LAST;
                 j++) {
-            if (cpu_feed_params[j] == param_type) {
+            if (cpu_feed_params[j] == param_type &&
+                    cpu_conn.out_log.length + param_len <=
+                    CPU_LOG_MAX_LENGTH) {
                 memcpy(&param, &gcs_conn.in_log.data[i], param_len);
                 (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
             }
@@ -254,83 +465,52 @@ void comms_tick(void) {
 		i += param_len;
     }
 
-    g_t[3] = Get_system_register(AVR32_COUNT) - g_t[0];
+    g_t[3] = Hal_count() - g_t[0];
 
     /*
-	Only send the telemetry packet every TELEMETRY_INTERVAL ticks. The
+	Only send the telemetry packet every TELEMETRY_INTERVAL frames. The
 	last valid CPU packet is copied directly to the GCS TX buffer so
 	leave that there.
 
     Transmit each set of 240 bytes over 60ms to avoid killing the buffer (100
     bytes).
 	*/
-	pdca_channel = &AVR32_PDCA.channel[PDCA_CHANNEL_AUX_TX];
+    pdca_channel = Hal_pdca_channel(gcs_conn.tx_pdca_num);
+    telemetry_tick = cpu_conn.last_tx_packet_tick % TELEMETRY_INTERVAL;
     if (pdca_channel->tcr == 0 &&
-			cpu_conn.last_tx_packet_tick % TELEMETRY_INTERVAL == 0) {
-		pdca_channel->cr = AVR32_PDCA_TDIS_MASK;
-
-		memcpy(gcs_tx_dma_buf, gcs_conn.tx_buf, TX_BUF_LEN);
-
-        pdca_channel->idr = 0xFFFFFFFFu;
-        pdca_channel->isr;
-        pdca_channel->mar = (uint32_t)gcs_tx_dma_buf;
-        pdca_channel->tcr = 60u;
-        pdca_channel->marr = 0;
-        pdca_channel->tcrr = 0;
-        pdca_channel->psr = AUX_USART_PDCA_PID_TX;
-        pdca_channel->mr = AVR32_PDCA_BYTE << AVR32_PDCA_SIZE_OFFSET;
-        pdca_channel->cr = AVR32_PDCA_ECLR_MASK | AVR32_PDCA_TEN_MASK;
-    } else if (pdca_channel->tcr == 0 &&
-            cpu_conn.last_tx_packet_tick % TELEMETRY_INTERVAL == 50u) {
-        pdca_channel->cr = AVR32_PDCA_TDIS_MASK;
-        pdca_channel->idr = 0xFFFFFFFFu;
-        pdca_channel->isr;
-        pdca_channel->mar = ((uint32_t)gcs_tx_dma_buf) + 60u;
-        pdca_channel->tcr = 60u;
-        pdca_channel->marr = 0;
-        pdca_channel->tcrr = 0;
-        pdca_channel->psr = AUX_USART_PDCA_PID_TX;
-        pdca_channel->mr = AVR32_PDCA_BYTE << AVR32_PDCA_SIZE_OFFSET;
-        pdca_channel->cr = AVR32_PDCA_ECLR_MASK | AVR32_PDCA_TEN_MASK;
-    } else if (pdca_channel->tcr == 0 &&
-            cpu_conn.last_tx_packet_tick % TELEMETRY_INTERVAL == 100u) {
-        pdca_channel->cr = AVR32_PDCA_TDIS_MASK;
-        pdca_channel->idr = 0xFFFFFFFFu;
-        pdca_channel->isr;
-        pdca_channel->mar = ((uint32_t)gcs_tx_dma_buf) + 120u;
-        pdca_channel->tcr = 60u;
-        pdca_channel->marr = 0;
-        pdca_channel->tcrr = 0;
-        pdca_channel->psr = AUX_USART_PDCA_PID_TX;
-        pdca_channel->mr = AVR32_PDCA_BYTE << AVR32_PDCA_SIZE_OFFSET;
-        pdca_channel->cr = AVR32_PDCA_ECLR_MASK | AVR32_PDCA_TEN_MASK;
-    } else if (pdca_channel->tcr == 0 &&
-            cpu_conn.last_tx_packet_tick % TELEMETRY_INTERVAL == 150u) {
-        pdca_channel->cr = AVR32_PDCA_TDIS_MASK;
-        pdca_channel->idr = 0xFFFFFFFFu;
-        pdca_channel->isr;
-        pdca_channel->mar = ((uint32_t)gcs_tx_dma_buf) + 180u;
-        pdca_channel->tcr = 60u;
-        pdca_channel->marr = 0;
-        pdca_channel->tcrr = 0;
-        pdca_channel->psr = AUX_USART_PDCA_PID_TX;
-        pdca_channel->mr = AVR32_PDCA_BYTE << AVR32_PDCA_SIZE_OFFSET;
-        pdca_channel->cr = AVR32_PDCA_ECLR_MASK | AVR32_PDCA_TEN_MASK;
+            telemetry_tick % TELEMETRY_CHUNK_INTERVAL == 0 &&
+            telemetry_tick < TELEMETRY_CHUNKS * TELEMETRY_CHUNK_INTERVAL) {
+        pdca_channel_reset(gcs_conn.tx_pdca_num);
+
+        if (telemetry_tick == 0) {
+            memcpy(gcs_tx_dma_buf, gcs_conn.tx_buf, TX_BUF_LEN);
+        }
+
+        i = TELEMETRY_CHUNK_LEN * (telemetry_tick / TELEMETRY_CHUNK_INTERVAL);
+        (void)pdca_channel_stage(gcs_conn.tx_pdca_num, &gcs_tx_dma_buf[i],
+                                 TELEMETRY_CHUNK_LEN);
+        pdca_channel_enable(gcs_conn.tx_pdca_num);
     }
 
+    /* Fill any space left with low-rate parameters */
+    comms_add_deferred();
+    comms_limit_cpu_log();
+
     /* Validate the last data buffer */
-    fcs_assert(memcmp(cpu_conn.tx_buf, cpu_tx_dma_buf, 192) == 0);
+    fcs_assert(memcmp(cpu_conn.tx_buf, cpu_tx_dma_buf, CPU_PACKET_LEN) == 0);
 
     /* Schedule the measurement log transfer over the CPU UART */
-    packet_len = fcs_log_serialize(cpu_conn.tx_buf, 192u, &cpu_conn.out_log);
+    packet_len = fcs_log_serialize(cpu_conn.tx_buf, CPU_PACKET_LEN,
+                                  &cpu_conn.out_log);
 
-    g_t[4] = Get_system_register(AVR32_COUNT) - g_t[0];
+    g_t[4] = Hal_count() - g_t[0];
 
     for (i = 0; i < packet_len; i++) {
-        cpu_conn.tx_buf[191u - i] = cpu_conn.tx_buf[packet_len - i - 1u];
+        cpu_conn.tx_buf[CPU_PACKET_LEN - 1u - i] =
+            cpu_conn.tx_buf[packet_len - i - 1u];
     }
-    for (; i < 192u; i++) {
-        cpu_conn.tx_buf[191u - i] = 0;
+    for (; i < CPU_PACKET_LEN; i++) {
+        cpu_conn.tx_buf[CPU_PACKET_LEN - 1u - i] = 0;
     }
 
     /*
@@ -343,52 +523,42 @@ void comms_tick(void) {
     fcs_log_init(&(cpu_conn.out_log), FCS_LOG_TYPE_MEASUREMENT,
                  cpu_conn.last_tx_packet_tick);
 
-	g_t[5] = Get_system_register(AVR32_COUNT) - g_t[0];
+	g_t[5] = Hal_count() - g_t[0];
 }
 
 void comms_start_transmit(void) {
 	volatile avr32_pdca_channel_t *pdca_channel;
     size_t i;
 
-    pdca_channel = &AVR32_PDCA.channel[PDCA_CHANNEL_CPU_TX];
+    pdca_channel = Hal_pdca_channel(cpu_conn.tx_pdca_num);
 
     /* Don't start the next transfer until the current one completes */
     if (pdca_channel->tcr) {
         return;
     }
 
-    pdca_channel->cr = AVR32_PDCA_TDIS_MASK;
-    pdca_channel->idr = 0xFFFFFFFFu;
-    pdca_channel->isr;
+    pdca_channel_reset(cpu_conn.tx_pdca_num);
 
-    for (i = 0; i < 192u; i++) {
+    for (i = 0; i < CPU_PACKET_LEN; i++) {
         cpu_tx_dma_buf[i] = cpu_conn.tx_buf[i];
     }
 
-    pdca_channel->mar = (uint32_t)cpu_tx_dma_buf;
-    pdca_channel->tcr = 192u;
-    pdca_channel->marr = 0;
-    pdca_channel->tcrr = 0;
-    pdca_channel->psr = CPU_USART_PDCA_PID_TX;
-    pdca_channel->mr = AVR32_PDCA_BYTE << AVR32_PDCA_SIZE_OFFSET;
-    pdca_channel->cr = AVR32_PDCA_ECLR_MASK | AVR32_PDCA_TEN_MASK;
+    (void)pdca_channel_stage(cpu_conn.tx_pdca_num, cpu_tx_dma_buf,
+                             CPU_PACKET_LEN);
+    pdca_channel_enable(cpu_conn.tx_pdca_num);
+
+    timesync_set_tx_start(Hal_count());
 }
 
-static void comms_process_conn_rx(struct connection_t *conn,
-uint32_t channel_id) {
+static void comms_process_conn_rx(struct connection_t *conn) {
     size_t bytes_read, bytes_avail;
-    bool result;
     volatile avr32_pdca_channel_t *pdca_channel;
 
-    /*
-    TODO: not the most elegant way of working out which PDCA channel to use
-    */
-	pdca_channel = &AVR32_PDCA.channel[channel_id];
+    pdca_channel = Hal_pdca_channel(conn->rx_pdca_num);
 
     /* Receive data from the UART */
     bytes_read = RX_BUF_LEN - pdca_channel->tcr;
     bytes_avail = 0;
-    result = true;
 
     fcs_assert(bytes_read <= RX_BUF_LEN);
 
@@ -408,22 +578,11 @@ uint32_t channel_id) {
         bytes_avail = 0;
         conn->rx_buf_idx = 0;
 
-        pdca_channel->cr = AVR32_PDCA_TDIS_MASK;
-        pdca_channel->idr = 0xFFFFFFFFu;
-        pdca_channel->isr;
-
-        pdca_channel->mar = (uint32_t)conn->rx_buf;
-        pdca_channel->tcr = RX_BUF_LEN;
-        pdca_channel->marr = (uint32_t)conn->rx_buf;
-        pdca_channel->tcrr = RX_BUF_LEN;
-        pdca_channel->psr = (conn == &cpu_conn) ? CPU_USART_PDCA_PID_RX : AUX_USART_PDCA_PID_RX;
-        pdca_channel->mr = (AVR32_PDCA_BYTE << AVR32_PDCA_SIZE_OFFSET)
-            | (1 << AVR32_PDCA_RING_OFFSET);
-        pdca_channel->cr = AVR32_PDCA_ECLR_MASK | AVR32_PDCA_TEN_MASK;
+        pdca_channel_start_ring(conn->rx_pdca_num, conn->rx_buf, RX_BUF_LEN);
     }
 
     if (bytes_avail) {
-        result = comms_process_conn_read(conn, bytes_avail);
+        (void)comms_process_conn_read(conn, bytes_avail);
     } else if (conn == &cpu_conn) {
 		LED_OFF(LED0_GPIO);
 		LED_OFF(LED2_GPIO);
@@ -24,6 +24,8 @@ SOFTWARE.
 #define _COMMS_H_
 
 #include "plog/log.h"
+#include "plog/parameter.h"
+#include "drivers/devicehealth.h"
 
 /*
 Inititalize communications -- set up USART and clear data structures.
@@ -39,9 +41,89 @@ void comms_start_transmit(void);
 
 void comms_set_cpu_status(uint32_t cycles_used);
 
+/*
+Add a FCS_PARAMETER_SAMPLE_TIME entry to the CPU log for the most recent
+parameter of the given type and device ID; sample_t is the COUNT value at
+which the underlying transfer completed.
+*/
+void comms_set_sample_time(enum fcs_parameter_type_t type, uint8_t device_id,
+uint32_t sample_t);
+
+/*
+Queue a low-rate parameter for the CPU log. Queued parameters are added in
+order at the end of each frame, as long as they fit in the packet; the rest
+wait for a later frame. Returns false, dropping the parameter, if the queue
+is full.
+*/
+bool comms_defer_parameter(const struct fcs_parameter_t *param);
+
+/*
+Add a FCS_PARAMETER_DEVICE_HEALTH entry to the CPU log for the device whose
+measurements have the given parameter type. May be called every frame, but
+each device's entry is only queued (see comms_defer_parameter) once per
+COMMS_HEALTH_PERIOD, in a frame determined by type so they don't all land in
+the same packet.
+*/
+void comms_set_device_health(enum fcs_parameter_type_t type,
+const struct device_health_t *health);
+
+/*
+Add a FCS_PARAMETER_DEVICE_RECOVERY entry to the CPU log for the device
+whose measurements have the given parameter type, with the number of times
+each recovery step has been taken. Queued like comms_set_device_health, but
+half a period after it.
+*/
+void comms_set_device_recovery(enum fcs_parameter_type_t type,
+uint16_t reset_count, uint16_t clear_count, uint16_t power_cycle_count);
+
+#define COMMS_HEALTH_PERIOD Frames_from_ms(1000u)
+#define COMMS_DEFERRED_MAX 8u
+
 #define RX_BUF_LEN 512u
 #define TX_BUF_LEN 256u
 
+/* Every CPU packet is padded out to exactly this length */
+#define CPU_PACKET_LEN 192u
+
+/*
+Longest CPU log (excluding the CRC) which fits in a packet once serialized:
+the CRC adds 4 bytes, COBS-R encoding 1 and the framing NULs 2
+*/
+#define CPU_LOG_MAX_LENGTH (CPU_PACKET_LEN - 7u)
+
+/*
+Length of a parameter with n values of the given size in bytes, and of a
+sample time (see comms_set_sample_time)
+*/
+#define Cpu_parameter_len(bytes, n) (3u + (bytes) * (n))
+#define CPU_SAMPLE_TIME_LEN Cpu_parameter_len(2u, 2u)
+
+/*
+CPU USART baud rate divisors for 16x and 8x oversampling, in eighths of a
+clock (CD << 3 | FP), rounded to nearest as usart_init_rs232 does. That
+always uses 16x oversampling, which at some clock rates is a long way from
+CPU_USART_BAUD (2.5% at 66MHz); in that case comms_init switches the CPU
+USART to 8x oversampling.
+*/
+#define CPU_USART_DIV_X16 ((8u * CONFIG_MAIN_HZ + 8u * CPU_USART_BAUD) / \
+                           (16u * CPU_USART_BAUD))
+#define CPU_USART_DIV_X8 ((8u * CONFIG_MAIN_HZ + 4u * CPU_USART_BAUD) / \
+                          (8u * CPU_USART_BAUD))
+#define CPU_USART_BAUD_X16 (CONFIG_MAIN_HZ / (2u * CPU_USART_DIV_X16))
+#define CPU_USART_BAUD_X8 (CONFIG_MAIN_HZ / CPU_USART_DIV_X8)
+#define Cpu_usart_baud_error(baud) ((baud) > CPU_USART_BAUD ? \
+                                    (baud) - CPU_USART_BAUD : \
+                                    CPU_USART_BAUD - (baud))
+
+#if Cpu_usart_baud_error(CPU_USART_BAUD_X8) < \
+        Cpu_usart_baud_error(CPU_USART_BAUD_X16)
+#define CPU_USART_OVER_X8 1
+#define CPU_USART_ACTUAL_BAUD CPU_USART_BAUD_X8
+#else
+#define CPU_USART_OVER_X8 0
+#define CPU_USART_ACTUAL_BAUD CPU_USART_BAUD_X16
+#endif
+
 struct connection_t {
     struct fcs_log_t in_log;
     struct fcs_log_t out_log;
@@ -57,6 +139,10 @@ struct connection_t {
     uint16_t last_rx_packet_tick;
     uint16_t last_tx_packet_tick;
 
+    /* PDCA channels, allocated by comms_init */
+    uint8_t rx_pdca_num;
+    uint8_t tx_pdca_num;
+
 	uint32_t rx_packets;
 	uint32_t rx_errors;
 };
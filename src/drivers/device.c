@@ -0,0 +1,255 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <asf.h>
+#include "hal.h"
+#include "fcsassert.h"
+#include "device.h"
+
+inline static struct device_step_t *device_step_at(
+const struct device_t *dev, void *seq, uint32_t idx);
+inline static void device_goto(struct device_t *dev, uint32_t idx);
+static void device_recover(struct device_t *dev);
+static enum device_result_t device_step(struct device_t *dev, void *seq);
+static void device_read(struct device_t *dev);
+
+inline static struct device_step_t *device_step_at(
+const struct device_t *dev, void *seq, uint32_t idx) {
+    return (struct device_step_t *)((uint8_t *)seq +
+                                    idx * dev->ops->txn_size +
+                                    dev->ops->step_offset);
+}
+
+inline static void device_goto(struct device_t *dev, uint32_t idx) {
+    dev->sequence_idx = idx;
+    dev->step_timer = 0;
+}
+
+static void device_recover(struct device_t *dev) {
+    dev->recovery_level++;
+    if (!dev->ops->reset || !dev->ops->reset(dev, dev->recovery_level)) {
+        device_power_down(dev);
+        return;
+    }
+
+    /*
+    Forget the failures of the aborted transactions, since they're about to
+    be retried
+    */
+    if (dev->state == DEVICE_INIT_SEQUENCE) {
+        dev->ops->clear(dev, dev->init_sequence);
+        /* Carry on from the transaction that failed */
+        dev->state_timer = 0;
+    } else {
+        dev->ops->clear(dev, dev->read_sequence);
+        /* Read sequences may depend on timing, so start from the beginning */
+        device_state_transition(dev, DEVICE_READ_SEQUENCE);
+    }
+}
+
+/*
+Run the step of seq at sequence_idx, moving on to the next step once it's
+done. Transactions return the result of the bus's transact operation;
+control steps return DEVICE_EXECUTED when done, and delays DEVICE_NOTREADY
+until then.
+*/
+static enum device_result_t device_step(struct device_t *dev, void *seq) {
+    struct device_step_t *step = device_step_at(dev, seq, dev->sequence_idx);
+    enum device_result_t result = DEVICE_EXECUTED;
+
+    switch (step->op) {
+        case DEVICE_OP_TRANSACTION:
+            result = dev->ops->transact(dev, seq, dev->sequence_idx);
+            if (result == DEVICE_EXECUTED) {
+                device_goto(dev, dev->sequence_idx + 1u);
+            }
+            break;
+        case DEVICE_OP_DELAY:
+            if (dev->step_timer >= step->arg) {
+                device_goto(dev, dev->sequence_idx + 1u);
+            } else {
+                result = DEVICE_NOTREADY;
+            }
+            break;
+        case DEVICE_OP_JUMP:
+            device_goto(dev, step->idx);
+            break;
+        case DEVICE_OP_LOOP:
+            if (dev->loop_count < step->arg) {
+                dev->loop_count++;
+                device_goto(dev, step->idx);
+            } else {
+                dev->loop_count = 0;
+                device_goto(dev, dev->sequence_idx + 1u);
+            }
+            break;
+        case DEVICE_OP_SAMPLE:
+            fcs_assert(dev->state == DEVICE_READ_SEQUENCE);
+            /* Move on first, as the driver may power the device down */
+            dev->state_timer = 0;
+            device_goto(dev, dev->sequence_idx + 1u);
+            dev->sample(step->arg, dev->completed_t);
+            break;
+        default:
+            fcs_assert(false);
+    }
+
+    return result;
+}
+
+/*
+Run read sequence steps until one has to wait for a delay, or for the bus
+once the device's read budget has been used, or the device is powered down
+by its sample function. The sequence starts again from the beginning when it
+reaches the end, but the bus isn't polled once it has, so a device with a
+read budget makes one pass per tick however fast the bus is -- the first
+transaction of the next pass is started (or its trigger armed) and collected
+next tick; failed transactions are retried next tick.
+*/
+static void device_read(struct device_t *dev) {
+    enum device_result_t result;
+    uint32_t i, start_t = Hal_count(),
+             budget = dev->read_budget_us * CONFIG_US_CYCLES;
+    bool wrapped = false;
+
+    for (i = 0; i < DEVICE_MAX_STEPS_PER_TICK &&
+            dev->state == DEVICE_READ_SEQUENCE; ) {
+        result = device_step(dev, dev->read_sequence);
+        if (result == DEVICE_SEQDONE) {
+            device_goto(dev, 0);
+            wrapped = true;
+            i++;
+        } else if (result == DEVICE_EXECUTED) {
+            i++;
+        } else if ((result == DEVICE_PENDING ||
+                    result == DEVICE_NOTREADY) &&
+                   device_step_at(dev, dev->read_sequence,
+                                  dev->sequence_idx)->op ==
+                    DEVICE_OP_TRANSACTION && !wrapped &&
+                   Hal_count() - start_t < budget) {
+            /* Keep polling the bus */
+        } else {
+            break;
+        }
+    }
+}
+
+void device_init(struct device_t *dev) {
+    fcs_assert(dev && dev->ops);
+    fcs_assert(dev->ops->transact && dev->ops->clear && dev->ops->power_up);
+    fcs_assert(dev->init_sequence);
+    fcs_assert(dev->read_sequence);
+    fcs_assert(dev->sample);
+    fcs_assert(dev->power_delay && dev->read_timeout && dev->init_timeout);
+    fcs_assert(dev->tick_budget_us < 1000000u / CONFIG_FRAME_HZ);
+    fcs_assert(dev->read_budget_us < 1000000u / CONFIG_FRAME_HZ);
+
+    dev->state = DEVICE_POWERING_DOWN;
+    dev->sequence_idx = 0;
+    dev->state_timer = 0;
+
+    /* Configure power enable pin */
+    if (dev->enable_pin_id) {
+        gpio_configure_pin(dev->enable_pin_id,
+            GPIO_DIR_OUTPUT | GPIO_INIT_LOW);
+    }
+}
+
+void device_power_down(struct device_t *dev) {
+    fcs_assert(dev);
+
+    if (dev->enable_pin_id) {
+        gpio_local_clr_gpio_pin(dev->enable_pin_id);
+    }
+
+    device_health_count(&dev->health.power_cycle_count);
+    dev->recovery_level = 0;
+    device_state_transition(dev, DEVICE_POWERING_DOWN);
+}
+
+void device_tick(struct device_t *dev) {
+    fcs_assert(dev && dev->ops);
+
+    dev->state_timer++;
+    dev->step_timer++;
+    device_health_tick(&dev->health);
+
+    if (dev->ops->poll) {
+        dev->ops->poll(dev);
+    }
+
+    if (dev->state == DEVICE_POWERING_DOWN &&
+            dev->state_timer > dev->power_delay) {
+        /* Power up */
+        if (dev->enable_pin_id) {
+            gpio_local_set_gpio_pin(dev->enable_pin_id);
+        }
+        dev->ops->power_up(dev);
+
+        dev->ops->clear(dev, dev->init_sequence);
+        device_state_transition(dev, DEVICE_POWERING_UP);
+    } else if (dev->state == DEVICE_POWERING_UP &&
+            dev->state_timer > dev->power_delay) {
+        device_state_transition(dev, DEVICE_INIT_SEQUENCE);
+    } else if (dev->state == DEVICE_INIT_SEQUENCE) {
+        /* Run init sequence steps in order until the sequence is done,
+           then transition to read sequence. Init sequences are chained, so
+           several commands may complete each tick; keep going while the bus
+           is busy, up to the device's tick budget. */
+        enum device_result_t result;
+        uint32_t start_t = Hal_count(),
+                 budget = dev->tick_budget_us * CONFIG_US_CYCLES,
+                 steps = 0;
+        do {
+            result = device_step(dev, dev->init_sequence);
+        } while ((result == DEVICE_EXECUTED &&
+                  ++steps < DEVICE_MAX_STEPS_PER_TICK) ||
+                 ((result == DEVICE_PENDING || result == DEVICE_NOTREADY) &&
+                  device_step_at(dev, dev->init_sequence,
+                                 dev->sequence_idx)->op ==
+                    DEVICE_OP_TRANSACTION &&
+                  Hal_count() - start_t < budget));
+
+        if (result == DEVICE_SEQDONE) {
+            dev->recovery_level = 0;
+            dev->ops->clear(dev, dev->read_sequence);
+            device_state_transition(dev, DEVICE_READ_SEQUENCE);
+        } else if (result == DEVICE_EXECUTED) {
+            /* Already advanced to the next command */
+        } else if (result == DEVICE_ERROR) {
+            device_recover(dev);
+        } else if (dev->state_timer > dev->init_timeout) {
+            device_health_count(&dev->health.timeout_count);
+            device_recover(dev);
+        }
+    } else if (dev->state == DEVICE_READ_SEQUENCE &&
+            dev->state_timer > dev->read_timeout) {
+        /* Watch for timeouts in the read state */
+        device_health_count(&dev->health.timeout_count);
+        device_recover(dev);
+    } else if (dev->state == DEVICE_READ_SEQUENCE) {
+        device_read(dev);
+    } else {
+        /* Waiting for a timer to expire */
+    }
+}
@@ -0,0 +1,169 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _DEVICE_H_
+#define _DEVICE_H_
+
+#include "devicehealth.h"
+#include "devicesequence.h"
+
+/*
+Device core shared by the I2C and SPI device frameworks (i2cdevice.c and
+spidevice.c). It runs each device through the same state machine -- power
+up, init sequence, read sequence, and power down after faults -- and
+interprets the sequences' control steps. Bus access goes through the
+device's device_bus_ops_t table, which is set by i2c_device_init or
+spi_device_init.
+
+Init sequence errors, and timeouts in the init or read states, are recovered
+from in steps, escalating while the device fails to return data: the bus's
+reset operation is called with the number of steps taken so far, and after
+each step it accepts, the current init transaction or the read sequence is
+retried. Once it declines (or if the bus has no reset operation) the device
+is power-cycled.
+*/
+
+enum device_state_t {
+    DEVICE_POWERING_UP = 0,
+    DEVICE_INIT_SEQUENCE,
+    DEVICE_READ_SEQUENCE,
+    DEVICE_POWERING_DOWN
+};
+
+/* Same values as twim_transaction_result_t and spim_transaction_result_t */
+enum device_result_t {
+    DEVICE_EXECUTED = 0,
+    DEVICE_NOTREADY,
+    DEVICE_PENDING,
+    DEVICE_SEQDONE,
+    DEVICE_ERROR
+};
+
+struct device_t;
+
+struct device_bus_ops_t {
+    /* Size of the bus's transaction type, and the offset of its step field */
+    uint32_t txn_size;
+    uint32_t step_offset;
+
+    /*
+    Start the transaction at idx in seq or collect its result, as for
+    twim_run_sequence, keeping the device's fault statistics up to date;
+    sets dev->completed_t when the transaction is executed
+    */
+    enum device_result_t (*transact)(struct device_t *dev, void *seq,
+                                     uint32_t idx);
+    /* Forget the progress of all of seq's transactions */
+    void (*clear)(struct device_t *dev, void *seq);
+    /* Called at the start of each tick, or NULL */
+    void (*poll)(struct device_t *dev);
+    /* Prepare the bus once the device has been powered up */
+    void (*power_up)(struct device_t *dev);
+    /*
+    Take recovery step level (from 1), aborting whatever the device has in
+    progress; returns false to have the device power-cycled instead. NULL
+    always power-cycles.
+    */
+    bool (*reset)(struct device_t *dev, uint32_t level);
+};
+
+struct device_t {
+    /* Device configuration data */
+    uint16_t power_delay; /* frames -- see Frames_from_ms */
+    uint16_t init_timeout; /* frames */
+    uint16_t read_timeout; /* frames */
+    /*
+    Time to keep polling a busy bus during each init sequence tick, so
+    several transactions can complete per frame -- 0 to poll once per tick
+    */
+    uint16_t tick_budget_us;
+    /*
+    As above for each read sequence tick, for devices which must collect a
+    short transaction's result before deciding what to read next
+    */
+    uint16_t read_budget_us;
+
+    /* Hardware configuration data */
+    uint8_t enable_pin_id;
+
+    /* Bus operations */
+    const struct device_bus_ops_t *ops;
+
+    /* Current device state */
+    enum device_state_t state;
+    uint32_t sequence_idx;
+    uint32_t state_timer; /* frames */
+    uint32_t step_timer; /* frames since sequence_idx last changed */
+    uint16_t loop_count; /* of the DEVICE_OP_LOOP step being run */
+    uint32_t completed_t; /* of the last transaction executed */
+
+    /* Number of recovery steps taken since the device last returned data */
+    uint8_t recovery_level;
+
+    /* Fault statistics */
+    struct device_health_t health;
+
+    /*
+    Transaction sequence definitions -- arrays of the bus's transaction
+    type, see devicesequence.h
+    */
+    void *init_sequence;
+    void *read_sequence;
+
+    /*
+    Called by the read sequence's DEVICE_OP_SAMPLE steps to convert and
+    report the data read; may call device_power_down if it's invalid
+    */
+    void (*sample)(uint16_t arg, uint32_t completed_t);
+};
+
+static inline void device_state_transition(struct device_t *dev,
+        enum device_state_t new_state) {
+    fcs_assert(new_state <= DEVICE_POWERING_DOWN);
+
+    dev->state = new_state;
+    dev->state_timer = 0;
+    dev->sequence_idx = 0;
+    dev->step_timer = 0;
+    dev->loop_count = 0;
+}
+
+/*
+Check the device's configuration and initialize its enable pin; called by
+i2c_device_init and spi_device_init once they've set dev->ops.
+*/
+void device_init(struct device_t *dev);
+
+/*
+Power the device down; it's powered up and initialized again after
+power_delay. Drivers should use this for faults which a bus reset won't fix
+(e.g. invalid data).
+*/
+void device_power_down(struct device_t *dev);
+
+/*
+Handle periodic device update tasks, including timeouts, fault recovery and
+running the init_sequence and read_sequence steps.
+*/
+void device_tick(struct device_t *dev);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _DEVICEHEALTH_H_
+#define _DEVICEHEALTH_H_
+
+/*
+Fault statistics kept by i2cdevice.c and spidevice.c for each device, and
+reported to the CPU by comms_set_device_health. Counts saturate at 65535.
+
+- error_count is the number of transactions which failed (NAK, arbitration
+  lost, or aborted), plus any data the device reports having lost (e.g. an
+  MPU-6000 FIFO overflow);
+- timeout_count is the number of init or read state timeouts;
+- power_cycle_count is the number of times the device has been powered down
+  after a fault;
+- max_gap is the longest time between successful reads, in frames, not
+  counting the time before the first one.
+*/
+struct device_health_t {
+    uint16_t error_count;
+    uint16_t timeout_count;
+    uint16_t power_cycle_count;
+    uint16_t max_gap; /* frames */
+
+    /* Frames since the last successful read */
+    uint16_t gap_timer;
+    bool seen_data;
+};
+
+static inline void device_health_count(uint16_t *count) {
+    if (*count < UINT16_MAX) {
+        (*count)++;
+    }
+}
+
+/* Call once per frame */
+static inline void device_health_tick(struct device_health_t *health) {
+    device_health_count(&health->gap_timer);
+}
+
+/* Call whenever the device returns data */
+static inline void device_health_data(struct device_health_t *health) {
+    if (health->seen_data && health->gap_timer > health->max_gap) {
+        health->max_gap = health->gap_timer;
+    }
+
+    health->gap_timer = 0;
+    health->seen_data = true;
+}
+
+#endif
@@ -0,0 +1,72 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _DEVICESEQUENCE_H_
+#define _DEVICESEQUENCE_H_
+
+/*
+Device sequences are arrays of TWIM or SPIM transactions, run by
+i2cdevice.c and spidevice.c. Besides bus transactions (step.op ==
+DEVICE_OP_TRANSACTION), a sequence may contain control steps, which don't use
+the bus:
+- DEVICE_OP_DELAY waits until step.arg frames after the step is reached;
+- DEVICE_OP_JUMP continues at step step.idx;
+- DEVICE_OP_LOOP continues at step step.idx step.arg times, then at the next
+  step (loops can't be nested);
+- DEVICE_OP_SAMPLE calls the device's sample function with step.arg and the
+  completion time of the last transaction executed, and restarts the read
+  timeout -- read sequences only.
+
+A transaction with no device address (I2C) or length (SPI) ends the sequence;
+control steps are never chained with the transactions around them.
+
+Sequences can have up to DEVICE_MAX_SEQUENCE_LEN steps, not counting the
+sentinel. Each tick, steps are run until one has to wait for the bus or a
+delay, up to DEVICE_MAX_STEPS_PER_TICK of them. When the init sequence ends the device
+moves on to its read sequence, which starts again from the beginning each
+time it ends.
+*/
+
+enum device_op_t {
+    DEVICE_OP_TRANSACTION = 0,
+    DEVICE_OP_DELAY,
+    DEVICE_OP_JUMP,
+    DEVICE_OP_LOOP,
+    DEVICE_OP_SAMPLE
+};
+
+struct device_step_t {
+    enum device_op_t op;
+    uint8_t idx;
+    uint16_t arg;
+};
+
+#define DEVICE_MAX_SEQUENCE_LEN 32u
+#define DEVICE_MAX_STEPS_PER_TICK 16u
+
+/* Control steps, for either kind of sequence */
+#define DEVICE_DELAY(frames) {.step = {DEVICE_OP_DELAY, 0, (frames)}}
+#define DEVICE_JUMP(idx) {.step = {DEVICE_OP_JUMP, (idx), 0}}
+#define DEVICE_LOOP(idx, count) {.step = {DEVICE_OP_LOOP, (idx), (count)}}
+#define DEVICE_SAMPLE(arg) {.step = {DEVICE_OP_SAMPLE, 0, (arg)}}
+
+#endif
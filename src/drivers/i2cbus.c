@@ -0,0 +1,302 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <asf.h>
+#include "hal.h"
+#include "fcsassert.h"
+#include "pdcachannel.h"
+#include "i2cdevice.h"
+#include "i2cbus.h"
+
+/* Bus clear timing -- half an SCL period at 100kHz, the slowest bus speed */
+#define I2C_BUS_CLEAR_HALF_PERIOD_CYCLES (5u * CONFIG_US_CYCLES)
+#define I2C_BUS_CLEAR_MAX_CLOCKS 9u
+
+struct i2c_bus_t i2c_bus[I2C_BUS_COUNT] = {
+    {
+        .sda_pin_id = I2C0_TWI_TWD_PIN,
+        .sda_function = I2C0_TWI_TWD_FUNCTION,
+        .scl_pin_id = I2C0_TWI_TWCK_PIN,
+        .scl_function = I2C0_TWI_TWCK_FUNCTION,
+        .twim_cfg = {
+            .twim = I2C0_TWI,
+            .tx_pid = I2C0_TWI_PDCA_PID_TX,
+            .rx_pid = I2C0_TWI_PDCA_PID_RX,
+            .chain = true
+        },
+        .arbitration = I2C_BUS_ROUND_ROBIN
+    },
+    {
+        .sda_pin_id = I2C1_TWI_TWD_PIN,
+        .sda_function = I2C1_TWI_TWD_FUNCTION,
+        .scl_pin_id = I2C1_TWI_TWCK_PIN,
+        .scl_function = I2C1_TWI_TWCK_FUNCTION,
+        .twim_cfg = {
+            .twim = I2C1_TWI,
+            .tx_pid = I2C1_TWI_PDCA_PID_TX,
+            .rx_pid = I2C1_TWI_PDCA_PID_RX,
+            .chain = true
+        },
+        .arbitration = I2C_BUS_ROUND_ROBIN
+    },
+    {
+        .sda_pin_id = I2C2_TWI_TWD_PIN,
+        .sda_function = I2C2_TWI_TWD_FUNCTION,
+        .scl_pin_id = I2C2_TWI_TWCK_PIN,
+        .scl_function = I2C2_TWI_TWCK_FUNCTION,
+        .twim_cfg = {
+            .twim = I2C2_TWI,
+            .tx_pid = I2C2_TWI_PDCA_PID_TX,
+            .rx_pid = I2C2_TWI_PDCA_PID_RX,
+            .chain = true
+        },
+        .arbitration = I2C_BUS_ROUND_ROBIN
+    }
+};
+
+inline static void i2c_bus_release(struct i2c_bus_t *bus);
+inline static void i2c_bus_release_if_idle(struct i2c_bus_t *bus);
+inline static void i2c_bus_clear_delay(void);
+static uint32_t i2c_bus_select(const struct i2c_bus_t *bus,
+uint32_t candidates);
+static void i2c_bus_adjust_speed(struct i2c_bus_t *bus);
+
+inline static void i2c_bus_release(struct i2c_bus_t *bus) {
+    if (bus->owner != I2C_BUS_NO_OWNER) {
+        bus->last_owner = bus->owner;
+        bus->owner = I2C_BUS_NO_OWNER;
+    }
+}
+
+inline static void i2c_bus_release_if_idle(struct i2c_bus_t *bus) {
+    /* The TWIM goes idle once it's finished everything the owner queued */
+    if (!bus->twim_cfg.seq) {
+        i2c_bus_release(bus);
+    }
+}
+
+inline static void i2c_bus_clear_delay(void) {
+    uint32_t start_t = Hal_count();
+
+    while (Hal_count() - start_t <
+            I2C_BUS_CLEAR_HALF_PERIOD_CYCLES);
+}
+
+static uint32_t i2c_bus_select(const struct i2c_bus_t *bus,
+uint32_t candidates) {
+    uint32_t i, idx, best = I2C_BUS_NO_OWNER;
+
+    /* Scan in round-robin order, starting after the last owner */
+    for (i = 1u; i <= bus->num_devices; i++) {
+        idx = (bus->last_owner + i) % bus->num_devices;
+        if (!(candidates & (1u << idx))) {
+            continue;
+        }
+
+        if (best == I2C_BUS_NO_OWNER ||
+                (bus->arbitration == I2C_BUS_PRIORITY &&
+                 bus->devices[idx]->priority < bus->devices[best]->priority)) {
+            best = idx;
+        }
+    }
+
+    return best;
+}
+
+static void i2c_bus_adjust_speed(struct i2c_bus_t *bus) {
+    uint32_t speed = bus->speed;
+
+    if (bus->error_count >= I2C_BUS_DOWNGRADE_ERRORS) {
+        speed -= speed / 3u;
+        if (speed < I2C_BUS_MIN_SPEED) {
+            speed = I2C_BUS_MIN_SPEED;
+        }
+    } else if (bus->clean_timer >= I2C_BUS_UPGRADE_PERIOD) {
+        speed += speed / 2u;
+        if (speed > bus->max_speed) {
+            speed = bus->max_speed;
+        }
+    } else {
+        return;
+    }
+
+    /* Wait for any transactions in progress to finish */
+    if (bus->owner != I2C_BUS_NO_OWNER || bus->twim_cfg.seq) {
+        return;
+    }
+
+    if (speed != bus->speed) {
+        bus->speed = speed;
+        twim_pdca_set_speed(&(bus->twim_cfg), speed);
+    }
+
+    bus->error_count = 0;
+    bus->clean_timer = 0;
+}
+
+void i2c_bus_add_device(struct i2c_bus_t *bus, struct i2c_device_t *dev) {
+    fcs_assert(bus && dev);
+    fcs_assert(bus->sda_pin_id && bus->sda_function < 8u);
+    fcs_assert(bus->scl_pin_id && bus->scl_function < 8u);
+    fcs_assert(bus->num_devices < I2C_BUS_MAX_DEVICES);
+    fcs_assert(100000u <= dev->speed && dev->speed <= 400000u);
+
+    if (!bus->num_devices) {
+        bus->twim_cfg.tx_pdca_num =
+            pdca_channel_alloc(bus->twim_cfg.tx_pid, AVR32_PDCA_BYTE);
+        bus->twim_cfg.rx_pdca_num =
+            pdca_channel_alloc(bus->twim_cfg.rx_pid, AVR32_PDCA_BYTE);
+    }
+
+    dev->bus_idx = bus->num_devices;
+    bus->devices[bus->num_devices++] = dev;
+
+    if (!bus->max_speed || dev->speed < bus->max_speed) {
+        bus->max_speed = dev->speed;
+    }
+    bus->speed = bus->max_speed;
+    bus->error_count = 0;
+    bus->clean_timer = 0;
+
+    bus->owner = I2C_BUS_NO_OWNER;
+    bus->last_owner = 0;
+    bus->requested = 0;
+    bus->waiting = 0;
+
+    /* Set up GPIOs */
+    gpio_enable_module_pin(bus->sda_pin_id, bus->sda_function);
+    gpio_enable_module_pin(bus->scl_pin_id, bus->scl_function);
+
+    twim_pdca_init(&(bus->twim_cfg), bus->speed);
+}
+
+void i2c_bus_tick(struct i2c_bus_t *bus) {
+    fcs_assert(bus && bus->num_devices);
+
+    i2c_bus_release_if_idle(bus);
+
+    if (bus->owner != I2C_BUS_NO_OWNER &&
+            ++bus->owner_timer > bus->devices[bus->owner]->bus_timeout) {
+        /*
+        The owner's transactions are taking too long -- abandon them so the
+        other devices can use the bus.
+        */
+        twim_pdca_abort(&(bus->twim_cfg));
+        i2c_bus_release(bus);
+        i2c_bus_note_error(bus);
+    }
+
+    bus->waiting = bus->requested;
+    bus->requested = 0;
+
+    if (bus->clean_timer < UINT32_MAX) {
+        bus->clean_timer++;
+    }
+    i2c_bus_adjust_speed(bus);
+}
+
+bool i2c_bus_acquire(struct i2c_bus_t *bus, struct i2c_device_t *dev) {
+    fcs_assert(bus && dev && dev->bus_idx < bus->num_devices);
+    fcs_assert(bus->devices[dev->bus_idx] == dev);
+
+    uint32_t winner;
+
+    i2c_bus_release_if_idle(bus);
+
+    if (bus->owner == I2C_BUS_NO_OWNER) {
+        winner = i2c_bus_select(bus, bus->waiting | bus->requested |
+                                     (1u << dev->bus_idx));
+        if (winner == dev->bus_idx) {
+            bus->owner = (uint8_t)winner;
+            bus->owner_timer = 0;
+            bus->requested &= (uint8_t)~(1u << winner);
+            bus->waiting &= (uint8_t)~(1u << winner);
+        }
+    }
+
+    if (bus->owner != dev->bus_idx) {
+        bus->requested |= (uint8_t)(1u << dev->bus_idx);
+        return false;
+    }
+
+    return true;
+}
+
+void i2c_bus_reset(struct i2c_bus_t *bus) {
+    fcs_assert(bus);
+
+    twim_pdca_abort(&(bus->twim_cfg));
+    i2c_bus_release(bus);
+}
+
+void i2c_bus_note_error(struct i2c_bus_t *bus) {
+    fcs_assert(bus);
+
+    if (bus->error_count < UINT8_MAX) {
+        bus->error_count++;
+    }
+    bus->clean_timer = 0;
+}
+
+void i2c_bus_clear(struct i2c_bus_t *bus) {
+    fcs_assert(bus);
+
+    uint32_t i;
+
+    twim_pdca_abort(&(bus->twim_cfg));
+
+    /* Take the pins over as open-drain GPIOs, released (high) */
+    gpio_configure_pin(bus->sda_pin_id,
+        GPIO_DIR_OUTPUT | GPIO_OPEN_DRAIN | GPIO_INIT_HIGH);
+    gpio_configure_pin(bus->scl_pin_id,
+        GPIO_DIR_OUTPUT | GPIO_OPEN_DRAIN | GPIO_INIT_HIGH);
+    i2c_bus_clear_delay();
+
+    /*
+    A slave holding SDA low is part-way through sending a byte (or its ACK);
+    clock it out until SDA is released
+    */
+    for (i = 0; i < I2C_BUS_CLEAR_MAX_CLOCKS &&
+            !gpio_local_get_pin_value(bus->sda_pin_id); i++) {
+        gpio_local_clr_gpio_pin(bus->scl_pin_id);
+        i2c_bus_clear_delay();
+        gpio_local_set_gpio_pin(bus->scl_pin_id);
+        i2c_bus_clear_delay();
+    }
+
+    /* STOP -- SDA goes high while SCL is high */
+    gpio_local_clr_gpio_pin(bus->scl_pin_id);
+    i2c_bus_clear_delay();
+    gpio_local_clr_gpio_pin(bus->sda_pin_id);
+    i2c_bus_clear_delay();
+    gpio_local_set_gpio_pin(bus->scl_pin_id);
+    i2c_bus_clear_delay();
+    gpio_local_set_gpio_pin(bus->sda_pin_id);
+    i2c_bus_clear_delay();
+
+    /* Hand the pins back to the TWIM, and start again from scratch */
+    gpio_enable_module_pin(bus->sda_pin_id, bus->sda_function);
+    gpio_enable_module_pin(bus->scl_pin_id, bus->scl_function);
+
+    twim_pdca_init(&(bus->twim_cfg), bus->speed);
+    i2c_bus_release(bus);
+}
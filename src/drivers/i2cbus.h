@@ -0,0 +1,149 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _I2CBUS_H_
+#define _I2CBUS_H_
+
+#include "twim_pdca.h"
+
+/*
+An I2C bus owns a TWIM and its PDCA channel pair, and shares them between
+up to I2C_BUS_MAX_DEVICES devices with distinct addresses. The channels are
+allocated when the first device is added.
+
+A device must own the bus to start a transaction; results of transactions
+already started are collected by twim_run_sequence whether or not the device
+still owns the bus. Ownership is granted by i2c_bus_acquire when the TWIM is
+idle, and lapses as soon as the TWIM has finished the owner's transactions
+(including any queued or chained ones). Both init and read sequences are
+chained, so a device keeps the bus for each run of back-to-back transactions
+(e.g. the MS5611's ADC read and the conversion that follows it), but never
+across a delay or sample step.
+
+When several devices want the bus, it goes to the device which requested it
+in this frame or the last, chosen in round-robin order starting after the
+previous owner -- or, for I2C_BUS_PRIORITY buses, the requester with the
+lowest priority value, ties being broken in round-robin order. A device
+which stops asking (e.g. because it's been powered down) drops out within
+two frames.
+
+If the owner holds the bus for more than its bus_timeout, the transactions in
+progress are aborted (and reported to the owner as errors) and the bus is
+released.
+
+Each bus starts at the highest speed supported by all its devices. After
+I2C_BUS_DOWNGRADE_ERRORS transaction errors without an intervening clean
+period of I2C_BUS_UPGRADE_PERIOD, the speed is reduced by a third (to no
+less than 100kHz); after each clean period at a reduced speed, it's raised
+again by half (to no more than the maximum). Speed changes are made by
+i2c_bus_tick once the TWIM is idle.
+
+i2c_bus_reset and i2c_bus_clear are used by i2cdevice.c to recover from
+device faults; both abort whatever is in progress on the bus, whichever
+device it belongs to.
+*/
+
+#define I2C_BUS_MAX_DEVICES 4u
+#define I2C_BUS_NO_OWNER 0xFFu
+
+#define I2C_BUS_MIN_SPEED 100000u
+#define I2C_BUS_DOWNGRADE_ERRORS 3u
+#define I2C_BUS_UPGRADE_PERIOD Frames_from_ms(10000u)
+
+struct i2c_device_t;
+
+enum i2c_bus_arbitration_t {
+    I2C_BUS_ROUND_ROBIN = 0,
+    I2C_BUS_PRIORITY
+};
+
+struct i2c_bus_t {
+    /* Hardware configuration data */
+    uint8_t sda_pin_id;
+    uint8_t sda_function;
+    uint8_t scl_pin_id;
+    uint8_t scl_function;
+
+    /* TWIM/PDCA configuration */
+    struct twim_pdca_cfg_t twim_cfg;
+
+    enum i2c_bus_arbitration_t arbitration;
+
+    /*
+    Managed by i2cbus.c -- max_speed is that of the slowest device, owner,
+    last_owner and the request bitmasks are indices into devices
+    */
+    uint32_t max_speed; /* bits/sec */
+    uint32_t speed; /* bits/sec */
+    uint8_t error_count; /* since the last clean period or speed change */
+    uint32_t clean_timer; /* frames since the last error */
+    struct i2c_device_t *devices[I2C_BUS_MAX_DEVICES];
+    uint8_t num_devices;
+    uint8_t owner;
+    uint8_t last_owner;
+    uint8_t requested; /* this frame */
+    uint8_t waiting; /* last frame */
+    uint32_t owner_timer; /* frames */
+};
+
+/* The IO board's I2C buses, I2C0-I2C2 */
+#define I2C_BUS_COUNT 3u
+extern struct i2c_bus_t i2c_bus[I2C_BUS_COUNT];
+
+/*
+Attach dev to bus, lowering the bus speed to dev->speed if necessary, and
+(re-)initialize the bus pins and TWIM. Must be called for all devices on a
+bus before any of them are ticked.
+*/
+void i2c_bus_add_device(struct i2c_bus_t *bus, struct i2c_device_t *dev);
+
+/*
+Handle once-per-frame bus tasks: owner timeouts, ageing of requests and
+speed changes.
+Called each tick by the first device attached to the bus.
+*/
+void i2c_bus_tick(struct i2c_bus_t *bus);
+
+/*
+Returns true if dev owns the bus, granting it first if the TWIM is idle and
+arbitration allows; otherwise records dev's request and returns false.
+*/
+bool i2c_bus_acquire(struct i2c_bus_t *bus, struct i2c_device_t *dev);
+
+/*
+Abort the transactions in progress, reset the TWIM and release the bus.
+*/
+void i2c_bus_reset(struct i2c_bus_t *bus);
+
+/*
+Record a transaction error, for bus speed control.
+*/
+void i2c_bus_note_error(struct i2c_bus_t *bus);
+
+/*
+As for i2c_bus_reset, but also free the bus from a slave holding SDA low by
+driving the pins as GPIOs: SCL is clocked until SDA is released (at most 9
+times), then a STOP is generated. Busy-waits for up to ~110us.
+*/
+void i2c_bus_clear(struct i2c_bus_t *bus);
+
+#endif
@@ -22,87 +22,116 @@ SOFTWARE.
 
 
 #include <asf.h>
-#include <avr32/io.h>
+#include <stddef.h>
+#include "hal.h"
 #include "fcsassert.h"
 #include "i2cdevice.h"
 
-void i2c_device_init(struct i2c_device_t *dev) {
-    fcs_assert(dev);
-    fcs_assert(dev->sda_pin_id && dev->sda_function < 8u);
-    fcs_assert(dev->scl_pin_id && dev->scl_function < 8u);
-    fcs_assert(100000u <= dev->speed && dev->speed <= 400000u);
-    fcs_assert(dev->init_sequence);
-    fcs_assert(dev->read_sequence);
-    fcs_assert(dev->power_delay && dev->read_timeout && dev->init_timeout);
-
-    dev->state = I2C_POWERING_DOWN;
-    dev->sequence_idx = 0;
-    dev->state_timer = 0;
-
-    /* Set up GPIOs */
-    gpio_enable_module_pin(dev->sda_pin_id, dev->sda_function);
-    gpio_enable_module_pin(dev->scl_pin_id, dev->scl_function);
-
-    /* Configure power enable pin */
-    if (dev->enable_pin_id) {
-        gpio_configure_pin(dev->enable_pin_id,
-            GPIO_DIR_OUTPUT | GPIO_INIT_LOW);
+static enum device_result_t i2c_device_transact(struct device_t *dev,
+void *seq, uint32_t idx);
+static void i2c_device_clear(struct device_t *dev, void *seq);
+static void i2c_device_poll(struct device_t *dev);
+static void i2c_device_power_up(struct device_t *dev);
+static bool i2c_device_reset(struct device_t *dev, uint32_t level);
+
+static const struct device_bus_ops_t i2c_device_ops = {
+    .txn_size = sizeof(struct twim_transaction_t),
+    .step_offset = offsetof(struct twim_transaction_t, step),
+    .transact = i2c_device_transact,
+    .clear = i2c_device_clear,
+    .poll = i2c_device_poll,
+    .power_up = i2c_device_power_up,
+    .reset = i2c_device_reset
+};
+
+static enum device_result_t i2c_device_transact(struct device_t *dev,
+void *seq, uint32_t idx) {
+    struct i2c_device_t *i2c_dev = (struct i2c_device_t *)dev;
+    struct twim_transaction_t *txn = (struct twim_transaction_t *)seq;
+
+    /*
+    Only starting a transaction needs the bus; the results of transactions
+    already started can be collected whoever owns it.
+    */
+    if (txn[idx].dev_addr &&
+            txn[idx].txn_status == TWIM_TRANSACTION_STATUS_NONE &&
+            !i2c_bus_acquire(i2c_dev->bus, i2c_dev)) {
+        return DEVICE_NOTREADY;
+    }
+
+    enum twim_transaction_result_t result =
+        twim_run_sequence(&(i2c_dev->bus->twim_cfg), txn, idx);
+
+    /*
+    Data coming back means the device is working again; write-only
+    transactions don't count since they're reported as soon as they're queued
+    */
+    if (result == TWIM_TRANSACTION_EXECUTED) {
+        dev->completed_t = txn[idx].completed_t;
+        if (txn[idx].rx_len) {
+            dev->recovery_level = 0;
+            device_health_data(&dev->health);
+        }
+    } else if (result == TWIM_TRANSACTION_ERROR) {
+        device_health_count(&dev->health.error_count);
+        i2c_bus_note_error(i2c_dev->bus);
     }
 
-    twim_pdca_init(&(dev->twim_cfg), dev->speed);
+    return (enum device_result_t)result;
 }
 
-void i2c_device_tick(struct i2c_device_t *dev) {
-    fcs_assert(dev);
-    fcs_assert(dev->read_sequence && dev->init_sequence);
-    fcs_assert(dev->power_delay && dev->read_timeout && dev->init_timeout);
+static void i2c_device_clear(struct device_t *dev, void *seq) {
+    struct i2c_device_t *i2c_dev = (struct i2c_device_t *)dev;
+    struct twim_transaction_t *txn = (struct twim_transaction_t *)seq;
+    uint32_t i;
+
+    for (i = 0; txn[i].dev_addr || txn[i].step.op; i++) {
+        txn[i].txn_status = TWIM_TRANSACTION_STATUS_NONE;
+    }
+    if (i2c_dev->bus->twim_cfg.error_seq == txn) {
+        i2c_dev->bus->twim_cfg.error_seq = NULL;
+    }
+}
 
-    dev->state_timer++;
+static void i2c_device_poll(struct device_t *dev) {
+    struct i2c_device_t *i2c_dev = (struct i2c_device_t *)dev;
 
-    if (dev->state == I2C_POWERING_DOWN &&
-            dev->state_timer > dev->power_delay) {
-        /* Power up */
-        if (dev->enable_pin_id) {
-            gpio_local_set_gpio_pin(dev->enable_pin_id);
-        }
-        twim_pdca_init(&(dev->twim_cfg), dev->speed);
-
-        dev->init_sequence[0].txn_status = TWIM_TRANSACTION_STATUS_NONE;
-        i2c_device_state_transition(dev, I2C_POWERING_UP);
-    } else if (dev->state == I2C_POWERING_UP &&
-            dev->state_timer > dev->power_delay) {
-        i2c_device_state_transition(dev, I2C_INIT_SEQUENCE);
-    } else if (dev->state == I2C_INIT_SEQUENCE) {
-        /* Run init sequence commands in order until the sequence is done,
-           then transition to read sequence */
-        enum twim_transaction_result_t result;
-        result = twim_run_sequence(&(dev->twim_cfg), dev->init_sequence,
-            dev->sequence_idx);
-
-        if (result == TWIM_TRANSACTION_SEQDONE) {
-            dev->read_sequence[0].txn_status = TWIM_TRANSACTION_STATUS_NONE;
-            i2c_device_state_transition(dev, I2C_READ_SEQUENCE);
-        } else if (result == TWIM_TRANSACTION_EXECUTED) {
-            dev->sequence_idx++;
-        } else if (result == TWIM_TRANSACTION_ERROR ||
-                dev->state_timer > dev->init_timeout) {
-            /* Power the device down */
-            if (dev->enable_pin_id) {
-                gpio_local_clr_gpio_pin(dev->enable_pin_id);
-            }
-
-            i2c_device_state_transition(dev, I2C_POWERING_DOWN);
-        }
-    } else if (dev->state == I2C_READ_SEQUENCE &&
-            dev->state_timer > dev->read_timeout) {
-        /* Watch for timeouts in the read state -- power down */
-        if (dev->enable_pin_id) {
-            gpio_local_clr_gpio_pin(dev->enable_pin_id);
-        }
+    if (i2c_dev->bus->devices[0] == i2c_dev) {
+        i2c_bus_tick(i2c_dev->bus);
+    }
+}
+
+static void i2c_device_power_up(struct device_t *dev) {
+    struct i2c_device_t *i2c_dev = (struct i2c_device_t *)dev;
+
+    /* Reset the TWIM too, unless other devices may be using it */
+    if (i2c_dev->bus->num_devices == 1u) {
+        twim_pdca_init(&(i2c_dev->bus->twim_cfg), i2c_dev->bus->speed);
+    }
+}
+
+static bool i2c_device_reset(struct device_t *dev, uint32_t level) {
+    struct i2c_device_t *i2c_dev = (struct i2c_device_t *)dev;
 
-        i2c_device_state_transition(dev, I2C_POWERING_DOWN);
+    if (level == 1u) {
+        device_health_count(&i2c_dev->bus_reset_count);
+        i2c_bus_reset(i2c_dev->bus);
+    } else if (level == 2u) {
+        device_health_count(&i2c_dev->bus_clear_count);
+        i2c_bus_clear(i2c_dev->bus);
     } else {
-        /* Either waiting for a timer to expire, or in the main read sequence
-           -- either way, do nothing */
+        return false;
     }
+
+    return true;
+}
+
+void i2c_device_init(struct i2c_device_t *dev) {
+    fcs_assert(dev && dev->bus);
+    fcs_assert(dev->bus_timeout);
+
+    dev->dev.ops = &i2c_device_ops;
+    device_init(&dev->dev);
+
+    i2c_bus_add_device(dev->bus, dev);
 }
@@ -24,59 +24,45 @@ SOFTWARE.
 #define _I2CDEVICE_H_
 
 #include "twim_pdca.h"
+#include "i2cbus.h"
+#include "device.h"
 
-enum i2c_state_t {
-    I2C_POWERING_UP = 0,
-    I2C_INIT_SEQUENCE,
-    I2C_READ_SEQUENCE,
-    I2C_POWERING_DOWN
-};
+/*
+I2C devices run on the device core (see device.h), sharing a bus and its TWIM
+with the other devices attached to it (see i2cbus.h). Sequences are arrays of
+twim_transaction_t.
+
+Fault recovery first resets the TWIM, then clears the bus (see
+i2c_bus_clear), before power-cycling the device.
+*/
 
 struct i2c_device_t {
+    /* Must be first -- the bus operations convert between the two */
+    struct device_t dev;
+
     /* I2C device configuration data */
     uint32_t speed; /* bits/sec */
-    uint16_t power_delay; /* ticks (ms) */
-    uint16_t init_timeout; /* ticks (ms) */
-    uint16_t read_timeout; /* ticks (ms) */
-
-    /* Hardware configuration data */
-    uint8_t sda_pin_id;
-    uint8_t sda_function;
-    uint8_t scl_pin_id;
-    uint8_t scl_function;
-    uint8_t enable_pin_id;
-
-    /* TWIM/PDCA configuration */
-    struct twim_pdca_cfg_t twim_cfg;
-
-    /* Current device state */
-    enum i2c_state_t state;
-    uint32_t sequence_idx;
-    uint32_t state_timer;
-
-    /* Transaction sequence definitions */
-    struct twim_transaction_t *init_sequence;
-    struct twim_transaction_t *read_sequence;
+    /* Longest the device may keep the bus busy in one go -- frames */
+    uint16_t bus_timeout;
+    /* Arbitration priority on I2C_BUS_PRIORITY buses -- 0 is highest */
+    uint8_t priority;
+
+    /* Bus the device is attached to, and its index on that bus */
+    struct i2c_bus_t *bus;
+    uint8_t bus_idx;
+
+    /*
+    Number of times each recovery step has been taken -- reported, with
+    dev.health.power_cycle_count, by comms_set_device_recovery
+    */
+    uint16_t bus_reset_count;
+    uint16_t bus_clear_count;
 };
 
-static inline void i2c_device_state_transition(struct i2c_device_t *dev,
-        enum i2c_state_t new_state) {
-    fcs_assert(new_state <= I2C_POWERING_DOWN);
-
-    dev->state = new_state;
-    dev->state_timer = 0;
-    dev->sequence_idx = 0;
-}
-
 /*
-Initialize I2C device pin configurations and TWIM.
+Initialize the I2C device's enable pin, and attach it to its bus. The device
+is then run by device_tick(&dev->dev).
 */
 void i2c_device_init(struct i2c_device_t *dev);
 
-/*
-Handle periodic I2C update tasks, including timeouts and management of the
-init_sequence commands.
-*/
-void i2c_device_tick(struct i2c_device_t *dev);
-
 #endif
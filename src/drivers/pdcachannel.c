@@ -0,0 +1,95 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <asf.h>
+#include "hal.h"
+#include "fcsassert.h"
+#include "pdcachannel.h"
+
+struct pdca_channel_usage_t pdca_channel_usage[AVR32_PDCA_CHANNEL_LENGTH];
+
+uint8_t pdca_channel_alloc(uint32_t pid, uint32_t size) {
+    fcs_assert(size <= AVR32_PDCA_WORD);
+
+    uint32_t i, ch = AVR32_PDCA_CHANNEL_LENGTH;
+
+    for (i = 0; i < AVR32_PDCA_CHANNEL_LENGTH; i++) {
+        if (!pdca_channel_usage[i].allocated) {
+            if (ch == AVR32_PDCA_CHANNEL_LENGTH) {
+                ch = i;
+            }
+        } else {
+            /* Each peripheral register can only be served by one channel */
+            fcs_assert(pdca_channel_usage[i].pid != pid);
+        }
+    }
+
+    fcs_assert(ch < AVR32_PDCA_CHANNEL_LENGTH);
+
+    pdca_channel_usage[ch].allocated = true;
+    pdca_channel_usage[ch].size = (uint8_t)size;
+    pdca_channel_usage[ch].pid = pid;
+    pdca_channel_usage[ch].loads = 0;
+    pdca_channel_usage[ch].bytes = 0;
+    pdca_channel_usage[ch].stalls = 0;
+
+    pdca_channel_reset((uint8_t)ch);
+
+    return (uint8_t)ch;
+}
+
+void pdca_channel_reset(uint8_t ch) {
+    fcs_assert(ch < AVR32_PDCA_CHANNEL_LENGTH &&
+               pdca_channel_usage[ch].allocated);
+
+    volatile avr32_pdca_channel_t *pdca = Hal_pdca_channel(ch);
+
+    Hal_write(pdca->cr, AVR32_PDCA_TDIS_MASK);
+    Hal_write(pdca->idr, 0xFFFFFFFFu);
+    pdca->tcr = 0;
+    pdca->marr = 0;
+    pdca->tcrr = 0;
+    pdca->psr = pdca_channel_usage[ch].pid;
+    pdca->mr = (uint32_t)pdca_channel_usage[ch].size <<
+               AVR32_PDCA_SIZE_OFFSET;
+    Hal_write(pdca->cr, AVR32_PDCA_ECLR_MASK);
+    pdca->isr;
+}
+
+void pdca_channel_start_ring(uint8_t ch, volatile void *buffer,
+uint32_t count) {
+    fcs_assert(buffer && count && count <= 0xFFFFu);
+
+    volatile avr32_pdca_channel_t *pdca = Hal_pdca_channel(ch);
+
+    pdca_channel_reset(ch);
+
+    pdca->mar = Hal_address(buffer);
+    pdca->tcr = count;
+    pdca->marr = Hal_address(buffer);
+    pdca->tcrr = count;
+    pdca->mr |= 1u << AVR32_PDCA_RING_OFFSET;
+    pdca_channel_enable(ch);
+
+    pdca_channel_usage[ch].loads++;
+    pdca_channel_usage[ch].bytes += count << pdca_channel_usage[ch].size;
+}
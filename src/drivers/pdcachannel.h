@@ -0,0 +1,120 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _PDCACHANNEL_H_
+#define _PDCACHANNEL_H_
+
+#include "hal.h"
+
+/*
+PDCA channel allocation and usage accounting.
+
+Drivers don't use fixed channel numbers; each one calls pdca_channel_alloc
+from its init function for every peripheral register it moves data to or
+from, and keeps the channel number returned. Allocating a second channel for
+the same peripheral ID, or more channels than the PDCA has, is an assertion
+failure, so two drivers can't end up sharing a channel without noticing.
+
+Channels are handed out in ascending order. When several channels are ready
+the PDCA serves the lowest-numbered first, so peripherals initialized earlier
+(the CPU and AUX USARTs, set up by comms_init) have priority over the
+sensors.
+
+Transfers should be set up through the functions below rather than by
+writing the channel registers directly, so that pdca_channel_usage stays up
+to date. For each channel it records:
+- pid and size, as passed to pdca_channel_alloc;
+- loads, the number of buffers loaded into MAR/TCR or MARR/TCRR;
+- bytes, the total size of those buffers;
+- stalls, the number of buffers pdca_channel_stage couldn't load because
+  both the current and the reload registers were in use.
+A ring buffer counts as one load each time pdca_channel_start_ring is
+called, regardless of how many times it wraps.
+*/
+
+struct pdca_channel_usage_t {
+    bool allocated;
+    uint8_t size; /* AVR32_PDCA_BYTE, AVR32_PDCA_HALF_WORD or AVR32_PDCA_WORD */
+    uint32_t pid;
+
+    uint32_t loads;
+    uint32_t bytes;
+    uint32_t stalls;
+};
+
+extern struct pdca_channel_usage_t
+    pdca_channel_usage[AVR32_PDCA_CHANNEL_LENGTH];
+
+/*
+Allocate the lowest-numbered free channel to the peripheral register with
+PDCA peripheral ID pid, for transfers of the given size
+(AVR32_PDCA_BYTE-AVR32_PDCA_WORD). Only call once per peripheral ID, from
+init functions.
+*/
+uint8_t pdca_channel_alloc(uint32_t pid, uint32_t size);
+
+/*
+Stop the channel and discard any buffers loaded, then set it up to serve its
+peripheral with interrupts disabled and errors cleared. The channel is left
+disabled; call pdca_channel_enable once the first buffer has been staged.
+*/
+void pdca_channel_reset(uint8_t ch);
+
+/*
+Reset the channel and start it transferring continuously to or from a ring
+buffer of count items, e.g. for a USART RX stream.
+*/
+void pdca_channel_start_ring(uint8_t ch, volatile void *buffer,
+uint32_t count);
+
+inline static void pdca_channel_enable(uint8_t ch) {
+    Hal_write(Hal_pdca_channel(ch)->cr, AVR32_PDCA_TEN_MASK);
+}
+
+/*
+Load a buffer of count items, in MAR/TCR if the channel is idle or in the
+reload registers if it's busy with another buffer -- in which case the PDCA
+moves on to it as soon as the current buffer is finished. Returns false if
+both are in use.
+*/
+inline static bool pdca_channel_stage(uint8_t ch, volatile const void *buffer,
+uint32_t count) {
+    volatile avr32_pdca_channel_t *pdca = Hal_pdca_channel(ch);
+    struct pdca_channel_usage_t *usage = &pdca_channel_usage[ch];
+
+    if (!pdca->tcr) {
+        pdca->mar = Hal_address(buffer);
+        pdca->tcr = count;
+    } else if (!pdca->tcrr) {
+        pdca->marr = Hal_address(buffer);
+        pdca->tcrr = count;
+    } else {
+        usage->stalls++;
+        return false;
+    }
+
+    usage->loads++;
+    usage->bytes += count << usage->size;
+    return true;
+}
+
+#endif
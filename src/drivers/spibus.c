@@ -0,0 +1,145 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <asf.h>
+#include "hal.h"
+#include "fcsassert.h"
+#include "pdcachannel.h"
+#include "spidevice.h"
+#include "spibus.h"
+
+#define SPI_BUS_NONE 0xFFu
+
+struct spi_bus_t spi_bus[SPI_BUS_COUNT] = {
+    {
+        .miso_pin_id = SPI1_SPI_MISO_PIN,
+        .miso_function = SPI1_SPI_MISO_FUNCTION,
+        .mosi_pin_id = SPI1_SPI_MOSI_PIN,
+        .mosi_function = SPI1_SPI_MOSI_FUNCTION,
+        .clk_pin_id = SPI1_SPI_CLK_PIN,
+        .clk_function = SPI1_SPI_CLK_FUNCTION,
+        .spim_cfg = {
+            .spim = SPI1_SPI,
+            .tx_pid = SPI1_SPI_PDCA_PID_TX,
+            .rx_pid = SPI1_SPI_PDCA_PID_RX
+        }
+    }
+};
+
+static uint32_t spi_bus_select(const struct spi_bus_t *bus,
+uint32_t candidates);
+
+static uint32_t spi_bus_select(const struct spi_bus_t *bus,
+uint32_t candidates) {
+    uint32_t i, idx;
+
+    /* Scan in round-robin order, starting after the last owner */
+    for (i = 1u; i <= bus->num_devices; i++) {
+        idx = (bus->last_owner + i) % bus->num_devices;
+        if (candidates & (1u << idx)) {
+            return idx;
+        }
+    }
+
+    return SPI_BUS_NONE;
+}
+
+void spi_bus_add_device(struct spi_bus_t *bus, struct spi_device_t *dev) {
+    fcs_assert(bus && dev);
+    fcs_assert(bus->miso_pin_id && bus->miso_function < 8u);
+    fcs_assert(bus->mosi_pin_id && bus->mosi_function < 8u);
+    fcs_assert(bus->clk_pin_id && bus->clk_function < 8u);
+    fcs_assert(bus->num_devices < SPI_BUS_MAX_DEVICES);
+
+    if (!bus->num_devices) {
+        bus->spim_cfg.tx_pdca_num =
+            pdca_channel_alloc(bus->spim_cfg.tx_pid, AVR32_PDCA_BYTE);
+        bus->spim_cfg.rx_pdca_num =
+            pdca_channel_alloc(bus->spim_cfg.rx_pid, AVR32_PDCA_BYTE);
+    }
+
+    dev->bus_idx = bus->num_devices;
+    bus->devices[bus->num_devices++] = dev;
+
+    bus->last_owner = 0;
+    bus->requested = 0;
+    bus->waiting = 0;
+
+    /* Set up GPIOs */
+    gpio_enable_module_pin(bus->miso_pin_id, bus->miso_function);
+    gpio_enable_module_pin(bus->mosi_pin_id, bus->mosi_function);
+    gpio_enable_module_pin(bus->clk_pin_id, bus->clk_function);
+
+    spim_pdca_cs_init(&(bus->spim_cfg), &(dev->cs), dev->speed,
+                      dev->fast_speed);
+    spim_pdca_init(&(bus->spim_cfg));
+}
+
+void spi_bus_tick(struct spi_bus_t *bus) {
+    fcs_assert(bus && bus->num_devices);
+
+    bus->waiting = bus->requested;
+    bus->requested = 0;
+}
+
+bool spi_bus_acquire(struct spi_bus_t *bus, struct spi_device_t *dev) {
+    fcs_assert(bus && dev && dev->bus_idx < bus->num_devices);
+    fcs_assert(bus->devices[dev->bus_idx] == dev);
+
+    uint32_t winner = SPI_BUS_NONE;
+
+    if (!bus->spim_cfg.txn) {
+        winner = spi_bus_select(bus, bus->waiting | bus->requested |
+                                     (1u << dev->bus_idx));
+    }
+
+    if (winner != dev->bus_idx) {
+        bus->requested |= (uint8_t)(1u << dev->bus_idx);
+        return false;
+    }
+
+    bus->last_owner = (uint8_t)winner;
+    bus->requested &= (uint8_t)~(1u << winner);
+    bus->waiting &= (uint8_t)~(1u << winner);
+
+    /*
+    Init sequences aren't timing-sensitive, so run them back-to-back. Read
+    sequences aren't chained: every SPI read is followed by a sample step
+    (which may set up the next read, as with the MPU-6000's FIFO count), and
+    data-ready triggered reads must find the SPIM idle.
+    */
+    bus->spim_cfg.chain = (dev->dev.state == DEVICE_INIT_SEQUENCE);
+
+    return true;
+}
+
+void spi_bus_reset_device(struct spi_bus_t *bus, struct spi_device_t *dev) {
+    fcs_assert(bus && dev && bus->devices[dev->bus_idx] == dev);
+
+    /* Reset the SPIM too, unless other devices may be using it */
+    if (bus->num_devices == 1u) {
+        spim_pdca_init(&(bus->spim_cfg));
+    } else {
+        spim_pdca_cs_init(&(bus->spim_cfg), &(dev->cs), dev->speed,
+                          dev->fast_speed);
+    }
+}
@@ -0,0 +1,105 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _SPIBUS_H_
+#define _SPIBUS_H_
+
+#include "spim_pdca.h"
+
+/*
+An SPI bus owns a SPIM and its PDCA channel pair, and shares them between up
+to SPI_BUS_MAX_DEVICES devices, each on its own chip-select. The channels
+are allocated when the first device is added.
+
+Transactions run one at a time. To start one, a device must be granted the
+bus by spi_bus_acquire, which only happens while the SPIM is idle: once the
+previous transaction has finished -- or, with CONFIG_PDCA_EVENTS, a whole
+chained init sequence -- and, without CONFIG_PDCA_EVENTS, its result has been
+collected. Transactions started by a device's data-ready trigger (see
+spidevice.h) don't need the bus, and go ahead of the others once the SPIM is
+idle.
+
+When several devices want the bus, it goes to the device which requested it
+in this frame or the last, chosen in round-robin order starting after the
+previous one granted it. A device which stops asking (e.g. because it's been
+powered down) drops out within two frames.
+*/
+
+#define SPI_BUS_MAX_DEVICES SPIM_PDCA_MAX_CS
+
+struct spi_device_t;
+
+struct spi_bus_t {
+    /* Hardware configuration data */
+    uint8_t miso_pin_id;
+    uint8_t miso_function;
+    uint8_t mosi_pin_id;
+    uint8_t mosi_function;
+    uint8_t clk_pin_id;
+    uint8_t clk_function;
+
+    /* SPIM/PDCA configuration */
+    struct spim_pdca_cfg_t spim_cfg;
+
+    /*
+    Managed by spibus.c -- last_owner and the request bitmasks are indices
+    into devices
+    */
+    struct spi_device_t *devices[SPI_BUS_MAX_DEVICES];
+    uint8_t num_devices;
+    uint8_t last_owner;
+    uint8_t requested; /* this frame */
+    uint8_t waiting; /* last frame */
+};
+
+/* The IO board's SPI buses -- only SPI1 is brought out */
+#define SPI_BUS_COUNT 1u
+extern struct spi_bus_t spi_bus[SPI_BUS_COUNT];
+
+/*
+Attach dev to bus, set up its chip-select, and (re-)initialize the bus pins
+and SPIM. Must be called for all devices on a bus before any of them are
+ticked.
+*/
+void spi_bus_add_device(struct spi_bus_t *bus, struct spi_device_t *dev);
+
+/*
+Handle once-per-frame bus tasks (ageing of requests).
+Called each tick by the first device attached to the bus.
+*/
+void spi_bus_tick(struct spi_bus_t *bus);
+
+/*
+Returns true if dev may start a transaction now: the SPIM is idle and
+arbitration allows. Otherwise records dev's request and returns false. Must
+be called with interrupts disabled, and the transaction started before they
+are enabled again.
+*/
+bool spi_bus_acquire(struct spi_bus_t *bus, struct spi_device_t *dev);
+
+/*
+Abort dev's transaction, if it's in progress, and reset its chip-select --
+or the whole SPIM, if dev is the only device on the bus.
+*/
+void spi_bus_reset_device(struct spi_bus_t *bus, struct spi_device_t *dev);
+
+#endif
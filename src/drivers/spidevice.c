@@ -22,91 +22,168 @@ SOFTWARE.
 
 
 #include <asf.h>
-#include <avr32/io.h>
+#include <stddef.h>
+#include "hal.h"
 #include "fcsassert.h"
 #include "spidevice.h"
 
+#define SPI_DEVICE_MAX_DRDY 2u
+
+static struct spi_device_t *spi_device_drdy[SPI_DEVICE_MAX_DRDY];
+
+static enum device_result_t spi_device_transact(struct device_t *dev,
+void *seq, uint32_t idx);
+static void spi_device_clear(struct device_t *dev, void *seq);
+static void spi_device_poll(struct device_t *dev);
+static void spi_device_power_up(struct device_t *dev);
+static bool spi_device_reset(struct device_t *dev, uint32_t level);
+
+static const struct device_bus_ops_t spi_device_ops = {
+    .txn_size = sizeof(struct spim_transaction_t),
+    .step_offset = offsetof(struct spim_transaction_t, step),
+    .transact = spi_device_transact,
+    .clear = spi_device_clear,
+    .poll = spi_device_poll,
+    .power_up = spi_device_power_up,
+    .reset = spi_device_reset
+};
+
+__attribute__((__interrupt__))
+static void spi_device_drdy_interrupt_handler(void) {
+    struct spi_device_t *dev;
+    uint32_t i, port_idx, mask;
+
+    for (i = 0; i < SPI_DEVICE_MAX_DRDY && spi_device_drdy[i]; i++) {
+        dev = spi_device_drdy[i];
+        port_idx = dev->drdy_pin_id >> 5u;
+        mask = 1u << (dev->drdy_pin_id & 0x1Fu);
+        if (!(AVR32_GPIO.port[port_idx].ifr & mask)) {
+            continue;
+        }
+
+        Hal_write(AVR32_GPIO.port[port_idx].ifrc, mask);
+        AVR32_GPIO.port[port_idx].ifr;
+
+        /* The device is only read once it's been initialized */
+        if (dev->dev.state == DEVICE_READ_SEQUENCE) {
+            spim_pdca_trigger(&(dev->bus->spim_cfg), &(dev->cs));
+        }
+    }
+}
+
+static enum device_result_t spi_device_transact(struct device_t *dev,
+void *seq, uint32_t idx) {
+    struct spi_device_t *spi_dev = (struct spi_device_t *)dev;
+    struct spim_transaction_t *txn = (struct spim_transaction_t *)seq;
+
+    enum spim_transaction_result_t result;
+    irqflags_t flags = cpu_irq_save();
+
+    /*
+    Only starting a transaction needs the bus; the results of transactions
+    already started can be collected whoever has it, and triggered
+    transactions are started by the trigger.
+    */
+    if (txn[idx].txn_len &&
+            txn[idx].txn_status == SPIM_TRANSACTION_STATUS_NONE &&
+            &txn[idx] != spi_dev->cs.trigger_txn &&
+            !spi_bus_acquire(spi_dev->bus, spi_dev)) {
+        cpu_irq_restore(flags);
+        return DEVICE_NOTREADY;
+    }
+
+    result = spim_run_sequence(&(spi_dev->bus->spim_cfg), &(spi_dev->cs),
+                               txn, idx);
+    cpu_irq_restore(flags);
+
+    if (result == SPIM_TRANSACTION_EXECUTED) {
+        dev->completed_t = txn[idx].completed_t;
+        if (dev->state == DEVICE_READ_SEQUENCE) {
+            dev->recovery_level = 0;
+            device_health_data(&dev->health);
+        }
+    } else if (result == SPIM_TRANSACTION_ERROR) {
+        device_health_count(&dev->health.error_count);
+    }
+
+    return (enum device_result_t)result;
+}
+
+static void spi_device_clear(struct device_t *dev, void *seq) {
+    struct spim_transaction_t *txn = (struct spim_transaction_t *)seq;
+    uint32_t i;
+
+    for (i = 0; txn[i].txn_len || txn[i].step.op; i++) {
+        txn[i].txn_status = SPIM_TRANSACTION_STATUS_NONE;
+    }
+}
+
+static void spi_device_poll(struct device_t *dev) {
+    struct spi_device_t *spi_dev = (struct spi_device_t *)dev;
+
+    if (spi_dev->bus->devices[0] == spi_dev) {
+        spi_bus_tick(spi_dev->bus);
+    }
+}
+
+static void spi_device_power_up(struct device_t *dev) {
+    struct spi_device_t *spi_dev = (struct spi_device_t *)dev;
+    irqflags_t flags = cpu_irq_save();
+
+    spi_bus_reset_device(spi_dev->bus, spi_dev);
+    cpu_irq_restore(flags);
+}
+
+static bool spi_device_reset(struct device_t *dev, uint32_t level) {
+    struct spi_device_t *spi_dev = (struct spi_device_t *)dev;
+    irqflags_t flags;
+
+    if (level != 1u) {
+        return false;
+    }
+
+    flags = cpu_irq_save();
+    spi_bus_reset_device(spi_dev->bus, spi_dev);
+    cpu_irq_restore(flags);
+
+    return true;
+}
+
 void spi_device_init(struct spi_device_t *dev) {
-    fcs_assert(dev);
-    fcs_assert(dev->miso_pin_id && dev->miso_function < 8u);
-    fcs_assert(dev->mosi_pin_id && dev->mosi_function < 8u);
+    fcs_assert(dev && dev->bus);
     fcs_assert(dev->cs_pin_id && dev->cs_function < 8u);
-    fcs_assert(dev->clk_pin_id && dev->clk_function < 8u);
     fcs_assert(1000000u <= dev->speed && dev->speed <= 20000000u);
-    fcs_assert(dev->init_sequence);
-    fcs_assert(dev->read_sequence);
-    fcs_assert(dev->power_delay && dev->read_timeout && dev->init_timeout);
+    fcs_assert(dev->speed <= dev->fast_speed &&
+               dev->fast_speed <= 20000000u);
 
-    dev->state = SPI_POWERING_DOWN;
-    dev->sequence_idx = 0;
-    dev->state_timer = 0;
+    uint32_t i;
+
+    dev->dev.ops = &spi_device_ops;
+    device_init(&dev->dev);
 
-    /* Set up GPIOs */
-    gpio_enable_module_pin(dev->miso_pin_id, dev->miso_function);
-    gpio_enable_module_pin(dev->mosi_pin_id, dev->mosi_function);
     gpio_enable_module_pin(dev->cs_pin_id, dev->cs_function);
-    gpio_enable_module_pin(dev->clk_pin_id, dev->clk_function);
 
-    /* Configure power enable pin */
-    if (dev->enable_pin_id) {
-        gpio_configure_pin(dev->enable_pin_id,
-            GPIO_DIR_OUTPUT | GPIO_INIT_LOW);
+    if (dev->drdy_pin_id) {
+        /* The read sequence must start with a transaction */
+        dev->cs.trigger_txn =
+            (struct spim_transaction_t *)dev->dev.read_sequence;
+        fcs_assert(dev->cs.trigger_txn->txn_len);
     }
 
-    spim_pdca_init(&(dev->spim_cfg), dev->speed);
-}
+    spi_bus_add_device(dev->bus, dev);
 
-void spi_device_tick(struct spi_device_t *dev) {
-    fcs_assert(dev);
-    fcs_assert(dev->read_sequence && dev->init_sequence);
-    fcs_assert(dev->power_delay && dev->read_timeout && dev->init_timeout);
+    if (dev->drdy_pin_id) {
+        for (i = 0; i < SPI_DEVICE_MAX_DRDY && spi_device_drdy[i]; i++);
+        fcs_assert(i < SPI_DEVICE_MAX_DRDY);
+        spi_device_drdy[i] = dev;
 
-    dev->state_timer++;
-
-    if (dev->state == SPI_POWERING_DOWN &&
-            dev->state_timer > dev->power_delay) {
-        /* Power up */
-        if (dev->enable_pin_id) {
-            gpio_local_set_gpio_pin(dev->enable_pin_id);
-        }
-        spim_pdca_init(&(dev->spim_cfg), dev->speed);
-
-        dev->init_sequence[0].txn_status = SPIM_TRANSACTION_STATUS_NONE;
-        spi_device_state_transition(dev, SPI_POWERING_UP);
-    } else if (dev->state == SPI_POWERING_UP &&
-            dev->state_timer > dev->power_delay) {
-        spi_device_state_transition(dev, SPI_INIT_SEQUENCE);
-    } else if (dev->state == SPI_INIT_SEQUENCE) {
-        /* Run init sequence commands in order until the sequence is done,
-           then transition to read sequence */
-        enum spim_transaction_result_t result;
-        result = spim_run_sequence(&(dev->spim_cfg), dev->init_sequence,
-            dev->sequence_idx);
-
-        if (result == SPIM_TRANSACTION_SEQDONE) {
-            dev->read_sequence[0].txn_status = SPIM_TRANSACTION_STATUS_NONE;
-            spi_device_state_transition(dev, SPI_READ_SEQUENCE);
-        } else if (result == SPIM_TRANSACTION_EXECUTED) {
-            dev->sequence_idx++;
-        } else if (result == SPIM_TRANSACTION_ERROR ||
-                dev->state_timer > dev->init_timeout) {
-            /* Power the device down */
-            if (dev->enable_pin_id) {
-                gpio_local_clr_gpio_pin(dev->enable_pin_id);
-            }
-
-            spi_device_state_transition(dev, SPI_POWERING_DOWN);
-        }
-    } else if (dev->state == SPI_READ_SEQUENCE &&
-            dev->state_timer > dev->read_timeout) {
-        /* Watch for timeouts in the read state -- power down */
-        if (dev->enable_pin_id) {
-            gpio_local_clr_gpio_pin(dev->enable_pin_id);
-        }
+        gpio_configure_pin(dev->drdy_pin_id, GPIO_DIR_INPUT);
 
-        spi_device_state_transition(dev, SPI_POWERING_DOWN);
-    } else {
-        /* Either waiting for a timer to expire, or in the main read sequence
-           -- either way, do nothing */
+        cpu_irq_disable();
+        INTC_register_interrupt(&spi_device_drdy_interrupt_handler,
+                                AVR32_GPIO_IRQ_0 + dev->drdy_pin_id / 8u,
+                                AVR32_INTC_INT0);
+        gpio_enable_pin_interrupt(dev->drdy_pin_id, GPIO_RISING_EDGE);
+        cpu_irq_enable();
     }
 }
@@ -24,63 +24,53 @@ SOFTWARE.
 #define _SPIDEVICE_H_
 
 #include "spim_pdca.h"
+#include "spibus.h"
+#include "device.h"
 
-enum spi_state_t {
-    SPI_POWERING_UP = 0,
-    SPI_INIT_SEQUENCE,
-    SPI_READ_SEQUENCE,
-    SPI_POWERING_DOWN
-};
+/*
+SPI devices run on the device core (see device.h), sharing a bus and its SPIM
+with the other devices attached to it (see spibus.h), each on its own
+chip-select. Sequences are arrays of spim_transaction_t; init sequences are
+chained if CONFIG_PDCA_EVENTS is set. Fault recovery first aborts the
+device's transaction and resets its chip-select, then power-cycles the
+device.
+
+A device with a data-ready output can have it connected to drdy_pin_id. The
+first transaction of the read sequence is then started by a rising edge on
+the pin (see spim_pdca_trigger), as soon as the device has new data, rather
+than when the device is ticked, so cs.started_t is the time the data became
+ready -- unless another device was using the bus, in which case it's when
+the bus became free. The rest of the sequence runs as usual.
+*/
 
 struct spi_device_t {
-    /* SPI device configuration data */
+    /* Must be first -- the bus operations convert between the two */
+    struct device_t dev;
+
+    /*
+    SPI device configuration data -- clock rates for SPIM_SPEED_SLOW and
+    SPIM_SPEED_FAST transactions respectively (see spim_pdca.h)
+    */
     uint32_t speed; /* Hz */
-    uint16_t power_delay; /* ticks (ms) */
-    uint16_t init_timeout; /* ticks (ms) */
-    uint16_t read_timeout; /* ticks (ms) */
+    uint32_t fast_speed; /* Hz */
 
     /* Hardware configuration data */
-    uint8_t miso_pin_id;
-    uint8_t miso_function;
-    uint8_t mosi_pin_id;
-    uint8_t mosi_function;
     uint8_t cs_pin_id;
     uint8_t cs_function;
-    uint8_t clk_pin_id;
-    uint8_t clk_function;
-    uint8_t enable_pin_id;
-
-    /* SPIM/PDCA configuration */
-    struct spim_pdca_cfg_t spim_cfg;
+    uint8_t drdy_pin_id; /* 0 if not connected */
 
-    /* Current device state */
-    enum spi_state_t state;
-    uint32_t sequence_idx;
-    uint32_t state_timer;
+    /* Chip-select configuration -- npcs must match cs_pin_id */
+    struct spim_pdca_cs_t cs;
 
-    /* Transaction sequence definitions */
-    struct spim_transaction_t *init_sequence;
-    struct spim_transaction_t *read_sequence;
+    /* Bus the device is attached to, and its index on that bus */
+    struct spi_bus_t *bus;
+    uint8_t bus_idx;
 };
 
-static inline void spi_device_state_transition(struct spi_device_t *dev,
-        enum spi_state_t new_state) {
-    fcs_assert(new_state <= SPI_POWERING_DOWN);
-
-    dev->state = new_state;
-    dev->state_timer = 0;
-    dev->sequence_idx = 0;
-}
-
 /*
-Initialize SPI device pin configurations and SPIM.
+Initialize the SPI device's chip-select and data-ready pins, and attach it to
+its bus. The device is then run by device_tick(&dev->dev).
 */
 void spi_device_init(struct spi_device_t *dev);
 
-/*
-Handle periodic SPI update tasks, including timeouts and management of the
-init_sequence commands.
-*/
-void spi_device_tick(struct spi_device_t *dev);
-
 #endif
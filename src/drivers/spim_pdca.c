@@ -22,147 +22,399 @@ SOFTWARE.
 
 
 #include <asf.h>
-#include <avr32/io.h>
+#include "hal.h"
 #include "fcsassert.h"
+#include "pdcachannel.h"
 #include "spim_pdca.h"
 
-inline static void spim_pdca_enable(volatile avr32_pdca_channel_t *pdca,
-volatile void *buffer, uint32_t nbytes, uint32_t pid);
+/* Master mode, with fixed peripheral select and no fault detection */
+#define SPIM_PDCA_MR (AVR32_SPI_MR_MSTR_MASK | AVR32_SPI_MR_MODFDIS_MASK)
+/* PCS value selecting no slave */
+#define SPIM_PDCA_PCS_NONE 0xFu
+/* Longest a byte can take to shift out -- 8 bits at the largest divisor */
+#define SPIM_PDCA_ABORT_CYCLES (8u * 0xFFu)
 
-inline static void spim_pdca_enable(volatile avr32_pdca_channel_t *pdca,
-volatile void *buffer, uint32_t nbytes, uint32_t pid) {
-    fcs_assert(pdca);
-    fcs_assert(nbytes <= 16u);
-    fcs_assert(!nbytes || buffer);
+/* CSR0-CSR3 are consecutive, and laid out alike */
+#define Spim_pdca_csr(spim, npcs) ((&((spim)->csr0))[(npcs)])
 
-    pdca->cr = AVR32_PDCA_TDIS_MASK;
+inline static uint8_t spim_pdca_scbr(uint32_t speed_hz);
+inline static void spim_pdca_deselect(struct spim_pdca_cfg_t *cfg);
+static void spim_pdca_start_trigger(struct spim_pdca_cfg_t *cfg,
+struct spim_pdca_cs_t *cs);
+static void spim_pdca_start_pending(struct spim_pdca_cfg_t *cfg);
 
-    if (pdca->tcr) {
-        pdca->tcr = 0;
+inline static uint8_t spim_pdca_scbr(uint32_t speed_hz) {
+    /* The SPI clock is CLK_SPI / SCBR, so round the divisor up */
+    uint32_t scbr = (CONFIG_MAIN_HZ + speed_hz - 1u) / speed_hz;
+
+    fcs_assert(scbr && scbr <= 0xffu);
+    return (uint8_t)scbr;
+}
+
+inline static void spim_pdca_deselect(struct spim_pdca_cfg_t *cfg) {
+    /* With CSAAT set, the slave stays selected until told otherwise */
+    Hal_write(cfg->spim->cr, AVR32_SPI_CR_LASTXFER_MASK);
+}
+
+static void spim_pdca_start_trigger(struct spim_pdca_cfg_t *cfg,
+struct spim_pdca_cs_t *cs) {
+    cs->trigger_armed = false;
+    cs->trigger_pending = false;
+    /* Only init sequences are chained, and they're never triggered */
+    cfg->chain = false;
+    cs->trigger_txn->txn_status = SPIM_TRANSACTION_STATUS_SENT;
+    spim_pdca_transact(cfg, cs, cs->trigger_txn);
+}
+
+static void spim_pdca_start_pending(struct spim_pdca_cfg_t *cfg) {
+    uint32_t i;
+    struct spim_pdca_cs_t *cs;
+
+    /* Triggered transactions go ahead of any others waiting */
+    for (i = 0; i < SPIM_PDCA_MAX_CS && !cfg->txn; i++) {
+        cs = cfg->cs_list[i];
+        if (cs && cs->trigger_pending) {
+            spim_pdca_start_trigger(cfg, cs);
+        }
+    }
+}
+
+#if CONFIG_PDCA_EVENTS
+#define SPIM_PDCA_NUM_INSTANCES 2u
+
+static struct spim_pdca_cfg_t *spim_pdca_event_cfg[SPIM_PDCA_NUM_INSTANCES];
+
+static void spim_pdca_event(struct spim_pdca_cfg_t *cfg);
+
+__attribute__((__interrupt__))
+static void spim_pdca_interrupt_handler(void) {
+    uint32_t i;
+    volatile avr32_pdca_channel_t *rx_pdca;
+
+    for (i = 0; i < SPIM_PDCA_NUM_INSTANCES; i++) {
+        if (!spim_pdca_event_cfg[i]) {
+            continue;
+        }
+
+        rx_pdca = Hal_pdca_channel(spim_pdca_event_cfg[i]->rx_pdca_num);
+        if (rx_pdca->isr & rx_pdca->imr & AVR32_PDCA_TRC_MASK) {
+            spim_pdca_event(spim_pdca_event_cfg[i]);
+        }
+    }
+}
+
+static void spim_pdca_event(struct spim_pdca_cfg_t *cfg) {
+    struct spim_transaction_t *txn = cfg->txn;
+
+    /* RX transfer complete implies the whole transaction is complete */
+    Hal_write(Hal_pdca_channel(cfg->rx_pdca_num)->idr, AVR32_PDCA_TRC_MASK);
+    if (!txn) {
+        return;
     }
 
-    if (nbytes) {
-        pdca->idr = 0xFFFFFFFFu;
-        pdca->mar = (uint32_t)buffer;
-        pdca->tcr = nbytes;
-        pdca->psr = pid;
-        pdca->marr = 0;
-        pdca->tcrr = 0;
-        pdca->mr = AVR32_PDCA_BYTE << AVR32_PDCA_SIZE_OFFSET;
-        pdca->cr = AVR32_PDCA_ECLR_MASK;
-        pdca->isr;
+    cfg->txn = NULL;
+    spim_pdca_deselect(cfg);
+    txn->completed_t = Hal_count();
+    txn->txn_status = SPIM_TRANSACTION_STATUS_DONE;
+
+    /* Sequences are terminated by a sentinel, so txn[1] is valid */
+    if (cfg->chain && txn[1].txn_len) {
+        txn[1].txn_status = SPIM_TRANSACTION_STATUS_SENT;
+        spim_pdca_transact(cfg, cfg->cs, &txn[1]);
+    } else {
+        spim_pdca_start_pending(cfg);
     }
 }
+#endif
 
-void spim_pdca_init(struct spim_pdca_cfg_t *cfg, uint32_t speed_hz) {
+void spim_pdca_init(struct spim_pdca_cfg_t *cfg) {
     fcs_assert(cfg);
     fcs_assert(cfg->spim && (cfg->spim == &AVR32_SPI0 ||
                              cfg->spim == &AVR32_SPI1));
     fcs_assert(cfg->rx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH &&
                cfg->tx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH);
-    fcs_assert(1000000u <= speed_hz && speed_hz <= 20000000u);
+    fcs_assert(pdca_channel_usage[cfg->tx_pdca_num].allocated &&
+               pdca_channel_usage[cfg->tx_pdca_num].pid == cfg->tx_pid);
+    fcs_assert(pdca_channel_usage[cfg->rx_pdca_num].allocated &&
+               pdca_channel_usage[cfg->rx_pdca_num].pid == cfg->rx_pid);
+
+    uint32_t i;
+    struct spim_pdca_cs_t *cs;
 
     /* Clear PDCAs */
-    spim_pdca_enable(&AVR32_PDCA.channel[cfg->tx_pdca_num], NULL, 0,
-        cfg->tx_pid);
-    spim_pdca_enable(&AVR32_PDCA.channel[cfg->rx_pdca_num], NULL, 0,
-        cfg->rx_pid);
-
-    /* Initialize the SPI device clock -- PBC for SPI0, PBA for SPI1 */
-    uint32_t f_prescaled = CONFIG_MAIN_HZ / speed_hz;
-    fcs_assert(f_prescaled <= 0xffu);
-
-    /* Set up the SPI registers */
-    cfg->spim->idr = 0xffffffffu;
-    cfg->spim->cr = AVR32_SPI_CR_SPIEN_MASK;
-    cfg->spim->cr = AVR32_SPI_CR_SWRST_MASK;
-    cfg->spim->cr = AVR32_SPI_CR_FLUSHFIFO_MASK;
-    /* Master mode, with fixed peripheral select set to 0b0111 (for CS3) */
-    cfg->spim->mr = AVR32_SPI_MR_MSTR_MASK |
-                    (0x7u << AVR32_SPI_MR_PCS_OFFSET);
-    /* Configure CSR3, which is the control register for CS3. Set the clock
-       divisor and set NCPHA = 1 to capture data on rising edge and change on
-       falling edge. */
-    cfg->spim->csr3 = (f_prescaled << AVR32_SPI_CSR3_SCBR_OFFSET) |
-                      AVR32_SPI_CSR3_NCPHA_MASK;
-    /* Clear SR */
-    cfg->spim->cr = AVR32_SPI_CR_SPIDIS_MASK;
+    pdca_channel_reset(cfg->tx_pdca_num);
+    pdca_channel_reset(cfg->rx_pdca_num);
+    cfg->txn = NULL;
+
+    /*
+    Set up the SPI registers; from then on, only the peripheral select and
+    the clock divisors change
+    */
+    Hal_write(cfg->spim->idr, 0xffffffffu);
+    Hal_write(cfg->spim->cr, AVR32_SPI_CR_SPIDIS_MASK);
+    Hal_write(cfg->spim->cr, AVR32_SPI_CR_SWRST_MASK);
+    Hal_write(cfg->spim->cr, AVR32_SPI_CR_FLUSHFIFO_MASK);
+    cfg->spim->mr = SPIM_PDCA_MR |
+                    (SPIM_PDCA_PCS_NONE << AVR32_SPI_MR_PCS_OFFSET);
+    cfg->cs = NULL;
+
+    /* The reset cleared the chip-select registers, so restore them */
+    for (i = 0; i < SPIM_PDCA_MAX_CS; i++) {
+        cs = cfg->cs_list[i];
+        if (cs) {
+            cs->speed = SPIM_SPEED_SLOW;
+            cs->trigger_armed = false;
+            cs->trigger_pending = false;
+            Spim_pdca_csr(cfg->spim, i) = cs->csr[SPIM_SPEED_SLOW];
+        }
+    }
+    Hal_write(cfg->spim->cr, AVR32_SPI_CR_SPIEN_MASK);
+
+#if CONFIG_PDCA_EVENTS
+    uint32_t instance = (cfg->spim == &AVR32_SPI0) ? 0 : 1u;
+
+    spim_pdca_event_cfg[instance] = cfg;
+
+    cpu_irq_disable();
+    INTC_register_interrupt(&spim_pdca_interrupt_handler,
+                            AVR32_PDCA_IRQ_0 + cfg->rx_pdca_num,
+                            AVR32_INTC_INT0);
+    cpu_irq_enable();
+#endif
+}
+
+void spim_pdca_cs_init(struct spim_pdca_cfg_t *cfg, struct spim_pdca_cs_t *cs,
+uint32_t slow_hz, uint32_t fast_hz) {
+    fcs_assert(cfg && cfg->spim);
+    fcs_assert(cs && cs->npcs < SPIM_PDCA_MAX_CS && cs->mode < 4u);
+    fcs_assert(!cfg->cs_list[cs->npcs] || cfg->cs_list[cs->npcs] == cs);
+    fcs_assert(1000000u <= slow_hz && slow_hz <= 20000000u);
+    fcs_assert(1000000u <= fast_hz && fast_hz <= 20000000u);
+
+    uint32_t csr;
+
+    if (cfg->txn && cfg->cs == cs) {
+        spim_pdca_abort(cfg);
+    }
+
+    /*
+    NCPHA is the inverse of CPHA; CSAAT keeps the slave selected between the
+    bytes of a transaction. CLK_SPI is PBC for SPI0, PBA for SPI1.
+    */
+    csr = ((uint32_t)cs->dlybct << AVR32_SPI_CSR0_DLYBCT_OFFSET) |
+          ((uint32_t)cs->dlybs << AVR32_SPI_CSR0_DLYBS_OFFSET) |
+          AVR32_SPI_CSR0_CSAAT_MASK |
+          ((cs->mode & 1u) ? 0 : AVR32_SPI_CSR0_NCPHA_MASK) |
+          ((cs->mode & 2u) ? AVR32_SPI_CSR0_CPOL_MASK : 0);
+    cs->csr[SPIM_SPEED_SLOW] = csr |
+        ((uint32_t)spim_pdca_scbr(slow_hz) << AVR32_SPI_CSR0_SCBR_OFFSET);
+    cs->csr[SPIM_SPEED_FAST] = csr |
+        ((uint32_t)spim_pdca_scbr(fast_hz) << AVR32_SPI_CSR0_SCBR_OFFSET);
+
+    cs->speed = SPIM_SPEED_SLOW;
+    cs->trigger_armed = false;
+    cs->trigger_pending = false;
+    Spim_pdca_csr(cfg->spim, cs->npcs) = cs->csr[SPIM_SPEED_SLOW];
+
+    cfg->cs_list[cs->npcs] = cs;
+}
+
+void spim_pdca_abort(struct spim_pdca_cfg_t *cfg) {
+    fcs_assert(cfg && cfg->spim);
+
+    uint32_t start_t;
+
+    if (!cfg->txn) {
+        return;
+    }
+
+#if CONFIG_PDCA_EVENTS
+    Hal_write(Hal_pdca_channel(cfg->rx_pdca_num)->idr, AVR32_PDCA_TRC_MASK);
+#endif
+    pdca_channel_reset(cfg->tx_pdca_num);
+    pdca_channel_reset(cfg->rx_pdca_num);
+
+    /*
+    Let the byte being shifted finish, then discard it, so it isn't taken
+    as the first byte of the next transaction
+    */
+    start_t = Hal_count();
+    while (!(cfg->spim->sr & AVR32_SPI_SR_TXEMPTY_MASK) &&
+            Hal_count() - start_t < SPIM_PDCA_ABORT_CYCLES);
+    (void)cfg->spim->rdr;
+
+    spim_pdca_deselect(cfg);
+    cfg->txn = NULL;
+    spim_pdca_start_pending(cfg);
 }
 
 void spim_pdca_transact(struct spim_pdca_cfg_t *cfg,
-struct spim_transaction_t *txn) {
+struct spim_pdca_cs_t *cs, struct spim_transaction_t *txn) {
     fcs_assert(cfg);
     fcs_assert(cfg->spim && (cfg->spim == &AVR32_SPI0 ||
                              cfg->spim == &AVR32_SPI1));
     fcs_assert(cfg->rx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH &&
                cfg->tx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH);
+    fcs_assert(cs && cs->npcs < SPIM_PDCA_MAX_CS &&
+               cfg->cs_list[cs->npcs] == cs);
     fcs_assert(txn);
 
     /* AVR32 datasheet, 27.8.5.1 */
     /* 1. Initialize PDCA */
-    volatile avr32_pdca_channel_t *tx_pdca =
-        &AVR32_PDCA.channel[cfg->tx_pdca_num];
-    volatile avr32_pdca_channel_t *rx_pdca =
-        &AVR32_PDCA.channel[cfg->rx_pdca_num];
-
-    /* Reset the SPIM FIFO */
-    cfg->spim->idr = 0xffffffffu;
-	cfg->spim->cr = AVR32_SPI_CR_SPIDIS_MASK;
-    cfg->spim->cr = AVR32_SPI_CR_SWRST_MASK;
-    cfg->spim->cr = AVR32_SPI_CR_FLUSHFIFO_MASK;
-    /* Master mode, with fixed peripheral select set to 0b0111 (for CS3) */
-    cfg->spim->mr = AVR32_SPI_MR_MSTR_MASK | AVR32_SPI_MR_MODFDIS_MASK |
-                    (0x7u << AVR32_SPI_MR_PCS_OFFSET);
-    /* Configure CSR3, which is the control register for CS3. Set the clock
-       divisor and set NCPHA = 1 to capture data on rising edge and change on
-       falling edge. */
-	cfg->spim->csr0 = (0x30u << AVR32_SPI_CSR3_SCBR_OFFSET) |
-                      AVR32_SPI_CSR3_NCPHA_MASK | AVR32_SPI_CSR3_CSAAT_MASK;
-	cfg->spim->csr1 = (0x30u << AVR32_SPI_CSR3_SCBR_OFFSET) |
-                      AVR32_SPI_CSR3_NCPHA_MASK | AVR32_SPI_CSR3_CSAAT_MASK;
-	cfg->spim->csr2 = (0x30u << AVR32_SPI_CSR3_SCBR_OFFSET) |
-                      AVR32_SPI_CSR3_NCPHA_MASK | AVR32_SPI_CSR3_CSAAT_MASK;
-    cfg->spim->csr3 = (0x30u << AVR32_SPI_CSR3_SCBR_OFFSET) |
-                      AVR32_SPI_CSR3_NCPHA_MASK | AVR32_SPI_CSR3_CSAAT_MASK;
-	cfg->spim->cr = AVR32_SPI_CR_SPIEN_MASK;
+    fcs_assert(txn->txn_len <= 16u);
+    fcs_assert(txn->ext_len <= SPIM_TRANSACTION_MAX_EXT_LEN);
+    fcs_assert(!txn->ext_len || (txn->txn_len && txn->rx_ext));
+    fcs_assert(txn->speed < SPIM_SPEED_CLASSES);
+
+    cs->started_t = Hal_count();
+    cfg->txn = txn;
+
+    /*
+    The SPIM is idle between transactions, so the peripheral select and
+    clock can change. With fixed peripheral select, NPCSn is selected by a
+    PCS value with bit n clear and the bits below it set.
+    */
+    if (cs != cfg->cs) {
+        cfg->cs = cs;
+        cfg->spim->mr = SPIM_PDCA_MR |
+                        ((SPIM_PDCA_PCS_NONE & ~(1u << cs->npcs)) <<
+                         AVR32_SPI_MR_PCS_OFFSET);
+    }
+    if (txn->speed != cs->speed) {
+        cs->speed = txn->speed;
+        Spim_pdca_csr(cfg->spim, cs->npcs) = cs->csr[txn->speed];
+    }
 
     /* Configure TX and RX PDCAs */
     if (txn->txn_len > 0u) {
-        spim_pdca_enable(rx_pdca, txn->rx_buf, txn->txn_len, cfg->rx_pid);
-        rx_pdca->cr = AVR32_PDCA_TEN_MASK;
+        pdca_channel_reset(cfg->rx_pdca_num);
+        (void)pdca_channel_stage(cfg->rx_pdca_num, txn->rx_buf,
+                                 txn->txn_len);
+        if (txn->ext_len) {
+            (void)pdca_channel_stage(cfg->rx_pdca_num, txn->rx_ext,
+                                     txn->ext_len);
+        }
+#if CONFIG_PDCA_EVENTS
+        /* Completion is handled by spim_pdca_event */
+        Hal_write(Hal_pdca_channel(cfg->rx_pdca_num)->ier,
+                  AVR32_PDCA_TRC_MASK);
+#endif
+        pdca_channel_enable(cfg->rx_pdca_num);
+
+        pdca_channel_reset(cfg->tx_pdca_num);
+        (void)pdca_channel_stage(cfg->tx_pdca_num, &txn->tx_buf[0],
+                                 txn->txn_len);
+        if (txn->ext_len) {
+            /*
+            Without tx_ext, rx_ext is sent as filler: each byte is fetched
+            before the RX PDCA overwrites it, since it has to be sent before
+            the byte replacing it arrives
+            */
+            if (txn->tx_ext) {
+                (void)pdca_channel_stage(cfg->tx_pdca_num, txn->tx_ext,
+                                         txn->ext_len);
+            } else {
+                (void)pdca_channel_stage(cfg->tx_pdca_num, txn->rx_ext,
+                                         txn->ext_len);
+            }
+        }
+        pdca_channel_enable(cfg->tx_pdca_num);
+    }
+}
+
+void spim_pdca_trigger(struct spim_pdca_cfg_t *cfg,
+struct spim_pdca_cs_t *cs) {
+    fcs_assert(cfg && cs && cs->trigger_txn);
 
-        spim_pdca_enable(tx_pdca, &txn->tx_buf[0], txn->txn_len - 0u,
-                         cfg->tx_pid);
-        tx_pdca->cr = AVR32_PDCA_TEN_MASK;
+    if (!cs->trigger_armed ||
+            cs->trigger_txn->txn_status != SPIM_TRANSACTION_STATUS_NONE) {
+        return;
+    }
+
+    if (cfg->txn) {
+        /* Another slave has the SPIM -- start once it's been collected */
+        cs->trigger_pending = true;
+    } else {
+        spim_pdca_start_trigger(cfg, cs);
     }
 }
 
 enum spim_transaction_result_t spim_run_sequence(struct spim_pdca_cfg_t *cfg,
-struct spim_transaction_t seq[], uint32_t idx) {
+struct spim_pdca_cs_t *cs, struct spim_transaction_t seq[], uint32_t idx) {
     fcs_assert(cfg);
     fcs_assert(cfg->spim && (cfg->spim == &AVR32_SPI0 ||
                              cfg->spim == &AVR32_SPI1));
     fcs_assert(cfg->rx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH &&
                cfg->tx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH);
-    fcs_assert(seq && idx < 10u);
+    fcs_assert(cs);
+    fcs_assert(seq && idx < DEVICE_MAX_SEQUENCE_LEN);
 
     enum spim_transaction_result_t result = SPIM_TRANSACTION_NOTREADY;
 
+#if CONFIG_PDCA_EVENTS
+    uint32_t i;
+
     if (!seq[idx].txn_len) {
         result = SPIM_TRANSACTION_SEQDONE;
-    } else if (seq[idx].txn_status == SPIM_TRANSACTION_STATUS_NONE) {
-        spim_pdca_transact(cfg, &(seq[idx]));
+    } else if (seq[idx].txn_status == SPIM_TRANSACTION_STATUS_DONE) {
+        /* Disarm before the trigger can see the transaction as idle */
+        if (&seq[idx] == cs->trigger_txn) {
+            cs->trigger_armed = false;
+        }
+        /* When chaining, the next transaction may already be running */
+        seq[idx].txn_status = SPIM_TRANSACTION_STATUS_NONE;
+        if (!cfg->chain) {
+            seq[idx + 1].txn_status = SPIM_TRANSACTION_STATUS_NONE;
+        }
+        result = SPIM_TRANSACTION_EXECUTED;
+    } else if (seq[idx].txn_status == SPIM_TRANSACTION_STATUS_NONE &&
+               &seq[idx] == cs->trigger_txn) {
+        cs->trigger_armed = true;
+    } else if (seq[idx].txn_status == SPIM_TRANSACTION_STATUS_NONE &&
+               !cfg->txn) {
+        if (cfg->chain) {
+            /* Clear state left over from the last run of the sequence */
+            for (i = idx + 1u; seq[i].txn_len; i++) {
+                seq[i].txn_status = SPIM_TRANSACTION_STATUS_NONE;
+            }
+        }
+
+        seq[idx].txn_status = SPIM_TRANSACTION_STATUS_SENT;
+        spim_pdca_transact(cfg, cs, &(seq[idx]));
+        result = SPIM_TRANSACTION_PENDING;
+    } else {
+        /* Nothing ready */
+    }
+#else
+    if (!seq[idx].txn_len) {
+        result = SPIM_TRANSACTION_SEQDONE;
+    } else if (seq[idx].txn_status == SPIM_TRANSACTION_STATUS_NONE &&
+               &seq[idx] == cs->trigger_txn) {
+        cs->trigger_armed = true;
+    } else if (seq[idx].txn_status == SPIM_TRANSACTION_STATUS_NONE &&
+               !cfg->txn) {
+        spim_pdca_transact(cfg, cs, &(seq[idx]));
         /* Sent the request, so the command isn't complete yet */
         seq[idx].txn_status = SPIM_TRANSACTION_STATUS_SENT;
         result = SPIM_TRANSACTION_PENDING;
-    } else if (!AVR32_PDCA.channel[cfg->rx_pdca_num].tcr) {
+    } else if (cfg->txn == &seq[idx] &&
+               !Hal_pdca_channel(cfg->rx_pdca_num)->tcr) {
         /* Checked for read command and PDCA transfer completion */
+        cfg->txn = NULL;
+        spim_pdca_deselect(cfg);
+        if (&seq[idx] == cs->trigger_txn) {
+            cs->trigger_armed = false;
+        }
         seq[idx].txn_status = SPIM_TRANSACTION_STATUS_NONE;
+        seq[idx].completed_t = Hal_count();
         seq[idx + 1].txn_status = SPIM_TRANSACTION_STATUS_NONE;
         result = SPIM_TRANSACTION_EXECUTED;
+
+        spim_pdca_start_pending(cfg);
     } else {
         /* Nothing ready */
     }
+#endif
 
     return result;
 }
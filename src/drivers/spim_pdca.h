@@ -23,14 +23,42 @@ SOFTWARE.
 #ifndef _SPIM_PDCA_H_
 #define _SPIM_PDCA_H_
 
+#include "devicesequence.h"
+
 /*
 SPIM transactions consist of an optional write command and an optional read
 command. If a write command is present, it is always sent before the read is
 initiated.
 
-Transactions store their write data inline, but any data read is stored to
-a buffer pointed to by rx_buf. Up to 4 bytes may be written, and 255 bytes
-read.
+Transactions exchange txn_len bytes (1-16) with the slave, sending tx_buf
+and receiving into rx_buf, then optionally continue for a payload of another
+ext_len bytes (up to SPIM_TRANSACTION_MAX_EXT_LEN) held in caller-owned
+buffers: tx_ext is sent while rx_ext is received into. Command bytes thus
+stay inline, and long bursts go straight between the slave and the caller's
+buffers without copying. The payload is staged in the PDCA reload registers,
+so the whole transaction runs without CPU involvement.
+
+rx_ext is required for a payload. If tx_ext is NULL, the previous contents
+of rx_ext are sent instead, as filler for a burst read; the slave must
+ignore them, as register reads do. tx_ext may equal rx_ext for an in-place
+exchange. In both cases each byte is fetched for sending before the byte
+replacing it arrives, so nothing is lost. The payload buffers must stay
+valid until the transaction completes.
+
+Each slave has its own chip-select (NPCS0-NPCS3), described by a
+spim_pdca_cs_t: its SPI mode, select delays and clock rates, and the state of
+its trigger (see below). Each transaction runs at the clock rate of its speed
+class: SPIM_SPEED_SLOW (the default) for configuration accesses, or
+SPIM_SPEED_FAST for reads of registers the slave can clock out faster. The
+SPIM is configured once by spim_pdca_init, and each chip-select's control
+register once by spim_pdca_cs_init; transactions only switch the selected
+chip-select, and the clock divisor, when they differ from the previous
+transaction's. The slave is selected for the whole of a transaction, and
+deselected when it completes.
+
+Only one transaction runs at a time, so spim_run_sequence won't start one
+while another (for any slave) is in progress; spibus.c decides which slave
+gets the SPIM next.
 
 When passed in an array to twim_run_sequence, each transaction is executed in
 the order defined. A transaction result is one of:
@@ -43,20 +71,55 @@ the order defined. A transaction result is one of:
 - SPIM_TRANSACTION_SEQDONE: returned if a transaction sequence has a
   terminating SPIM_TRANSACTION_SENTINEL value, and the sequence index points
   to this value.
+
+Control steps (see devicesequence.h) are treated as the end of the sequence
+here; spidevice.c interprets them.
+
+A chip-select's trigger_txn is started by spim_pdca_trigger -- typically from
+a data-ready interrupt -- rather than by spim_run_sequence, which instead arms
+the trigger and returns SPIM_TRANSACTION_NOTREADY until the transaction has
+been started. If another slave's transaction is in progress when the trigger
+fires, the triggered transaction is started as soon as that one has been
+collected, ahead of any others waiting for the SPIM. The trigger is disarmed
+when the transaction is collected, so each arming starts it at most once.
+
+Since the interrupt handlers may start transactions, the other functions here
+must be called with interrupts disabled once a trigger or CONFIG_PDCA_EVENTS
+is in use.
 */
 
 enum spim_transaction_status_t {
     SPIM_TRANSACTION_STATUS_NONE = 0,
-    SPIM_TRANSACTION_STATUS_SENT
+    SPIM_TRANSACTION_STATUS_SENT,
+    SPIM_TRANSACTION_STATUS_DONE /* set by the completion interrupt */
+};
+
+enum spim_speed_t {
+    SPIM_SPEED_SLOW = 0,
+    SPIM_SPEED_FAST,
+    SPIM_SPEED_CLASSES
 };
 
 struct spim_transaction_t {
     uint8_t txn_len;
     uint8_t tx_buf[16];
     volatile uint8_t rx_buf[16];
-    enum spim_transaction_status_t txn_status;
+    volatile enum spim_transaction_status_t txn_status;
+    volatile uint32_t completed_t; /* COUNT value at completion */
+
+    /* Control step data -- see devicesequence.h */
+    struct device_step_t step;
+
+    /* Optional external payload -- see above */
+    const uint8_t *tx_ext;
+    volatile uint8_t *rx_ext;
+    uint16_t ext_len;
+
+    enum spim_speed_t speed;
 };
 
+#define SPIM_TRANSACTION_MAX_EXT_LEN 1024u
+
 enum spim_transaction_result_t {
     SPIM_TRANSACTION_EXECUTED = 0,
     SPIM_TRANSACTION_NOTREADY,
@@ -65,18 +128,58 @@ enum spim_transaction_result_t {
     SPIM_TRANSACTION_ERROR
 };
 
-#define SPIM_TRANSACTION_SENTINEL {0, {0}, {0}, 0}
+#define SPIM_TRANSACTION_SENTINEL {0, {0}, {0}, 0, 0, {0}, NULL, NULL, 0, 0}
+
+#define SPIM_PDCA_MAX_CS 4u
+
+/*
+spim_pdca_cs_t describes a slave's chip-select:
+- npcs is the chip-select line, 0-3;
+- mode is the SPI mode, 0-3 (CPOL in bit 1, CPHA in bit 0);
+- dlybs is the delay from select to the first clock edge, in CLK_SPI cycles
+  (0 for half a clock period);
+- dlybct is the delay between the bytes of a transaction, in units of 32
+  CLK_SPI cycles;
+- csr, speed, trigger_armed and trigger_pending are managed by spim_pdca.c:
+  the chip-select register value for each speed class, the class the
+  register is currently set to, and the trigger state;
+- trigger_txn, if set, is the transaction started by spim_pdca_trigger;
+- started_t is the COUNT value at which the slave's last transaction was
+  started.
+*/
+
+struct spim_pdca_cs_t {
+    uint8_t npcs;
+    uint8_t mode;
+    uint8_t dlybs;
+    uint8_t dlybct;
+
+    uint32_t csr[SPIM_SPEED_CLASSES];
+    enum spim_speed_t speed;
+
+    struct spim_transaction_t *trigger_txn;
+    volatile bool trigger_armed;
+    volatile bool trigger_pending;
+    volatile uint32_t started_t;
+};
 
 /*
 spim_pdca_cfg_t stores relevant pointers and channel IDs for a SPIM/PDCA
 channel combination.
 - spim must point to a SPIM instance (TODO);
-- tx_pdca_num must be a unique PDCA channel ID (0-31);
-- rx_pdca_num must be a unique PDCA channle ID (0-31);
 - tx_pid is the PDCA peripheral ID of the SPIM instance TX register
   (TODO)
 - rx_pid is the PDCA peripheral ID of the SPIM instance RX register
   (TODO)
+- tx_pdca_num and rx_pdca_num must be channels allocated for tx_pid and
+  rx_pid by pdca_channel_alloc (see pdcachannel.h);
+- cs_list and cs are managed by spim_pdca.c: the chip-selects set up by
+  spim_pdca_cs_init (indexed by npcs), and the one the SPIM currently
+  selects;
+- txn points to the transaction in progress, if any;
+- chain, if true, causes the interrupt handler to start the next transaction
+  in the sequence as soon as the current one completes (only used if
+  CONFIG_PDCA_EVENTS is set).
 */
 
 struct spim_pdca_cfg_t {
@@ -85,28 +188,60 @@ struct spim_pdca_cfg_t {
     uint8_t rx_pdca_num;
     uint32_t tx_pid;
     uint32_t rx_pid;
+
+    struct spim_pdca_cs_t *cs_list[SPIM_PDCA_MAX_CS];
+    struct spim_pdca_cs_t *cs;
+
+    bool chain;
+    struct spim_transaction_t *volatile txn;
 };
 
 /*
-spim_pdca_init performs basic configuration of a SPIM instance, including
-setting the clock waveform generator (CWGR) to the correct parameters for
-the desired SPI clock rate (must be 1MHz-20MHz inclusive).
+spim_pdca_init resets and configures a SPIM instance for all subsequent
+transactions, aborting any in progress. The chip-selects already set up are
+kept, but their triggers are disarmed.
+*/
+void spim_pdca_init(struct spim_pdca_cfg_t *cfg);
+
+/*
+spim_pdca_cs_init sets up the control register of chip-select cs, with the
+clock rates (1MHz-20MHz inclusive) of its SPIM_SPEED_SLOW and
+SPIM_SPEED_FAST classes; each is rounded down to the nearest rate the divisor
+allows. Any transaction of cs's in progress is aborted, and its trigger is
+disarmed.
+*/
+void spim_pdca_cs_init(struct spim_pdca_cfg_t *cfg, struct spim_pdca_cs_t *cs,
+uint32_t slow_hz, uint32_t fast_hz);
+
+/*
+spim_pdca_abort abandons cfg->txn, if it's in progress, and deselects the
+slave. Busy-waits for up to a byte time at the slowest clock rate (~40us).
 */
-void spim_pdca_init(struct spim_pdca_cfg_t *cfg, uint32_t speed_hz);
+void spim_pdca_abort(struct spim_pdca_cfg_t *cfg);
 
 /*
-spim_pdca_write executes a write[/read] transaction specified by txn on the
-SPIM identified by cfg.
+spim_pdca_transact executes a write[/read] transaction specified by txn on
+the SPIM identified by cfg, with the slave on chip-select cs.
 */
 void spim_pdca_transact(struct spim_pdca_cfg_t *cfg,
-struct spim_transaction_t *txn);
+struct spim_pdca_cs_t *cs, struct spim_transaction_t *txn);
+
+/*
+spim_pdca_trigger starts cs->trigger_txn if spim_run_sequence has armed it
+(or marks it to be started once the SPIM is free); otherwise it does nothing.
+Called from interrupt handlers.
+*/
+void spim_pdca_trigger(struct spim_pdca_cfg_t *cfg,
+struct spim_pdca_cs_t *cs);
 
 /*
-spim_run_sequence executes the next transaction in seq (indexed by seq_idx);
-if both write and read components of the transaction have been successfully
-completed it returns SPIM_TRANSACTION_EXECUTED.
+spim_run_sequence executes the next transaction in seq (indexed by seq_idx)
+with the slave on chip-select cs; if both write and read components of the
+transaction have been successfully completed it returns
+SPIM_TRANSACTION_EXECUTED, and the transaction's completed_t field is set to
+the value of the COUNT register at that time.
 */
 enum spim_transaction_result_t spim_run_sequence(struct spim_pdca_cfg_t *cfg,
-struct spim_transaction_t seq[], uint32_t seq_idx);
+struct spim_pdca_cs_t *cs, struct spim_transaction_t seq[], uint32_t seq_idx);
 
 #endif
\ No newline at end of file
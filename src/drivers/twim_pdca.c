@@ -22,60 +22,246 @@ SOFTWARE.
 
 
 #include <asf.h>
-#include <avr32/io.h>
+#include "hal.h"
 #include "fcsassert.h"
+#include "pdcachannel.h"
 #include "twim_pdca.h"
 
-inline static void twim_pdca_enable(volatile avr32_pdca_channel_t *pdca,
-volatile void *buffer, uint32_t nbytes, uint32_t pid);
+#define TWIM_PDCA_ERROR_MASK (AVR32_TWIM_SR_ANAK_MASK | \
+                              AVR32_TWIM_SR_DNAK_MASK | \
+                              AVR32_TWIM_SR_ARBLST_MASK)
 
-inline static void twim_pdca_enable(volatile avr32_pdca_channel_t *pdca,
-volatile void *buffer, uint32_t nbytes, uint32_t pid) {
-    fcs_assert(pdca);
-    fcs_assert(nbytes <= 255u);
-    fcs_assert(!nbytes || buffer);
+inline static uint32_t twim_pdca_num_cmds(
+const struct twim_transaction_t *txn);
+static void twim_pdca_reset(struct twim_pdca_cfg_t *cfg);
+static void twim_pdca_fail(struct twim_pdca_cfg_t *cfg);
+static void twim_pdca_set_cwgr(struct twim_pdca_cfg_t *cfg,
+uint32_t speed_hz);
+static bool twim_pdca_issue(struct twim_pdca_cfg_t *cfg,
+const struct twim_transaction_t *txn, uint32_t phase);
+static void twim_pdca_service(struct twim_pdca_cfg_t *cfg);
 
-    pdca->cr = AVR32_PDCA_TDIS_MASK;
+#if CONFIG_PDCA_EVENTS
+#define TWIM_PDCA_NUM_INSTANCES 3u
+#define TWIM_PDCA_EVENT_MASK (AVR32_TWIM_IER_CCOMP_MASK | \
+                              AVR32_TWIM_IER_ANAK_MASK | \
+                              AVR32_TWIM_IER_DNAK_MASK | \
+                              AVR32_TWIM_IER_ARBLST_MASK)
 
-    if (pdca->tcr) {
-        pdca->tcr = 0;
-    }
+static struct twim_pdca_cfg_t *twim_pdca_event_cfg[TWIM_PDCA_NUM_INSTANCES];
+
+__attribute__((__interrupt__))
+static void twim_pdca_interrupt_handler(void) {
+    uint32_t i;
 
-    if (nbytes) {
-        pdca->idr = 0xFFFFFFFFu;
-        pdca->mar = (uint32_t)buffer;
-        pdca->tcr = nbytes;
-        pdca->psr = pid;
-        pdca->marr = 0;
-        pdca->tcrr = 0;
-        pdca->mr = AVR32_PDCA_BYTE << AVR32_PDCA_SIZE_OFFSET;
-        pdca->cr = AVR32_PDCA_ECLR_MASK;
-        pdca->isr;
+    for (i = 0; i < TWIM_PDCA_NUM_INSTANCES; i++) {
+        if (twim_pdca_event_cfg[i] && (twim_pdca_event_cfg[i]->twim->sr &
+                                       twim_pdca_event_cfg[i]->twim->imr)) {
+            /*
+            A command completed (freeing a CMDR/NCMDR slot) or the bus
+            failed; either way, let the engine catch up.
+            */
+            Hal_write(twim_pdca_event_cfg[i]->twim->scr,
+                      AVR32_TWIM_SCR_CCOMP_MASK);
+            twim_pdca_service(twim_pdca_event_cfg[i]);
+        }
     }
 }
+#endif
 
-void twim_pdca_init(struct twim_pdca_cfg_t *cfg, uint32_t speed_hz) {
-    fcs_assert(cfg);
-    fcs_assert(cfg->twim && (cfg->twim == &AVR32_TWIM0 ||
-                             cfg->twim == &AVR32_TWIM1 ||
-                             cfg->twim == &AVR32_TWIM2));
-    fcs_assert(cfg->rx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH &&
-               cfg->tx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH);
-    fcs_assert(100000u <= speed_hz && speed_hz <= 400000u);
+inline static uint32_t twim_pdca_num_cmds(
+const struct twim_transaction_t *txn) {
+    return (txn->tx_len ? 1u : 0) + (txn->rx_len ? 1u : 0);
+}
 
-    /* Clear PDCAs */
-    twim_pdca_enable(&AVR32_PDCA.channel[cfg->tx_pdca_num], NULL, 0,
-        cfg->tx_pid);
-    twim_pdca_enable(&AVR32_PDCA.channel[cfg->rx_pdca_num], NULL, 0,
-        cfg->rx_pid);
+static void twim_pdca_reset(struct twim_pdca_cfg_t *cfg) {
+    /*
+    Clear PDCAs, leaving them enabled and idle; transfers are started by
+    staging a buffer in twim_pdca_issue.
+    */
+    pdca_channel_reset(cfg->tx_pdca_num);
+    pdca_channel_reset(cfg->rx_pdca_num);
+    pdca_channel_enable(cfg->tx_pdca_num);
+    pdca_channel_enable(cfg->rx_pdca_num);
 
-    /* Set up the TWI registers */
-    cfg->twim->idr = 0xffffffffu;
-    cfg->twim->cr = AVR32_TWIM_CR_MEN_MASK;
-    cfg->twim->cr = AVR32_TWIM_CR_SWRST_MASK;
+    /* Reset the TWIM module, then restore the clock configuration */
+    Hal_write(cfg->twim->idr, 0xffffffffu);
+    Hal_write(cfg->twim->cr, AVR32_TWIM_CR_MEN_MASK);
+    Hal_write(cfg->twim->cr, AVR32_TWIM_CR_SWRST_MASK);
+    Hal_write(cfg->twim->cr, AVR32_TWIM_CR_MDIS_MASK);
+    cfg->twim->cwgr = cfg->cwgr;
     /* Clear SR */
-    cfg->twim->scr = 0xffffffffu;
-    cfg->twim->cr = AVR32_TWIM_CR_MDIS_MASK;
+    Hal_write(cfg->twim->scr, 0xffffffffu);
+
+#if CONFIG_PDCA_EVENTS
+    Hal_write(cfg->twim->ier, TWIM_PDCA_EVENT_MASK);
+#endif
+
+    /* Master stays enabled; it idles until a command is written */
+    Hal_write(cfg->twim->cr, AVR32_TWIM_CR_MEN_MASK);
+
+    cfg->seq = NULL;
+}
+
+/*
+Mark the transactions in progress as failed, record the error against their
+sequence, and reset the TWIM.
+*/
+static void twim_pdca_fail(struct twim_pdca_cfg_t *cfg) {
+    struct twim_transaction_t *cur, *next;
+
+    if (cfg->seq) {
+        cur = &cfg->seq[cfg->cur_idx];
+        next = &cfg->seq[cfg->cur_idx + 1u];
+
+        if (cur->txn_status == TWIM_TRANSACTION_STATUS_SENT) {
+            cur->txn_status = TWIM_TRANSACTION_STATUS_FAILED;
+        }
+        if (next->dev_addr &&
+                next->txn_status == TWIM_TRANSACTION_STATUS_SENT) {
+            next->txn_status = TWIM_TRANSACTION_STATUS_FAILED;
+        }
+        cfg->error_seq = cfg->seq;
+    }
+
+    twim_pdca_reset(cfg);
+}
+
+static bool twim_pdca_issue(struct twim_pdca_cfg_t *cfg,
+const struct twim_transaction_t *txn, uint32_t phase) {
+    uint32_t cmd;
+    bool read = !txn->tx_len || phase;
+
+    /* Both command registers full */
+    if ((cfg->twim->cmdr & AVR32_TWIM_CMDR_VALID_MASK) &&
+            (cfg->twim->ncmdr & AVR32_TWIM_NCMDR_VALID_MASK)) {
+        return false;
+    }
+
+    /*
+    Stage the data first, so it's ready when the command starts. The write
+    command of a write/read transaction has no STOP; if the read command
+    can't be queued before the write finishes, the TWIM holds the bus until
+    it is.
+    */
+    if (read) {
+        fcs_assert(txn->rx_buf && txn->rx_len);
+        if (!pdca_channel_stage(cfg->rx_pdca_num, txn->rx_buf,
+                                txn->rx_len)) {
+            return false;
+        }
+
+        cmd = (txn->dev_addr << AVR32_TWIM_CMDR_SADR_OFFSET)
+            | (txn->rx_len << AVR32_TWIM_CMDR_NBYTES_OFFSET)
+            | AVR32_TWIM_CMDR_VALID_MASK
+            | AVR32_TWIM_CMDR_START_MASK
+            | AVR32_TWIM_CMDR_STOP_MASK
+            | AVR32_TWIM_CMDR_READ_MASK;
+    } else {
+        if (!pdca_channel_stage(cfg->tx_pdca_num,
+                                (volatile void*)txn->tx_buf, txn->tx_len)) {
+            return false;
+        }
+
+        cmd = (txn->dev_addr << AVR32_TWIM_CMDR_SADR_OFFSET)
+            | (txn->tx_len << AVR32_TWIM_CMDR_NBYTES_OFFSET)
+            | AVR32_TWIM_CMDR_VALID_MASK
+            | AVR32_TWIM_CMDR_START_MASK
+            | (txn->rx_len ? 0 : AVR32_TWIM_CMDR_STOP_MASK);
+    }
+
+    if (!(cfg->twim->cmdr & AVR32_TWIM_CMDR_VALID_MASK)) {
+        cfg->twim->cmdr = cmd;
+    } else {
+        cfg->twim->ncmdr = cmd;
+    }
+
+    return true;
+}
+
+/*
+Issue as many queued commands as the hardware will take, and mark completed
+transactions as done. Must be called with the TWIM interrupt disabled (or
+from the interrupt handler) if CONFIG_PDCA_EVENTS is set.
+*/
+static void twim_pdca_service(struct twim_pdca_cfg_t *cfg) {
+    struct twim_transaction_t *cur, *next;
+    volatile avr32_pdca_channel_t *rx_pdca =
+        Hal_pdca_channel(cfg->rx_pdca_num);
+    uint32_t n_cur, n_next, pending_cmds, pending_rx;
+
+    while (cfg->seq) {
+        cur = &cfg->seq[cfg->cur_idx];
+        /* Sequences are terminated by a sentinel, so this is valid */
+        next = &cfg->seq[cfg->cur_idx + 1u];
+        n_cur = twim_pdca_num_cmds(cur);
+        n_next = next->dev_addr ? twim_pdca_num_cmds(next) : 0;
+
+        if (cfg->twim->sr & TWIM_PDCA_ERROR_MASK) {
+            twim_pdca_fail(cfg);
+            break;
+        }
+
+        /* Issue the rest of the current transaction's commands */
+        while (cfg->cur_issued < n_cur &&
+                twim_pdca_issue(cfg, cur, cfg->cur_issued)) {
+            cfg->cur_issued++;
+        }
+
+        /* Queue the next transaction behind it, if it's wanted */
+        if (cfg->chain && next->dev_addr &&
+                next->txn_status == TWIM_TRANSACTION_STATUS_NONE) {
+            next->txn_status = TWIM_TRANSACTION_STATUS_SENT;
+        }
+        if (cfg->cur_issued == n_cur &&
+                next->txn_status == TWIM_TRANSACTION_STATUS_SENT) {
+            while (cfg->next_issued < n_next &&
+                    twim_pdca_issue(cfg, next, cfg->next_issued)) {
+                if (!next->tx_len || cfg->next_issued) {
+                    cfg->next_rx = 1u;
+                }
+                cfg->next_issued++;
+            }
+        }
+
+        /*
+        The current transaction is complete once none of its commands or RX
+        buffers are pending; anything still pending belongs to the next.
+        */
+        pending_cmds =
+            ((cfg->twim->cmdr & AVR32_TWIM_CMDR_VALID_MASK) ? 1u : 0) +
+            ((cfg->twim->ncmdr & AVR32_TWIM_NCMDR_VALID_MASK) ? 1u : 0);
+        pending_rx = (rx_pdca->tcr ? 1u : 0) + (rx_pdca->tcrr ? 1u : 0);
+        if (cfg->cur_issued < n_cur || pending_cmds > cfg->next_issued ||
+                pending_rx > cfg->next_rx) {
+            break;
+        }
+
+        /* A NAK may have ended the command rather than completing it */
+        if (cfg->twim->sr & TWIM_PDCA_ERROR_MASK) {
+            continue;
+        }
+
+        cur->completed_t = Hal_count();
+        if (cur->txn_status == TWIM_TRANSACTION_STATUS_SENT) {
+            cur->txn_status = TWIM_TRANSACTION_STATUS_DONE;
+        }
+
+        cfg->cur_idx++;
+        cfg->cur_issued = cfg->next_issued;
+        cfg->next_issued = 0;
+        cfg->next_rx = 0;
+
+        if (next->txn_status != TWIM_TRANSACTION_STATUS_SENT) {
+            /* Nothing else has been requested, so the TWIM is now idle */
+            cfg->seq = NULL;
+        }
+    }
+}
+
+static void twim_pdca_set_cwgr(struct twim_pdca_cfg_t *cfg,
+uint32_t speed_hz) {
+    fcs_assert(100000u <= speed_hz && speed_hz <= 400000u);
 
     /* Initialize the TWI device clock */
     uint32_t f_prescaled = (CONFIG_MAIN_HZ / speed_hz / 2u);
@@ -102,80 +288,74 @@ void twim_pdca_init(struct twim_pdca_cfg_t *cfg, uint32_t speed_hz) {
     cfg->twim->CWGR.stasto = f_prescaled;
     cfg->twim->CWGR.high = f_prescaled / 2;
     cfg->twim->CWGR.low = f_prescaled / 2;
+    cfg->cwgr = cfg->twim->cwgr;
 }
 
-void twim_pdca_transact(struct twim_pdca_cfg_t *cfg,
-struct twim_transaction_t *txn) {
+void twim_pdca_init(struct twim_pdca_cfg_t *cfg, uint32_t speed_hz) {
     fcs_assert(cfg);
     fcs_assert(cfg->twim && (cfg->twim == &AVR32_TWIM0 ||
                              cfg->twim == &AVR32_TWIM1 ||
                              cfg->twim == &AVR32_TWIM2));
     fcs_assert(cfg->rx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH &&
                cfg->tx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH);
-    fcs_assert(txn);
+    fcs_assert(pdca_channel_usage[cfg->tx_pdca_num].allocated &&
+               pdca_channel_usage[cfg->tx_pdca_num].pid == cfg->tx_pid);
+    fcs_assert(pdca_channel_usage[cfg->rx_pdca_num].allocated &&
+               pdca_channel_usage[cfg->rx_pdca_num].pid == cfg->rx_pid);
 
-    /* AVR32 datasheet, 27.8.5.1 */
-    /* 1. Initialize PDCA */
-    volatile avr32_pdca_channel_t *tx_pdca =
-        &AVR32_PDCA.channel[cfg->tx_pdca_num];
-    volatile avr32_pdca_channel_t *rx_pdca =
-        &AVR32_PDCA.channel[cfg->rx_pdca_num];
-    uint32_t tx_cmd = 0, rx_cmd = 0;
+    twim_pdca_set_cwgr(cfg, speed_hz);
 
-    /* Reset the TWIM module */
-    cfg->twim->idr = 0xffffffffu;
-    cfg->twim->cr = AVR32_TWIM_CR_MEN_MASK;
-    cfg->twim->cr = AVR32_TWIM_CR_SWRST_MASK;
-    /* Clear SR */
-    cfg->twim->scr = 0xffffffffu;
-    cfg->twim->cr = AVR32_TWIM_CR_MDIS_MASK;
+#if CONFIG_PDCA_EVENTS
+    uint32_t instance = (cfg->twim == &AVR32_TWIM0) ? 0 :
+                        (cfg->twim == &AVR32_TWIM1) ? 1u : 2u;
 
-    /* Configure TX and RX PDCAs */
-    if (txn->tx_len) {
-        twim_pdca_enable(tx_pdca, txn->tx_buf, txn->tx_len, cfg->tx_pid);
-        tx_cmd = (txn->dev_addr << AVR32_TWIM_CMDR_SADR_OFFSET)
-            | (txn->tx_len << AVR32_TWIM_CMDR_NBYTES_OFFSET)
-            | AVR32_TWIM_CMDR_VALID_MASK
-            | AVR32_TWIM_CMDR_START_MASK
-            | (txn->rx_len ? 0 : AVR32_TWIM_CMDR_STOP_MASK);
-    }
-    if (txn->rx_len) {
-        fcs_assert(txn->rx_buf);
+    cpu_irq_disable();
+    twim_pdca_event_cfg[instance] = cfg;
+    INTC_register_interrupt(&twim_pdca_interrupt_handler,
+                            instance == 0 ? AVR32_TWIM0_IRQ :
+                            instance == 1u ? AVR32_TWIM1_IRQ :
+                            AVR32_TWIM2_IRQ,
+                            AVR32_INTC_INT0);
+#endif
 
-        twim_pdca_enable(rx_pdca, txn->rx_buf, txn->rx_len, cfg->rx_pid);
-        rx_cmd = (txn->dev_addr << AVR32_TWIM_CMDR_SADR_OFFSET)
-            | (txn->rx_len << AVR32_TWIM_CMDR_NBYTES_OFFSET)
-            | AVR32_TWIM_CMDR_VALID_MASK
-            | AVR32_TWIM_CMDR_START_MASK
-            | AVR32_TWIM_CMDR_STOP_MASK
-            | AVR32_TWIM_CMDR_READ_MASK;
-    }
+    twim_pdca_reset(cfg);
+    cfg->error_seq = NULL;
 
-    /* 2. Configure TWIM (ADR, NBYTES etc)
-       set the command to start the transfer */
-    if (txn->tx_len && txn->rx_len) {
-        cfg->twim->cmdr = tx_cmd;
-        cfg->twim->ncmdr = rx_cmd;
-    } else if (txn->tx_len && !txn->rx_len) {
-        cfg->twim->cmdr = tx_cmd;
-        cfg->twim->ncmdr = 0;
-    } else if (!txn->tx_len && txn->rx_len) {
-        cfg->twim->cmdr = rx_cmd;
-        cfg->twim->ncmdr = 0;
-    } else {
-        /* nothing to do */
-    }
+#if CONFIG_PDCA_EVENTS
+    cpu_irq_enable();
+#endif
+}
 
-    /* Enable master transfer */
-    cfg->twim->cr = AVR32_TWIM_CR_MEN_MASK;
+void twim_pdca_set_speed(struct twim_pdca_cfg_t *cfg, uint32_t speed_hz) {
+    fcs_assert(cfg && cfg->twim);
+    fcs_assert(!cfg->seq);
 
-    /* 3. Start transfer by enabling PDCA */
-    if (txn->tx_len) {
-        tx_pdca->cr = AVR32_PDCA_TEN_MASK;
-    }
-    if (txn->rx_len) {
-        rx_pdca->cr = AVR32_PDCA_TEN_MASK;
-    }
+#if CONFIG_PDCA_EVENTS
+    cpu_irq_disable();
+#endif
+
+    /* The master is idle, so it can be stopped while the clock changes */
+    Hal_write(cfg->twim->cr, AVR32_TWIM_CR_MDIS_MASK);
+    twim_pdca_set_cwgr(cfg, speed_hz);
+    Hal_write(cfg->twim->cr, AVR32_TWIM_CR_MEN_MASK);
+
+#if CONFIG_PDCA_EVENTS
+    cpu_irq_enable();
+#endif
+}
+
+void twim_pdca_abort(struct twim_pdca_cfg_t *cfg) {
+    fcs_assert(cfg && cfg->twim);
+
+#if CONFIG_PDCA_EVENTS
+    cpu_irq_disable();
+#endif
+
+    twim_pdca_fail(cfg);
+
+#if CONFIG_PDCA_EVENTS
+    cpu_irq_enable();
+#endif
 }
 
 enum twim_transaction_result_t twim_run_sequence(struct twim_pdca_cfg_t *cfg,
@@ -186,49 +366,91 @@ struct twim_transaction_t seq[], uint32_t idx) {
                              cfg->twim == &AVR32_TWIM2));
     fcs_assert(cfg->rx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH &&
                cfg->tx_pdca_num < AVR32_PDCA_CHANNEL_LENGTH);
-    fcs_assert(seq && idx < 10u);
+    fcs_assert(seq && idx < DEVICE_MAX_SEQUENCE_LEN);
 
     enum twim_transaction_result_t result = TWIM_TRANSACTION_NOTREADY;
-    bool tx_ready, tx_err;
+    uint32_t i;
+
+#if CONFIG_PDCA_EVENTS
+    cpu_irq_disable();
+#endif
+
+    twim_pdca_service(cfg);
 
     if (!seq[idx].dev_addr) {
         result = TWIM_TRANSACTION_SEQDONE;
-    } else {
-        tx_ready = !cfg->twim->CMDR.valid ||
-                    (cfg->twim->SR.txrdy &&
-                        !AVR32_PDCA.channel[cfg->tx_pdca_num].tcr);
-        tx_err = cfg->twim->SR.arblst || cfg->twim->SR.dnak ||
-                 cfg->twim->SR.anak;
-
-        if (tx_err) {
-            seq[idx].txn_status = TWIM_TRANSACTION_STATUS_NONE;
-            result = TWIM_TRANSACTION_ERROR;
-        } else if (tx_ready &&
-                   seq[idx].txn_status == TWIM_TRANSACTION_STATUS_NONE) {
-            twim_pdca_transact(cfg, &(seq[idx]));
-            if (seq[idx].rx_len) {
-                /* Sent the request, so the command isn't complete yet */
-                seq[idx].txn_status = TWIM_TRANSACTION_STATUS_SENT;
-                result = TWIM_TRANSACTION_PENDING;
-            } else {
-                /*
-                Mark transaction as complete if there's nothing else to do
-                */
-                seq[idx].txn_status = TWIM_TRANSACTION_STATUS_NONE;
-                seq[idx + 1].txn_status = TWIM_TRANSACTION_STATUS_NONE;
-                result = TWIM_TRANSACTION_EXECUTED;
+    } else if (cfg->error_seq == seq) {
+        /*
+        Report bus errors once, whichever transaction in the sequence they
+        affected
+        */
+        cfg->error_seq = NULL;
+        seq[idx].txn_status = TWIM_TRANSACTION_STATUS_NONE;
+        result = TWIM_TRANSACTION_ERROR;
+    } else if (seq[idx].txn_status == TWIM_TRANSACTION_STATUS_FAILED) {
+        seq[idx].txn_status = TWIM_TRANSACTION_STATUS_NONE;
+        result = TWIM_TRANSACTION_ERROR;
+    } else if (seq[idx].txn_status == TWIM_TRANSACTION_STATUS_NONE) {
+        if (!cfg->seq) {
+            /* TWIM is idle; start the sequence here */
+            if (cfg->chain) {
+                /* Clear state left over from the last run of the sequence */
+                for (i = idx + 1u; seq[i].dev_addr; i++) {
+                    seq[i].txn_status = TWIM_TRANSACTION_STATUS_NONE;
+                }
             }
-        } else if (!AVR32_PDCA.channel[cfg->rx_pdca_num].tcr &&
-                cfg->twim->SR.ccomp &&
-                seq[idx].txn_status == TWIM_TRANSACTION_STATUS_SENT) {
-            /* Checked for read command and PDCA transfer completion */
-            seq[idx].txn_status = TWIM_TRANSACTION_STATUS_NONE;
-            seq[idx + 1].txn_status = TWIM_TRANSACTION_STATUS_NONE;
-            result = TWIM_TRANSACTION_EXECUTED;
+
+            cfg->seq = seq;
+            cfg->cur_idx = idx;
+            cfg->cur_issued = 0;
+            cfg->next_issued = 0;
+            cfg->next_rx = 0;
+            seq[idx].txn_status = TWIM_TRANSACTION_STATUS_SENT;
+            result = TWIM_TRANSACTION_PENDING;
+        } else if (cfg->seq == seq && cfg->cur_idx + 1u == idx) {
+            /* Queue behind the transaction in progress */
+            seq[idx].txn_status = TWIM_TRANSACTION_STATUS_SENT;
+            result = TWIM_TRANSACTION_PENDING;
         } else {
-            /* Nothing ready */
+            /* Busy with something else */
+        }
+
+        if (result == TWIM_TRANSACTION_PENDING) {
+            twim_pdca_service(cfg);
+        }
+    } else {
+        /* Sent, but not yet complete */
+    }
+
+    if ((!cfg->chain || !seq[idx + 1].dev_addr) && !seq[idx].rx_len &&
+            cfg->seq == seq &&
+            seq[idx].txn_status == TWIM_TRANSACTION_STATUS_SENT &&
+            (cfg->seq + cfg->cur_idx == &seq[idx] ?
+                cfg->cur_issued : cfg->next_issued) ==
+            twim_pdca_num_cmds(&seq[idx])) {
+        /*
+        Write-only transactions are complete as far as the caller is
+        concerned once they're queued, unless the next transaction may
+        already be chained behind them
+        */
+        seq[idx].txn_status = TWIM_TRANSACTION_STATUS_NONE;
+        seq[idx].completed_t = Hal_count();
+        seq[idx + 1].txn_status = TWIM_TRANSACTION_STATUS_NONE;
+        result = TWIM_TRANSACTION_EXECUTED;
+    }
+
+    if (seq[idx].txn_status == TWIM_TRANSACTION_STATUS_DONE) {
+        /* When chaining, the next transaction may already be running */
+        seq[idx].txn_status = TWIM_TRANSACTION_STATUS_NONE;
+        if (!cfg->chain) {
+            seq[idx + 1].txn_status = TWIM_TRANSACTION_STATUS_NONE;
         }
+        result = TWIM_TRANSACTION_EXECUTED;
     }
 
+#if CONFIG_PDCA_EVENTS
+    cpu_irq_enable();
+#endif
+
     return result;
 }
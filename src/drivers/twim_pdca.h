@@ -23,6 +23,8 @@ SOFTWARE.
 #ifndef _TWIM_PDCA_H_
 #define _TWIM_PDCA_H_
 
+#include "devicesequence.h"
+
 /*
 TWIM transactions consist of an optional write command and an optional read
 command. If a write command is present, it is always sent before the read is
@@ -43,11 +45,24 @@ the order defined. A transaction result is one of:
 - TWIM_TRANSACTION_SEQDONE: returned if a transaction sequence has a
   terminating TWIM_TRANSACTION_SENTINEL value, and the sequence index points
   to this value.
+
+Control steps (see devicesequence.h) are treated as the end of the sequence
+here; i2cdevice.c interprets them.
+
+The TWIM is configured once by twim_pdca_init, and only reset again after a
+bus error. Transaction commands are queued through CMDR/NCMDR, with data
+buffers staged in the PDCA channel and reload registers, so up to two
+transactions can be in flight at once: the one requested, plus the next one
+in the same sequence if it has already been requested (or cfg->chain is set).
+Completion is detected by counting the commands and RX buffers still pending
+in hardware.
 */
 
 enum twim_transaction_status_t {
     TWIM_TRANSACTION_STATUS_NONE = 0,
-    TWIM_TRANSACTION_STATUS_SENT
+    TWIM_TRANSACTION_STATUS_SENT,
+    TWIM_TRANSACTION_STATUS_DONE, /* set when completion is detected */
+    TWIM_TRANSACTION_STATUS_FAILED /* set when a bus error is detected */
 };
 
 struct twim_transaction_t {
@@ -56,7 +71,11 @@ struct twim_transaction_t {
     uint8_t tx_buf[4];
     uint8_t rx_len;
     volatile void *rx_buf;
-    enum twim_transaction_status_t txn_status;
+    volatile enum twim_transaction_status_t txn_status;
+    volatile uint32_t completed_t; /* COUNT value at completion */
+
+    /* Control step data -- see devicesequence.h */
+    struct device_step_t step;
 };
 
 enum twim_transaction_result_t {
@@ -67,19 +86,34 @@ enum twim_transaction_result_t {
     TWIM_TRANSACTION_ERROR
 };
 
-#define TWIM_TRANSACTION_SENTINEL {0, 0, {0}, 0, NULL, 0}
+#define TWIM_TRANSACTION_SENTINEL {0, 0, {0}, 0, NULL, 0, 0, {0}}
 
 
 /*
 twim_pdca_cfg_t stores relevant pointers and channel IDs for a TWIM/PDCA
 channel combination.
 - twim must point to a TWIM instance (AVR32_TWIM0-AVR32_TWIM2);
-- tx_pdca_num must be a unique PDCA channel ID (0-31);
-- rx_pdca_num must be a unique PDCA channle ID (0-31);
 - tx_pid is the PDCA peripheral ID of the TWIM instance TX register
   (AVR32_TWIM0_PDCA_ID_TX-AVR32_TWIM2_PDCA_ID_TX)
 - rx_pid is the PDCA peripheral ID of the TWIM instance RX register
   (AVR32_TWIM0_PDCA_ID_RX-AVR32_TWIM2_PDCA_ID_RX)
+- tx_pdca_num and rx_pdca_num must be channels allocated for tx_pid and
+  rx_pid by pdca_channel_alloc (see pdcachannel.h), before twim_pdca_init is
+  first called.
+
+If chain is true, each transaction in a sequence is queued as soon as there
+is room in the hardware, rather than waiting for twim_run_sequence to be
+called for it.
+
+The remaining fields are managed by twim_pdca.c:
+- cwgr is the clock waveform generator value, restored after a reset;
+- seq is the sequence being executed, or NULL if the TWIM is idle;
+- cur_idx is the index of the oldest incomplete transaction in seq;
+- cur_issued and next_issued are the number of commands issued for
+  seq[cur_idx] and seq[cur_idx + 1] respectively;
+- next_rx is 1 if seq[cur_idx + 1]'s read buffer has been staged;
+- error_seq is the sequence affected by the last bus error, until the error
+  is reported by twim_run_sequence.
 */
 
 struct twim_pdca_cfg_t {
@@ -88,6 +122,16 @@ struct twim_pdca_cfg_t {
     uint8_t rx_pdca_num;
     uint32_t tx_pid;
     uint32_t rx_pid;
+
+    bool chain;
+
+    uint32_t cwgr;
+    struct twim_transaction_t *seq;
+    uint8_t cur_idx;
+    uint8_t cur_issued;
+    uint8_t next_issued;
+    uint8_t next_rx;
+    struct twim_transaction_t *error_seq;
 };
 
 /*
@@ -97,18 +141,27 @@ the desired I2C speed (must be 100-400kHz inclusive).
 */
 void twim_pdca_init(struct twim_pdca_cfg_t *cfg, uint32_t speed_hz);
 
+/*
+twim_pdca_set_speed changes the I2C speed (100-400kHz inclusive) of an idle
+TWIM, i.e. one with no sequence in progress.
+*/
+void twim_pdca_set_speed(struct twim_pdca_cfg_t *cfg, uint32_t speed_hz);
 
 /*
-twim_pdca_write executes a write[/read] transaction specified by txn on the
-TWIM identified by cfg.
+twim_pdca_abort abandons the transactions in progress, which are marked as
+failed and reported as errors by the next twim_run_sequence call for their
+sequence, and resets the TWIM.
 */
-void twim_pdca_transact(struct twim_pdca_cfg_t *cfg,
-struct twim_transaction_t *txn);
+void twim_pdca_abort(struct twim_pdca_cfg_t *cfg);
 
 /*
 twim_run_sequence executes the next transaction in seq (indexed by seq_idx);
 if both write and read components of the transaction have been successfully
-completed it returns TWIM_TRANSACTION_EXECUTED.
+completed it returns TWIM_TRANSACTION_EXECUTED, and the transaction's
+completed_t field is set to the value of the COUNT register at that time.
+Write-only transactions are reported as executed as soon as they're queued,
+unless cfg->chain is set and another transaction follows them; a bus error
+is reported by the next call for the same sequence.
 */
 enum twim_transaction_result_t twim_run_sequence(struct twim_pdca_cfg_t *cfg,
 struct twim_transaction_t seq[], uint32_t seq_idx);
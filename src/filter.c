@@ -0,0 +1,234 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <asf.h>
+#include <math.h>
+#include <string.h>
+#include "fcsassert.h"
+#include "filter.h"
+
+#define FILTER_PI 3.14159265f
+#define FILTER_FIR_BITS 15u
+
+static void filter_chain_add_biquad(struct filter_chain_t *f,
+const float b[3], const float a[3]);
+inline static int32_t filter_coeff(float value);
+inline static void filter_biquad_step(struct filter_biquad_t *bq,
+uint32_t ch, int32_t *value);
+
+inline static int32_t filter_coeff(float value) {
+    value *= (float)(1u << FILTER_BIQUAD_COEFF_BITS);
+    return (int32_t)(value < 0.0f ? value - 0.5f : value + 0.5f);
+}
+
+static void filter_chain_add_biquad(struct filter_chain_t *f,
+const float b[3], const float a[3]) {
+    fcs_assert(f->num_biquads < FILTER_MAX_BIQUADS);
+
+    struct filter_biquad_t *bq = &f->biquad[f->num_biquads++];
+
+    bq->b[0] = filter_coeff(b[0] / a[0]);
+    bq->b[1] = filter_coeff(b[1] / a[0]);
+    bq->b[2] = filter_coeff(b[2] / a[0]);
+    bq->a[0] = filter_coeff(a[1] / a[0]);
+    bq->a[1] = filter_coeff(a[2] / a[0]);
+
+    memset(bq->x, 0, sizeof(bq->x));
+    memset(bq->y, 0, sizeof(bq->y));
+    memset(bq->err, 0, sizeof(bq->err));
+}
+
+/* Run one channel's value through a biquad stage, in place */
+inline static void filter_biquad_step(struct filter_biquad_t *bq,
+uint32_t ch, int32_t *value) {
+    int32_t x = *value, y;
+    int64_t acc;
+
+    /*
+    The low bits discarded from each output are carried into the next, so
+    the rounding error is first-order noise-shaped rather than recirculated
+    through the poles
+    */
+    acc = (int64_t)bq->err[ch];
+    acc += (int64_t)bq->b[0] * x;
+    acc += (int64_t)bq->b[1] * bq->x[ch][0];
+    acc += (int64_t)bq->b[2] * bq->x[ch][1];
+    acc -= (int64_t)bq->a[0] * bq->y[ch][0];
+    acc -= (int64_t)bq->a[1] * bq->y[ch][1];
+
+    y = (int32_t)(acc >> FILTER_BIQUAD_COEFF_BITS);
+    bq->err[ch] = (int32_t)(acc - ((int64_t)y << FILTER_BIQUAD_COEFF_BITS));
+
+    bq->x[ch][1] = bq->x[ch][0];
+    bq->x[ch][0] = x;
+    bq->y[ch][1] = bq->y[ch][0];
+    bq->y[ch][0] = y;
+
+    *value = y;
+}
+
+void filter_chain_init_fir(struct filter_chain_t *f, uint32_t channels,
+uint32_t decimation, const int16_t *taps, uint32_t num_taps) {
+    fcs_assert(f && taps);
+    fcs_assert(0 < channels && channels <= FILTER_MAX_CHANNELS);
+    fcs_assert(0 < decimation && decimation <= UINT8_MAX);
+    fcs_assert(0 < num_taps && num_taps <= FILTER_MAX_FIR_TAPS);
+
+    uint32_t i, gain = 0;
+
+    /* Keeps the accumulator within an int32 */
+    for (i = 0; i < num_taps; i++) {
+        gain += (uint32_t)(taps[i] < 0 ? -taps[i] : taps[i]);
+    }
+    fcs_assert(gain < (2u << FILTER_FIR_BITS));
+
+    memset(f, 0, sizeof(*f));
+    f->decimator = FILTER_DECIMATOR_FIR;
+    f->channels = (uint8_t)channels;
+    f->decimation = (uint8_t)decimation;
+    f->taps = taps;
+    f->num_taps = (uint8_t)num_taps;
+}
+
+void filter_chain_init_cic(struct filter_chain_t *f, uint32_t channels,
+uint32_t decimation) {
+    fcs_assert(f);
+    fcs_assert(0 < channels && channels <= FILTER_MAX_CHANNELS);
+    fcs_assert(1u < decimation && decimation <= FILTER_MAX_CIC_DECIMATION &&
+               !(decimation & (decimation - 1u)));
+
+    uint32_t bits;
+
+    memset(f, 0, sizeof(*f));
+    f->decimator = FILTER_DECIMATOR_CIC;
+    f->channels = (uint8_t)channels;
+    f->decimation = (uint8_t)decimation;
+
+    /* The gain is decimation ^ FILTER_CIC_ORDER */
+    for (bits = 0; (1u << bits) < decimation; bits++);
+    f->cic_shift = (uint8_t)(bits * FILTER_CIC_ORDER);
+}
+
+void filter_chain_add_lowpass(struct filter_chain_t *f, float freq, float q) {
+    fcs_assert(f && 0.0f < freq && freq < 0.5f && q > 0.0f);
+
+    /* RBJ audio EQ cookbook low-pass */
+    float w0 = 2.0f * FILTER_PI * freq, cosw0 = cosf(w0),
+          alpha = sinf(w0) / (2.0f * q);
+    float b[3] = {
+        (1.0f - cosw0) / 2.0f, 1.0f - cosw0, (1.0f - cosw0) / 2.0f
+    };
+    float a[3] = { 1.0f + alpha, -2.0f * cosw0, 1.0f - alpha };
+
+    filter_chain_add_biquad(f, b, a);
+}
+
+void filter_chain_add_notch(struct filter_chain_t *f, float freq, float q) {
+    fcs_assert(f && 0.0f < freq && freq < 0.5f && q > 0.0f);
+
+    /* RBJ audio EQ cookbook notch */
+    float w0 = 2.0f * FILTER_PI * freq, cosw0 = cosf(w0),
+          alpha = sinf(w0) / (2.0f * q);
+    float b[3] = { 1.0f, -2.0f * cosw0, 1.0f };
+    float a[3] = { 1.0f + alpha, -2.0f * cosw0, 1.0f - alpha };
+
+    filter_chain_add_biquad(f, b, a);
+}
+
+void filter_chain_add(struct filter_chain_t *f, const int16_t in[]) {
+    fcs_assert(f && in);
+
+    uint32_t i, ch;
+
+    if (f->decimator == FILTER_DECIMATOR_FIR) {
+        memcpy(f->history[f->history_idx], in,
+               f->channels * sizeof(f->history[0][0]));
+        if (++f->history_idx == f->num_taps) {
+            f->history_idx = 0;
+        }
+    } else {
+        for (ch = 0; ch < f->channels; ch++) {
+            f->integrator[0][ch] += (uint32_t)(int32_t)in[ch];
+            for (i = 1u; i < FILTER_CIC_ORDER; i++) {
+                f->integrator[i][ch] += f->integrator[i - 1u][ch];
+            }
+        }
+    }
+}
+
+void filter_chain_decimate(struct filter_chain_t *f, int16_t out[]) {
+    fcs_assert(f && out);
+
+    uint32_t i, j, k, ch, v, t, frac;
+    int32_t acc;
+
+    for (ch = 0; ch < f->channels; ch++) {
+        if (f->decimator == FILTER_DECIMATOR_FIR) {
+            acc = 0;
+            for (j = 0, k = f->history_idx; j < f->num_taps; j++) {
+                acc += (int32_t)f->taps[j] * f->history[k][ch];
+                if (++k == f->num_taps) {
+                    k = 0;
+                }
+            }
+            frac = FILTER_FIR_BITS;
+        } else {
+            v = f->integrator[FILTER_CIC_ORDER - 1u][ch];
+            for (i = 0; i < FILTER_CIC_ORDER; i++) {
+                t = v - f->comb[i][ch];
+                f->comb[i][ch] = v;
+                v = t;
+            }
+            acc = (int32_t)((((int64_t)(int32_t)v << FILTER_FRAC_BITS) +
+                             (1 << (f->cic_shift - 1u))) >> f->cic_shift);
+            frac = FILTER_FRAC_BITS;
+        }
+
+        /* FIR output is only rounded once if there are no biquads */
+        if (f->num_biquads && frac > FILTER_FRAC_BITS) {
+            acc = (acc + (1 << (frac - FILTER_FRAC_BITS - 1u))) >>
+                  (frac - FILTER_FRAC_BITS);
+            frac = FILTER_FRAC_BITS;
+        }
+        for (i = 0; i < f->num_biquads; i++) {
+            filter_biquad_step(&f->biquad[i], ch, &acc);
+        }
+
+        acc = (acc + (1 << (frac - 1u))) >> frac;
+        if (acc > INT16_MAX) {
+            acc = INT16_MAX;
+        } else if (acc < INT16_MIN) {
+            acc = INT16_MIN;
+        }
+        out[ch] = (int16_t)acc;
+    }
+}
+
+uint32_t filter_chain_delay(const struct filter_chain_t *f) {
+    fcs_assert(f);
+
+    if (f->decimator == FILTER_DECIMATOR_FIR) {
+        return f->num_taps - 1u;
+    } else {
+        return FILTER_CIC_ORDER * (f->decimation - 1u);
+    }
+}
@@ -0,0 +1,135 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+/*
+Fixed-point filter chain for multi-channel sensor data (e.g. accel and gyro
+XYZ), with the same filter applied to each channel:
+
+1. a decimator from the input sample rate to the output rate -- either an
+   FIR filter evaluated once per output (taps in Q15, summing to 1), or a
+   FILTER_CIC_ORDER-order CIC (cascaded integrator-comb) filter, which
+   costs a few adds per input sample and no multiplies, but attenuates
+   aliases less and droops in the passband;
+2. up to FILTER_MAX_BIQUADS biquad stages (low-pass or notch) at the output
+   rate, in direct form I with Q28 coefficients and error feedback, so low
+   cut-offs don't lose precision.
+
+Between stages, samples are int32 in the input's units with
+FILTER_FRAC_BITS fractional bits; the chain's output is rounded and
+saturated back to int16 (an FIR decimator's output, only once).
+
+The inner loops are 16x16-bit (FIR) and 32x32-bit (biquad)
+multiply-accumulates. Everything after init is integer arithmetic, so a
+host build computes the same outputs from the same coefficients; only the
+biquad design in filter_chain_add_lowpass/notch uses floating point, and
+may round a coefficient differently with a different C library.
+test/filter_test.c checks each kind of chain against a double-precision
+model (to within 0.5LSB for the FIR, 0.75LSB otherwise) and times it on the
+host; target cycle counts need measuring on hardware.
+*/
+
+#define FILTER_MAX_CHANNELS 6u
+#define FILTER_MAX_FIR_TAPS 64u
+#define FILTER_MAX_BIQUADS 2u
+#define FILTER_CIC_ORDER 3u
+#define FILTER_MAX_CIC_DECIMATION 16u
+#define FILTER_FRAC_BITS 8u
+#define FILTER_BIQUAD_COEFF_BITS 28u
+
+enum filter_decimator_t {
+    FILTER_DECIMATOR_FIR = 0,
+    FILTER_DECIMATOR_CIC
+};
+
+struct filter_biquad_t {
+    /* b0, b1, b2, then a1, a2 (a0 is 1) -- Q28 */
+    int32_t b[3];
+    int32_t a[2];
+
+    /* Per channel: the last two inputs and outputs, and the rounding error */
+    int32_t x[FILTER_MAX_CHANNELS][2];
+    int32_t y[FILTER_MAX_CHANNELS][2];
+    int32_t err[FILTER_MAX_CHANNELS];
+};
+
+struct filter_chain_t {
+    /* Configuration, set by filter_chain_init_fir/cic */
+    enum filter_decimator_t decimator;
+    uint8_t channels;
+    uint8_t decimation;
+    uint8_t num_taps;
+    uint8_t num_biquads;
+    const int16_t *taps;
+
+    /* FIR input history, oldest at history_idx */
+    int16_t history[FILTER_MAX_FIR_TAPS][FILTER_MAX_CHANNELS];
+    uint8_t history_idx;
+
+    /* CIC integrator and comb delay state -- wraps modulo 2^32 */
+    uint32_t integrator[FILTER_CIC_ORDER][FILTER_MAX_CHANNELS];
+    uint32_t comb[FILTER_CIC_ORDER][FILTER_MAX_CHANNELS];
+    uint8_t cic_shift;
+
+    struct filter_biquad_t biquad[FILTER_MAX_BIQUADS];
+};
+
+/*
+Set up f as an FIR decimator by decimation over channels channels; taps
+must stay valid, and sum (in absolute value) to less than 2.
+*/
+void filter_chain_init_fir(struct filter_chain_t *f, uint32_t channels,
+uint32_t decimation, const int16_t *taps, uint32_t num_taps);
+
+/*
+Set up f as a CIC decimator by decimation (a power of two, no more than
+FILTER_MAX_CIC_DECIMATION) over channels channels.
+*/
+void filter_chain_init_cic(struct filter_chain_t *f, uint32_t channels,
+uint32_t decimation);
+
+/*
+Append a biquad low-pass or notch stage; freq is the cut-off or centre
+frequency as a fraction of the output rate (less than 0.5).
+*/
+void filter_chain_add_lowpass(struct filter_chain_t *f, float freq, float q);
+void filter_chain_add_notch(struct filter_chain_t *f, float freq, float q);
+
+/* Add an input sample (one value per channel) */
+void filter_chain_add(struct filter_chain_t *f, const int16_t in[]);
+
+/*
+Produce an output sample as of the last input added; must be called once
+per decimation period, after its last input, for the CIC and biquad states
+to stay consistent.
+*/
+void filter_chain_decimate(struct filter_chain_t *f, int16_t out[]);
+
+/*
+The decimator's group delay, in half input sample periods (the biquads'
+delay depends on frequency, so isn't included).
+*/
+uint32_t filter_chain_delay(const struct filter_chain_t *f);
+
+#endif
@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _HAL_H_
+#define _HAL_H_
+
+/*
+Hardware access for the drivers. Peripheral registers are still accessed
+through the AVR32_* register blocks, but everything which only works on real
+hardware goes through these macros:
+
+- Hal_count() reads the COUNT system register;
+- Hal_pdca_channel(n) is a pointer to PDCA channel n's registers;
+- Hal_write(reg, value) writes a register with side effects on write (CR,
+  SCR, IER and IDR), which plain memory can't emulate;
+- Hal_address(ptr) is the bus address of a PDCA buffer, for MAR/MARR;
+- Hal_user_page() points to the (read-only) contents of the flash user page.
+
+On the board these compile to exactly the register accesses they replace.
+When built with HAL_SIM defined they're provided by hal/sim.c instead, which
+simulates the registers, the cycle counter and the TWIM, SPI, USART and PDCA
+peripherals so the drivers and main loop can run on a host; see hal/sim.h.
+*/
+
+#ifdef HAL_SIM
+#include "hal/sim.h"
+#else
+#include <avr32/io.h>
+
+#define Hal_count() Get_system_register(AVR32_COUNT)
+#define Hal_pdca_channel(n) (&AVR32_PDCA.channel[(n)])
+#define Hal_write(reg, value) ((reg) = (value))
+#define Hal_address(ptr) ((uint32_t)(ptr))
+#define Hal_user_page() ((const uint8_t *)AVR32_FLASHC_USER_PAGE_ADDRESS)
+#endif
+
+#endif
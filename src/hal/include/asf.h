@@ -0,0 +1,136 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _HAL_SIM_ASF_H_
+#define _HAL_SIM_ASF_H_
+
+/*
+Host replacement for lib/asf.h, used when building with HAL_SIM. The clock
+functions do nothing; the GPIO, USART and INTC functions are implemented by
+hal/sim.c.
+*/
+
+#include <compiler.h>
+#include "conf_board.h"
+
+/* From lib/gpio/gpio.h */
+#define GPIO_SUCCESS            0
+#define GPIO_INVALID_ARGUMENT   1
+
+#define GPIO_PIN_CHANGE         0
+#define GPIO_RISING_EDGE        1
+#define GPIO_FALLING_EDGE       2
+
+#define GPIO_DIR_INPUT  (0 << 0)
+#define GPIO_DIR_OUTPUT (1 << 0)
+#define GPIO_INIT_LOW   (0 << 1)
+#define GPIO_INIT_HIGH  (1 << 1)
+#define GPIO_PULL_UP    (1 << 2)
+#define GPIO_PULL_DOWN  (2 << 2)
+#define GPIO_BUSKEEPER  (3 << 2)
+#define GPIO_DRIVE_MIN  (0 << 4)
+#define GPIO_DRIVE_LOW  (1 << 4)
+#define GPIO_DRIVE_HIGH (2 << 4)
+#define GPIO_DRIVE_MAX  (3 << 4)
+#define GPIO_OPEN_DRAIN (1 << 6)
+#define GPIO_INTERRUPT  (1 << 7)
+#define GPIO_BOTHEDGES  (3 << 7)
+#define GPIO_RISING     (5 << 7)
+#define GPIO_FALLING    (7 << 7)
+
+uint32_t gpio_enable_module_pin(uint32_t pin, uint32_t function);
+void gpio_configure_pin(uint32_t pin, uint32_t flags);
+uint32_t gpio_enable_pin_interrupt(uint32_t pin, uint32_t mode);
+void gpio_local_init(void);
+bool gpio_local_get_pin_value(uint32_t pin);
+void gpio_local_set_gpio_pin(uint32_t pin);
+void gpio_local_clr_gpio_pin(uint32_t pin);
+void gpio_local_tgl_gpio_pin(uint32_t pin);
+
+/* From lib/clock/osc.h and lib/clock/pll.h */
+#define OSC_ID_OSC0             0
+#define PLL_SRC_OSC0            0
+
+struct pll_config {
+    uint32_t ctrl;
+};
+
+static inline void osc_enable(uint8_t id) {
+    (void)id;
+}
+
+static inline bool osc_is_ready(uint8_t id) {
+    (void)id;
+    return true;
+}
+
+static inline void osc_wait_ready(uint8_t id) {
+    (void)id;
+}
+
+static inline void pll_config_init(struct pll_config *cfg,
+unsigned int src, unsigned int div, unsigned int mul) {
+    (void)src;
+    (void)div;
+    (void)mul;
+    cfg->ctrl = 0;
+}
+
+static inline void pll_enable(const struct pll_config *cfg,
+unsigned int pll_id) {
+    (void)cfg;
+    (void)pll_id;
+}
+
+static inline void pll_disable(unsigned int pll_id) {
+    (void)pll_id;
+}
+
+static inline bool pll_is_locked(unsigned int pll_id) {
+    (void)pll_id;
+    return true;
+}
+
+/* From lib/usart/usart.h */
+#define USART_SUCCESS                 0
+#define USART_INVALID_INPUT           1
+#define USART_NO_PARITY               AVR32_USART_MR_PAR_NONE
+#define USART_1_STOPBIT               AVR32_USART_MR_NBSTOP_1
+#define USART_NORMAL_CHMODE           AVR32_USART_MR_CHMODE_NORMAL
+
+typedef struct {
+    unsigned long baudrate;
+    unsigned char charlength;
+    unsigned char paritytype;
+    unsigned short stopbits;
+    unsigned char channelmode;
+} usart_options_t;
+
+int usart_init_rs232(volatile avr32_usart_t *usart,
+const usart_options_t *opt, long pba_hz);
+
+/* From lib/intc/intc.h */
+void INTC_init_interrupts(void);
+void INTC_register_interrupt(__int_handler handler, uint32_t irq,
+uint32_t int_level);
+
+#endif
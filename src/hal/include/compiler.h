@@ -0,0 +1,52 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _HAL_SIM_COMPILER_H_
+#define _HAL_SIM_COMPILER_H_
+
+/*
+Host replacement for lib/compiler.h, used when building with HAL_SIM. The
+CPU's interrupt mask is simulated by hal/sim.c.
+*/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "hal/sim.h"
+
+/* Interrupt handlers are ordinary functions on the host */
+#define __interrupt__ __used__
+
+#define Assert(expr) ((void)0)
+
+typedef uint32_t irqflags_t;
+typedef void (*__int_handler)(void);
+
+void cpu_irq_enable(void);
+void cpu_irq_disable(void);
+irqflags_t cpu_irq_save(void);
+void cpu_irq_restore(irqflags_t flags);
+
+#define cpu_relax()
+
+#endif
@@ -0,0 +1,950 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <asf.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "fcsassert.h"
+#include "hal.h"
+
+/* Cycles COUNT advances by on each read, when not following the host clock */
+#define HAL_SIM_COUNT_STEP 16u
+
+/* The TWIM always runs at 400kHz -- 9 bit periods per byte */
+#define HAL_SIM_TWIM_BYTE_CYCLES (9u * CONFIG_MAIN_HZ / 400000u)
+
+#define HAL_SIM_TWIM_ERROR_MASK (AVR32_TWIM_SR_ANAK_MASK | \
+                                 AVR32_TWIM_SR_DNAK_MASK | \
+                                 AVR32_TWIM_SR_ARBLST_MASK)
+
+#define HAL_SIM_NUM_PDCA AVR32_PDCA_CHANNEL_LENGTH
+#define HAL_SIM_NUM_GPIO (sizeof(hal_sim_gpio.port) / \
+                          sizeof(hal_sim_gpio.port[0]) * 32u)
+#define HAL_SIM_NUM_IRQ (64u * 32u)
+
+#define HAL_SIM_USART_RX_LEN 4096u
+#define HAL_SIM_MAX_GPIO_PULSES 4u
+
+#define HAL_SIM_REGION_BITS 20u
+#define HAL_SIM_REGION_MASK ((1u << HAL_SIM_REGION_BITS) - 1u)
+#define HAL_SIM_NUM_REGIONS 64u
+
+#define Hal_sim_in_block(reg, block) \
+    ((uintptr_t)(reg) - (uintptr_t)&(block) < sizeof(block))
+
+/* Simulated register blocks */
+volatile avr32_pdca_t hal_sim_pdca;
+volatile avr32_twim_t hal_sim_twim[HAL_SIM_NUM_TWIM];
+volatile avr32_spi_t hal_sim_spi[HAL_SIM_NUM_SPI];
+volatile avr32_usart_t hal_sim_usart[HAL_SIM_NUM_USART];
+volatile avr32_gpio_t hal_sim_gpio;
+volatile avr32_pwm_t hal_sim_pwm;
+volatile avr32_adcifa_t hal_sim_adcifa;
+volatile avr32_pm_t hal_sim_pm;
+volatile avr32_flashc_t hal_sim_flashc;
+uint8_t hal_sim_user_page[HAL_SIM_USER_PAGE_SIZE];
+
+struct hal_sim_twim_t {
+    const struct hal_sim_i2c_slave_t *slaves[HAL_SIM_MAX_I2C_SLAVES];
+    uint32_t num_slaves;
+
+    bool enabled;
+    bool active; /* executing CMDR */
+    const struct hal_sim_i2c_slave_t *slave;
+    uint8_t buf[256];
+    uint32_t len;
+    uint32_t pos;
+    uint64_t next_t;
+
+    uint32_t commands;
+    uint32_t naks;
+};
+
+struct hal_sim_spi_t {
+    const struct hal_sim_spi_slave_t *slaves[HAL_SIM_SPI_MAX_CS];
+
+    bool enabled;
+    bool first;
+    uint32_t npcs; /* selected for the last byte */
+    bool pending; /* rx is being shifted in */
+    uint8_t rx;
+    uint64_t next_t;
+
+    uint32_t bytes;
+};
+
+struct hal_sim_usart_t {
+    hal_sim_usart_tx_t tx;
+    void *tx_ctx;
+
+    uint8_t rx_buf[HAL_SIM_USART_RX_LEN];
+    uint32_t rx_head;
+    uint32_t rx_tail;
+
+    uint64_t tx_next_t;
+    uint64_t rx_next_t;
+    uint64_t last_rx_t;
+    bool timeout_armed;
+    bool timeout_started;
+
+    uint32_t tx_bytes;
+    uint32_t rx_bytes;
+    uint32_t rx_dropped;
+};
+
+struct hal_sim_gpio_pulse_t {
+    uint32_t pin;
+    uint32_t period;
+    uint32_t width;
+};
+
+static const uint32_t hal_sim_twim_pid[HAL_SIM_NUM_TWIM][2] = {
+    {AVR32_TWIM0_PDCA_ID_TX, AVR32_TWIM0_PDCA_ID_RX},
+    {AVR32_TWIM1_PDCA_ID_TX, AVR32_TWIM1_PDCA_ID_RX},
+    {AVR32_TWIM2_PDCA_ID_TX, AVR32_TWIM2_PDCA_ID_RX}
+};
+static const uint32_t hal_sim_twim_irq[HAL_SIM_NUM_TWIM] = {
+    AVR32_TWIM0_IRQ, AVR32_TWIM1_IRQ, AVR32_TWIM2_IRQ
+};
+static const uint32_t hal_sim_spi_pid[HAL_SIM_NUM_SPI][2] = {
+    {AVR32_SPI0_PDCA_ID_TX, AVR32_SPI0_PDCA_ID_RX},
+    {AVR32_SPI1_PDCA_ID_TX, AVR32_SPI1_PDCA_ID_RX}
+};
+static const uint32_t hal_sim_usart_pid[HAL_SIM_NUM_USART][2] = {
+    {AVR32_PDCA_PID_USART0_TX, AVR32_PDCA_PID_USART0_RX},
+    {AVR32_PDCA_PID_USART1_TX, AVR32_PDCA_PID_USART1_RX},
+    {AVR32_PDCA_PID_USART2_TX, AVR32_PDCA_PID_USART2_RX},
+    {AVR32_PDCA_PID_USART3_TX, AVR32_PDCA_PID_USART3_RX},
+    {AVR32_PDCA_PID_USART4_TX, AVR32_PDCA_PID_USART4_RX}
+};
+static const uint32_t hal_sim_usart_irq[HAL_SIM_NUM_USART] = {
+    AVR32_USART0_IRQ, AVR32_USART1_IRQ, AVR32_USART2_IRQ, AVR32_USART3_IRQ,
+    AVR32_USART4_IRQ
+};
+
+static struct hal_sim_twim_t hal_sim_twim_state[HAL_SIM_NUM_TWIM];
+static struct hal_sim_spi_t hal_sim_spi_state[HAL_SIM_NUM_SPI];
+static struct hal_sim_usart_t hal_sim_usart_state[HAL_SIM_NUM_USART];
+static struct hal_sim_gpio_pulse_t hal_sim_gpio_pulses[HAL_SIM_MAX_GPIO_PULSES];
+static uint32_t hal_sim_num_gpio_pulses;
+
+static __int_handler hal_sim_handlers[HAL_SIM_NUM_IRQ];
+static bool hal_sim_irq_enabled;
+static bool hal_sim_in_irq;
+
+static uint8_t *hal_sim_regions[HAL_SIM_NUM_REGIONS];
+
+static uint64_t hal_sim_now;
+static uint64_t hal_sim_end;
+static bool hal_sim_realtime;
+static struct timespec hal_sim_host_start;
+
+static uint64_t hal_sim_host_ns(void);
+static uint8_t *hal_sim_pointer(uint32_t address);
+static volatile avr32_pdca_channel_t *hal_sim_pdca_find(uint32_t pid);
+static void hal_sim_pdca_advance(volatile avr32_pdca_channel_t *pdca);
+static bool hal_sim_pdca_pull(uint32_t pid, uint8_t *data);
+static bool hal_sim_pdca_push(uint32_t pid, uint8_t data);
+static uint32_t hal_sim_usart_byte_cycles(volatile avr32_usart_t *usart);
+static void hal_sim_twim_step(uint32_t idx);
+static void hal_sim_spi_step(uint32_t idx);
+static void hal_sim_usart_step(uint32_t idx);
+static void hal_sim_gpio_step(void);
+static void hal_sim_irq(uint32_t irq, bool pending);
+static void hal_sim_step(void);
+static void hal_sim_finish(void);
+static void hal_sim_init(void);
+
+static uint64_t hal_sim_host_ns(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)(t.tv_sec - hal_sim_host_start.tv_sec) * 1000000000u +
+           (uint64_t)t.tv_nsec - (uint64_t)hal_sim_host_start.tv_nsec;
+}
+
+uint32_t hal_sim_address(volatile const void *ptr) {
+    uint8_t *p = (uint8_t*)(uintptr_t)ptr;
+    uint32_t i;
+
+    if (!p) {
+        return 0;
+    }
+
+    for (i = 0; i < HAL_SIM_NUM_REGIONS && hal_sim_regions[i]; i++) {
+        if (p >= hal_sim_regions[i] &&
+                (uintptr_t)(p - hal_sim_regions[i]) <= HAL_SIM_REGION_MASK) {
+            break;
+        }
+    }
+
+    fcs_assert(i < HAL_SIM_NUM_REGIONS);
+    if (!hal_sim_regions[i]) {
+        hal_sim_regions[i] = p;
+    }
+
+    /* Region 0 starts at 1 << HAL_SIM_REGION_BITS, so NULL stays 0 */
+    return ((i + 1u) << HAL_SIM_REGION_BITS) |
+           (uint32_t)(p - hal_sim_regions[i]);
+}
+
+static uint8_t *hal_sim_pointer(uint32_t address) {
+    uint32_t i = (address >> HAL_SIM_REGION_BITS) - 1u;
+
+    fcs_assert(i < HAL_SIM_NUM_REGIONS && hal_sim_regions[i]);
+    return hal_sim_regions[i] + (address & HAL_SIM_REGION_MASK);
+}
+
+static volatile avr32_pdca_channel_t *hal_sim_pdca_find(uint32_t pid) {
+    volatile avr32_pdca_channel_t *pdca;
+    uint32_t i;
+
+    for (i = 0; i < HAL_SIM_NUM_PDCA; i++) {
+        pdca = &hal_sim_pdca.channel[i];
+        if ((pdca->sr & AVR32_PDCA_TEN_MASK) && pdca->psr == pid &&
+                pdca->tcr) {
+            return pdca;
+        }
+    }
+
+    return NULL;
+}
+
+static void hal_sim_pdca_advance(volatile avr32_pdca_channel_t *pdca) {
+    pdca->mar++;
+    pdca->tcr--;
+
+    if (!pdca->tcr && pdca->tcrr) {
+        pdca->mar = pdca->marr;
+        pdca->tcr = pdca->tcrr;
+
+        /* In ring mode the reload registers keep their values */
+        if (!(pdca->mr & (1u << AVR32_PDCA_RING_OFFSET))) {
+            pdca->tcrr = 0;
+        }
+    }
+}
+
+static bool hal_sim_pdca_pull(uint32_t pid, uint8_t *data) {
+    volatile avr32_pdca_channel_t *pdca = hal_sim_pdca_find(pid);
+
+    if (!pdca) {
+        return false;
+    }
+
+    *data = *hal_sim_pointer(pdca->mar);
+    hal_sim_pdca_advance(pdca);
+    return true;
+}
+
+static bool hal_sim_pdca_push(uint32_t pid, uint8_t data) {
+    volatile avr32_pdca_channel_t *pdca = hal_sim_pdca_find(pid);
+
+    if (!pdca) {
+        return false;
+    }
+
+    *hal_sim_pointer(pdca->mar) = data;
+    hal_sim_pdca_advance(pdca);
+    return true;
+}
+
+static uint32_t hal_sim_usart_byte_cycles(volatile avr32_usart_t *usart) {
+    uint32_t cd, fp, oversampling;
+
+    cd = (usart->brgr & AVR32_USART_BRGR_CD_MASK) >>
+         AVR32_USART_BRGR_CD_OFFSET;
+    fp = (usart->brgr & AVR32_USART_BRGR_FP_MASK) >>
+         AVR32_USART_BRGR_FP_OFFSET;
+    oversampling = (usart->mr & AVR32_USART_MR_OVER_MASK) ? 8u : 16u;
+
+    /* Start, 8 data and stop bits; 0 if the baud rate generator is off */
+    return 10u * oversampling * (cd * 8u + fp) / 8u;
+}
+
+void hal_sim_write(volatile void *reg, uint32_t value) {
+    volatile avr32_pdca_channel_t *pdca;
+    volatile avr32_twim_t *twim;
+    volatile avr32_spi_t *spi;
+    volatile avr32_usart_t *usart;
+    volatile avr32_gpio_port_t *port;
+    uint32_t i;
+
+    for (i = 0; i < HAL_SIM_NUM_GPIO / 32u; i++) {
+        port = &hal_sim_gpio.port[i];
+        if (Hal_sim_in_block(reg, *port) && reg == &port->ifrc) {
+            port->ifr &= ~value;
+            return;
+        }
+    }
+
+    for (i = 0; i < HAL_SIM_NUM_PDCA; i++) {
+        pdca = &hal_sim_pdca.channel[i];
+        if (!Hal_sim_in_block(reg, *pdca)) {
+            continue;
+        }
+
+        if (reg == &pdca->cr) {
+            if (value & AVR32_PDCA_TDIS_MASK) {
+                pdca->sr &= ~AVR32_PDCA_TEN_MASK;
+            }
+            if (value & AVR32_PDCA_TEN_MASK) {
+                pdca->sr |= AVR32_PDCA_TEN_MASK;
+            }
+            if (value & AVR32_PDCA_ECLR_MASK) {
+                pdca->isr &= ~AVR32_PDCA_TERR_MASK;
+            }
+        } else if (reg == &pdca->ier) {
+            pdca->imr |= value;
+        } else if (reg == &pdca->idr) {
+            pdca->imr &= ~value;
+        } else {
+            *(volatile uint32_t*)reg = value;
+        }
+        return;
+    }
+
+    for (i = 0; i < HAL_SIM_NUM_TWIM; i++) {
+        twim = &hal_sim_twim[i];
+        if (!Hal_sim_in_block(reg, *twim)) {
+            continue;
+        }
+
+        if (reg == &twim->cr) {
+            if (value & AVR32_TWIM_CR_SWRST_MASK) {
+                twim->cmdr = 0;
+                twim->ncmdr = 0;
+                twim->sr = AVR32_TWIM_SR_IDLE_MASK |
+                           AVR32_TWIM_SR_BUSFREE_MASK;
+                hal_sim_twim_state[i].enabled = false;
+                hal_sim_twim_state[i].active = false;
+            }
+            if (value & AVR32_TWIM_CR_MDIS_MASK) {
+                hal_sim_twim_state[i].enabled = false;
+            }
+            if (value & AVR32_TWIM_CR_MEN_MASK) {
+                hal_sim_twim_state[i].enabled = true;
+            }
+        } else if (reg == &twim->scr) {
+            twim->sr &= ~value;
+        } else if (reg == &twim->ier) {
+            twim->imr |= value;
+        } else if (reg == &twim->idr) {
+            twim->imr &= ~value;
+        } else {
+            *(volatile uint32_t*)reg = value;
+        }
+        return;
+    }
+
+    for (i = 0; i < HAL_SIM_NUM_SPI; i++) {
+        spi = &hal_sim_spi[i];
+        if (!Hal_sim_in_block(reg, *spi)) {
+            continue;
+        }
+
+        if (reg == &spi->cr) {
+            if (value & AVR32_SPI_CR_SWRST_MASK) {
+                spi->mr = 0;
+                spi->sr = 0;
+                spi->csr0 = 0;
+                spi->csr1 = 0;
+                spi->csr2 = 0;
+                spi->csr3 = 0;
+                hal_sim_spi_state[i].enabled = false;
+                hal_sim_spi_state[i].pending = false;
+                hal_sim_spi_state[i].first = true;
+            }
+            if (value & AVR32_SPI_CR_LASTXFER_MASK) {
+                hal_sim_spi_state[i].first = true;
+            }
+            if (value & AVR32_SPI_CR_SPIDIS_MASK) {
+                hal_sim_spi_state[i].enabled = false;
+            }
+            if (value & AVR32_SPI_CR_SPIEN_MASK) {
+                hal_sim_spi_state[i].enabled = true;
+            }
+        } else if (reg == &spi->ier) {
+            spi->imr |= value;
+        } else if (reg == &spi->idr) {
+            spi->imr &= ~value;
+        } else {
+            *(volatile uint32_t*)reg = value;
+        }
+        return;
+    }
+
+    for (i = 0; i < HAL_SIM_NUM_USART; i++) {
+        usart = &hal_sim_usart[i];
+        if (!Hal_sim_in_block(reg, *usart)) {
+            continue;
+        }
+
+        if (reg == &usart->cr) {
+            if (value & AVR32_USART_CR_STTTO_MASK) {
+                /* The time-out starts again after the next character */
+                usart->csr &= ~AVR32_USART_CSR_TIMEOUT_MASK;
+                hal_sim_usart_state[i].timeout_armed = true;
+                hal_sim_usart_state[i].timeout_started = false;
+            }
+            if (value & AVR32_USART_CR_RSTSTA_MASK) {
+                usart->csr &= ~AVR32_USART_CSR_OVRE_MASK;
+            }
+        } else if (reg == &usart->ier) {
+            usart->imr |= value;
+        } else if (reg == &usart->idr) {
+            usart->imr &= ~value;
+        } else {
+            *(volatile uint32_t*)reg = value;
+        }
+        return;
+    }
+
+    *(volatile uint32_t*)reg = value;
+}
+
+static void hal_sim_twim_step(uint32_t idx) {
+    volatile avr32_twim_t *twim = &hal_sim_twim[idx];
+    struct hal_sim_twim_t *s = &hal_sim_twim_state[idx];
+    uint32_t i, addr;
+    bool read;
+
+    while (s->enabled && !(twim->sr & HAL_SIM_TWIM_ERROR_MASK)) {
+        read = (twim->cmdr & AVR32_TWIM_CMDR_READ_MASK) ? true : false;
+
+        if (!s->active) {
+            if (!(twim->cmdr & AVR32_TWIM_CMDR_VALID_MASK)) {
+                twim->sr |= AVR32_TWIM_SR_IDLE_MASK;
+                break;
+            }
+
+            /* Start the command with the address byte */
+            if (s->next_t < hal_sim_now) {
+                s->next_t = hal_sim_now;
+            }
+            addr = (twim->cmdr & AVR32_TWIM_CMDR_SADR_MASK) >>
+                   AVR32_TWIM_CMDR_SADR_OFFSET;
+            s->slave = NULL;
+            for (i = 0; i < s->num_slaves; i++) {
+                if (s->slaves[i]->addr == addr) {
+                    s->slave = s->slaves[i];
+                }
+            }
+
+            s->commands++;
+            twim->sr &= ~AVR32_TWIM_SR_IDLE_MASK;
+            if (!s->slave) {
+                s->naks++;
+                twim->sr |= AVR32_TWIM_SR_ANAK_MASK;
+                break;
+            }
+
+            s->active = true;
+            s->len = (twim->cmdr & AVR32_TWIM_CMDR_NBYTES_MASK) >>
+                     AVR32_TWIM_CMDR_NBYTES_OFFSET;
+            s->pos = 0;
+            if (read && s->slave->read) {
+                s->slave->read(s->slave->ctx, s->buf, s->len);
+            }
+            s->next_t += HAL_SIM_TWIM_BYTE_CYCLES;
+        } else if (s->next_t > hal_sim_now) {
+            break;
+        } else if (s->pos < s->len) {
+            /* The TWIM stretches the clock while the PDCA can't keep up */
+            if (read && !hal_sim_pdca_push(hal_sim_twim_pid[idx][1],
+                                           s->buf[s->pos])) {
+                s->next_t = hal_sim_now;
+                break;
+            } else if (!read && !hal_sim_pdca_pull(hal_sim_twim_pid[idx][0],
+                                                   &s->buf[s->pos])) {
+                s->next_t = hal_sim_now;
+                break;
+            }
+
+            s->pos++;
+            s->next_t += HAL_SIM_TWIM_BYTE_CYCLES;
+        } else {
+            s->active = false;
+            if (!read && s->slave->write &&
+                    !s->slave->write(s->slave->ctx, s->buf, s->len)) {
+                s->naks++;
+                twim->sr |= AVR32_TWIM_SR_DNAK_MASK;
+                break;
+            }
+
+            /* NCMDR moves up to CMDR */
+            twim->sr |= AVR32_TWIM_SR_CCOMP_MASK;
+            twim->cmdr = twim->ncmdr;
+            twim->ncmdr = 0;
+        }
+    }
+}
+
+static void hal_sim_spi_step(uint32_t idx) {
+    volatile avr32_spi_t *spi = &hal_sim_spi[idx];
+    struct hal_sim_spi_t *s = &hal_sim_spi_state[idx];
+    const struct hal_sim_spi_slave_t *slave;
+    uint32_t pcs, npcs, scbr = 0;
+    uint8_t tx;
+
+    /* Fixed peripheral select: NPCSn is selected by the lowest 0 bit */
+    pcs = (spi->mr & AVR32_SPI_MR_PCS_MASK) >> AVR32_SPI_MR_PCS_OFFSET;
+    for (npcs = 0; npcs < HAL_SIM_SPI_MAX_CS && (pcs & (1u << npcs));
+         npcs++);
+    slave = npcs < HAL_SIM_SPI_MAX_CS ? s->slaves[npcs] : NULL;
+    if (npcs < HAL_SIM_SPI_MAX_CS) {
+        scbr = (((volatile uint32_t *)&spi->csr0)[npcs] &
+                AVR32_SPI_CSR0_SCBR_MASK) >> AVR32_SPI_CSR0_SCBR_OFFSET;
+    }
+
+    while (s->enabled && s->next_t <= hal_sim_now) {
+        if (s->pending) {
+            (void)hal_sim_pdca_push(hal_sim_spi_pid[idx][1], s->rx);
+            s->pending = false;
+        }
+
+        if (!hal_sim_pdca_pull(hal_sim_spi_pid[idx][0], &tx)) {
+            s->next_t = hal_sim_now;
+            break;
+        }
+
+        if (npcs != s->npcs) {
+            s->npcs = npcs;
+            s->first = true;
+        }
+        s->rx = slave ? slave->exchange(slave->ctx, tx, s->first) : 0xFFu;
+        s->first = false;
+        s->pending = true;
+        s->bytes++;
+        s->next_t += 8u * (scbr ? scbr : 1u);
+    }
+
+    if (s->pending) {
+        spi->sr &= ~AVR32_SPI_SR_TXEMPTY_MASK;
+    } else {
+        spi->sr |= AVR32_SPI_SR_TXEMPTY_MASK;
+    }
+}
+
+static void hal_sim_usart_step(uint32_t idx) {
+    volatile avr32_usart_t *usart = &hal_sim_usart[idx];
+    struct hal_sim_usart_t *s = &hal_sim_usart_state[idx];
+    uint32_t byte_cycles = hal_sim_usart_byte_cycles(usart);
+    uint8_t data;
+
+    if (!byte_cycles) {
+        return;
+    }
+
+    while (s->tx_next_t <= hal_sim_now) {
+        if (!hal_sim_pdca_pull(hal_sim_usart_pid[idx][0], &data)) {
+            s->tx_next_t = hal_sim_now;
+            break;
+        }
+
+        if (s->tx) {
+            s->tx(s->tx_ctx, data);
+        }
+        s->tx_bytes++;
+        s->tx_next_t += byte_cycles;
+    }
+
+    while (s->rx_next_t <= hal_sim_now) {
+        if (s->rx_head == s->rx_tail) {
+            s->rx_next_t = hal_sim_now;
+            break;
+        }
+
+        /* Without a PDCA transfer, the byte waits in RHR */
+        data = s->rx_buf[s->rx_tail];
+        s->rx_tail = (s->rx_tail + 1u) % HAL_SIM_USART_RX_LEN;
+        if (!hal_sim_pdca_push(hal_sim_usart_pid[idx][1], data)) {
+            if (usart->csr & AVR32_USART_CSR_RXRDY_MASK) {
+                usart->csr |= AVR32_USART_CSR_OVRE_MASK;
+                s->rx_dropped++;
+            }
+            usart->rhr = data;
+            usart->csr |= AVR32_USART_CSR_RXRDY_MASK;
+        }
+
+        s->rx_bytes++;
+        s->rx_next_t += byte_cycles;
+        s->last_rx_t = s->rx_next_t;
+        if (s->timeout_armed) {
+            s->timeout_started = true;
+        }
+    }
+
+    if (s->timeout_started && hal_sim_now - s->last_rx_t >=
+            (uint64_t)(usart->rtor & AVR32_USART_RTOR_TO_MASK) *
+            byte_cycles / 10u) {
+        usart->csr |= AVR32_USART_CSR_TIMEOUT_MASK;
+        s->timeout_armed = false;
+        s->timeout_started = false;
+    }
+}
+
+static void hal_sim_gpio_step(void) {
+    const struct hal_sim_gpio_pulse_t *pulse;
+    uint32_t i;
+    bool level;
+
+    for (i = 0; i < hal_sim_num_gpio_pulses; i++) {
+        pulse = &hal_sim_gpio_pulses[i];
+        level = hal_sim_now % pulse->period < pulse->width;
+        if (level != gpio_local_get_pin_value(pulse->pin)) {
+            hal_sim_gpio_input(pulse->pin, level);
+        }
+    }
+}
+
+static void hal_sim_irq(uint32_t irq, bool pending) {
+    fcs_assert(irq < HAL_SIM_NUM_IRQ);
+
+    if (pending && hal_sim_handlers[irq]) {
+        hal_sim_in_irq = true;
+        hal_sim_handlers[irq]();
+        hal_sim_in_irq = false;
+    }
+}
+
+static void hal_sim_step(void) {
+    volatile avr32_pdca_channel_t *pdca;
+    volatile avr32_gpio_port_t *port;
+    uint32_t i;
+
+    for (i = 0; i < HAL_SIM_NUM_TWIM; i++) {
+        hal_sim_twim_step(i);
+    }
+    for (i = 0; i < HAL_SIM_NUM_SPI; i++) {
+        hal_sim_spi_step(i);
+    }
+    for (i = 0; i < HAL_SIM_NUM_USART; i++) {
+        hal_sim_usart_step(i);
+    }
+    hal_sim_gpio_step();
+    for (i = 0; i < HAL_SIM_NUM_PDCA; i++) {
+        pdca = &hal_sim_pdca.channel[i];
+        pdca->isr = (pdca->isr & AVR32_PDCA_TERR_MASK) |
+                    (pdca->tcr ? 0 : AVR32_PDCA_TRC_MASK) |
+                    (pdca->tcrr ? 0 : AVR32_PDCA_RCZ_MASK);
+    }
+
+    /* The PWM applies double-buffered updates immediately */
+    hal_sim_pwm.scuc = 0;
+
+    if (!hal_sim_irq_enabled || hal_sim_in_irq) {
+        return;
+    }
+
+    for (i = 0; i < HAL_SIM_NUM_TWIM; i++) {
+        hal_sim_irq(hal_sim_twim_irq[i],
+                    hal_sim_twim[i].sr & hal_sim_twim[i].imr);
+    }
+    for (i = 0; i < HAL_SIM_NUM_USART; i++) {
+        hal_sim_irq(hal_sim_usart_irq[i],
+                    hal_sim_usart[i].csr & hal_sim_usart[i].imr);
+    }
+    for (i = 0; i < HAL_SIM_NUM_PDCA; i++) {
+        pdca = &hal_sim_pdca.channel[i];
+        hal_sim_irq(AVR32_PDCA_IRQ_0 + i, pdca->isr & pdca->imr);
+    }
+    /* Each GPIO interrupt line serves eight pins */
+    for (i = 0; i < HAL_SIM_NUM_GPIO / 8u; i++) {
+        port = &hal_sim_gpio.port[i / 4u];
+        hal_sim_irq(AVR32_GPIO_IRQ_0 + i,
+                    port->ifr & port->ier & (0xFFu << ((i % 4u) * 8u)));
+    }
+}
+
+uint32_t hal_sim_count(void) {
+    uint64_t t;
+
+    if (hal_sim_realtime) {
+        t = hal_sim_host_ns() * (CONFIG_MAIN_HZ / 1000u) / 1000000u;
+        hal_sim_now = (t > hal_sim_now) ? t : hal_sim_now + 1u;
+    } else {
+        hal_sim_now += HAL_SIM_COUNT_STEP;
+    }
+
+    hal_sim_step();
+
+    if (hal_sim_end && hal_sim_now >= hal_sim_end) {
+        hal_sim_finish();
+    }
+
+    return (uint32_t)hal_sim_now;
+}
+
+uint64_t hal_sim_cycles(void) {
+    return hal_sim_now;
+}
+
+static void hal_sim_finish(void) {
+    uint64_t host_ns = hal_sim_host_ns(),
+             frames = hal_sim_now / CONFIG_FRAME_CYCLES;
+    uint32_t i;
+
+    fprintf(stderr, "%llu frames (%.3fs), host %.3fs, %.2fus per frame\n",
+            (unsigned long long)frames,
+            (double)hal_sim_now / (double)CONFIG_MAIN_HZ,
+            (double)host_ns / 1e9, (double)host_ns / 1e3 / (double)frames);
+    for (i = 0; i < HAL_SIM_NUM_TWIM; i++) {
+        fprintf(stderr, "TWIM%u: %u commands, %u NAKs\n", (unsigned int)i,
+                (unsigned int)hal_sim_twim_state[i].commands,
+                (unsigned int)hal_sim_twim_state[i].naks);
+    }
+    for (i = 0; i < HAL_SIM_NUM_SPI; i++) {
+        fprintf(stderr, "SPI%u: %u bytes\n", (unsigned int)i,
+                (unsigned int)hal_sim_spi_state[i].bytes);
+    }
+    for (i = 0; i < HAL_SIM_NUM_USART; i++) {
+        fprintf(stderr, "USART%u: %u bytes sent, %u received, %u dropped\n",
+                (unsigned int)i, (unsigned int)hal_sim_usart_state[i].tx_bytes,
+                (unsigned int)hal_sim_usart_state[i].rx_bytes,
+                (unsigned int)hal_sim_usart_state[i].rx_dropped);
+    }
+
+    exit(0);
+}
+
+void hal_sim_attach_i2c(uint32_t twim_idx,
+const struct hal_sim_i2c_slave_t *slave) {
+    fcs_assert(twim_idx < HAL_SIM_NUM_TWIM && slave);
+    fcs_assert(hal_sim_twim_state[twim_idx].num_slaves <
+               HAL_SIM_MAX_I2C_SLAVES);
+
+    struct hal_sim_twim_t *s = &hal_sim_twim_state[twim_idx];
+    s->slaves[s->num_slaves++] = slave;
+}
+
+void hal_sim_attach_spi(uint32_t spi_idx, uint32_t npcs,
+const struct hal_sim_spi_slave_t *slave) {
+    fcs_assert(spi_idx < HAL_SIM_NUM_SPI && npcs < HAL_SIM_SPI_MAX_CS &&
+               slave && slave->exchange);
+
+    hal_sim_spi_state[spi_idx].slaves[npcs] = slave;
+}
+
+void hal_sim_attach_usart(uint32_t usart_idx, hal_sim_usart_tx_t tx,
+void *ctx) {
+    fcs_assert(usart_idx < HAL_SIM_NUM_USART);
+
+    hal_sim_usart_state[usart_idx].tx = tx;
+    hal_sim_usart_state[usart_idx].tx_ctx = ctx;
+}
+
+void hal_sim_usart_rx(uint32_t usart_idx, const uint8_t *data,
+uint32_t len) {
+    fcs_assert(usart_idx < HAL_SIM_NUM_USART && (data || !len));
+
+    struct hal_sim_usart_t *s = &hal_sim_usart_state[usart_idx];
+    uint32_t i, next;
+
+    for (i = 0; i < len; i++) {
+        next = (s->rx_head + 1u) % HAL_SIM_USART_RX_LEN;
+        if (next == s->rx_tail) {
+            s->rx_dropped += len - i;
+            break;
+        }
+
+        s->rx_buf[s->rx_head] = data[i];
+        s->rx_head = next;
+    }
+}
+
+__attribute__((__weak__)) void hal_sim_setup(void) {
+}
+
+/* Host versions of the CPU and ASF functions */
+void cpu_irq_enable(void) {
+    hal_sim_irq_enabled = true;
+}
+
+void cpu_irq_disable(void) {
+    hal_sim_irq_enabled = false;
+}
+
+irqflags_t cpu_irq_save(void) {
+    irqflags_t flags = hal_sim_irq_enabled ? 1u : 0;
+
+    hal_sim_irq_enabled = false;
+    return flags;
+}
+
+void cpu_irq_restore(irqflags_t flags) {
+    hal_sim_irq_enabled = flags ? true : false;
+}
+
+void INTC_init_interrupts(void) {
+    memset(hal_sim_handlers, 0, sizeof(hal_sim_handlers));
+}
+
+void INTC_register_interrupt(__int_handler handler, uint32_t irq,
+uint32_t int_level) {
+    fcs_assert(irq < HAL_SIM_NUM_IRQ);
+    (void)int_level;
+
+    hal_sim_handlers[irq] = handler;
+}
+
+uint32_t gpio_enable_module_pin(uint32_t pin, uint32_t function) {
+    (void)function;
+    return pin < HAL_SIM_NUM_GPIO ? GPIO_SUCCESS : GPIO_INVALID_ARGUMENT;
+}
+
+void gpio_configure_pin(uint32_t pin, uint32_t flags) {
+    fcs_assert(pin < HAL_SIM_NUM_GPIO);
+
+    if ((flags & GPIO_DIR_OUTPUT) && (flags & GPIO_INIT_HIGH)) {
+        gpio_local_set_gpio_pin(pin);
+    } else if (flags & GPIO_DIR_OUTPUT) {
+        gpio_local_clr_gpio_pin(pin);
+    }
+}
+
+uint32_t gpio_enable_pin_interrupt(uint32_t pin, uint32_t mode) {
+    volatile avr32_gpio_port_t *port;
+    uint32_t mask;
+
+    if (pin >= HAL_SIM_NUM_GPIO || mode > GPIO_FALLING_EDGE) {
+        return GPIO_INVALID_ARGUMENT;
+    }
+
+    /* IMR1:IMR0 select the edges, as for GPIO_PIN_CHANGE etc. */
+    port = &hal_sim_gpio.port[pin >> 5u];
+    mask = 1u << (pin & 0x1Fu);
+    port->imr0 = (mode & 1u) ? (port->imr0 | mask) : (port->imr0 & ~mask);
+    port->imr1 = (mode & 2u) ? (port->imr1 | mask) : (port->imr1 & ~mask);
+    port->ier |= mask;
+
+    return GPIO_SUCCESS;
+}
+
+void gpio_local_init(void) {
+}
+
+bool gpio_local_get_pin_value(uint32_t pin) {
+    fcs_assert(pin < HAL_SIM_NUM_GPIO);
+
+    return (hal_sim_gpio.port[pin >> 5u].pvr >> (pin & 0x1Fu)) & 1u;
+}
+
+void gpio_local_set_gpio_pin(uint32_t pin) {
+    fcs_assert(pin < HAL_SIM_NUM_GPIO);
+
+    hal_sim_gpio.port[pin >> 5u].ovr |= 1u << (pin & 0x1Fu);
+    hal_sim_gpio.port[pin >> 5u].pvr |= 1u << (pin & 0x1Fu);
+}
+
+void gpio_local_clr_gpio_pin(uint32_t pin) {
+    fcs_assert(pin < HAL_SIM_NUM_GPIO);
+
+    hal_sim_gpio.port[pin >> 5u].ovr &= ~(1u << (pin & 0x1Fu));
+    hal_sim_gpio.port[pin >> 5u].pvr &= ~(1u << (pin & 0x1Fu));
+}
+
+void gpio_local_tgl_gpio_pin(uint32_t pin) {
+    fcs_assert(pin < HAL_SIM_NUM_GPIO);
+
+    hal_sim_gpio.port[pin >> 5u].ovr ^= 1u << (pin & 0x1Fu);
+    hal_sim_gpio.port[pin >> 5u].pvr ^= 1u << (pin & 0x1Fu);
+}
+
+void hal_sim_gpio_input(uint32_t pin, bool value) {
+    fcs_assert(pin < HAL_SIM_NUM_GPIO);
+
+    volatile avr32_gpio_port_t *port = &hal_sim_gpio.port[pin >> 5u];
+    uint32_t mask = 1u << (pin & 0x1Fu);
+    bool rising = (port->imr0 & mask) ? true : false,
+         falling = (port->imr1 & mask) ? true : false;
+
+    if (value == gpio_local_get_pin_value(pin)) {
+        return;
+    }
+
+    if (value) {
+        port->pvr |= mask;
+    } else {
+        port->pvr &= ~mask;
+    }
+
+    if ((!rising && !falling) || (rising && value) || (falling && !value)) {
+        port->ifr |= mask;
+    }
+}
+
+void hal_sim_gpio_pulse(uint32_t pin, uint32_t period, uint32_t width) {
+    fcs_assert(pin < HAL_SIM_NUM_GPIO && width < period);
+    fcs_assert(hal_sim_num_gpio_pulses < HAL_SIM_MAX_GPIO_PULSES);
+
+    hal_sim_gpio_pulses[hal_sim_num_gpio_pulses].pin = pin;
+    hal_sim_gpio_pulses[hal_sim_num_gpio_pulses].period = period;
+    hal_sim_gpio_pulses[hal_sim_num_gpio_pulses].width = width;
+    hal_sim_num_gpio_pulses++;
+}
+
+int usart_init_rs232(volatile avr32_usart_t *usart,
+const usart_options_t *opt, long pba_hz) {
+    fcs_assert(usart && opt && opt->baudrate && pba_hz);
+
+    uint32_t div_x8 = (uint32_t)(((uint64_t)pba_hz + opt->baudrate) /
+                                 (2u * opt->baudrate));
+
+    /* 16x oversampling, with a fractional divider */
+    usart->mr = AVR32_USART_MR_MODE_NORMAL << AVR32_USART_MR_MODE_OFFSET;
+    usart->brgr = ((div_x8 >> 3u) << AVR32_USART_BRGR_CD_OFFSET) |
+                  ((div_x8 & 0x7u) << AVR32_USART_BRGR_FP_OFFSET);
+    usart->csr = AVR32_USART_CSR_TXRDY_MASK | AVR32_USART_CSR_TXEMPTY_MASK;
+
+    return USART_SUCCESS;
+}
+
+__attribute__((__constructor__))
+static void hal_sim_init(void) {
+    const char *env;
+    uint32_t i;
+
+    clock_gettime(CLOCK_MONOTONIC, &hal_sim_host_start);
+
+    /* Clocks are always ready */
+    hal_sim_pm.sr = 0xFFFFFFFFu;
+
+    memset(hal_sim_user_page, 0xFF, sizeof(hal_sim_user_page));
+
+    for (i = 0; i < HAL_SIM_NUM_TWIM; i++) {
+        hal_sim_twim[i].sr = AVR32_TWIM_SR_IDLE_MASK |
+                             AVR32_TWIM_SR_BUSFREE_MASK;
+    }
+    for (i = 0; i < HAL_SIM_NUM_SPI; i++) {
+        hal_sim_spi_state[i].first = true;
+    }
+
+    env = getenv("HAL_SIM_FRAMES");
+    if (env) {
+        hal_sim_end = (uint64_t)strtoul(env, NULL, 10) * CONFIG_FRAME_CYCLES;
+    }
+    hal_sim_realtime = getenv("HAL_SIM_REALTIME") ? true : false;
+
+    hal_sim_setup();
+}
@@ -0,0 +1,199 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _HAL_SIM_H_
+#define _HAL_SIM_H_
+
+/*
+Host simulation backend for hal.h.
+
+To build the firmware for a host, define HAL_SIM and compile src/hal/sim.c
+with the C files in src, src/drivers, src/peripherals and src/plog (but
+none of lib/), and with src/hal/include ahead of everything else on the
+include path -- it replaces the ASF headers. Register layouts come from the
+AVR32 toolchain's part headers, so __AVR32_UC3C0512C__ and
+__AVR32_ABI_COMPILER__ must also be defined, and the toolchain's include
+directory added after src and src/config.
+
+The register blocks are ordinary memory, updated by the peripheral models
+each time COUNT is read:
+
+- PDCA channels move bytes between memory and the peripheral selected by PSR,
+  with reload and ring modes, and set TRC and RCZ;
+- TWIMs execute CMDR then NCMDR at 400kHz against the slaves attached with
+  hal_sim_attach_i2c, setting ANAK if no slave has the address and DNAK if
+  the slave rejects a write;
+- SPI masters exchange bytes with the slave attached with hal_sim_attach_spi
+  to the chip-select set by MR.PCS, at the rate set by its CSR's SCBR;
+  CR.SWRST, CR.LASTXFER and changes of chip-select deselect the slave, and
+  SR.TXEMPTY is set while no byte is being shifted;
+- USARTs pass transmitted bytes to the callback attached with
+  hal_sim_attach_usart and receive bytes queued by hal_sim_usart_rx, at the
+  rate set by BRGR and MR.OVER, and implement the receiver time-out;
+- handlers registered with INTC_register_interrupt are called from Hal_count
+  when their interrupt is enabled and pending, and the CPU has interrupts
+  enabled.
+
+The flash user page is a buffer, erased (all 0xFF) at start-up; the harness
+may fill it in hal_sim_setup.
+
+GPIO and PWM registers are plain storage, apart from OVR and PVR which track
+the pins set by the GPIO functions and the inputs driven by the harness; pin
+interrupts enabled with gpio_enable_pin_interrupt set IFR on the selected
+edges, which Hal_write to IFRC clears. Bit-field views of registers (e.g.
+TWIM.CWGR, PM.SR) aren't interpreted, as the host's bit-field layout differs
+from the AVR32's.
+
+COUNT advances by HAL_SIM_COUNT_STEP cycles each time it's read, so runs are
+repeatable. If HAL_SIM_REALTIME is set in the environment, COUNT follows the
+host's monotonic clock instead, so the CPU usage the firmware reports is the
+time the host takes to run each frame. If HAL_SIM_FRAMES is set, the program
+exits after that many frames, printing peripheral statistics and the host
+time per frame to stderr.
+
+The test harness (test/harness.c, built by test/Makefile) provides
+hal_sim_setup to attach device models; it's called before main.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr32/io.h>
+
+#undef AVR32_PDCA
+#undef AVR32_TWIM0
+#undef AVR32_TWIM1
+#undef AVR32_TWIM2
+#undef AVR32_SPI0
+#undef AVR32_SPI1
+#undef AVR32_USART0
+#undef AVR32_USART1
+#undef AVR32_USART2
+#undef AVR32_USART3
+#undef AVR32_USART4
+#undef AVR32_GPIO
+#undef AVR32_PWM
+#undef AVR32_ADCIFA
+#undef AVR32_PM
+#undef AVR32_FLASHC
+
+#define HAL_SIM_NUM_TWIM 3u
+#define HAL_SIM_NUM_SPI 2u
+#define HAL_SIM_NUM_USART 5u
+#define HAL_SIM_USER_PAGE_SIZE 512u
+
+extern volatile avr32_pdca_t hal_sim_pdca;
+extern volatile avr32_twim_t hal_sim_twim[HAL_SIM_NUM_TWIM];
+extern volatile avr32_spi_t hal_sim_spi[HAL_SIM_NUM_SPI];
+extern volatile avr32_usart_t hal_sim_usart[HAL_SIM_NUM_USART];
+extern volatile avr32_gpio_t hal_sim_gpio;
+extern volatile avr32_pwm_t hal_sim_pwm;
+extern volatile avr32_adcifa_t hal_sim_adcifa;
+extern volatile avr32_pm_t hal_sim_pm;
+extern volatile avr32_flashc_t hal_sim_flashc;
+extern uint8_t hal_sim_user_page[HAL_SIM_USER_PAGE_SIZE];
+
+#define AVR32_PDCA hal_sim_pdca
+#define AVR32_TWIM0 hal_sim_twim[0]
+#define AVR32_TWIM1 hal_sim_twim[1]
+#define AVR32_TWIM2 hal_sim_twim[2]
+#define AVR32_SPI0 hal_sim_spi[0]
+#define AVR32_SPI1 hal_sim_spi[1]
+#define AVR32_USART0 hal_sim_usart[0]
+#define AVR32_USART1 hal_sim_usart[1]
+#define AVR32_USART2 hal_sim_usart[2]
+#define AVR32_USART3 hal_sim_usart[3]
+#define AVR32_USART4 hal_sim_usart[4]
+#define AVR32_GPIO hal_sim_gpio
+#define AVR32_PWM hal_sim_pwm
+#define AVR32_ADCIFA hal_sim_adcifa
+#define AVR32_PM hal_sim_pm
+#define AVR32_FLASHC hal_sim_flashc
+
+#define Hal_count() hal_sim_count()
+#define Hal_pdca_channel(n) (&hal_sim_pdca.channel[(n)])
+#define Hal_write(reg, value) hal_sim_write(&(reg), (uint32_t)(value))
+#define Hal_address(ptr) hal_sim_address(ptr)
+#define Hal_user_page() ((const uint8_t *)hal_sim_user_page)
+
+uint32_t hal_sim_count(void);
+void hal_sim_write(volatile void *reg, uint32_t value);
+
+/*
+PDCA addresses are 32 bits; host buffers are mapped into 1MB windows, each
+starting at the first buffer address seen in it.
+*/
+uint32_t hal_sim_address(volatile const void *ptr);
+
+/*
+Device models. Callbacks run from within Hal_count, and the models must stay
+valid for the rest of the run.
+*/
+struct hal_sim_i2c_slave_t {
+    uint8_t addr; /* 7-bit */
+
+    /* Called with the data of each write; return false to NAK it */
+    bool (*write)(void *ctx, const uint8_t *data, uint32_t len);
+    /* Called to fill the data of each read */
+    void (*read)(void *ctx, uint8_t *data, uint32_t len);
+    void *ctx;
+};
+
+struct hal_sim_spi_slave_t {
+    /*
+    Called for each byte, returning the byte shifted out by the slave; first
+    is true for the first byte after the slave is selected
+    */
+    uint8_t (*exchange)(void *ctx, uint8_t tx, bool first);
+    void *ctx;
+};
+
+typedef void (*hal_sim_usart_tx_t)(void *ctx, uint8_t data);
+
+#define HAL_SIM_MAX_I2C_SLAVES 4u
+#define HAL_SIM_SPI_MAX_CS 4u
+
+/* Provided by the test harness; the default does nothing */
+void hal_sim_setup(void);
+
+void hal_sim_attach_i2c(uint32_t twim_idx,
+const struct hal_sim_i2c_slave_t *slave);
+void hal_sim_attach_spi(uint32_t spi_idx, uint32_t npcs,
+const struct hal_sim_spi_slave_t *slave);
+void hal_sim_attach_usart(uint32_t usart_idx, hal_sim_usart_tx_t tx,
+void *ctx);
+
+/* Drive an input pin */
+void hal_sim_gpio_input(uint32_t pin, bool value);
+
+/*
+Drive an input pin high for width cycles at the start of every period
+cycles, counting from start-up
+*/
+void hal_sim_gpio_pulse(uint32_t pin, uint32_t period, uint32_t width);
+
+/* Queue data to arrive on a USART's RX line from now on */
+void hal_sim_usart_rx(uint32_t usart_idx, const uint8_t *data, uint32_t len);
+
+/* Simulated cycles since start-up */
+uint64_t hal_sim_cycles(void);
+
+#endif
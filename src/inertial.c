@@ -0,0 +1,133 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <asf.h>
+#include <string.h>
+#include "fcsassert.h"
+#include "inertial.h"
+
+#define INERTIAL_DELTA_GAIN_SHIFT 32u
+#define INERTIAL_DELTA_ONE (1 << INERTIAL_DELTA_FRAC_BITS)
+
+inline static void inertial_cross(const int32_t a[3], const int32_t b[3],
+int64_t out[3]);
+
+inline static void inertial_cross(const int32_t a[3], const int32_t b[3],
+int64_t out[3]) {
+    out[0] = (int64_t)a[1] * b[2] - (int64_t)a[2] * b[1];
+    out[1] = (int64_t)a[2] * b[0] - (int64_t)a[0] * b[2];
+    out[2] = (int64_t)a[0] * b[1] - (int64_t)a[1] * b[0];
+}
+
+void inertial_delta_init(struct inertial_delta_t *d, float angle_lsb) {
+    fcs_assert(d);
+    fcs_assert(0.0f < angle_lsb && angle_lsb < 1e-5f);
+
+    /* Output units, then Q32 */
+    const float scale = (float)INERTIAL_DELTA_ONE * 4294967296.0f;
+
+    d->cross_gain = (int64_t)(angle_lsb / 12.0f * scale + 0.5f);
+    d->rot_gain = (int64_t)(angle_lsb / 2.0f * scale + 0.5f);
+    fcs_assert(d->cross_gain > 0);
+
+    inertial_delta_reset(d);
+}
+
+void inertial_delta_reset(struct inertial_delta_t *d) {
+    fcs_assert(d);
+
+    memset(d->alpha, 0, sizeof(d->alpha));
+    memset(d->nu, 0, sizeof(d->nu));
+    memset(d->beta, 0, sizeof(d->beta));
+    memset(d->scul, 0, sizeof(d->scul));
+    d->samples = 0;
+    memset(d->last_gyro, 0, sizeof(d->last_gyro));
+    memset(d->last_accel, 0, sizeof(d->last_accel));
+}
+
+void inertial_delta_add(struct inertial_delta_t *d,
+const int16_t gyro[3], const int16_t accel[3]) {
+    fcs_assert(d && gyro && accel);
+    fcs_assert(d->samples < INERTIAL_DELTA_MAX_SAMPLES);
+
+    int32_t g[3], a[3], a6[3], v6[3];
+    int64_t cone[3], scul_a[3], scul_v[3];
+    uint32_t i;
+
+    /*
+    With alpha and nu the sums before this sample, and the previous sample
+    standing in for its increment:
+      d(beta) = 1/2 (alpha + last_gyro/6) x gyro
+      d(scul) = 1/2 ((alpha + last_gyro/6) x accel +
+                     (nu + last_accel/6) x gyro)
+    Both are computed six times over, and cross_gain divides by 12.
+    */
+    for (i = 0; i < 3u; i++) {
+        g[i] = gyro[i];
+        a[i] = accel[i];
+        a6[i] = 6 * d->alpha[i] + d->last_gyro[i];
+        v6[i] = 6 * d->nu[i] + d->last_accel[i];
+    }
+
+    inertial_cross(a6, g, cone);
+    inertial_cross(a6, a, scul_a);
+    inertial_cross(v6, g, scul_v);
+
+    for (i = 0; i < 3u; i++) {
+        d->beta[i] += cone[i] * d->cross_gain;
+        d->scul[i] += (scul_a[i] + scul_v[i]) * d->cross_gain;
+
+        d->alpha[i] += gyro[i];
+        d->nu[i] += accel[i];
+        d->last_gyro[i] = gyro[i];
+        d->last_accel[i] = accel[i];
+    }
+
+    d->samples++;
+}
+
+uint32_t inertial_delta_end(struct inertial_delta_t *d,
+int32_t d_angle[3], int32_t d_velocity[3]) {
+    fcs_assert(d && d_angle && d_velocity);
+
+    int64_t rot[3];
+    uint32_t i, samples = d->samples;
+
+    /* Rotation correction: 1/2 alpha x nu */
+    inertial_cross(d->alpha, d->nu, rot);
+
+    for (i = 0; i < 3u; i++) {
+        d_angle[i] = d->alpha[i] * INERTIAL_DELTA_ONE +
+                     (int32_t)(d->beta[i] >> INERTIAL_DELTA_GAIN_SHIFT);
+        d_velocity[i] = d->nu[i] * INERTIAL_DELTA_ONE +
+                        (int32_t)((d->scul[i] + rot[i] * d->rot_gain) >>
+                                  INERTIAL_DELTA_GAIN_SHIFT);
+    }
+
+    memset(d->alpha, 0, sizeof(d->alpha));
+    memset(d->nu, 0, sizeof(d->nu));
+    memset(d->beta, 0, sizeof(d->beta));
+    memset(d->scul, 0, sizeof(d->scul));
+    d->samples = 0;
+
+    return samples;
+}
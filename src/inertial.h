@@ -0,0 +1,92 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _INERTIAL_H_
+#define _INERTIAL_H_
+
+/*
+Integration of high-rate gyro and accelerometer samples into delta-angle
+and delta-velocity vectors over an interval of several samples, with coning
+and sculling correction (Savage's two-sample algorithm).
+
+Samples are raw sensor readings, taken at a fixed rate. The outputs are in
+the same units as the sums of the samples over the interval -- raw LSB times
+sample periods -- with INERTIAL_DELTA_FRAC_BITS fractional bits, so the
+sensor calibration applies to them as it does to single readings:
+- the delta-angle is the sum of the gyro samples plus the coning correction;
+- the delta-velocity is the sum of the accelerometer samples plus the
+  rotation and sculling corrections.
+
+The corrections are second-order in the angle, so they depend on the gyro's
+scale: angle_lsb is the rotation in radians represented by one LSB held for
+one sample period. The accelerometer's scale cancels out.
+
+All arithmetic is in fixed point. An interval may be up to
+INERTIAL_DELTA_MAX_SAMPLES samples long, and the rotation over it must be
+less than a radian.
+*/
+
+#define INERTIAL_DELTA_FRAC_BITS 8u
+#define INERTIAL_DELTA_MAX_SAMPLES 128u
+
+struct inertial_delta_t {
+    /* Correction gains -- Q32 */
+    int64_t cross_gain; /* angle_lsb / 12, scaled to the output units */
+    int64_t rot_gain; /* angle_lsb / 2, scaled to the output units */
+
+    /* Sums of the samples in the interval so far */
+    int32_t alpha[3];
+    int32_t nu[3];
+    /* Coning and sculling corrections -- Q32 of the output units */
+    int64_t beta[3];
+    int64_t scul[3];
+    uint32_t samples;
+
+    /* The previous samples, which may be from the last interval */
+    int16_t last_gyro[3];
+    int16_t last_accel[3];
+};
+
+/*
+Set up the integrator for a gyro scale of angle_lsb radians per LSB-sample,
+and start an interval.
+*/
+void inertial_delta_init(struct inertial_delta_t *d, float angle_lsb);
+
+/*
+Discard the interval so far, and forget the previous samples; used when
+samples have been lost.
+*/
+void inertial_delta_reset(struct inertial_delta_t *d);
+
+/* Add the next gyro and accelerometer sample (XYZ each) to the interval */
+void inertial_delta_add(struct inertial_delta_t *d, const int16_t gyro[3],
+const int16_t accel[3]);
+
+/*
+End the interval, setting d_angle and d_velocity (XYZ each), and start the
+next one. Returns the number of samples in the interval.
+*/
+uint32_t inertial_delta_end(struct inertial_delta_t *d, int32_t d_angle[3],
+int32_t d_velocity[3]);
+
+#endif
@@ -22,7 +22,9 @@ SOFTWARE.
 
 
 #include <asf.h>
+#include "hal.h"
 #include "fcsassert.h"
+#include "main.h"
 #include "comms.h"
 #include "peripherals/gp.h"
 #include "peripherals/pwm.h"
@@ -32,6 +34,8 @@ SOFTWARE.
 #include "peripherals/mpu6000.h"
 #include "peripherals/ms4525.h"
 
+uint32_t frame_start_t;
+
 static void sysclk_init(void);
 
 static void sysclk_init(void) {
@@ -71,6 +75,7 @@ int main(void) {
 	/* Initialize core systems */
     sysclk_init();
 	gpio_local_init();
+    INTC_init_interrupts();
 
     /* Initialize the core iomon systems */
     comms_init();
@@ -93,11 +98,11 @@ int main(void) {
     LED_OFF(LED0_GPIO);
     LED_OFF(LED3_GPIO);
 
-    uint32_t counts_per_ms, frame, start_t;
-    counts_per_ms = CONFIG_MAIN_HZ / 1000u;
-    frame = Get_system_register(AVR32_COUNT) / counts_per_ms;
+    uint32_t counts_per_frame, frame;
+    counts_per_frame = CONFIG_FRAME_CYCLES;
+    frame = Hal_count() / counts_per_frame;
     while (true) {
-		start_t = frame * counts_per_ms;
+        frame_start_t = frame * counts_per_frame;
 
         /* Input/output procedure */
         gp_tick();
@@ -114,20 +119,22 @@ int main(void) {
         pwm_tick();
 
         /* Work out CPU usage for the last frame */
-		comms_set_cpu_status(Get_system_register(AVR32_COUNT) - start_t);
+        comms_set_cpu_status(Hal_count() - frame_start_t);
         frame++;
 
         /*
         If we lose an entire frame, skip the next one to avoid compounding the
         issue, and flash LED3 to alert.
         */
-        if ((Get_system_register(AVR32_COUNT) - start_t) > counts_per_ms) {
+        if ((Hal_count() - frame_start_t) >
+                counts_per_frame) {
             LED_ON(LED3_GPIO);
         } else {
             LED_OFF(LED3_GPIO);
         }
 
-        while ((Get_system_register(AVR32_COUNT) - start_t) < counts_per_ms) {
+        while ((Hal_count() - frame_start_t) <
+                counts_per_frame) {
             /* FIXME: use udelay instead of busy loop */
             cpu_relax();
         }
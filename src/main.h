@@ -24,4 +24,14 @@ SOFTWARE.
 #ifndef _MAIN_H_
 #define _MAIN_H_
 
+/* COUNT value at the start of the current frame */
+extern uint32_t frame_start_t;
+
+/*
+Signed offset in microseconds of COUNT value t from the start of the current
+frame.
+*/
+#define Frame_offset_us(t) \
+    ((int32_t)((uint32_t)(t) - frame_start_t) / (int32_t)CONFIG_US_CYCLES)
+
 #endif
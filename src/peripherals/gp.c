@@ -21,7 +21,7 @@ SOFTWARE.
 */
 
 #include <asf.h>
-#include <avr32/io.h>
+#include "hal.h"
 #include <string.h>
 #include <adcifa/adcifa.h>
 #include "fcsassert.h"
@@ -47,7 +47,8 @@ static const uint32_t gp_output_pins[GP_NUM_OUTPUTS] =
    the PDCA. The gp_adc_last_sample_idx value contains the index of the last
    ADC sample read. */
 static volatile int16_t gp_adc_samples[GP_ADC_BUF_SIZE * 2u];
-static uint32_t gp_adc_last_sample_idx;
+//static uint32_t gp_adc_last_sample_idx;
+//static uint8_t gp_adc_pdca_num;
 
 static void gp_set_pins(uint32_t pin_values);
 static uint32_t gp_get_pins(void);
@@ -78,6 +79,8 @@ void gp_init(void) {
     gpio_configure_pin(LED3_GPIO, GPIO_DIR_OUTPUT | GPIO_INIT_HIGH);
 
 //    /* Initialize ADCs */
+//    gp_adc_pdca_num = pdca_channel_alloc(ADC_PDCA_PID_RX,
+//                                         AVR32_PDCA_HALF_WORD);
 //
 //    /* Set GPIOs for channels 0-3 */
 //    gpio_enable_module_pin(ADC_PITOT_PIN, ADC_PITOT_FUNCTION);
@@ -143,13 +146,14 @@ void gp_tick(void) {
 
     if (fcs_parameter_find_by_type_and_device(
             &cpu_conn.in_log, FCS_PARAMETER_GP_OUT, 0, &param)) {
-        if (param.data.u8[0] && gpout_high_time == 0 && gpout_low_time > 5000u) {
+        if (param.data.u8[0] && gpout_high_time == 0 &&
+                gpout_low_time > Frames_from_ms(5000u)) {
             gpout_high_time = 1;
         } else if (!param.data.u8[0] && gpout_low_time == 0) {
             gpout_low_time = 1;
         }
 
-        if (gpout_high_time && gpout_high_time <= 100) {
+        if (gpout_high_time && gpout_high_time <= Frames_from_ms(100u)) {
             gp_set_pins(0xFu);
         } else {
             gp_set_pins(0x0u);
@@ -179,7 +183,7 @@ void gp_tick(void) {
 //       adc_totals value, and increment adc_sample_count for each. Divide each
 //       adc_totals value by adc_sample_count. */
 //    volatile avr32_pdca_channel_t *pdca_channel =
-//        &AVR32_PDCA.channel[PDCA_CHANNEL_ADC_RX];
+//        Hal_pdca_channel(gp_adc_pdca_num);
 //
 //    uint32_t samples_read = GP_ADC_BUF_SIZE - pdca_channel->tcr;
 //    uint32_t samples_avail = 0, sample = 0,
@@ -208,17 +212,8 @@ void gp_tick(void) {
 //        ADCIFA_disable();
 //
 //        /* Configure PDCA transfer in ring buffer mode */
-//        pdca_channel->cr = AVR32_PDCA_TDIS_MASK;
-//        pdca_channel->idr = 0xFFFFFFFFu;
-//        pdca_channel->mar = (uint32_t)gp_adc_samples;
-//        pdca_channel->tcr = GP_ADC_BUF_SIZE;
-//        pdca_channel->marr = (uint32_t)gp_adc_samples;
-//        pdca_channel->tcrr = GP_ADC_BUF_SIZE;
-//        pdca_channel->psr = ADC_PDCA_PID_RX;
-//        pdca_channel->mr = (AVR32_PDCA_HALF_WORD << AVR32_PDCA_SIZE_OFFSET)
-//            | (1 << AVR32_PDCA_RING_OFFSET);
-//        pdca_channel->cr = AVR32_PDCA_ECLR_MASK | AVR32_PDCA_TEN_MASK;
-//        pdca_channel->isr;
+//        pdca_channel_start_ring(gp_adc_pdca_num, gp_adc_samples,
+//                                GP_ADC_BUF_SIZE);
 //
 //        ADCIFA_enable();
 //    }
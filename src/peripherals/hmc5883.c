@@ -22,7 +22,7 @@ SOFTWARE.
 
 
 #include <asf.h>
-#include <avr32/io.h>
+#include "hal.h"
 #include <string.h>
 #include "fcsassert.h"
 #include "drivers/i2cdevice.h"
@@ -32,6 +32,8 @@ SOFTWARE.
 
 static volatile uint8_t hmc5883_inbuf[6];
 
+static void hmc5883_sample(uint16_t arg, uint32_t completed_t);
+
 static struct twim_transaction_t init_sequence[] = {
     /*
     Device address, TX byte count, TX bytes (0-4), RX byte count, RX buffer
@@ -41,121 +43,94 @@ static struct twim_transaction_t init_sequence[] = {
     */
 
     /* Write 0x78 to CRA -- 8 samples per measurement, 75Hz nominal, no bias */
-    {HMC5883_DEVICE_ADDR, 2u, {0x00u, 0x78u}, 0, NULL, 0},
+    {HMC5883_DEVICE_ADDR, 2u, {0x00u, 0x78u}, 0, NULL, 0, 0, {0}},
     /* Write 0x00 to CRB -- gain = 2 (1090LSB/Ga) */
-    {HMC5883_DEVICE_ADDR, 2u, {0x01u, 0x20u}, 0, NULL, 0},
+    {HMC5883_DEVICE_ADDR, 2u, {0x01u, 0x20u}, 0, NULL, 0, 0, {0}},
     TWIM_TRANSACTION_SENTINEL
 };
 
 static struct twim_transaction_t read_sequence[] = {
     /* Write single-measurement start to MODE register (0x01) */
-    {HMC5883_DEVICE_ADDR, 2u, {0x02u, 0x01u}, 0, NULL, 0},
+    {HMC5883_DEVICE_ADDR, 2u, {0x02u, 0x01u}, 0, NULL, 0, 0, {0}},
+    /* Wait 8ms for the measurement to complete */
+    DEVICE_DELAY(Frames_from_ms(8u)),
     /*
     Read 6 bytes from DXRA -- returns:
     DXRA, DXRB, DZRA, DZRB, DYRA, DYRB (A=MSB, B=LSB)
     */
-    {HMC5883_DEVICE_ADDR, 1u, {0x03u}, 6u, hmc5883_inbuf, 0},
+    {HMC5883_DEVICE_ADDR, 1u, {0x03u}, 6u, hmc5883_inbuf, 0, 0, {0}},
+    DEVICE_SAMPLE(0),
     TWIM_TRANSACTION_SENTINEL
 };
 
 static struct i2c_device_t hmc5883 = {
-    .speed = 100000u,
-    .power_delay = 500u,
-    .init_timeout = 600u,
-    .read_timeout = 15u,
-
-    .sda_pin_id = HMC5883_TWI_TWD_PIN,
-    .sda_function = HMC5883_TWI_TWD_FUNCTION,
-    .scl_pin_id = HMC5883_TWI_TWCK_PIN,
-    .scl_function = HMC5883_TWI_TWCK_FUNCTION,
-    .enable_pin_id = HMC5883_ENABLE_PIN,
-
-    .twim_cfg = {
-        .twim = HMC5883_TWI,
-        .tx_pdca_num = PDCA_CHANNEL_HMC5883_TX,
-        .rx_pdca_num = PDCA_CHANNEL_HMC5883_RX,
-        .tx_pid = HMC5883_TWI_PDCA_PID_TX,
-        .rx_pid = HMC5883_TWI_PDCA_PID_RX
+    .dev = {
+        .power_delay = Frames_from_ms(500u),
+        .init_timeout = Frames_from_ms(600u),
+        .read_timeout = Frames_from_ms(15u),
+        .tick_budget_us = 200u,
+        .enable_pin_id = HMC5883_ENABLE_PIN,
+
+        .init_sequence = init_sequence,
+        .read_sequence = read_sequence,
+        .sample = hmc5883_sample
     },
 
-    .init_sequence = init_sequence,
-    .read_sequence = read_sequence
+    .speed = 400000u, /* datasheet maximum */
+    .bus_timeout = Frames_from_ms(5u),
+    .bus = HMC5883_I2C_BUS
 };
 
 #ifndef CONTINUE_ON_ASSERT
 #define HMC5883Assert(x) Assert(x)
 #else
-#define HMC5883Assert(x) if (!(x)) { hmc5883.state_timer = 0xffffu; }
+#define HMC5883Assert(x) if (!(x)) { hmc5883.dev.state_timer = 0xffffu; }
 #endif
 
-void hmc5883_measure(void);
-
 void hmc5883_init(void) {
     i2c_device_init(&hmc5883);
 }
 
 void hmc5883_tick(void) {
-    i2c_device_tick(&hmc5883);
-
-    if (hmc5883.state == I2C_READ_SEQUENCE) {
-        hmc5883_measure();
-    }
+    device_tick(&hmc5883.dev);
+    comms_set_device_health(FCS_PARAMETER_MAGNETOMETER_XYZ,
+                            &hmc5883.dev.health);
+    comms_set_device_recovery(FCS_PARAMETER_MAGNETOMETER_XYZ,
+                              hmc5883.bus_reset_count,
+                              hmc5883.bus_clear_count,
+                              hmc5883.dev.health.power_cycle_count);
 }
 
-void hmc5883_measure(void) {
+static void hmc5883_sample(uint16_t arg, uint32_t completed_t) {
     struct fcs_parameter_t param;
-    enum twim_transaction_result_t read_result;
     int16_t measurement[3];
 
-    if (hmc5883.state_timer >= 8u) {
-        /*
-        Wait until the 8th tick (~7ms after measurement command), then execute
-        a read operation to get the latest magnetometer measurement. If the
-        command completes, start another measurement.
-        */
-        read_result = twim_run_sequence(&hmc5883.twim_cfg,
-                                        hmc5883.read_sequence, 1u);
-
-        if (read_result == TWIM_TRANSACTION_EXECUTED) {
-            /* Convert the result and update the comms module */
-            memcpy(measurement, hmc5883_inbuf, 6u);
-
-            /*
-            Magnetic field over-/underflow -- should maybe adjust sensitivity
-            automatically?
-            */
-            if (!  (-2048 <= measurement[0] && measurement[0] <= 2047 &&
-                    -2048 <= measurement[1] && measurement[1] <= 2047 &&
-                    -2048 <= measurement[2] && measurement[2] <= 2047)) {
-                /* Power the device down */
-                gpio_local_clr_gpio_pin(hmc5883.enable_pin_id);
-                i2c_device_state_transition(&hmc5883, I2C_POWERING_DOWN);
-                return;
-            }
-
-            /* Registers are ordered X, Z, Y */
-            fcs_parameter_set_header(&param, FCS_VALUE_SIGNED, 16u, 3u);
-            fcs_parameter_set_type(&param, FCS_PARAMETER_MAGNETOMETER_XYZ);
-            fcs_parameter_set_device_id(&param, 0);
-            param.data.i16[0] = swap_i16(-measurement[0]);
-            param.data.i16[1] = swap_i16(measurement[2]);
-            param.data.i16[2] = swap_i16(-measurement[1]);
-            (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
-
-            sensor_status.updated |= UPDATED_MAG;
-            sensor_status.mag_count++;
-
-            hmc5883.state_timer = 0;
-        }
-    }
+    /* Convert the result and update the comms module */
+    memcpy(measurement, (const uint8_t *)hmc5883_inbuf, 6u);
 
-    if (hmc5883.state_timer == 0) {
-        /*
-        At the start of the read state, or after each successful read,
-        generate a measurement command.
-        */
-        hmc5883.read_sequence[0].txn_status = TWIM_TRANSACTION_STATUS_NONE;
-        hmc5883.read_sequence[1].txn_status = TWIM_TRANSACTION_STATUS_NONE;
-        twim_run_sequence(&hmc5883.twim_cfg, hmc5883.read_sequence, 0);
+    /*
+    Magnetic field over-/underflow -- should maybe adjust sensitivity
+    automatically?
+    */
+    if (!  (-2048 <= measurement[0] && measurement[0] <= 2047 &&
+            -2048 <= measurement[1] && measurement[1] <= 2047 &&
+            -2048 <= measurement[2] && measurement[2] <= 2047)) {
+        /* Power the device down */
+        device_power_down(&hmc5883.dev);
+        return;
     }
+
+    /* Registers are ordered X, Z, Y */
+    fcs_parameter_set_header(&param, FCS_VALUE_SIGNED, 16u, 3u);
+    fcs_parameter_set_type(&param, FCS_PARAMETER_MAGNETOMETER_XYZ);
+    fcs_parameter_set_device_id(&param, 0);
+    param.data.i16[0] = swap_i16(-measurement[0]);
+    param.data.i16[1] = swap_i16(measurement[2]);
+    param.data.i16[2] = swap_i16(-measurement[1]);
+    (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
+
+    comms_set_sample_time(FCS_PARAMETER_MAGNETOMETER_XYZ, 0, completed_t);
+
+    sensor_status.updated |= UPDATED_MAG;
+    sensor_status.mag_count++;
 }
@@ -22,18 +22,186 @@ SOFTWARE.
 
 
 #include <asf.h>
-#include <avr32/io.h>
+#include "hal.h"
 #include <string.h>
 #include "fcsassert.h"
 #include "comms.h"
 #include "drivers/spidevice.h"
+#include "calibration.h"
+#include "filter.h"
+#include "inertial.h"
 #include "mpu6000.h"
+#include "vibration.h"
 #include "plog/parameter.h"
 
+#if CONFIG_MPU6000_DELTAS && !CONFIG_MPU6000_FIFO
+#error "CONFIG_MPU6000_DELTAS requires CONFIG_MPU6000_FIFO"
+#endif
+
+/*
+In FIFO mode (CONFIG_MPU6000_FIFO), every 8kHz accel/gyro sample is queued in
+the MPU-6000's FIFO and read out in a single burst each frame. The samples
+are run through a 64-tap FIR low-pass filter (-0.2dB at 100Hz, -3dB at
+230Hz, -56dB from 500Hz up) and decimated to the frame rate, so vibration
+above the frame rate's Nyquist frequency is rejected rather than aliased.
+The price is a group delay of 31.5 samples (3.9ms).
+
+The FIR can be replaced by a cheaper CIC filter (CONFIG_MPU6000_CIC), with a
+delay of 10.5 samples but only -12dB at 500Hz, so vibration between 500Hz and
+1kHz aliases into the output band much less attenuated; low-pass and notch
+stages can be added after either. The accelerometer itself only updates at
+1kHz; its FIFO entries repeat each value until the next.
+
+With CONFIG_MPU6000_DELTAS, the samples are instead integrated into a
+delta-angle and delta-velocity (see inertial.h) over each decimation period,
+which are sent in place of the filtered readings. If a burst completes more
+than one period, its deltas cover all of them; a FIFO reset discards the
+period in progress. The deltas are sent as 16-bit values, like the readings
+they replace, with rounding errors carried forward (see
+mpu6000_delta_scale).
+
+The read sequence reads FIFO_COUNT, then mpu6000_sample sets the length of
+the burst read from FIFO_R_W that follows -- or, if too many samples are
+queued to catch up on (e.g. after an overflow), turns it into a FIFO reset.
+TEMP_OUT is read separately after the burst, rather than queued with every
+sample.
+
+If the calibration store has a thermal calibration for the MPU-6000, the
+readings (or deltas) are compensated as they're logged, using the mean
+temperature over each MPU6000_TEMP_INTERVAL; the mean is also sent to the
+CPU, so the calibration can be fitted offline.
+
+With CONFIG_MPU6000_VIBRATION, one accelerometer sample per frame (in FIFO
+mode, the one at the end of each decimation period) is passed to a vibration
+analyser, which works through each block of samples a little at a time in
+mpu6000_tick. Its results (the energy in each of mpu6000_vibration_bands
+and the peak frequencies) are queued for the CPU, so they're only sent in
+frames with room for them.
+
+With CONFIG_MPU6000_DRDY, the first read of each sequence -- FIFO_COUNT, or
+the register snapshot -- is started by the data-ready interrupt (see
+spidevice.h), so the newest sample's time is known to within the interrupt
+latency and the read waits for nothing once it's ready.
+*/
+#define MPU6000_SAMPLE_HZ 8000u
+#define MPU6000_SAMPLE_CYCLES (CONFIG_MAIN_HZ / MPU6000_SAMPLE_HZ)
+#define MPU6000_DECIMATION (MPU6000_SAMPLE_HZ / CONFIG_FRAME_HZ)
+
+/*
+Age of the newest sample when a read starts -- reads started by the
+data-ready interrupt start as it's ready, others half a period later on
+average
+*/
+#if CONFIG_MPU6000_DRDY
+#define MPU6000_READ_AGE_CYCLES 0
+#else
+#define MPU6000_READ_AGE_CYCLES (MPU6000_SAMPLE_CYCLES / 2u)
+#endif
+
+/* Accel XYZ then gyro XYZ, each big-endian */
+#define MPU6000_FIFO_SAMPLE_LEN 12u
+/* Samples read per frame, allowing for clock drift between the two */
+#define MPU6000_FIFO_MAX_SAMPLES (MPU6000_DECIMATION + 2u)
+#define MPU6000_FIFO_RESET_SAMPLES (4u * MPU6000_DECIMATION)
+/*
+Polling time for the FIFO_COUNT and TEMP_OUT reads and a full burst at the
+20MHz read clock (17.3MHz after rounding, ~2 bytes/us), plus set-up time
+*/
+#define MPU6000_READ_BUDGET_US \
+    ((7u + MPU6000_FIFO_MAX_SAMPLES * MPU6000_FIFO_SAMPLE_LEN) / 2u + 25u)
+
+#define MPU6000_FIR_TAPS 64u
+#define MPU6000_LPF_Q 0.7071f /* Butterworth */
+#define MPU6000_NOTCH_Q 2.0f
+
+/* Radians per gyro LSB per sample period, at 500deg/s full-scale */
+#define MPU6000_GYRO_ANGLE_LSB \
+    (0.0174532925f / 65.5f / (float)MPU6000_SAMPLE_HZ)
+
+/*
+Temperature readings are averaged over each interval, then used to update
+the thermal compensation and sent to the CPU (for fitting the calibration)
+*/
+#define MPU6000_TEMP_INTERVAL Frames_from_ms(100u)
+
+/* mpu6000_sample arguments */
+#define MPU6000_READ_REGISTERS 0
+#define MPU6000_READ_FIFO_COUNT 1u
+#define MPU6000_READ_FIFO_DATA 2u
+#define MPU6000_READ_TEMP 3u
+
+static void mpu6000_sample(uint16_t arg, uint32_t completed_t);
+static void mpu6000_temp(int16_t temp);
+#if !CONFIG_MPU6000_DELTAS
+static void mpu6000_log(const int16_t accel[3], const int16_t gyro[3],
+uint32_t sample_t);
+#endif
+
+#if CONFIG_MPU6000_FIFO
+static void mpu6000_fifo_count(void);
+static void mpu6000_fifo_data(void);
+static void mpu6000_fifo_sample(uint32_t idx, int16_t sample[6]);
+
+#if CONFIG_MPU6000_DELTAS
+static void mpu6000_log_delta(const int32_t d_angle[3],
+const int32_t d_velocity[3], uint32_t samples, uint32_t sample_t);
+
+static int16_t mpu6000_delta_scale(int32_t delta, int32_t *residual);
+static struct inertial_delta_t mpu6000_delta;
+/* Rounding errors carried into the next deltas -- accel XYZ, gyro XYZ */
+static int32_t mpu6000_delta_residual[6];
+#else
+#if !CONFIG_MPU6000_CIC
+/*
+Kaiser-windowed sinc (280Hz at 8kHz, beta 5.5), symmetric, sums to 32768
+*/
+static const int16_t mpu6000_fir[MPU6000_FIR_TAPS] = {
+    5, 5, 4, 0, -8, -19, -35, -55, -79, -105, -130, -153,
+    -170, -177, -169, -142, -94, -19, 82, 212, 370, 553, 756, 974,
+    1200, 1426, 1642, 1839, 2008, 2143, 2237, 2283, 2283, 2237, 2143, 2008,
+    1839, 1642, 1426, 1200, 974, 756, 553, 370, 212, 82, -19, -94,
+    -142, -169, -177, -170, -153, -130, -105, -79, -55, -35, -19, -8,
+    0, 4, 5, 5
+};
+#endif
+
+static struct filter_chain_t mpu6000_filter;
+#endif
+
+static uint8_t mpu6000_fifo_phase; /* samples since the last output */
+static volatile uint8_t
+    mpu6000_fifo_buf[MPU6000_FIFO_MAX_SAMPLES * MPU6000_FIFO_SAMPLE_LEN];
+static uint32_t mpu6000_fifo_samples; /* being read */
+static uint32_t mpu6000_fifo_t; /* COUNT value of the newest queued */
+static uint32_t mpu6000_fifo_backlog; /* queued behind those being read */
+static bool mpu6000_fifo_resetting;
+#endif
+
+/* Thermal calibration, and the corrections at the last mean temperature */
+static struct calibration_thermal_t mpu6000_thermal;
+static struct calibration_thermal_comp_t mpu6000_comp;
+static bool mpu6000_calibrated;
+static bool mpu6000_temp_valid;
+static int32_t mpu6000_temp_sum;
+static uint32_t mpu6000_temp_count;
+
+#if CONFIG_MPU6000_VIBRATION
+static void mpu6000_log_vibration(const struct vibration_result_t *result);
+
+/* Band edges, Hz -- frame vibration, and the propeller rates */
+static const uint16_t mpu6000_vibration_bands[VIBRATION_BANDS + 1u] = {
+    5u, 40u, 100u, 200u, 500u
+};
+static struct vibration_t mpu6000_vibration;
+#endif
+
 static struct spim_transaction_t init_sequence[] = {
     /*
     TX byte count, TX bytes (0-4), RX byte count, RX buffer
 
+    Register writes are limited to 1MHz; sensor and FIFO reads run at up to
+    20MHz.
+
     With this configuration, accel and gyro are sampled at 8kHz with
     accelerometer LPF off (260Hz), gyro LPF off (256Hz), accel latency at 0ms
     and gyro latency at 0.98ms.
@@ -43,101 +211,513 @@ static struct spim_transaction_t init_sequence[] = {
 
     /* Write 0x15 to USER_CTRL -- disables I2C interface and resets FIFO and
        signal path. */
-    {2u, {0x6au, 0x15u}, {0, 0}, 0},
+    {2u, {0x6au, 0x15u}, {0, 0}, 0, 0, {0}, NULL, NULL, 0, SPIM_SPEED_SLOW},
     /* Write 0x02 to RA_PWR_MGMT_1 -- sets clock source to gyro w/ PLL */
-    {2u, {0x6bu, 0x02u}, {0, 0}, 0},
+    {2u, {0x6bu, 0x02u}, {0, 0}, 0, 0, {0}, NULL, NULL, 0, SPIM_SPEED_SLOW},
     /* Write 0x00 to RA_SMPLRT_DIV -- 8000/(1+0) = 8kHz */
-    {2u, {0x19u, 0x00u}, {0, 0}, 0},
+    {2u, {0x19u, 0x00u}, {0, 0}, 0, 0, {0}, NULL, NULL, 0, SPIM_SPEED_SLOW},
     /* Write 0x00 to RA_CONFIG -- disable FSync, no/256Hz low-pass */
-    {2u, {0x1au, 0x00u}, {0, 0}, 0},
+    {2u, {0x1au, 0x00u}, {0, 0}, 0, 0, {0}, NULL, NULL, 0, SPIM_SPEED_SLOW},
     /* Write 0x08 to RA_GYRO_CONFIG -- no self test, scale 500deg/s */
-    {2u, {0x1bu, 0x08u}, {0, 0}, 0},
+    {2u, {0x1bu, 0x08u}, {0, 0}, 0, 0, {0}, NULL, NULL, 0, SPIM_SPEED_SLOW},
     /* Write 0x10 to RA_ACCEL_CONFIG -- no self test, scale of +-8g, no HPF */
-    {2u, {0x1cu, 0x10u}, {0, 0}, 0},
+    {2u, {0x1cu, 0x10u}, {0, 0}, 0, 0, {0}, NULL, NULL, 0, SPIM_SPEED_SLOW},
     /* Write 0x00 to RA_SIGNAL_PATH_RESET -- reset sensor signal paths */
-    {2u, {0x68u, 0x00u}, {0, 0}, 0},
+    {2u, {0x68u, 0x00u}, {0, 0}, 0, 0, {0}, NULL, NULL, 0, SPIM_SPEED_SLOW},
+#if CONFIG_MPU6000_DRDY
+    /* Write 0x00 to RA_INT_PIN_CFG -- active high, push-pull, 50us pulse */
+    {2u, {0x37u, 0x00u}, {0, 0}, 0, 0, {0}, NULL, NULL, 0, SPIM_SPEED_SLOW},
+    /* Write 0x01 to RA_INT_ENABLE -- pulse INT as each sample is ready */
+    {2u, {0x38u, 0x01u}, {0, 0}, 0, 0, {0}, NULL, NULL, 0, SPIM_SPEED_SLOW},
+#endif
+#if CONFIG_MPU6000_FIFO
+    /* Write 0x78 to RA_FIFO_EN -- queue accel and gyro XYZ */
+    {2u, {0x23u, 0x78u}, {0, 0}, 0, 0, {0}, NULL, NULL, 0, SPIM_SPEED_SLOW},
+    /* Write 0x54 to USER_CTRL -- enable and reset FIFO, I2C still off */
+    {2u, {0x6au, 0x54u}, {0, 0}, 0, 0, {0}, NULL, NULL, 0, SPIM_SPEED_SLOW},
+#endif
     SPIM_TRANSACTION_SENTINEL
 };
 
+#if CONFIG_MPU6000_FIFO
+static struct spim_transaction_t read_sequence[] = {
+    /* Read 2 bytes from RA_FIFO_COUNTH -- returns COUNT.H, COUNT.L */
+    {3u, {0x72u | 0x80, 0, 0}, {0}, 0, 0, {0}, NULL, NULL, 0,
+     SPIM_SPEED_FAST},
+    DEVICE_SAMPLE(MPU6000_READ_FIFO_COUNT),
+    /* Burst read from RA_FIFO_R_W, set up by mpu6000_fifo_count */
+    {1u, {0x74u | 0x80}, {0}, 0, 0, {0}, NULL, mpu6000_fifo_buf, 0,
+     SPIM_SPEED_FAST},
+    DEVICE_SAMPLE(MPU6000_READ_FIFO_DATA),
+    /* Read 2 bytes from RA_TEMP_OUT_H -- returns TEMP.H, TEMP.L */
+    {3u, {0x41u | 0x80, 0, 0}, {0}, 0, 0, {0}, NULL, NULL, 0,
+     SPIM_SPEED_FAST},
+    DEVICE_SAMPLE(MPU6000_READ_TEMP),
+    SPIM_TRANSACTION_SENTINEL
+};
+
+#define MPU6000_FIFO_READ_IDX 2u
+#define MPU6000_TEMP_READ_IDX 4u
+#else
 static struct spim_transaction_t read_sequence[] = {
     /* Read 14 bytes from RA_ACCEL_XOUT_H -- returns:
        AX.H, AX.L, AY.H, AY.L, AZ.H, AZ.L,
        TEMP.H, TEMP.L,
        GX.H, GX.L, GY.H, GY.L, GZ.H, GZ.L */
-    {15u, {0x3bu | 0x80, 0}, {0}, 0},
+    {15u, {0x3bu | 0x80, 0}, {0}, 0, 0, {0}, NULL, NULL, 0,
+     SPIM_SPEED_FAST},
+    DEVICE_SAMPLE(MPU6000_READ_REGISTERS),
     SPIM_TRANSACTION_SENTINEL
 };
+#endif
 
 static struct spi_device_t mpu6000 = {
+    .dev = {
+        .power_delay = Frames_from_ms(100u),
+        .init_timeout = Frames_from_ms(150u),
+        .read_timeout = Frames_from_ms(5u),
+#if CONFIG_MPU6000_FIFO
+        .read_budget_us = MPU6000_READ_BUDGET_US,
+#endif
+        .enable_pin_id = MPU6000_ENABLE_PIN,
+
+        .init_sequence = init_sequence,
+        .read_sequence = read_sequence,
+        .sample = mpu6000_sample
+    },
+
     .speed = 1000000u,
-    .power_delay = 100u,
-    .init_timeout = 150u,
-    .read_timeout = 5u,
-
-    .miso_pin_id = MPU6000_SPI_MISO_PIN,
-    .miso_function = MPU6000_SPI_MISO_FUNCTION,
-    .mosi_pin_id = MPU6000_SPI_MOSI_PIN,
-    .mosi_function = MPU6000_SPI_MOSI_FUNCTION,
+    .fast_speed = 20000000u,
+
     .cs_pin_id = MPU6000_SPI_CS_PIN,
     .cs_function = MPU6000_SPI_CS_FUNCTION,
-    .clk_pin_id = MPU6000_SPI_CLK_PIN,
-    .clk_function = MPU6000_SPI_CLK_FUNCTION,
-    .enable_pin_id = MPU6000_ENABLE_PIN,
-
-    .spim_cfg = {
-        .spim = MPU6000_SPI,
-        .tx_pdca_num = PDCA_CHANNEL_MPU6000_TX,
-        .rx_pdca_num = PDCA_CHANNEL_MPU6000_RX,
-        .tx_pid = MPU6000_SPI_PDCA_PID_TX,
-        .rx_pid = MPU6000_SPI_PDCA_PID_RX
+#if CONFIG_MPU6000_DRDY
+    .drdy_pin_id = MPU6000_INT_PIN,
+#endif
+
+    /* SPI mode 0 */
+    .cs = {
+        .npcs = MPU6000_SPI_CS,
+        .mode = 0
     },
 
-    .init_sequence = init_sequence,
-    .read_sequence = read_sequence
+    .bus = MPU6000_SPI_BUS
 };
 
 void mpu6000_init(void) {
+    mpu6000_calibrated = calibration_load_thermal(CALIBRATION_MPU6000,
+                                                  &mpu6000_thermal);
+#if CONFIG_MPU6000_DELTAS
+    inertial_delta_init(&mpu6000_delta, MPU6000_GYRO_ANGLE_LSB);
+#elif CONFIG_MPU6000_FIFO
+#if CONFIG_MPU6000_CIC
+    filter_chain_init_cic(&mpu6000_filter, 6u, MPU6000_DECIMATION);
+#else
+    filter_chain_init_fir(&mpu6000_filter, 6u, MPU6000_DECIMATION,
+                          mpu6000_fir, MPU6000_FIR_TAPS);
+#endif
+#if CONFIG_MPU6000_LPF_HZ
+    filter_chain_add_lowpass(&mpu6000_filter,
+                             (float)CONFIG_MPU6000_LPF_HZ /
+                             (float)CONFIG_FRAME_HZ, MPU6000_LPF_Q);
+#endif
+#if CONFIG_MPU6000_NOTCH_HZ
+    filter_chain_add_notch(&mpu6000_filter,
+                           (float)CONFIG_MPU6000_NOTCH_HZ /
+                           (float)CONFIG_FRAME_HZ, MPU6000_NOTCH_Q);
+#endif
+#endif
+#if CONFIG_MPU6000_VIBRATION
+    vibration_init(&mpu6000_vibration, CONFIG_FRAME_HZ,
+                   mpu6000_vibration_bands);
+#endif
     spi_device_init(&mpu6000);
 }
 
 void mpu6000_tick(void) {
-    struct fcs_parameter_t param;
+#if CONFIG_MPU6000_VIBRATION
+    struct vibration_result_t result;
+#endif
+
+    device_tick(&mpu6000.dev);
+    comms_set_device_health(FCS_PARAMETER_ACCELEROMETER_XYZ,
+                            &mpu6000.dev.health);
+
+#if CONFIG_MPU6000_VIBRATION
+    if (vibration_tick(&mpu6000_vibration, &result)) {
+        mpu6000_log_vibration(&result);
+    }
+#endif
+}
+
+static void mpu6000_sample(uint16_t arg, uint32_t completed_t) {
+    /*
+    Samples are timed from the start of the read (of FIFO_COUNT, in FIFO
+    mode) instead
+    */
+    (void)completed_t;
+
+#if CONFIG_MPU6000_FIFO
+    struct spim_transaction_t *txn = &read_sequence[MPU6000_TEMP_READ_IDX];
+
+    if (arg == MPU6000_READ_FIFO_COUNT) {
+        mpu6000_fifo_count();
+    } else if (arg == MPU6000_READ_FIFO_DATA) {
+        mpu6000_fifo_data();
+    } else {
+        fcs_assert(arg == MPU6000_READ_TEMP);
+        mpu6000_temp((int16_t)((txn->rx_buf[1] << 8u) | txn->rx_buf[2]));
+    }
+#else
     int16_t data[7];
+    uint32_t i;
+
+    fcs_assert(arg == MPU6000_READ_REGISTERS);
+
+    /*
+    Accel XYZ is in data[0:3], temp is in data [3], and gyro XYZ is in
+    data[4:7] (Python slice notation).
+    */
+    for (i = 0; i < 7u; i++) {
+        data[i] = (int16_t)((read_sequence[0].rx_buf[1u + i * 2u] << 8u) |
+                            read_sequence[0].rx_buf[2u + i * 2u]);
+    }
+
+    mpu6000_temp(data[3]);
+#if CONFIG_MPU6000_VIBRATION
+    vibration_add(&mpu6000_vibration, &data[0]);
+#endif
+    mpu6000_log(&data[0], &data[4],
+                mpu6000.cs.started_t - MPU6000_READ_AGE_CYCLES);
+#endif
+}
 
-    spi_device_tick(&mpu6000);
+/*
+Add a temperature reading to the current interval; at the end of each
+interval (or on the first reading), update the thermal compensation and
+queue the mean temperature for the CPU. The mean covers many frames, so it
+has no sample time, and it can wait for a frame with room.
+*/
+static void mpu6000_temp(int16_t temp) {
+    struct fcs_parameter_t param;
+
+    mpu6000_temp_sum += temp;
+    if (++mpu6000_temp_count < MPU6000_TEMP_INTERVAL && mpu6000_temp_valid) {
+        return;
+    }
 
-    if (mpu6000.state == SPI_READ_SEQUENCE &&
-            spim_run_sequence(&mpu6000.spim_cfg, mpu6000.read_sequence, 0) ==
-            SPIM_TRANSACTION_EXECUTED) {
+    temp = (int16_t)(mpu6000_temp_sum / (int32_t)mpu6000_temp_count);
+    mpu6000_temp_sum = 0;
+    mpu6000_temp_count = 0;
+    mpu6000_temp_valid = true;
+
+    if (mpu6000_calibrated) {
+        calibration_thermal_eval(&mpu6000_thermal, temp, &mpu6000_comp);
+    }
+
+    /* Raw reading (degC = temp / 340 + 36.53), and calibration status */
+    fcs_parameter_set_header(&param, FCS_VALUE_SIGNED, 16u, 2u);
+    fcs_parameter_set_type(&param, FCS_PARAMETER_IMU_TEMP);
+    fcs_parameter_set_device_id(&param, 0);
+    param.data.i16[0] = swap_i16(temp);
+    param.data.i16[1] = swap_i16(mpu6000_calibrated ? 1 : 0);
+    (void)comms_defer_parameter(&param);
+}
+
+#if !CONFIG_MPU6000_DELTAS
+/*
+Convert the result and update the comms module; sample_t is the COUNT value
+at which the measurement was made.
+*/
+static void mpu6000_log(const int16_t accel[3], const int16_t gyro[3],
+uint32_t sample_t) {
+    struct fcs_parameter_t param;
+    int16_t a[3], g[3];
+    uint32_t i;
+
+    for (i = 0; i < 3u; i++) {
+        if (mpu6000_calibrated) {
+            a[i] = calibration_thermal_apply(&mpu6000_comp, i, accel[i]);
+            g[i] = calibration_thermal_apply(&mpu6000_comp, i + 3u, gyro[i]);
+        } else {
+            a[i] = accel[i];
+            g[i] = gyro[i];
+        }
+    }
+
+    fcs_parameter_set_header(&param, FCS_VALUE_SIGNED, 16u, 3u);
+    fcs_parameter_set_type(&param, FCS_PARAMETER_ACCELEROMETER_XYZ);
+    fcs_parameter_set_device_id(&param, 0);
+    param.data.i16[0] = swap_i16(a[1]);
+    param.data.i16[1] = swap_i16(a[0]);
+    param.data.i16[2] = swap_i16(-a[2]);
+    (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
+
+    fcs_parameter_set_type(&param, FCS_PARAMETER_GYROSCOPE_XYZ);
+    fcs_parameter_set_device_id(&param, 0);
+    param.data.i16[0] = swap_i16(g[1]);
+    param.data.i16[1] = swap_i16(g[0]);
+    param.data.i16[2] = swap_i16(-g[2]);
+    (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
+
+    /* Accel and gyro are both sampled by the same burst read */
+    comms_set_sample_time(FCS_PARAMETER_ACCELEROMETER_XYZ, 0, sample_t);
+    comms_set_sample_time(FCS_PARAMETER_GYROSCOPE_XYZ, 0, sample_t);
+
+    sensor_status.updated |= UPDATED_ACCEL;
+    sensor_status.accel_count++;
+}
+
+#endif
+
+#if CONFIG_MPU6000_FIFO
+static void mpu6000_fifo_count(void) {
+    struct spim_transaction_t *txn = &read_sequence[MPU6000_FIFO_READ_IDX];
+    uint32_t samples;
+
+    samples = ((uint32_t)read_sequence[0].rx_buf[1] << 8u |
+               read_sequence[0].rx_buf[2]) / MPU6000_FIFO_SAMPLE_LEN;
+    mpu6000_fifo_t = mpu6000.cs.started_t - MPU6000_READ_AGE_CYCLES;
+
+    if (samples > MPU6000_FIFO_RESET_SAMPLES) {
+        /*
+        Too far behind to catch up (or the FIFO overflowed and lost sample
+        alignment) -- write 0x54 to USER_CTRL to discard the queue
+        */
+        txn->txn_len = 2u;
+        txn->tx_buf[0] = 0x6au;
+        txn->tx_buf[1] = 0x54u;
+        txn->ext_len = 0;
+        txn->speed = SPIM_SPEED_SLOW;
+        mpu6000_fifo_samples = 0;
+        mpu6000_fifo_backlog = 0;
+        mpu6000_fifo_resetting = true;
+        device_health_count(&mpu6000.dev.health.error_count);
+    } else {
         /*
-        Convert the result and update the comms module.
-        Accel XYZ is in data[0:3], temp is in data [3], and gyro XYZ is in
-        data[4:7] (Python slice notation).
+        The FIFO is read oldest first, so a clamped burst leaves the newest
+        samples queued for the next read
         */
-        memcpy(data, &read_sequence[0].rx_buf[1], sizeof(data));
-
-        fcs_parameter_set_header(&param, FCS_VALUE_SIGNED, 16u, 3u);
-        fcs_parameter_set_type(&param, FCS_PARAMETER_ACCELEROMETER_XYZ);
-        fcs_parameter_set_device_id(&param, 0);
-        param.data.i16[0] = swap_i16(data[1]);
-        param.data.i16[1] = swap_i16(data[0]);
-        param.data.i16[2] = swap_i16(-data[2]);
-        (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
-
-        fcs_parameter_set_type(&param, FCS_PARAMETER_GYROSCOPE_XYZ);
-        fcs_parameter_set_device_id(&param, 0);
-        param.data.i16[0] = swap_i16(data[5]);
-        param.data.i16[1] = swap_i16(data[4]);
-        param.data.i16[2] = swap_i16(-data[6]);
-        (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
-
-        sensor_status.updated |= UPDATED_ACCEL;
-        sensor_status.accel_count++;
-
-        mpu6000.state_timer = 0;
+        mpu6000_fifo_backlog = 0;
+        if (samples > MPU6000_FIFO_MAX_SAMPLES) {
+            mpu6000_fifo_backlog = samples - MPU6000_FIFO_MAX_SAMPLES;
+            samples = MPU6000_FIFO_MAX_SAMPLES;
+        }
+
+        /* With no samples, only the register address is sent */
+        txn->txn_len = 1u;
+        txn->tx_buf[0] = 0x74u | 0x80;
+        txn->ext_len = (uint16_t)(samples * MPU6000_FIFO_SAMPLE_LEN);
+        txn->speed = SPIM_SPEED_FAST;
+        mpu6000_fifo_samples = samples;
+        mpu6000_fifo_resetting = false;
+    }
+}
+
+static void mpu6000_fifo_data(void) {
+    int16_t sample[6];
+    uint32_t i, out_idx, sample_t, n = mpu6000_fifo_samples,
+             phase = mpu6000_fifo_phase;
+    bool updated;
+#if CONFIG_MPU6000_DELTAS
+    int32_t d_angle[3], d_velocity[3];
+    uint32_t samples = 0;
+#else
+    int16_t out[6];
+#endif
+
+    if (mpu6000_fifo_resetting) {
+#if CONFIG_MPU6000_DELTAS
+        inertial_delta_reset(&mpu6000_delta);
+#endif
+#if CONFIG_MPU6000_VIBRATION
+        vibration_discard(&mpu6000_vibration);
+#endif
+        return;
+    }
+
+    /*
+    Output is made at the last sample in the burst which completes a
+    decimation period, if any
+    */
+    updated = (phase + n >= MPU6000_DECIMATION);
+    out_idx = n - 1u - (phase + n) % MPU6000_DECIMATION;
+    mpu6000_fifo_phase = (uint8_t)((phase + n) % MPU6000_DECIMATION);
+
+    for (i = 0; i < n; i++) {
+        mpu6000_fifo_sample(i, sample);
+#if CONFIG_MPU6000_VIBRATION
+        /* The accelerometer only updates once per period */
+        if ((phase + i + 1u) % MPU6000_DECIMATION == 0) {
+            vibration_add(&mpu6000_vibration, &sample[0]);
+        }
+#endif
+#if CONFIG_MPU6000_DELTAS
+        inertial_delta_add(&mpu6000_delta, &sample[3], &sample[0]);
+        if (updated && i == out_idx) {
+            samples = inertial_delta_end(&mpu6000_delta, d_angle,
+                                         d_velocity);
+        }
+#else
         /*
-        Start the next read to make sure there are values ready next tick
+        Every period is decimated to keep the filter state consistent, but
+        only the last is logged
         */
-        spim_run_sequence(&mpu6000.spim_cfg, mpu6000.read_sequence, 0);
+        filter_chain_add(&mpu6000_filter, sample);
+        if ((phase + i + 1u) % MPU6000_DECIMATION == 0) {
+            filter_chain_decimate(&mpu6000_filter, out);
+        }
+#endif
+    }
+
+    if (!updated) {
+        return;
+    }
+
+    /*
+    The newest sample when FIFO_COUNT was read is the last read unless some
+    were left queued behind the burst; each earlier one was taken a period
+    before that.
+    */
+    sample_t = mpu6000_fifo_t - (mpu6000_fifo_backlog + n - 1u - out_idx) *
+                                MPU6000_SAMPLE_CYCLES;
+#if CONFIG_MPU6000_DELTAS
+    mpu6000_log_delta(d_angle, d_velocity, samples, sample_t);
+#else
+    /* Allow for the decimator's delay */
+    mpu6000_log(&out[0], &out[3], sample_t -
+                (filter_chain_delay(&mpu6000_filter) *
+                 MPU6000_SAMPLE_CYCLES) / 2u);
+#endif
+}
+
+/* Convert FIFO sample idx of the burst to accel XYZ then gyro XYZ */
+static void mpu6000_fifo_sample(uint32_t idx, int16_t sample[6]) {
+    volatile uint8_t *buf = &mpu6000_fifo_buf[idx * MPU6000_FIFO_SAMPLE_LEN];
+    uint32_t i;
+
+    for (i = 0; i < 6u; i++) {
+        sample[i] = (int16_t)((buf[i * 2u] << 8u) | buf[i * 2u + 1u]);
+    }
+}
+
+#if CONFIG_MPU6000_DELTAS
+/*
+Update the comms module with the deltas over the last samples samples, the
+last of which was taken at sample_t.
+*/
+static void mpu6000_log_delta(const int32_t d_angle[3],
+const int32_t d_velocity[3], uint32_t samples, uint32_t sample_t) {
+    struct fcs_parameter_t param;
+    int32_t da[3], dv[3];
+    int16_t a[3], v[3];
+    uint32_t i;
+
+    /*
+    The thermal compensation is affine in the readings, so it applies to
+    their sums; only the (second-order) coning and sculling corrections are
+    left computed from uncorrected readings.
+    */
+    for (i = 0; i < 3u; i++) {
+        if (mpu6000_calibrated) {
+            dv[i] = calibration_thermal_apply_sum(&mpu6000_comp, i,
+                                                  d_velocity[i], samples);
+            da[i] = calibration_thermal_apply_sum(&mpu6000_comp, i + 3u,
+                                                  d_angle[i], samples);
+        } else {
+            dv[i] = d_velocity[i];
+            da[i] = d_angle[i];
+        }
+    }
+
+    for (i = 0; i < 3u; i++) {
+        v[i] = mpu6000_delta_scale(dv[i], &mpu6000_delta_residual[i]);
+        a[i] = mpu6000_delta_scale(da[i], &mpu6000_delta_residual[i + 3u]);
+    }
+
+    /*
+    Axes are mapped as for mpu6000_log; the mapping is a rotation, so the
+    corrections carry over
+    */
+    fcs_parameter_set_header(&param, FCS_VALUE_SIGNED, 16u, 3u);
+    fcs_parameter_set_type(&param, FCS_PARAMETER_DELTA_VELOCITY_XYZ);
+    fcs_parameter_set_device_id(&param, 0);
+    param.data.i16[0] = swap_i16(v[1]);
+    param.data.i16[1] = swap_i16(v[0]);
+    param.data.i16[2] = swap_i16(-v[2]);
+    (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
+
+    fcs_parameter_set_type(&param, FCS_PARAMETER_DELTA_ANGLE_XYZ);
+    fcs_parameter_set_device_id(&param, 0);
+    param.data.i16[0] = swap_i16(a[1]);
+    param.data.i16[1] = swap_i16(a[0]);
+    param.data.i16[2] = swap_i16(-a[2]);
+    (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
+
+    comms_set_sample_time(FCS_PARAMETER_DELTA_VELOCITY_XYZ, 0, sample_t);
+    comms_set_sample_time(FCS_PARAMETER_DELTA_ANGLE_XYZ, 0, sample_t);
+
+    sensor_status.updated |= UPDATED_ACCEL;
+    sensor_status.accel_count++;
+}
+
+/*
+Convert a delta from raw LSB-samples (with INERTIAL_DELTA_FRAC_BITS
+fractional bits) to LSB-frames, rounding to nearest; the rounding error is
+carried into the next delta via residual, so the sum of the deltas sent
+stays within an LSB of the true integral. Deltas beyond the int16 range are
+saturated, and the excess is dropped rather than carried.
+*/
+static int16_t mpu6000_delta_scale(int32_t delta, int32_t *residual) {
+    const int64_t unit =
+        (int64_t)MPU6000_DECIMATION << INERTIAL_DELTA_FRAC_BITS;
+    int64_t total = (int64_t)delta + *residual, n = total + unit / 2, q;
+
+    q = n >= 0 ? n / unit : -((unit - 1 - n) / unit);
+    if (q > INT16_MAX) {
+        q = INT16_MAX;
+    } else if (q < -INT16_MAX) {
+        q = -INT16_MAX;
+    }
+
+    total -= q * unit;
+    if (total > unit) {
+        total = unit;
+    } else if (total < -unit) {
+        total = -unit;
+    }
+    *residual = (int32_t)total;
+
+    return (int16_t)q;
+}
+#endif
+#endif
+
+#if CONFIG_MPU6000_VIBRATION
+/*
+Queue the results of a vibration analysis for the CPU; they cover the
+VIBRATION_N frames before the analysis started, so no sample time is set.
+*/
+static void mpu6000_log_vibration(const struct vibration_result_t *result) {
+    struct fcs_parameter_t param;
+    uint32_t i;
+
+    fcs_parameter_set_header(&param, FCS_VALUE_UNSIGNED, 16u,
+                             VIBRATION_PEAKS);
+    fcs_parameter_set_type(&param, FCS_PARAMETER_VIBRATION_PEAKS);
+    fcs_parameter_set_device_id(&param, 0);
+    for (i = 0; i < VIBRATION_PEAKS; i++) {
+        param.data.u16[i] = swap_u16(result->peak_dhz[i]);
+    }
+    (void)comms_defer_parameter(&param);
+
+    fcs_parameter_set_header(&param, FCS_VALUE_UNSIGNED, 32u,
+                             VIBRATION_BANDS);
+    fcs_parameter_set_type(&param, FCS_PARAMETER_VIBRATION_BANDS);
+    fcs_parameter_set_device_id(&param, 0);
+    for (i = 0; i < VIBRATION_BANDS; i++) {
+        param.data.u32[i] = swap_u32(result->band_ms[i]);
     }
+    (void)comms_defer_parameter(&param);
 }
+#endif
@@ -22,7 +22,7 @@ SOFTWARE.
 
 
 #include <asf.h>
-#include <avr32/io.h>
+#include "hal.h"
 #include <string.h>
 #include "fcsassert.h"
 #include "comms.h"
@@ -32,34 +32,40 @@ SOFTWARE.
 
 static volatile uint8_t data_buf[4];
 
+static void ms4525_sample(uint16_t arg, uint32_t completed_t);
+
+static struct twim_transaction_t init_sequence[] = {
+    {MS4525_DEVICE_ADDR, 0u, {0x00u}, 0, NULL, 0, 0, {0}},      /* READ_MR */
+    DEVICE_DELAY(1u),
+    {MS4525_DEVICE_ADDR, 0u, {0x00u}, 4u, data_buf, 0, 0, {0}},   /* READ_DF4 */
+    TWIM_TRANSACTION_SENTINEL
+};
+
 static struct twim_transaction_t read_sequence[] = {
-    {MS4525_DEVICE_ADDR, 0u, {0x00u}, 0, NULL, 0},      /* READ_MR */
-    {MS4525_DEVICE_ADDR, 0u, {0x00u}, 4u, data_buf, 0},   /* READ_DF4 */
+    {MS4525_DEVICE_ADDR, 0u, {0x00u}, 0, NULL, 0, 0, {0}},      /* READ_MR */
+    /* Give the measurement a frame to complete */
+    DEVICE_DELAY(1u),
+    {MS4525_DEVICE_ADDR, 0u, {0x00u}, 4u, data_buf, 0, 0, {0}},   /* READ_DF4 */
+    DEVICE_SAMPLE(0),
     TWIM_TRANSACTION_SENTINEL
 };
 
 static struct i2c_device_t ms4525 = {
-    .speed = 150000u,
-    .power_delay = 100u,
-    .init_timeout = 200u,
-    .read_timeout = 15u,
-
-    .sda_pin_id = MS4525_TWI_TWD_PIN,
-    .sda_function = MS4525_TWI_TWD_FUNCTION,
-    .scl_pin_id = MS4525_TWI_TWCK_PIN,
-    .scl_function = MS4525_TWI_TWCK_FUNCTION,
-    .enable_pin_id = MS4525_ENABLE_PIN,
-
-    .twim_cfg = {
-        .twim = MS4525_TWI,
-        .tx_pdca_num = PDCA_CHANNEL_MS4525_TX,
-        .rx_pdca_num = PDCA_CHANNEL_MS4525_RX,
-        .tx_pid = MS4525_TWI_PDCA_PID_TX,
-        .rx_pid = MS4525_TWI_PDCA_PID_RX
+    .dev = {
+        .power_delay = Frames_from_ms(100u),
+        .init_timeout = Frames_from_ms(200u),
+        .read_timeout = Frames_from_ms(15u),
+        .tick_budget_us = 100u,
+        .enable_pin_id = MS4525_ENABLE_PIN,
+
+        .init_sequence = init_sequence,
+        .read_sequence = read_sequence,
+        .sample = ms4525_sample
     },
 
-    .init_sequence = read_sequence,
-    .read_sequence = read_sequence
+    .speed = 400000u, /* datasheet maximum */
+    .bus_timeout = Frames_from_ms(5u),
+    .bus = MS4525_I2C_BUS
 };
 
 void ms4525_init(void) {
@@ -67,46 +73,37 @@ void ms4525_init(void) {
 }
 
 void ms4525_tick(void) {
+    device_tick(&ms4525.dev);
+    comms_set_device_health(FCS_PARAMETER_PITOT, &ms4525.dev.health);
+    comms_set_device_recovery(FCS_PARAMETER_PITOT, ms4525.bus_reset_count,
+                              ms4525.bus_clear_count,
+                              ms4525.dev.health.power_cycle_count);
+}
+
+static void ms4525_sample(uint16_t arg, uint32_t completed_t) {
     uint16_t pressure, temp;
     uint8_t status;
     struct fcs_parameter_t param;
 
-    i2c_device_tick(&ms4525);
-    if (ms4525.state != I2C_READ_SEQUENCE) {
-        return;
-    }
-
-    enum twim_transaction_result_t result;
-    result = twim_run_sequence(&ms4525.twim_cfg, ms4525.read_sequence,
-                               ms4525.sequence_idx);
-    if (result != TWIM_TRANSACTION_EXECUTED) {
-        return;
-    }
-
     /* Convert the result and update the comms module */
-    if (ms4525.sequence_idx == 1u) {
-        ms4525.sequence_idx = 0;
-        ms4525.state_timer = 0;
-
-        status = (data_buf[0] >> 6u) & 0x3u;
-        pressure = ((data_buf[0] << 8u) + data_buf[1]) & 0x3FFFu;
-        temp = ((data_buf[2] << 8u) + data_buf[3]) & 0x3FFFu;
-
-        if (status == 0) {
-            fcs_parameter_set_header(&param, FCS_VALUE_UNSIGNED, 16u, 2u);
-            fcs_parameter_set_type(&param, FCS_PARAMETER_PITOT);
-            fcs_parameter_set_device_id(&param, 0);
-            param.data.u16[0] = swap_u16(pressure);
-            param.data.u16[1] = swap_u16(temp);
-            (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
-
-            sensor_status.updated |= UPDATED_PITOT;
-            sensor_status.pitot_count++;
-        } else {
-            /* Something went wrong */
-            i2c_device_state_transition(&ms4525, I2C_POWERING_DOWN);
-        }
+    status = (data_buf[0] >> 6u) & 0x3u;
+    pressure = ((data_buf[0] << 8u) + data_buf[1]) & 0x3FFFu;
+    temp = ((data_buf[2] << 8u) + data_buf[3]) & 0x3FFFu;
+
+    if (status == 0) {
+        fcs_parameter_set_header(&param, FCS_VALUE_UNSIGNED, 16u, 2u);
+        fcs_parameter_set_type(&param, FCS_PARAMETER_PITOT);
+        fcs_parameter_set_device_id(&param, 0);
+        param.data.u16[0] = swap_u16(pressure);
+        param.data.u16[1] = swap_u16(temp);
+        (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
+
+        comms_set_sample_time(FCS_PARAMETER_PITOT, 0, completed_t);
+
+        sensor_status.updated |= UPDATED_PITOT;
+        sensor_status.pitot_count++;
     } else {
-        ms4525.sequence_idx++;
+        /* Something went wrong */
+        device_power_down(&ms4525.dev);
     }
 }
@@ -22,7 +22,7 @@ SOFTWARE.
 
 
 #include <asf.h>
-#include <avr32/io.h>
+#include "hal.h"
 #include <string.h>
 #include "fcsassert.h"
 #include "comms.h"
@@ -38,54 +38,63 @@ struct ms5611_read_t {
 
 static volatile uint8_t d1_buf[3], d2_buf[3], c1_buf[2], c2_buf[2], c3_buf[2],
                         c4_buf[2], c5_buf[2], c6_buf[2];
-static uint32_t ms5611_last_conv_requested;
+
+/*
+Pressure conversions per temperature conversion -- each takes the 2ms
+conversion delay plus a frame for the ADC read, giving a temperature reading
+about 10 times per second
+*/
+#define MS5611_PRESSURE_PER_TEMP \
+    (Frames_from_ms(100u) / (Frames_from_ms(2u) + 1u))
+
+static void ms5611_sample(uint16_t arg, uint32_t completed_t);
 
 static struct twim_transaction_t init_sequence[] = {
     /* Device address, TX byte count, TX bytes (0-4), RX byte count, RX buffer */
-    {MS5611_DEVICE_ADDR, 1u, {0xA2u}, 2u, c1_buf, 0},  /* READ C1: sens_t1 */
-    {MS5611_DEVICE_ADDR, 1u, {0xA4u}, 2u, c2_buf, 0},  /* READ C2: off_t1 */
-    {MS5611_DEVICE_ADDR, 1u, {0xA6u}, 2u, c3_buf, 0},  /* READ C3: tcs */
-    {MS5611_DEVICE_ADDR, 1u, {0xA8u}, 2u, c4_buf, 0},  /* READ C4: tco */
-    {MS5611_DEVICE_ADDR, 1u, {0xAAu}, 2u, c5_buf, 0},  /* READ C5: t_ref */
-    {MS5611_DEVICE_ADDR, 1u, {0xACu}, 2u, c6_buf, 0},  /* READ C6: tempsens */
+    {MS5611_DEVICE_ADDR, 1u, {0xA2u}, 2u, c1_buf, 0, 0, {0}},  /* READ C1: sens_t1 */
+    {MS5611_DEVICE_ADDR, 1u, {0xA4u}, 2u, c2_buf, 0, 0, {0}},  /* READ C2: off_t1 */
+    {MS5611_DEVICE_ADDR, 1u, {0xA6u}, 2u, c3_buf, 0, 0, {0}},  /* READ C3: tcs */
+    {MS5611_DEVICE_ADDR, 1u, {0xA8u}, 2u, c4_buf, 0, 0, {0}},  /* READ C4: tco */
+    {MS5611_DEVICE_ADDR, 1u, {0xAAu}, 2u, c5_buf, 0, 0, {0}},  /* READ C5: t_ref */
+    {MS5611_DEVICE_ADDR, 1u, {0xACu}, 2u, c6_buf, 0, 0, {0}},  /* READ C6: tempsens */
     TWIM_TRANSACTION_SENTINEL
 };
 
+/*
+The ADC read command returns invalid results if it's sent less than 2ms
+after the conversion command.
+*/
 static struct twim_transaction_t read_sequence[] = {
-    {MS5611_DEVICE_ADDR, 1u, {0x52u}, 0, NULL, 0},     /* CONV D2, OSR=512 */
-    {MS5611_DEVICE_ADDR, 1u, {0x00u}, 3u, d2_buf, 0},  /* ADC READ initiate */
-    {MS5611_DEVICE_ADDR, 1u, {0x42u}, 0, NULL, 0},     /* CONV D1, OSR=512 */
-    {MS5611_DEVICE_ADDR, 1u, {0x00u}, 3u, d1_buf, 0},  /* ADC READ initiate */
+    {MS5611_DEVICE_ADDR, 1u, {0x52u}, 0, NULL, 0, 0, {0}},     /* CONV D2, OSR=512 */
+    DEVICE_DELAY(Frames_from_ms(2u)),
+    {MS5611_DEVICE_ADDR, 1u, {0x00u}, 3u, d2_buf, 0, 0, {0}},  /* ADC READ initiate */
+    {MS5611_DEVICE_ADDR, 1u, {0x42u}, 0, NULL, 0, 0, {0}},     /* CONV D1, OSR=512 */
+    DEVICE_DELAY(Frames_from_ms(2u)),
+    {MS5611_DEVICE_ADDR, 1u, {0x00u}, 3u, d1_buf, 0, 0, {0}},  /* ADC READ initiate */
+    DEVICE_SAMPLE(0),
+    /* Repeat from CONV D1, then start again with temperature */
+    DEVICE_LOOP(3u, MS5611_PRESSURE_PER_TEMP),
     TWIM_TRANSACTION_SENTINEL
 };
 
 static struct i2c_device_t ms5611 = {
-    .speed = 250000u,
-    .power_delay = 100u,
-    .init_timeout = 300u,
-    .read_timeout = 150u,
-
-    .sda_pin_id = MS5611_TWI_TWD_PIN,
-    .sda_function = MS5611_TWI_TWD_FUNCTION,
-    .scl_pin_id = MS5611_TWI_TWCK_PIN,
-    .scl_function = MS5611_TWI_TWCK_FUNCTION,
-    .enable_pin_id = MS5611_ENABLE_PIN,
-
-    .twim_cfg = {
-        .twim = MS5611_TWI,
-        .tx_pdca_num = PDCA_CHANNEL_MS5611_TX,
-        .rx_pdca_num = PDCA_CHANNEL_MS5611_RX,
-        .tx_pid = MS5611_TWI_PDCA_PID_TX,
-        .rx_pid = MS5611_TWI_PDCA_PID_RX
+    .dev = {
+        .power_delay = Frames_from_ms(100u),
+        .init_timeout = Frames_from_ms(300u),
+        .read_timeout = Frames_from_ms(150u),
+        .tick_budget_us = 250u,
+        .enable_pin_id = MS5611_ENABLE_PIN,
+
+        .init_sequence = init_sequence,
+        .read_sequence = read_sequence,
+        .sample = ms5611_sample
     },
 
-    .init_sequence = init_sequence,
-    .read_sequence = read_sequence
+    .speed = 400000u, /* datasheet maximum */
+    .bus_timeout = Frames_from_ms(5u),
+    .bus = MS5611_I2C_BUS
 };
 
-/* The number of packets (ms) between temperature readings */
-#define MS5611_TEMP_PERIOD 100u
-
 static inline struct ms5611_read_t ms5611_actual_pressure_temp(uint32_t d1,
         uint32_t d2) {
     /* Perform 1st-order temperature compensation as described on page 7-8 of
@@ -158,74 +167,42 @@ void ms5611_init(void) {
 }
 
 void ms5611_tick(void) {
+    device_tick(&ms5611.dev);
+    comms_set_device_health(FCS_PARAMETER_PRESSURE_TEMP, &ms5611.dev.health);
+    comms_set_device_recovery(FCS_PARAMETER_PRESSURE_TEMP, ms5611.bus_reset_count,
+                              ms5611.bus_clear_count,
+                              ms5611.dev.health.power_cycle_count);
+}
+
+static void ms5611_sample(uint16_t arg, uint32_t completed_t) {
     struct ms5611_read_t conv_result;
-    enum twim_transaction_result_t result;
     struct fcs_parameter_t param;
 
-    i2c_device_tick(&ms5611);
-
-    if (ms5611.state != I2C_READ_SEQUENCE) {
-        return;
-    } else if ((ms5611.sequence_idx == 1u || ms5611.sequence_idx == 3u) &&
-            ms5611.state_timer - ms5611_last_conv_requested <= 1u) {
-        /* Insert a 2ms delay after each sample is requested, otherwise
-           the ADC read command returns invalid results */
-        return;
-    }
-
-    /*
-    Attempt to read the value for the last requested sample; abort if not
-    ready.
-    */
-    result = twim_run_sequence(&ms5611.twim_cfg, ms5611.read_sequence,
-                               ms5611.sequence_idx);
-    if (result != TWIM_TRANSACTION_EXECUTED) {
-        return;
-    }
-
-    ms5611.sequence_idx++;
-
-    switch (ms5611.sequence_idx) {
-        case 1u:
-        case 3u:
-            ms5611_last_conv_requested = ms5611.state_timer;
-            break;
-        case 4u:
-            /* Convert the result and update the comms module */
-            conv_result = ms5611_actual_pressure_temp(
-                d1_buf[2] + (d1_buf[1] << 8u) + (d1_buf[0] << 16u),
-                d2_buf[2] + (d2_buf[1] << 8u) + (d2_buf[0] << 16u));
-
-            if (!conv_result.err) {
-                fcs_parameter_set_header(&param, FCS_VALUE_UNSIGNED, 16u, 2u);
-                fcs_parameter_set_type(&param, FCS_PARAMETER_PRESSURE_TEMP);
-                fcs_parameter_set_device_id(&param, 0);
-
-				/*
-				Convert temp to range [0, 12500] by adding 4000; convert
-				pressure to range [500, 60000] by dividing by 2.
-				*/
-                param.data.u16[0] = swap_u16(conv_result.p >> 1u);
-                param.data.u16[1] = swap_u16(conv_result.temp + 4000);
-                (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
-
-                sensor_status.updated |= UPDATED_BARO;
-                sensor_status.baro_count++;
-            } else {
-                /* Something went wrong */
-                fcs_assert(false);
-            }
-
-            /*
-            Do pressure conversions as frequently as possible, but a temp
-            conversion no more than 10 times per second -- just loop back to
-            sequence idx #2, which is the D1 convert command.
-            */
-            if (ms5611.state_timer >= MS5611_TEMP_PERIOD) {
-                i2c_device_state_transition(&ms5611, I2C_READ_SEQUENCE);
-            } else {
-                ms5611.sequence_idx = 2u;
-            }
-            break;
+    /* Convert the result and update the comms module */
+    conv_result = ms5611_actual_pressure_temp(
+        d1_buf[2] + (d1_buf[1] << 8u) + (d1_buf[0] << 16u),
+        d2_buf[2] + (d2_buf[1] << 8u) + (d2_buf[0] << 16u));
+
+    if (!conv_result.err) {
+        fcs_parameter_set_header(&param, FCS_VALUE_UNSIGNED, 16u, 2u);
+        fcs_parameter_set_type(&param, FCS_PARAMETER_PRESSURE_TEMP);
+        fcs_parameter_set_device_id(&param, 0);
+
+        /*
+        Convert temp to range [0, 12500] by adding 4000; convert pressure to
+        range [500, 60000] by dividing by 2.
+        */
+        param.data.u16[0] = swap_u16(conv_result.p >> 1u);
+        param.data.u16[1] = swap_u16(conv_result.temp + 4000);
+        (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
+
+        /* Timestamp with completion of the D1 ADC read */
+        comms_set_sample_time(FCS_PARAMETER_PRESSURE_TEMP, 0, completed_t);
+
+        sensor_status.updated |= UPDATED_BARO;
+        sensor_status.baro_count++;
+    } else {
+        /* Something went wrong */
+        fcs_assert(false);
     }
 }
@@ -22,7 +22,7 @@ SOFTWARE.
 
 
 #include <asf.h>
-#include <avr32/io.h>
+#include "hal.h"
 #include <string.h>
 #include "fcsassert.h"
 #include "comms.h"
@@ -33,10 +33,40 @@ SOFTWARE.
 #define PWM_INTERNAL_TO_EXTERNAL_THRESHOLD 20000u
 #define PWM_EXTERNAL_TO_INTERNAL_THRESHOLD 40000u
 #define PWM_TRANSITION_PULSE_COUNT 5u
-#define PWM_TRIM_MEASUREMENT_TICKS 5000u
+#define PWM_TRIM_MEASUREMENT_TICKS Frames_from_ms(5000u)
 
-#define PWM_FAILSAFE_INTERNAL_TICKS 750u
-#define PWM_FAILSAFE_EXTERNAL_TICKS 1500u
+#define PWM_FAILSAFE_INTERNAL_TICKS Frames_from_ms(750u)
+#define PWM_FAILSAFE_EXTERNAL_TICKS Frames_from_ms(1500u)
+
+/*
+PWM pulse timing, in ns. The 16-bit PWM values cover PWM_PULSE_RANGE_NS of
+pulse width, starting at PWM_OUT_MIN_NS for outputs and PWM_IN_MIN_NS for
+inputs. These reproduce the cycle counts used at 52MHz exactly.
+*/
+#define PWM_PERIOD_NS 20164904u /* ~49.6Hz */
+#define PWM_PULSE_RANGE_NS 1260289u
+#define PWM_OUT_MIN_NS 821712u
+#define PWM_IN_MIN_NS 823635u
+#define PWM_IN_MAX_NS 2082000u
+
+/*
+The channel counters are 20 bits, so above ~52MHz the output channels have
+to run from MCK / 2.
+*/
+#define PWM_OUT_CPRE (Cycles_from_ns(PWM_PERIOD_NS) > 0xfffffu ? 1u : 0)
+#define Pwm_out_cycles_from_ns(ns) (Cycles_from_ns(ns) >> PWM_OUT_CPRE)
+#define PWM_OUT_PERIOD Pwm_out_cycles_from_ns(PWM_PERIOD_NS)
+#define PWM_OUT_MIN Pwm_out_cycles_from_ns(PWM_OUT_MIN_NS)
+
+/* PWM value <-> cycle scale factors, with 16 fractional bits */
+#define PWM_OUT_SCALE \
+    ((Pwm_out_cycles_from_ns(PWM_PULSE_RANGE_NS) << 16u) / 65535u)
+#define PWM_IN_SCALE ((65535u << 16u) / Cycles_from_ns(PWM_PULSE_RANGE_NS))
+#define PWM_IN_MIN Cycles_from_ns(PWM_IN_MIN_NS)
+#define PWM_IN_MAX Cycles_from_ns(PWM_IN_MAX_NS)
+
+#define Pwm_out_cycles(value) \
+    (PWM_OUT_MIN + (uint32_t)(((uint64_t)(value) * PWM_OUT_SCALE) >> 16u))
 
 static uint32_t pwm_out_values[PWM_NUM_OUTPUTS];
 static uint16_t pwm_trim_offsets[PWM_NUM_OUTPUTS];
@@ -61,7 +91,7 @@ static void pwm_input_interrupt_handler(void) {
     uint32_t cycle_count, i, delta, ifr;
 
     ifr = AVR32_GPIO.port[port_idx].ifr;
-    cycle_count = Get_system_register(AVR32_COUNT);
+    cycle_count = Hal_count();
 
     /*
     Check PWM input pins; if there's a state change, reset the current count.
@@ -78,14 +108,15 @@ static void pwm_input_interrupt_handler(void) {
 
                 /*
                 Now we have number of cycles the input was high for; we
-                need a mapping from 0.85-2.15ms to the range [0, 65535].
+                need a mapping from 0.82-2.08ms to the range [0, 65535].
                 */
-                if (delta <= 42829u) {
+                if (delta <= PWM_IN_MIN) {
                     pwm_input_next[i] = 0;
-                } else if (delta >= 108264u) {
+                } else if (delta >= PWM_IN_MAX) {
                     pwm_input_next[i] = 65535u;
                 } else {
-                    pwm_input_next[i] = (delta - 42829u) & 0xffffu;
+                    pwm_input_next[i] = (uint32_t)(((uint64_t)(delta -
+                        PWM_IN_MIN) * PWM_IN_SCALE) >> 16u) & 0xffffu;
                 }
             }
 
@@ -121,7 +152,6 @@ void pwm_init(void) {
 	gpio_configure_pin(pwm_input_pins[3], GPIO_DIR_INPUT | GPIO_PULL_DOWN);
 
     cpu_irq_disable();
-    INTC_init_interrupts();
     INTC_register_interrupt(&pwm_input_interrupt_handler,
                             AVR32_GPIO_IRQ_0 + pwm_input_pins[0] / 8,
                             AVR32_INTC_INT0);
@@ -142,8 +172,8 @@ void pwm_init(void) {
 
     /* Set PWM mode register. */
     AVR32_PWM.clk =
-        (1u << AVR32_PWM_DIVA_OFFSET) | /* run CLKA at full CPU clock speed
-                                           (52MHz) */
+        (1u << AVR32_PWM_DIVA_OFFSET) | /* run CLKA at full CPU clock
+                                           speed */
         (0 << AVR32_PWM_DIVB_OFFSET) |  /* disable CLKB */
         (0 << AVR32_PWM_PREA_OFFSET) |  /* no pre-division */
         (0 << AVR32_PWM_PREB_OFFSET) |
@@ -163,12 +193,13 @@ void pwm_init(void) {
     AVR32_PWM.scm |= (0xfu << AVR32_PWM_SCM_SYNC0_OFFSET);
 
     for (uint8_t i = 0; i < PWM_NUM_OUTPUTS; i++) {
-        /* Set polarity so cycle starts high. */
-        AVR32_PWM.channel[i].cmr = AVR32_PWM_CPOL_MASK;
-        /* 1.5ms duty cycle */
-        AVR32_PWM.channel[i].cdtyupd = 75497u;
-        /* 48Hz period */
-        AVR32_PWM.channel[i].cprdupd = 1048575u;
+        /* Set polarity so cycle starts high, and the channel clock. */
+        AVR32_PWM.channel[i].cmr = AVR32_PWM_CPOL_MASK |
+                                   (PWM_OUT_CPRE << AVR32_PWM_CPRE_OFFSET);
+        /* 1.45ms duty cycle */
+        AVR32_PWM.channel[i].cdtyupd = Pwm_out_cycles(32768u);
+        /* ~49.6Hz period */
+        AVR32_PWM.channel[i].cprdupd = PWM_OUT_PERIOD;
     }
 
     /* Write the channel value update */
@@ -296,15 +327,15 @@ void pwm_set_values(uint16_t pwms[PWM_NUM_OUTPUTS]) {
     if (!AVR32_PWM.SCUC.updulock) {
         for (i = 0; i < PWM_NUM_OUTPUTS; i++) {
             /*
-            Channel period is 1048576 cycles long, at 48Hz; PWM pulse width is
-            1-2ms. A PWM value in the range 42729-108264 means the pulse range
-            is 0.85-2.15ms.
+            Channel period is PWM_PERIOD_NS (~49.6Hz); PWM pulse width is
+            1-2ms. The PWM value range [0, 65535] maps to pulse widths of
+            0.82-2.08ms.
             */
-            pwm_val = (uint32_t)pwms[i] + 42729u;
+            pwm_val = Pwm_out_cycles(pwms[i]);
             if (pwm_val != pwm_out_values[i]) {
                 /* Change PWM duty cycle for the current channel (20-bit) */
                 AVR32_PWM.channel[i].cdtyupd = pwm_val & 0x000fffffu;
-                AVR32_PWM.channel[i].cprdupd = 1048575u;
+                AVR32_PWM.channel[i].cprdupd = PWM_OUT_PERIOD;
 
                 pwm_out_values[i] = pwm_val;
                 updated = true;
@@ -334,16 +365,11 @@ void pwm_terminate_flight(void) {
     Infinite loop to lock out any possibility of recovery -- reset the WDT
     each time as well otherwise the system will restart itself.
     */
-    static uint16_t pwm_values[PWM_NUM_OUTPUTS] = {0, 25000u, 25000u, 0};
-
     LED_ON(LED3_GPIO);
 
     irqflags_t flags = cpu_irq_save();
     /* Take control of the PWM */
     for (;;) {
-		//pwm_enable();
-        //pwm_set_values(pwm_values);
-
         pwm_disable();
     }
     cpu_irq_restore(flags);
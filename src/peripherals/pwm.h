@@ -28,7 +28,7 @@ SOFTWARE.
 
 void pwm_init(void);
 void pwm_tick(void);
-void pwm_set_values(uint16_t pwms[]);
+void pwm_set_values(uint16_t pwms[PWM_NUM_OUTPUTS]);
 void pwm_enable(void);
 void pwm_disable(void);
 
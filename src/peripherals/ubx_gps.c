@@ -21,10 +21,11 @@ SOFTWARE.
 */
 
 #include <asf.h>
-#include <avr32/io.h>
+#include "hal.h"
 #include <string.h>
 #include "fcsassert.h"
 #include "comms.h"
+#include "drivers/pdcachannel.h"
 #include "ubx_gps.h"
 #include "plog/parameter.h"
 
@@ -117,8 +118,8 @@ checksum u16
 #define UBX_MSG_OVERHEAD (UBX_PREFIX_LEN + UBX_SUFFIX_LEN)
 
 /* Timeout values */
-#define UBX_POWER_DELAY 500u
-#define UBX_TIMEOUT 1500u
+#define UBX_POWER_DELAY Frames_from_ms(500u)
+#define UBX_TIMEOUT Frames_from_ms(1500u)
 
 /* GPS class and message IDs */
 #define UBX_MSG_NAV_PVT "\x01\x07"
@@ -133,6 +134,7 @@ static enum ubx_state_t ubx_state = UBX_POWERING_DOWN;
 static uint32_t ubx_state_timer; /* tracks time in current state */
 
 static volatile uint8_t ubx_inbuf[UBX_INBUF_SIZE];
+static uint8_t ubx_inbuf_pdca_num;
 static uint8_t ubx_msgbuf[UBX_MSGBUF_SIZE];
 
 static enum ubx_msg_parser_state_t ubx_inbuf_parse_state =
@@ -173,6 +175,9 @@ void ubx_init(void) {
     usart_options.channelmode = USART_NORMAL_CHMODE;
     result = usart_init_rs232(GPS_USART, &usart_options, CONFIG_MAIN_HZ);
     fcs_assert(result == USART_SUCCESS);
+
+    ubx_inbuf_pdca_num =
+        pdca_channel_alloc(GPS_USART_PDCA_PID_RX, AVR32_PDCA_BYTE);
 }
 
 /*
@@ -187,7 +192,7 @@ void ubx_tick(void) {
 
     /* Parse messages appearing in the input buffer */
     volatile avr32_pdca_channel_t *pdca_channel =
-        &AVR32_PDCA.channel[PDCA_CHANNEL_GPS_RX];
+        Hal_pdca_channel(ubx_inbuf_pdca_num);
 
     /* Reset message done flag */
     if (ubx_inbuf_parse_state == UBX_PARSER_DONE_MSG) {
@@ -219,17 +224,7 @@ void ubx_tick(void) {
         ubx_inbuf_idx = 0;
         ubx_inbuf_parse_state = UBX_PARSER_NO_MSG;
 
-        pdca_channel->cr = AVR32_PDCA_TDIS_MASK;
-        pdca_channel->idr = 0xFFFFFFFFu;
-        pdca_channel->mar = (uint32_t)ubx_inbuf;
-        pdca_channel->tcr = UBX_INBUF_SIZE;
-        pdca_channel->marr = (uint32_t)ubx_inbuf;
-        pdca_channel->tcrr = UBX_INBUF_SIZE;
-        pdca_channel->psr = GPS_USART_PDCA_PID_RX;
-        pdca_channel->mr = (AVR32_PDCA_BYTE << AVR32_PDCA_SIZE_OFFSET)
-            | (1 << AVR32_PDCA_RING_OFFSET);
-        pdca_channel->cr = AVR32_PDCA_ECLR_MASK | AVR32_PDCA_TEN_MASK;
-        pdca_channel->isr;
+        pdca_channel_start_ring(ubx_inbuf_pdca_num, ubx_inbuf, UBX_INBUF_SIZE);
     }
 
     for (; bytes_avail && ubx_inbuf_parse_state != UBX_PARSER_DONE_MSG;
@@ -345,7 +340,13 @@ void ubx_tick(void) {
 static void ubx_process_latest_msg(void) {
     struct fcs_parameter_t param;
     struct ubx_nav_pvt_t msg;
-    uint32_t pos_err;
+    uint32_t pos_err, parse_t;
+
+    /*
+    The GPS is read via the USART PDCA, so the best available timestamp is
+    the time at which the message was parsed.
+    */
+    parse_t = Hal_count();
 
     /*
     UBX_NAVIGATING holds until more than UBX_TIMEOUT ticks elapse between
@@ -398,6 +399,11 @@ static void ubx_process_latest_msg(void) {
             param.data.i16[2] = swap_i16(clamp_s16(swap_i32(msg.velD)));
             (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
 
+            comms_set_sample_time(FCS_PARAMETER_GPS_POSITION_LLA, 0,
+                                  parse_t);
+            comms_set_sample_time(FCS_PARAMETER_GPS_VELOCITY_NED, 0,
+                                  parse_t);
+
             sensor_status.updated |= UPDATED_GPS;
             sensor_status.gps_count++;
         }
@@ -34,7 +34,7 @@ SOFTWARE.
 void fcs_log_init(struct fcs_log_t *plog, enum fcs_log_type_t type,
 uint16_t frame_id) {
     fcs_assert(plog);
-    fcs_assert(((uint32_t)plog & 0x3) == 0);
+    fcs_assert(((uintptr_t)plog & 0x3) == 0);
     fcs_assert(type > FCS_LOG_TYPE_INVALID);
     fcs_assert(type < FCS_LOG_TYPE_LAST);
 
@@ -59,7 +59,7 @@ struct fcs_log_t *plog) {
     fcs_assert(out_buf);
     fcs_assert(out_buf_length);
     fcs_assert(plog);
-    fcs_assert(((uint32_t)plog & 0x3) == 0);
+    fcs_assert(((uintptr_t)plog & 0x3) == 0);
     fcs_assert(FCS_LOG_MIN_LENGTH <= plog->length &&
                plog->length <= FCS_LOG_MAX_LENGTH);
     fcs_assert(plog->data[0] > (uint8_t)FCS_LOG_TYPE_INVALID);
@@ -98,7 +98,7 @@ struct fcs_log_t *plog) {
 bool fcs_log_deserialize(struct fcs_log_t *plog, const uint8_t *in_buf,
 size_t in_buf_len) {
     fcs_assert(plog);
-    fcs_assert(((uint32_t)plog & 0x3) == 0);
+    fcs_assert(((uintptr_t)plog & 0x3) == 0);
     fcs_assert(in_buf);
     fcs_assert(in_buf_len);
 
@@ -90,6 +90,55 @@ enum fcs_parameter_type_t {
     FCS_PARAMETER_CONTROL_STATUS,
     /* General-purpose */
     FCS_PARAMETER_KEY_VALUE,
+    /*
+    Sample timing: value 0 is the type of the parameter with the same device
+    ID that was sampled, value 1 is the offset in microseconds of the sample
+    from the start of the frame in which the packet was generated.
+    */
+    FCS_PARAMETER_SAMPLE_TIME,
+    /* IO/CPU time synchronization -- see timesync.h */
+    FCS_PARAMETER_IO_TIME,
+    FCS_PARAMETER_TIME_SYNC,
+    /*
+    Device fault statistics: the device ID is the type of the device's
+    measurement parameter, and the values are the error, timeout and power
+    cycle counts and the longest gap between reads in ms -- see
+    drivers/devicehealth.h
+    */
+    FCS_PARAMETER_DEVICE_HEALTH,
+    /*
+    Inertial deltas over a sampling interval (see inertial.h): the XYZ
+    delta-angle (or delta-velocity), including the coning (or rotation and
+    sculling) correction, in raw gyro (or accelerometer) LSB times frame
+    periods -- a one-frame delta has the scale of a single reading. Rounding
+    errors are carried into the next interval. The sample time is that of
+    the interval's last reading.
+    */
+    FCS_PARAMETER_DELTA_ANGLE_XYZ,
+    FCS_PARAMETER_DELTA_VELOCITY_XYZ,
+    /*
+    IMU die temperature, averaged over a sensor-specific interval: value 0
+    is in the sensor's raw units, value 1 is 1 if the readings are being
+    thermally compensated (see calibration.h), 0 if not
+    */
+    FCS_PARAMETER_IMU_TEMP,
+    /*
+    Frequencies of the largest peaks in the accelerometer spectrum, largest
+    first, in units of 0.1Hz (0 for none); see vibration.h
+    */
+    FCS_PARAMETER_VIBRATION_PEAKS,
+    /*
+    Mean-square acceleration in each of a sensor-specific set of frequency
+    bands, summed over the axes, in the sensor's raw units squared
+    */
+    FCS_PARAMETER_VIBRATION_BANDS,
+    /*
+    Device fault recovery statistics: the device ID is as for
+    FCS_PARAMETER_DEVICE_HEALTH, and the values are the number of bus resets,
+    bus clears and power cycles the device's recovery has taken -- see
+    drivers/i2cdevice.h
+    */
+    FCS_PARAMETER_DEVICE_RECOVERY,
     /* Sentinel */
     FCS_PARAMETER_LAST
 };
@@ -0,0 +1,259 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <asf.h>
+#include "hal.h"
+#include "fcsassert.h"
+#include "main.h"
+#include "comms.h"
+#include "timesync.h"
+#include "plog/parameter.h"
+
+/* Receiver time-out after the final byte of a CPU packet, in bit periods */
+#define TIMESYNC_RX_TIMEOUT_BITS 20u
+
+/* Number of recent IO packet transmit times kept for matching requests */
+#define TIMESYNC_TX_HISTORY_LEN 8u
+
+/*
+Exchanges with a round-trip delay more than this many microseconds above the
+minimum recently observed are discarded.
+*/
+#define TIMESYNC_MAX_EXCESS_DELAY_US 10
+
+/* Offset errors larger than this (us) reset the estimate */
+#define TIMESYNC_MAX_OFFSET_ERROR_US 1000
+
+/* Maximum time between accepted exchanges before the estimate is reset */
+#define TIMESYNC_MAX_INTERVAL_US 10000000u
+
+/* Drift is in units of 2^-32 us/us; limit to +/-500ppm */
+#define TIMESYNC_MAX_DRIFT 2147484
+
+/* Loop gains, as right-shifts applied to the offset error */
+#define TIMESYNC_OFFSET_GAIN_SHIFT 2u
+#define TIMESYNC_DRIFT_GAIN_SHIFT 4u
+
+#define TIMESYNC_FRAME_US (1000000u / CONFIG_FRAME_HZ)
+
+/* Time between the start and the end of an IO packet transmission */
+#define TIMESYNC_TX_PACKET_US \
+    ((CPU_PACKET_LEN * 10u * 1000000u) / CPU_USART_ACTUAL_BAUD)
+
+/* Time between the end of a CPU packet and the receiver time-out */
+#define TIMESYNC_RX_TIMEOUT_CYCLES \
+    ((TIMESYNC_RX_TIMEOUT_BITS * CONFIG_MAIN_HZ) / CPU_USART_ACTUAL_BAUD)
+
+struct timesync_tx_t {
+    uint32_t frame_us; /* IO_TIME value 0 of the packet */
+    uint32_t tx_end_us; /* T1 */
+};
+
+static struct timesync_tx_t timesync_tx_history[TIMESYNC_TX_HISTORY_LEN];
+static uint32_t timesync_tx_idx;
+
+/* IO time at the start of the current frame */
+static uint32_t timesync_frame_us;
+
+/* COUNT value at which the last CPU packet finished arriving */
+static volatile uint32_t timesync_rx_end_t;
+
+static uint32_t timesync_last_request_us;
+static int32_t timesync_min_delay_us;
+
+/*
+Current estimate: at IO time timesync_ref_us, CPU time is IO time plus
+timesync_offset_us + timesync_offset_frac / 65536; the offset changes by
+timesync_drift / 2^32 us for each IO us.
+*/
+static bool timesync_locked;
+static uint32_t timesync_ref_us;
+static uint32_t timesync_offset_us;
+static uint32_t timesync_offset_frac;
+static int32_t timesync_drift;
+
+static void timesync_adjust_offset(int64_t adj);
+static uint32_t timesync_cpu_time(uint32_t io_us);
+static void timesync_process_request(uint32_t frame_us, uint32_t t2,
+uint32_t t3);
+
+__attribute__((__interrupt__))
+static void timesync_rx_interrupt_handler(void) {
+    uint32_t t = Hal_count();
+
+    if (CPU_USART->csr & AVR32_USART_CSR_TIMEOUT_MASK) {
+        timesync_rx_end_t = t - TIMESYNC_RX_TIMEOUT_CYCLES;
+
+        /* Re-arm the time-out; it won't start again until the next byte */
+        Hal_write(CPU_USART->cr, AVR32_USART_CR_STTTO_MASK);
+    }
+}
+
+static void timesync_adjust_offset(int64_t adj) {
+    /* adj is in units of 1/65536 us */
+    int64_t frac = (int64_t)timesync_offset_frac + adj;
+
+    timesync_offset_us += (uint32_t)(int32_t)(frac >> 16);
+    timesync_offset_frac = (uint32_t)(frac & 0xFFFF);
+}
+
+static uint32_t timesync_cpu_time(uint32_t io_us) {
+    int32_t dt = (int32_t)(io_us - timesync_ref_us);
+    int64_t frac = (int64_t)timesync_offset_frac +
+                   (((int64_t)timesync_drift * dt) >> 16) + 0x8000;
+
+    return io_us + timesync_offset_us + (uint32_t)(int32_t)(frac >> 16);
+}
+
+static void timesync_process_request(uint32_t frame_us, uint32_t t2,
+uint32_t t3) {
+    uint32_t i, t1, t4, offset_us;
+    int32_t delay_us, dt;
+    int64_t err;
+
+    /* Find the transmit time of the packet the CPU is responding to */
+    for (i = 0; i < TIMESYNC_TX_HISTORY_LEN; i++) {
+        if (timesync_tx_history[i].frame_us == frame_us) {
+            break;
+        }
+    }
+    if (i == TIMESYNC_TX_HISTORY_LEN) {
+        return;
+    }
+
+    t1 = timesync_tx_history[i].tx_end_us;
+    t4 = timesync_frame_us + (uint32_t)Frame_offset_us(timesync_rx_end_t);
+
+    /* NTP offset and round-trip delay */
+    offset_us = (t2 - t1) +
+                (uint32_t)((int32_t)((t3 - t4) - (t2 - t1)) / 2);
+    delay_us = (int32_t)((t4 - t1) - (t3 - t2));
+
+    /*
+    Discard exchanges which were delayed on either side, or where T4 was
+    not captured for this packet (in which case the delay is wildly off).
+    The minimum delay slowly increases so a persistent change in delay is
+    eventually accepted.
+    */
+    if (delay_us < timesync_min_delay_us) {
+        timesync_min_delay_us = delay_us;
+    } else {
+        timesync_min_delay_us++;
+    }
+    if (delay_us > timesync_min_delay_us + TIMESYNC_MAX_EXCESS_DELAY_US) {
+        return;
+    }
+
+    dt = (int32_t)(t1 - timesync_ref_us);
+    if (timesync_locked &&
+            (dt <= 0 || (uint32_t)dt > TIMESYNC_MAX_INTERVAL_US)) {
+        timesync_locked = false;
+    }
+
+    if (timesync_locked) {
+        /* Bring the estimate forward to T1 */
+        timesync_adjust_offset(((int64_t)timesync_drift * dt) >> 16);
+        timesync_ref_us = t1;
+
+        err = (int64_t)(int32_t)(offset_us - timesync_offset_us) * 65536 -
+              (int64_t)timesync_offset_frac;
+        if (err > (int64_t)TIMESYNC_MAX_OFFSET_ERROR_US * 65536 ||
+                err < -(int64_t)TIMESYNC_MAX_OFFSET_ERROR_US * 65536) {
+            timesync_locked = false;
+        } else {
+            timesync_adjust_offset(err >> TIMESYNC_OFFSET_GAIN_SHIFT);
+            timesync_drift += (int32_t)(((err * 65536) / dt) >>
+                                        TIMESYNC_DRIFT_GAIN_SHIFT);
+
+            if (timesync_drift > TIMESYNC_MAX_DRIFT) {
+                timesync_drift = TIMESYNC_MAX_DRIFT;
+            } else if (timesync_drift < -TIMESYNC_MAX_DRIFT) {
+                timesync_drift = -TIMESYNC_MAX_DRIFT;
+            }
+        }
+    }
+
+    if (!timesync_locked) {
+        timesync_ref_us = t1;
+        timesync_offset_us = offset_us;
+        timesync_offset_frac = 0;
+        timesync_drift = 0;
+        timesync_locked = true;
+    }
+}
+
+void timesync_init(void) {
+    uint32_t i;
+
+    for (i = 0; i < TIMESYNC_TX_HISTORY_LEN; i++) {
+        /* Not a multiple of the frame period, so never matches */
+        timesync_tx_history[i].frame_us = 0xFFFFFFFFu;
+    }
+    timesync_min_delay_us = INT32_MAX - TIMESYNC_MAX_EXCESS_DELAY_US;
+    timesync_locked = false;
+
+    cpu_irq_disable();
+    INTC_register_interrupt(&timesync_rx_interrupt_handler, CPU_USART_IRQ,
+                            AVR32_INTC_INT1);
+    CPU_USART->rtor = TIMESYNC_RX_TIMEOUT_BITS;
+    Hal_write(CPU_USART->cr, AVR32_USART_CR_STTTO_MASK);
+    Hal_write(CPU_USART->ier, AVR32_USART_IER_TIMEOUT_MASK);
+    cpu_irq_enable();
+}
+
+void timesync_tick(void) {
+    struct fcs_parameter_t param;
+    uint32_t request_us;
+
+    timesync_frame_us += TIMESYNC_FRAME_US;
+
+    if (fcs_parameter_find_by_type_and_device(
+            &cpu_conn.in_log, FCS_PARAMETER_TIME_SYNC, 0, &param) &&
+            fcs_parameter_get_num_values(&param) == 3u &&
+            fcs_parameter_get_precision_bits(&param) == 32u) {
+        /* The same request stays in the input log until replaced */
+        request_us = swap_u32(param.data.u32[0]);
+        if (request_us != timesync_last_request_us) {
+            timesync_last_request_us = request_us;
+            timesync_process_request(request_us, swap_u32(param.data.u32[1]),
+                                     swap_u32(param.data.u32[2]));
+        }
+    }
+
+    fcs_parameter_set_header(&param, FCS_VALUE_UNSIGNED, 32u,
+                             timesync_locked ? 2u : 1u);
+    fcs_parameter_set_type(&param, FCS_PARAMETER_IO_TIME);
+    fcs_parameter_set_device_id(&param, 0);
+    param.data.u32[0] = swap_u32(timesync_frame_us);
+    param.data.u32[1] = swap_u32(timesync_cpu_time(timesync_frame_us));
+    (void)fcs_log_add_parameter(&cpu_conn.out_log, &param);
+}
+
+void timesync_set_tx_start(uint32_t t) {
+    struct timesync_tx_t *tx;
+
+    tx = &timesync_tx_history[timesync_tx_idx % TIMESYNC_TX_HISTORY_LEN];
+    tx->frame_us = timesync_frame_us;
+    tx->tx_end_us = timesync_frame_us + (uint32_t)Frame_offset_us(t) +
+                    TIMESYNC_TX_PACKET_US;
+    timesync_tx_idx++;
+}
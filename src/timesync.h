@@ -0,0 +1,69 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _TIMESYNC_H_
+#define _TIMESYNC_H_
+
+/*
+Two-way time synchronization between the IO board and the CPU, following
+the NTP on-wire protocol. All times are 32-bit microsecond counters, and all
+arithmetic on them is modulo 2^32.
+
+Every IO packet includes a FCS_PARAMETER_IO_TIME parameter; value 0 is the
+IO time at the start of the frame in which the packet was generated (the
+reference for FCS_PARAMETER_SAMPLE_TIME offsets). Once synchronized, value 1
+is the IO board's estimate of the CPU time at that same instant.
+
+The packet's final byte is sent at T1, and received by the CPU at T2. To
+request a sync update, the CPU includes a FCS_PARAMETER_TIME_SYNC parameter
+in one of its packets, containing three unsigned 32-bit values:
+- the IO_TIME value 0 of the IO packet received at T2;
+- T2 in CPU time;
+- T3, the CPU time at which the final byte of the packet containing the
+  TIME_SYNC parameter is sent.
+
+The IO board records the time T4 at which that final byte is received (via
+the CPU USART receiver time-out interrupt), and updates its offset and drift
+estimates from the four timestamps. Measuring all times at the end of the
+packet means the serialization delay is the same in both directions.
+*/
+
+/*
+Enable the CPU USART receiver time-out interrupt; must be called after the
+CPU USART has been initialized.
+*/
+void timesync_init(void);
+
+/*
+Advance the IO clock by one frame, process any TIME_SYNC parameter in the
+CPU input log and add the FCS_PARAMETER_IO_TIME parameter to the CPU output
+log. Must be called once per frame, before the output log is serialized.
+*/
+void timesync_tick(void);
+
+/*
+Record the COUNT value at which transmission of the current frame's CPU
+packet started.
+*/
+void timesync_set_tx_start(uint32_t t);
+
+#endif
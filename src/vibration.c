@@ -0,0 +1,331 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <asf.h>
+#include <math.h>
+#include <string.h>
+#include "fcsassert.h"
+#include "vibration.h"
+
+#define VIBRATION_PI 3.14159265f
+#define VIBRATION_COS_BITS 15u
+/*
+Windowed samples (input times the Q15 window) are shifted down by
+VIBRATION_WINDOW_SHIFT, leaving VIBRATION_INPUT_BITS fractional bits. Each
+FFT stage halves its outputs, so magnitudes never exceed those of the
+inputs: below 2^(16 + VIBRATION_INPUT_BITS) * sqrt(2).
+*/
+#define VIBRATION_WINDOW_SHIFT 4u
+#define VIBRATION_INPUT_BITS (VIBRATION_COS_BITS - VIBRATION_WINDOW_SHIFT)
+#define VIBRATION_POWER_BITS 8u
+
+/*
+cos(2 pi k / N) in Q15 -- the Hann window is (1 - cos) / 2, and the sines of
+the twiddle factors are the cosines a quarter of a turn earlier
+*/
+static int16_t vibration_cos[VIBRATION_N];
+
+inline static uint32_t vibration_bitrev(uint32_t i);
+inline static int32_t vibration_windowed(int16_t value, int16_t mean,
+int32_t w);
+inline static uint64_t vibration_mag2(int32_t re, int32_t im);
+inline static void vibration_window(struct vibration_t *v, uint32_t n);
+inline static void vibration_butterfly(struct vibration_t *v, uint32_t b);
+inline static void vibration_power(struct vibration_t *v, uint32_t k);
+static void vibration_result(const struct vibration_t *v,
+struct vibration_result_t *result);
+
+inline static uint32_t vibration_bitrev(uint32_t i) {
+    uint32_t b, r = 0;
+
+    for (b = 0; b < VIBRATION_LOG2_N; b++) {
+        r = (r << 1u) | ((i >> b) & 1u);
+    }
+
+    return r;
+}
+
+inline static int32_t vibration_windowed(int16_t value, int16_t mean,
+int32_t w) {
+    /* |value - mean| < 2^16 and w < 2^15, so the product fits */
+    return ((int32_t)value - mean) * w >> VIBRATION_WINDOW_SHIFT;
+}
+
+inline static uint64_t vibration_mag2(int32_t re, int32_t im) {
+    return (uint64_t)((int64_t)re * re) + (uint64_t)((int64_t)im * im);
+}
+
+inline static void vibration_window(struct vibration_t *v, uint32_t n) {
+    const int16_t *sample = v->capture[v->capture_buf ^ 1u][n];
+    int32_t w = (32768 - vibration_cos[n]) >> 1;
+    uint32_t dest = vibration_bitrev(n);
+
+    /* Store in bit-reversed order, ready for the decimation-in-time FFT */
+    if (v->pass == 0) {
+        v->re[dest] = vibration_windowed(sample[0], v->mean[0], w);
+        v->im[dest] = vibration_windowed(sample[1], v->mean[1], w);
+    } else {
+        v->re[dest] = vibration_windowed(sample[2], v->mean[2], w);
+        v->im[dest] = 0;
+    }
+}
+
+inline static void vibration_butterfly(struct vibration_t *v, uint32_t b) {
+    uint32_t s = v->stage, half = 1u << s, j = b & (half - 1u),
+             i0 = ((b >> s) << (s + 1u)) + j, i1 = i0 + half,
+             k = j << (VIBRATION_LOG2_N - 1u - s);
+    int32_t c = vibration_cos[k],
+            sn = vibration_cos[(k - VIBRATION_N / 4u) & (VIBRATION_N - 1u)],
+            t_re, t_im, x_re = v->re[i0], x_im = v->im[i0];
+
+    /* t = x[i1] * exp(-2 pi i k / N) */
+    t_re = (int32_t)(((int64_t)v->re[i1] * c + (int64_t)v->im[i1] * sn) >>
+                     VIBRATION_COS_BITS);
+    t_im = (int32_t)(((int64_t)v->im[i1] * c - (int64_t)v->re[i1] * sn) >>
+                     VIBRATION_COS_BITS);
+
+    v->re[i0] = (x_re + t_re) >> 1;
+    v->im[i0] = (x_im + t_im) >> 1;
+    v->re[i1] = (x_re - t_re) >> 1;
+    v->im[i1] = (x_im - t_im) >> 1;
+}
+
+inline static void vibration_power(struct vibration_t *v, uint32_t k) {
+    /*
+    For the X/Y pass, |X_k|^2 + |Y_k|^2 = (|Z_k|^2 + |Z_(N-k)|^2) / 2; for
+    the Z pass |Z_k| = |Z_(N-k)|. Either way, doubling for the negative
+    frequencies gives |Z_k|^2 + |Z_(N-k)|^2.
+    */
+    uint64_t p = vibration_mag2(v->re[k], v->im[k]) +
+                 vibration_mag2(v->re[VIBRATION_N - k],
+                                v->im[VIBRATION_N - k]);
+
+    p >>= 2u * VIBRATION_INPUT_BITS - VIBRATION_POWER_BITS;
+    if (v->pass == 0) {
+        v->power[k] = p;
+    } else {
+        v->power[k] += p;
+    }
+}
+
+static void vibration_result(const struct vibration_t *v,
+struct vibration_result_t *result) {
+    uint32_t b, k, i, bits, peak_k[VIBRATION_PEAKS];
+    uint64_t sum, total, noise, threshold, peak_p[VIBRATION_PEAKS];
+    uint8_t hist[65];
+    int64_t pm, p0, pp, delta;
+
+    memset(result, 0, sizeof(*result));
+
+    /*
+    Band mean-squares, corrected for the Hann window's power gain of 3/8
+    */
+    for (b = 0; b < VIBRATION_BANDS; b++) {
+        sum = 0;
+        for (k = v->band_bin[b]; k < v->band_bin[b + 1u]; k++) {
+            sum += v->power[k];
+        }
+
+        sum = (sum * 8u / 3u) >> VIBRATION_POWER_BITS;
+        result->band_ms[b] = sum > UINT32_MAX ? UINT32_MAX : (uint32_t)sum;
+    }
+
+    /*
+    Peaks must stand above the mean bin power, and VIBRATION_PEAK_RATIO times
+    above the noise floor -- the median bin power, rounded up to a power of
+    two by counting the bins at each bit length
+    */
+    total = 0;
+    memset(hist, 0, sizeof(hist));
+    for (k = 1u; k < VIBRATION_N / 2u; k++) {
+        total += v->power[k];
+        for (bits = 0; bits < 64u && (v->power[k] >> bits); bits++);
+        hist[bits]++;
+    }
+    for (bits = 0, i = 0; i < (VIBRATION_N / 2u - 1u) / 2u; bits++) {
+        i += hist[bits];
+    }
+    noise = 1ull << (bits - 1u);
+    threshold = total / (VIBRATION_N / 2u - 1u);
+    if (threshold < noise * VIBRATION_PEAK_RATIO) {
+        threshold = noise * VIBRATION_PEAK_RATIO;
+    }
+
+    /* Keep the largest local maxima, in descending order of power */
+    memset(peak_p, 0, sizeof(peak_p));
+    memset(peak_k, 0, sizeof(peak_k));
+    for (k = 2u; k < VIBRATION_N / 2u - 1u; k++) {
+        if (v->power[k] <= threshold || v->power[k] <= v->power[k - 1u] ||
+                v->power[k] < v->power[k + 1u]) {
+            continue;
+        }
+
+        for (i = VIBRATION_PEAKS; i > 0 && v->power[k] > peak_p[i - 1u];
+                i--) {
+            if (i < VIBRATION_PEAKS) {
+                peak_p[i] = peak_p[i - 1u];
+                peak_k[i] = peak_k[i - 1u];
+            }
+        }
+        if (i < VIBRATION_PEAKS) {
+            peak_p[i] = v->power[k];
+            peak_k[i] = k;
+        }
+    }
+
+    /*
+    Refine each peak by fitting a parabola through it and its neighbours;
+    as the peak is a local maximum, the offset is within half a bin.
+    */
+    for (i = 0; i < VIBRATION_PEAKS && peak_k[i]; i++) {
+        k = peak_k[i];
+        pm = (int64_t)v->power[k - 1u];
+        p0 = (int64_t)v->power[k];
+        pp = (int64_t)v->power[k + 1u];
+        delta = (pp - pm) * 128 / (2 * p0 - pm - pp);
+
+        result->peak_dhz[i] = (uint16_t)(
+            (((int64_t)k << 8u) + delta) * v->sample_hz * 10 /
+            ((int64_t)VIBRATION_N << 8u));
+    }
+}
+
+void vibration_init(struct vibration_t *v, uint32_t sample_hz,
+const uint16_t band_edges_hz[VIBRATION_BANDS + 1u]) {
+    fcs_assert(v && band_edges_hz);
+    fcs_assert(sample_hz && sample_hz <= 6000u);
+
+    uint32_t k, b, bin;
+    float c;
+
+    memset(v, 0, sizeof(*v));
+    v->sample_hz = (uint16_t)sample_hz;
+
+    for (k = 0; k < VIBRATION_N; k++) {
+        c = cosf(2.0f * VIBRATION_PI * (float)k / (float)VIBRATION_N) *
+            32767.0f;
+        vibration_cos[k] = (int16_t)(c >= 0.0f ? c + 0.5f : c - 0.5f);
+    }
+
+    /* The DC and Nyquist bins aren't in any band */
+    for (b = 0; b <= VIBRATION_BANDS; b++) {
+        fcs_assert(band_edges_hz[b] <= sample_hz / 2u);
+        fcs_assert(b == 0 || band_edges_hz[b] >= band_edges_hz[b - 1u]);
+
+        bin = (band_edges_hz[b] * VIBRATION_N + sample_hz / 2u) / sample_hz;
+        if (bin < 1u) {
+            bin = 1u;
+        } else if (bin > VIBRATION_N / 2u) {
+            bin = VIBRATION_N / 2u;
+        }
+        v->band_bin[b] = (uint8_t)bin;
+    }
+}
+
+void vibration_add(struct vibration_t *v, const int16_t accel[3]) {
+    fcs_assert(v && accel);
+
+    uint32_t axis;
+
+    for (axis = 0; axis < 3u; axis++) {
+        v->capture[v->capture_buf][v->capture_idx][axis] = accel[axis];
+        v->capture_sum[axis] += accel[axis];
+    }
+
+    if (++v->capture_idx < VIBRATION_N) {
+        return;
+    }
+
+    /* Hand the block over for analysis, unless the last is still going */
+    if (v->state == VIBRATION_IDLE) {
+        for (axis = 0; axis < 3u; axis++) {
+            v->mean[axis] =
+                (int16_t)(v->capture_sum[axis] / (int32_t)VIBRATION_N);
+        }
+        v->capture_buf ^= 1u;
+        v->pass = 0;
+        v->stage = 0;
+        v->pos = 0;
+        v->state = VIBRATION_WINDOW;
+    } else {
+        v->overruns++;
+    }
+
+    vibration_discard(v);
+}
+
+void vibration_discard(struct vibration_t *v) {
+    fcs_assert(v);
+
+    v->capture_idx = 0;
+    memset(v->capture_sum, 0, sizeof(v->capture_sum));
+}
+
+bool vibration_tick(struct vibration_t *v, struct vibration_result_t *result) {
+    fcs_assert(v && result);
+
+    uint32_t ops;
+
+    for (ops = 0; ops < VIBRATION_TICK_OPS; ops++) {
+        switch (v->state) {
+            case VIBRATION_IDLE:
+                return false;
+            case VIBRATION_WINDOW:
+                vibration_window(v, v->pos);
+                if (++v->pos == VIBRATION_N) {
+                    v->pos = 0;
+                    v->stage = 0;
+                    v->state = VIBRATION_FFT;
+                }
+                break;
+            case VIBRATION_FFT:
+                vibration_butterfly(v, v->pos);
+                if (++v->pos == VIBRATION_N / 2u) {
+                    v->pos = 0;
+                    if (++v->stage == VIBRATION_LOG2_N) {
+                        /* The DC bin isn't needed */
+                        v->pos = 1u;
+                        v->state = VIBRATION_POWER;
+                    }
+                }
+                break;
+            case VIBRATION_POWER:
+                vibration_power(v, v->pos);
+                if (++v->pos == VIBRATION_N / 2u) {
+                    v->pos = 0;
+                    if (v->pass == 0) {
+                        v->pass = 1u;
+                        v->state = VIBRATION_WINDOW;
+                    } else {
+                        v->state = VIBRATION_RESULT;
+                    }
+                }
+                break;
+            case VIBRATION_RESULT:
+                vibration_result(v, result);
+                v->state = VIBRATION_IDLE;
+                return true;
+        }
+    }
+
+    return false;
+}
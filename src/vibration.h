@@ -0,0 +1,109 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _VIBRATION_H_
+#define _VIBRATION_H_
+
+/*
+Vibration spectrum analysis of 3-axis accelerometer samples.
+
+Samples are captured in blocks of VIBRATION_N (alternating between two
+buffers). Each full block is analysed while the next is captured: the mean
+(mostly gravity) is removed, and each axis is Hann-windowed and transformed
+by a fixed-point radix-2 FFT -- X and Y together as the real and imaginary
+parts of one complex FFT, Z on its own. The analysis is spread over
+vibration_tick calls, each doing at most VIBRATION_TICK_OPS butterflies (or
+equivalent steps), so it takes about 90 ticks. If a block fills before the
+previous one's analysis is finished, it's dropped.
+
+The results are the mean-square acceleration (summed over the three axes,
+in input LSB^2) in each of VIBRATION_BANDS frequency bands, and the
+frequencies of the VIBRATION_PEAKS largest spectral peaks, refined to a
+fraction of a bin by parabolic interpolation. Peaks count if they're above
+the mean bin power and at least VIBRATION_PEAK_RATIO times the median.
+*/
+
+#define VIBRATION_LOG2_N 8u
+#define VIBRATION_N (1u << VIBRATION_LOG2_N)
+#define VIBRATION_BANDS 4u
+#define VIBRATION_PEAKS 3u
+#define VIBRATION_PEAK_RATIO 8u
+#define VIBRATION_TICK_OPS 32u
+
+enum vibration_state_t {
+    VIBRATION_IDLE = 0,
+    VIBRATION_WINDOW,
+    VIBRATION_FFT,
+    VIBRATION_POWER,
+    VIBRATION_RESULT
+};
+
+struct vibration_result_t {
+    /* 0.1Hz, largest peak first; 0 if there are fewer peaks */
+    uint16_t peak_dhz[VIBRATION_PEAKS];
+    /* Mean-square acceleration, input LSB^2 */
+    uint32_t band_ms[VIBRATION_BANDS];
+};
+
+struct vibration_t {
+    /* Configuration, set by vibration_init */
+    uint16_t sample_hz;
+    uint8_t band_bin[VIBRATION_BANDS + 1u]; /* first bin of each band */
+
+    /* Capture -- sums are for the mean */
+    int16_t capture[2][VIBRATION_N][3];
+    int32_t capture_sum[3];
+    uint8_t capture_buf;
+    uint16_t capture_idx;
+    uint32_t overruns;
+
+    /* Analysis of the other buffer */
+    enum vibration_state_t state;
+    uint8_t pass; /* 0 for X/Y, 1 for Z */
+    uint8_t stage;
+    uint16_t pos;
+    int16_t mean[3];
+    int32_t re[VIBRATION_N];
+    int32_t im[VIBRATION_N];
+    uint64_t power[VIBRATION_N / 2u]; /* Q8 input LSB^2 */
+};
+
+/*
+Set up v for samples at sample_hz; band_edges_hz are the lower edge of each
+band, then the upper edge of the last (no more than sample_hz / 2).
+*/
+void vibration_init(struct vibration_t *v, uint32_t sample_hz,
+const uint16_t band_edges_hz[VIBRATION_BANDS + 1u]);
+
+/* Capture the next accelerometer sample (XYZ) */
+void vibration_add(struct vibration_t *v, const int16_t accel[3]);
+
+/* Discard the block being captured, e.g. after samples have been lost */
+void vibration_discard(struct vibration_t *v);
+
+/*
+Continue the analysis in progress; returns true and sets result when it
+finishes.
+*/
+bool vibration_tick(struct vibration_t *v, struct vibration_result_t *result);
+
+#endif
@@ -0,0 +1,312 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Host test for calibration.c: loads thermal calibrations with random
+coefficients through the simulated user page, and checks
+- calibration_thermal_eval's fixed-point Horner evaluation against a
+  double-precision evaluation of the polynomials, over the whole int16
+  temperature range;
+- that temperatures outside temp_min..temp_max give the corrections at the
+  nearest end of the range;
+- that a store with a bad CRC, magic or version loads as zero, and that
+  its corrections leave every reading unchanged;
+- that calibration_thermal_apply_sum of N equal readings matches N times
+  calibration_thermal_apply of one, within apply's rounding.
+The store is written in the host's byte order, as calibration.c reads it in
+the target's.
+
+Exits with status 1 if any check fails.
+*/
+
+#include <asf.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "crc32.h"
+#include "calibration.h"
+
+#define TEST_CALIBRATIONS 200u
+#define TEST_TEMP_STEP 7
+
+/*
+Largest coefficient magnitude: each times 2^15 must fit in an int32. The
+temperature range stays within about 2^15 of temp_ref, so |x| < 1.
+*/
+#define TEST_COEFF_MAX 65535
+#define TEST_TEMP_MIN (-15000)
+#define TEST_TEMP_MAX 12000
+
+/*
+Horner's method truncates once per term after the first, and |x| < 1, so
+each result is within that many units of the exact value
+*/
+#define TEST_EVAL_TOLERANCE ((double)(CALIBRATION_THERMAL_TERMS - 1u))
+
+#define TEST_BIAS_ONE ((double)(1 << CALIBRATION_BIAS_FRAC_BITS))
+#define TEST_SCALE_ONE ((double)(1 << CALIBRATION_SCALE_FRAC_BITS))
+
+static const uint32_t test_sum_samples[] = { 1u, 8u, 64u, 128u };
+#define TEST_SUM_COUNTS (sizeof(test_sum_samples) / \
+                         sizeof(test_sum_samples[0]))
+
+static uint32_t test_seed = 12345u;
+
+/* Stands in for hal/sim.c's user page */
+uint8_t hal_sim_user_page[HAL_SIM_USER_PAGE_SIZE];
+
+void pwm_terminate_flight(void);
+static int32_t test_random(int32_t min, int32_t max);
+static void test_store(const struct calibration_thermal_t *cal,
+uint32_t magic, uint32_t version, uint32_t crc_xor);
+static double test_poly(const int32_t coeffs[], double x);
+static bool test_eval(const struct calibration_thermal_t *cal,
+double *max_err);
+static bool test_clamp(const struct calibration_thermal_t *cal);
+static bool test_invalid(const struct calibration_thermal_t *cal);
+static bool test_identity(const struct calibration_thermal_t *cal);
+static bool test_sum(const struct calibration_thermal_t *cal,
+double *max_err);
+
+/* Reached by fcs_assert */
+void pwm_terminate_flight(void) {
+    fprintf(stderr, "fcs_assert failed\n");
+    abort();
+}
+
+static int32_t test_random(int32_t min, int32_t max) {
+    test_seed = test_seed * 1664525u + 1013904223u;
+    return min + (int32_t)((test_seed >> 8u) %
+                           (uint32_t)(max - min + 1));
+}
+
+/* Write a store holding cal for every sensor, with its CRC XORed by crc_xor */
+static void test_store(const struct calibration_thermal_t *cal,
+uint32_t magic, uint32_t version, uint32_t crc_xor) {
+    struct calibration_store_t store;
+    uint32_t i;
+
+    memset(&store, 0, sizeof(store));
+    store.magic = magic;
+    store.version = version;
+    for (i = 0; i < CALIBRATION_SENSORS; i++) {
+        memcpy(&store.thermal[i], cal, sizeof(*cal));
+    }
+    store.crc = fcs_crc32((const uint8_t *)&store,
+                          offsetof(struct calibration_store_t, crc),
+                          0xFFFFFFFFu) ^ crc_xor;
+
+    memset(hal_sim_user_page, 0xFF, sizeof(hal_sim_user_page));
+    memcpy(hal_sim_user_page, &store, sizeof(store));
+}
+
+static double test_poly(const int32_t coeffs[], double x) {
+    double p = 0, xk = 1.0;
+    uint32_t k;
+
+    for (k = 0; k < CALIBRATION_THERMAL_TERMS; k++) {
+        p += (double)coeffs[k] * xk;
+        xk *= x;
+    }
+
+    return p;
+}
+
+static bool test_eval(const struct calibration_thermal_t *cal,
+double *max_err) {
+    struct calibration_thermal_comp_t comp;
+    int32_t temp;
+    uint32_t i;
+    double x, err;
+    bool ok = true;
+
+    for (temp = cal->temp_min; temp <= cal->temp_max;
+            temp += TEST_TEMP_STEP) {
+        calibration_thermal_eval(cal, (int16_t)temp, &comp);
+        x = (double)(temp - cal->temp_ref) /
+            (double)(1 << CALIBRATION_THERMAL_X_BITS);
+
+        for (i = 0; i < CALIBRATION_IMU_AXES; i++) {
+            err = fabs((double)comp.bias[i] -
+                       test_poly(cal->axis[i].bias, x));
+            *max_err = fmax(*max_err, err);
+            ok = ok && err <= TEST_EVAL_TOLERANCE;
+
+            err = fabs((double)comp.scale[i] - TEST_SCALE_ONE -
+                       test_poly(cal->axis[i].scale, x));
+            *max_err = fmax(*max_err, err);
+            ok = ok && err <= TEST_EVAL_TOLERANCE;
+        }
+    }
+
+    return ok;
+}
+
+static bool test_clamp(const struct calibration_thermal_t *cal) {
+    struct calibration_thermal_comp_t comp, end;
+    int32_t temp;
+    bool ok = true;
+
+    calibration_thermal_eval(cal, cal->temp_min, &end);
+    for (temp = INT16_MIN; temp < cal->temp_min; temp += TEST_TEMP_STEP) {
+        calibration_thermal_eval(cal, (int16_t)temp, &comp);
+        ok = ok && memcmp(&comp, &end, sizeof(comp)) == 0;
+    }
+
+    calibration_thermal_eval(cal, cal->temp_max, &end);
+    for (temp = INT16_MAX; temp > cal->temp_max; temp -= TEST_TEMP_STEP) {
+        calibration_thermal_eval(cal, (int16_t)temp, &comp);
+        ok = ok && memcmp(&comp, &end, sizeof(comp)) == 0;
+    }
+
+    return ok;
+}
+
+/* A store with a bad CRC, magic or version must load as no calibration */
+static bool test_invalid(const struct calibration_thermal_t *cal) {
+    static const struct calibration_thermal_t zero;
+    struct calibration_thermal_t loaded;
+    bool ok = true;
+
+    test_store(cal, CALIBRATION_MAGIC, CALIBRATION_VERSION, 0);
+    ok = ok && calibration_load_thermal(CALIBRATION_MPU6000, &loaded) &&
+         memcmp(&loaded, cal, sizeof(loaded)) == 0;
+
+    test_store(cal, CALIBRATION_MAGIC, CALIBRATION_VERSION, 1u);
+    ok = ok && !calibration_load_thermal(CALIBRATION_MPU6000, &loaded) &&
+         memcmp(&loaded, &zero, sizeof(loaded)) == 0 &&
+         test_identity(&loaded);
+
+    test_store(cal, CALIBRATION_MAGIC ^ 0x100u, CALIBRATION_VERSION, 0);
+    ok = ok && !calibration_load_thermal(CALIBRATION_MPU6000, &loaded) &&
+         memcmp(&loaded, &zero, sizeof(loaded)) == 0 &&
+         test_identity(&loaded);
+
+    test_store(cal, CALIBRATION_MAGIC, CALIBRATION_VERSION + 1u, 0);
+    ok = ok && !calibration_load_thermal(CALIBRATION_MPU6000, &loaded) &&
+         memcmp(&loaded, &zero, sizeof(loaded)) == 0 &&
+         test_identity(&loaded);
+
+    return ok;
+}
+
+/* Corrections from cal must leave every reading and sum unchanged */
+static bool test_identity(const struct calibration_thermal_t *cal) {
+    struct calibration_thermal_comp_t comp;
+    int32_t value, sum;
+    uint32_t i;
+    bool ok = true;
+
+    calibration_thermal_eval(cal, 0, &comp);
+    for (i = 0; i < CALIBRATION_IMU_AXES; i++) {
+        for (value = INT16_MIN; value <= INT16_MAX; value++) {
+            ok = ok && calibration_thermal_apply(&comp, i, (int16_t)value) ==
+                       value;
+            sum = value * 8 * (int32_t)TEST_BIAS_ONE;
+            ok = ok && calibration_thermal_apply_sum(&comp, i, sum, 8u) ==
+                       sum;
+        }
+    }
+
+    return ok;
+}
+
+/*
+calibration_thermal_apply_sum of N readings of value, with the bias' Q8
+fraction, against N times calibration_thermal_apply's rounded result: the
+difference is N times apply's rounding, under half an LSB, plus apply_sum's
+own, under half a Q8 unit
+*/
+static bool test_sum(const struct calibration_thermal_t *cal,
+double *max_err) {
+    struct calibration_thermal_comp_t comp;
+    int32_t temp, value, sum;
+    uint32_t i, j, n;
+    double err, limit;
+    bool ok = true;
+
+    for (temp = cal->temp_min; temp <= cal->temp_max; temp += 1000) {
+        calibration_thermal_eval(cal, (int16_t)temp, &comp);
+        for (i = 0; i < CALIBRATION_IMU_AXES; i++) {
+            for (value = -30000; value <= 30000; value += 997) {
+                for (j = 0; j < TEST_SUM_COUNTS; j++) {
+                    n = test_sum_samples[j];
+                    sum = value * (int32_t)n * (int32_t)TEST_BIAS_ONE;
+                    err = fabs((double)calibration_thermal_apply_sum(
+                                   &comp, i, sum, n) -
+                               (double)n * TEST_BIAS_ONE *
+                               (double)calibration_thermal_apply(
+                                   &comp, i, (int16_t)value));
+                    limit = (double)n * TEST_BIAS_ONE / 2.0 + 0.5;
+                    *max_err = fmax(*max_err,
+                                    err / ((double)n * TEST_BIAS_ONE));
+                    ok = ok && err <= limit;
+                }
+            }
+        }
+    }
+
+    return ok;
+}
+
+int main(void) {
+    struct calibration_thermal_t cal;
+    uint32_t n, i, k;
+    double eval_err = 0, sum_err = 0;
+    bool eval_ok = true, clamp_ok = true, invalid_ok = true, sum_ok = true;
+
+    for (n = 0; n < TEST_CALIBRATIONS; n++) {
+        memset(&cal, 0, sizeof(cal));
+        cal.temp_ref = (int16_t)test_random(-2000, 2000);
+        cal.temp_min = (int16_t)test_random(TEST_TEMP_MIN, cal.temp_ref);
+        cal.temp_max = (int16_t)test_random(cal.temp_ref, TEST_TEMP_MAX);
+        for (i = 0; i < CALIBRATION_IMU_AXES; i++) {
+            for (k = 0; k < CALIBRATION_THERMAL_TERMS; k++) {
+                cal.axis[i].bias[k] = test_random(-TEST_COEFF_MAX,
+                                                  TEST_COEFF_MAX);
+                cal.axis[i].scale[k] = test_random(-TEST_COEFF_MAX,
+                                                   TEST_COEFF_MAX);
+            }
+        }
+
+        eval_ok = test_eval(&cal, &eval_err) && eval_ok;
+        clamp_ok = test_clamp(&cal) && clamp_ok;
+        sum_ok = test_sum(&cal, &sum_err) && sum_ok;
+        /* The identity check covers every reading, so only do it once */
+        if (n == 0) {
+            invalid_ok = test_invalid(&cal);
+        }
+    }
+
+    printf("eval      max error %.2f (limit %.0f): %s\n", eval_err,
+           TEST_EVAL_TOLERANCE, eval_ok ? "ok" : "FAIL");
+    printf("clamp     %s\n", clamp_ok ? "ok" : "FAIL");
+    printf("invalid   %s\n", invalid_ok ? "ok" : "FAIL");
+    printf("sum       max error %.3f LSB per sample (limit 0.5): %s\n",
+           sum_err, sum_ok ? "ok" : "FAIL");
+
+    return eval_ok && clamp_ok && invalid_ok && sum_ok ? 0 : 1;
+}
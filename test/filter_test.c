@@ -0,0 +1,314 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Host test for filter.c: runs filter chains over six channels of noise and
+tones, checks each output against a double-precision model of the same
+filter, and reports the time each chain takes per input sample.
+
+The models use the exact FIR taps, exact CIC sums and biquad coefficients
+designed in double precision, so the tolerances cover the chain's rounding
+(FIR, CIC) and its rounding plus Q28 coefficient quantization (biquads).
+Exits with status 1 if any output is out of tolerance.
+*/
+
+#include <asf.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "filter.h"
+
+#define TEST_CHANNELS 6u
+#define TEST_DECIMATION 8u
+#define TEST_OUTPUTS 4000u
+#define TEST_INPUTS (TEST_OUTPUTS * TEST_DECIMATION)
+#define TEST_TIMING_RUNS 20u
+
+#define TEST_LPF_FREQ 0.08
+#define TEST_LPF_Q 0.7071
+#define TEST_NOTCH_FREQ 0.2
+#define TEST_NOTCH_Q 2.0
+
+/* The MPU-6000 driver's taps (see mpu6000.c) */
+static const int16_t test_fir[] = {
+    5, 5, 4, 0, -8, -19, -35, -55, -79, -105, -130, -153,
+    -170, -177, -169, -142, -94, -19, 82, 212, 370, 553, 756, 974,
+    1200, 1426, 1642, 1839, 2008, 2143, 2237, 2283, 2283, 2237, 2143, 2008,
+    1839, 1642, 1426, 1200, 974, 756, 553, 370, 212, 82, -19, -94,
+    -142, -169, -177, -170, -153, -130, -105, -79, -55, -35, -19, -8,
+    0, 4, 5, 5
+};
+#define TEST_FIR_TAPS (sizeof(test_fir) / sizeof(test_fir[0]))
+
+enum test_chain_t {
+    TEST_FIR = 0,
+    TEST_FIR_BIQUADS,
+    TEST_CIC,
+    TEST_CIC_BIQUADS,
+    TEST_CHAINS
+};
+
+static const char *test_chain_names[TEST_CHAINS] = {
+    "FIR", "FIR+LPF+notch", "CIC", "CIC+LPF+notch"
+};
+
+/* Worst-case output error allowed, in LSB */
+static const double test_tolerance[TEST_CHAINS] = { 0.5, 0.75, 0.75, 0.75 };
+
+struct test_biquad_t {
+    double b[3];
+    double a[3];
+    double x[TEST_CHANNELS][2];
+    double y[TEST_CHANNELS][2];
+};
+
+static int16_t test_input[TEST_INPUTS][TEST_CHANNELS];
+
+void pwm_terminate_flight(void);
+static void test_generate(void);
+static void test_chain_init(struct filter_chain_t *f, enum test_chain_t chain);
+static void test_biquad_init(struct test_biquad_t *bq, double freq, double q,
+bool notch);
+static double test_biquad_step(struct test_biquad_t *bq, uint32_t ch,
+double x);
+static double test_reference(enum test_chain_t chain, uint32_t n,
+uint32_t ch, struct test_biquad_t bq[2]);
+static bool test_accuracy(enum test_chain_t chain);
+static void test_timing(enum test_chain_t chain);
+
+/* Reached by fcs_assert */
+void pwm_terminate_flight(void) {
+    fprintf(stderr, "fcs_assert failed\n");
+    abort();
+}
+
+/*
+Channel 0 is full-scale-ish noise; the others are tones in the pass band,
+the transition band and the stop band (where they'd alias), with a little
+noise on top
+*/
+static void test_generate(void) {
+    static const double freq[TEST_CHANNELS] = {
+        0, 0.004, 0.02, 0.05, 0.08, 0.3
+    };
+    uint32_t n, ch, seed = 12345u;
+    double value, noise;
+
+    for (n = 0; n < TEST_INPUTS; n++) {
+        for (ch = 0; ch < TEST_CHANNELS; ch++) {
+            seed = seed * 1664525u + 1013904223u;
+            noise = (double)(int32_t)(seed >> 16u) - 32768.0;
+            if (ch == 0) {
+                value = noise * 0.6;
+            } else {
+                value = 12000.0 * sin(2.0 * M_PI * freq[ch] * (double)n +
+                                      (double)ch) + noise * 0.05;
+            }
+            test_input[n][ch] = (int16_t)lrint(value);
+        }
+    }
+}
+
+static void test_chain_init(struct filter_chain_t *f,
+enum test_chain_t chain) {
+    if (chain == TEST_FIR || chain == TEST_FIR_BIQUADS) {
+        filter_chain_init_fir(f, TEST_CHANNELS, TEST_DECIMATION, test_fir,
+                              TEST_FIR_TAPS);
+    } else {
+        filter_chain_init_cic(f, TEST_CHANNELS, TEST_DECIMATION);
+    }
+    if (chain == TEST_FIR_BIQUADS || chain == TEST_CIC_BIQUADS) {
+        filter_chain_add_lowpass(f, (float)TEST_LPF_FREQ, (float)TEST_LPF_Q);
+        filter_chain_add_notch(f, (float)TEST_NOTCH_FREQ,
+                               (float)TEST_NOTCH_Q);
+    }
+}
+
+/* RBJ audio EQ cookbook, as in filter.c */
+static void test_biquad_init(struct test_biquad_t *bq, double freq, double q,
+bool notch) {
+    double w0 = 2.0 * M_PI * freq, cosw0 = cos(w0),
+           alpha = sin(w0) / (2.0 * q);
+
+    memset(bq, 0, sizeof(*bq));
+    if (notch) {
+        bq->b[0] = 1.0;
+        bq->b[1] = -2.0 * cosw0;
+        bq->b[2] = 1.0;
+    } else {
+        bq->b[0] = (1.0 - cosw0) / 2.0;
+        bq->b[1] = 1.0 - cosw0;
+        bq->b[2] = (1.0 - cosw0) / 2.0;
+    }
+    bq->a[0] = 1.0 + alpha;
+    bq->a[1] = -2.0 * cosw0;
+    bq->a[2] = 1.0 - alpha;
+}
+
+static double test_biquad_step(struct test_biquad_t *bq, uint32_t ch,
+double x) {
+    double y = (bq->b[0] * x + bq->b[1] * bq->x[ch][0] +
+                bq->b[2] * bq->x[ch][1] - bq->a[1] * bq->y[ch][0] -
+                bq->a[2] * bq->y[ch][1]) / bq->a[0];
+
+    bq->x[ch][1] = bq->x[ch][0];
+    bq->x[ch][0] = x;
+    bq->y[ch][1] = bq->y[ch][0];
+    bq->y[ch][0] = y;
+    return y;
+}
+
+/* The model's output for the decimation period ending at input n */
+static double test_reference(enum test_chain_t chain, uint32_t n,
+uint32_t ch, struct test_biquad_t bq[2]) {
+    uint32_t i, j, k;
+    double y = 0, x;
+
+    if (chain == TEST_FIR || chain == TEST_FIR_BIQUADS) {
+        for (j = 0; j < TEST_FIR_TAPS; j++) {
+            i = n + j + 1u - TEST_FIR_TAPS;
+            if (i <= n) {
+                y += (double)test_fir[j] * (double)test_input[i][ch];
+            }
+        }
+        y /= 32768.0;
+    } else {
+        /*
+        Three cascaded moving sums of TEST_DECIMATION inputs: the impulse
+        response is the triple convolution of a box, so weight each input
+        by the number of ways its lag splits into three lags under
+        TEST_DECIMATION
+        */
+        for (k = 0; k <= 3u * (TEST_DECIMATION - 1u) && k <= n; k++) {
+            uint32_t ways = 0, a, b;
+            for (a = 0; a < TEST_DECIMATION; a++) {
+                for (b = 0; b < TEST_DECIMATION; b++) {
+                    if (k >= a + b && k - a - b < TEST_DECIMATION) {
+                        ways++;
+                    }
+                }
+            }
+            x = (double)test_input[n - k][ch];
+            y += (double)ways * x;
+        }
+        y /= (double)(TEST_DECIMATION * TEST_DECIMATION * TEST_DECIMATION);
+    }
+
+    if (chain == TEST_FIR_BIQUADS || chain == TEST_CIC_BIQUADS) {
+        y = test_biquad_step(&bq[0], ch, y);
+        y = test_biquad_step(&bq[1], ch, y);
+    }
+
+    return y;
+}
+
+static bool test_accuracy(enum test_chain_t chain) {
+    static struct filter_chain_t f;
+    struct test_biquad_t bq[2];
+    int16_t out[TEST_CHANNELS];
+    uint32_t n, ch, outputs = 0;
+    double err, max_err = 0, sum_sq = 0;
+
+    test_chain_init(&f, chain);
+    test_biquad_init(&bq[0], TEST_LPF_FREQ, TEST_LPF_Q, false);
+    test_biquad_init(&bq[1], TEST_NOTCH_FREQ, TEST_NOTCH_Q, true);
+
+    for (n = 0; n < TEST_INPUTS; n++) {
+        filter_chain_add(&f, test_input[n]);
+        if (n % TEST_DECIMATION != TEST_DECIMATION - 1u) {
+            continue;
+        }
+
+        filter_chain_decimate(&f, out);
+        for (ch = 0; ch < TEST_CHANNELS; ch++) {
+            err = fabs((double)out[ch] - test_reference(chain, n, ch, bq));
+            if (err > max_err) {
+                max_err = err;
+            }
+            sum_sq += err * err;
+            outputs++;
+        }
+    }
+
+    printf("%-14s max error %.3f LSB (limit %.2f), rms %.3f LSB: %s\n",
+           test_chain_names[chain], max_err, test_tolerance[chain],
+           sqrt(sum_sq / (double)outputs),
+           max_err <= test_tolerance[chain] ? "ok" : "FAIL");
+    return max_err <= test_tolerance[chain];
+}
+
+/* Host time per six-channel input sample, decimation included */
+static void test_timing(enum test_chain_t chain) {
+    static struct filter_chain_t f;
+    int16_t out[TEST_CHANNELS];
+    uint32_t run, n;
+    struct timespec start, end;
+    double ns;
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t cycles = __rdtsc();
+#endif
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (run = 0; run < TEST_TIMING_RUNS; run++) {
+        test_chain_init(&f, chain);
+        for (n = 0; n < TEST_INPUTS; n++) {
+            filter_chain_add(&f, test_input[n]);
+            if (n % TEST_DECIMATION == TEST_DECIMATION - 1u) {
+                filter_chain_decimate(&f, out);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    ns = ((double)(end.tv_sec - start.tv_sec) * 1e9 +
+          (double)(end.tv_nsec - start.tv_nsec)) /
+         (double)(TEST_TIMING_RUNS * TEST_INPUTS);
+#if defined(__x86_64__) || defined(__i386__)
+    printf("%-14s %.1f ns, %.0f TSC cycles per input sample\n",
+           test_chain_names[chain], ns,
+           (double)(__rdtsc() - cycles) /
+           (double)(TEST_TIMING_RUNS * TEST_INPUTS));
+#else
+    printf("%-14s %.1f ns per input sample\n", test_chain_names[chain], ns);
+#endif
+}
+
+int main(void) {
+    uint32_t chain;
+    bool ok = true;
+
+    test_generate();
+    for (chain = 0; chain < TEST_CHAINS; chain++) {
+        ok = test_accuracy((enum test_chain_t)chain) && ok;
+    }
+    for (chain = 0; chain < TEST_CHAINS; chain++) {
+        test_timing((enum test_chain_t)chain);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,293 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Host simulation harness (see hal/sim.h): models of the I/O board's sensors,
+attached to the simulated TWIMs and SPI master before main runs, and a test
+calibration in the flash user page.
+
+The models are only as detailed as the drivers need -- the MS4525DO and
+HMC5883L return fixed readings, the MS5611 returns fixed conversions and
+checks that each ADC read comes at least 2ms after its conversion command,
+and the MPU-6000 fills its FIFO with a 12-byte sample every 125us while
+USER_CTRL.FIFO_EN is set, overflowing at 1024 bytes.
+
+At exit, each model's counts are printed to stderr after the simulator's
+own, and the process exits with status 1 if the MPU-6000's FIFO overflowed,
+an MS5611 result was read early, or a sensor was never read.
+*/
+
+#include <asf.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "calibration.h"
+#include "crc32.h"
+
+#define HARNESS_SAMPLE_CYCLES (CONFIG_MAIN_HZ / 8000u)
+
+/* MS4525DO -- 14-bit pressure and 11-bit temperature, status 0 */
+static uint32_t ms4525_reads;
+
+static bool ms4525_write(void *ctx, const uint8_t *data, uint32_t len) {
+    (void)ctx;
+    (void)data;
+    (void)len;
+    return true;
+}
+
+static void ms4525_read(void *ctx, uint8_t *data, uint32_t len) {
+    uint32_t i;
+
+    (void)ctx;
+    ms4525_reads++;
+    for (i = 0; i < len; i++) {
+        data[i] = (uint8_t)(0x12u + i);
+    }
+    data[0] &= 0x3fu;
+}
+
+static const struct hal_sim_i2c_slave_t ms4525 = {
+    0x28u, ms4525_write, ms4525_read, NULL
+};
+
+/* MS5611 -- PROM from a real part, and a constant D1 and D2 */
+static const uint16_t ms5611_prom[8] = {
+    0, 40127u, 36924u, 23317u, 23282u, 33464u, 28312u, 0
+};
+static uint8_t ms5611_cmd, ms5611_conv;
+static uint64_t ms5611_conv_t;
+static uint32_t ms5611_d1, ms5611_d2, ms5611_early;
+
+static bool ms5611_write(void *ctx, const uint8_t *data, uint32_t len) {
+    (void)ctx;
+    (void)len;
+
+    ms5611_cmd = data[0];
+    if ((data[0] & 0xf0u) == 0x40u || (data[0] & 0xf0u) == 0x50u) {
+        ms5611_conv = data[0];
+        ms5611_conv_t = hal_sim_cycles();
+    }
+    return true;
+}
+
+static void ms5611_read(void *ctx, uint8_t *data, uint32_t len) {
+    uint32_t value;
+
+    (void)ctx;
+    (void)len;
+
+    if (ms5611_cmd >= 0xa0u) {
+        value = ms5611_prom[(ms5611_cmd >> 1u) & 7u];
+        data[0] = (uint8_t)(value >> 8u);
+        data[1] = (uint8_t)value;
+        return;
+    }
+
+    /* Allow 0.1ms for the difference between the two clocks */
+    if (hal_sim_cycles() - ms5611_conv_t <
+            2u * CONFIG_MAIN_HZ / 1000u - CONFIG_MAIN_HZ / 10000u) {
+        ms5611_early++;
+    }
+    if ((ms5611_conv & 0xf0u) == 0x40u) {
+        value = 9085466u;
+        ms5611_d1++;
+    } else {
+        value = 8569150u;
+        ms5611_d2++;
+    }
+    data[0] = (uint8_t)(value >> 16u);
+    data[1] = (uint8_t)(value >> 8u);
+    data[2] = (uint8_t)value;
+}
+
+static const struct hal_sim_i2c_slave_t ms5611 = {
+    0x77u, ms5611_write, ms5611_read, NULL
+};
+
+/* HMC5883L -- counts single-measurement starts, and reads back zeros */
+static uint32_t hmc5883_measurements, hmc5883_reads;
+
+static bool hmc5883_write(void *ctx, const uint8_t *data, uint32_t len) {
+    (void)ctx;
+    if (len == 2u && data[0] == 0x02u && data[1] == 0x01u) {
+        hmc5883_measurements++;
+    }
+    return true;
+}
+
+static void hmc5883_read(void *ctx, uint8_t *data, uint32_t len) {
+    (void)ctx;
+    hmc5883_reads++;
+    memset(data, 0, len);
+}
+
+static const struct hal_sim_i2c_slave_t hmc5883 = {
+    0x1eu, hmc5883_write, hmc5883_read, NULL
+};
+
+/*
+MPU-6000 -- registers auto-increment, apart from FIFO_R_W; reads of anything
+but FIFO_COUNT, FIFO_R_W and TEMP_OUT return zero
+*/
+#define MPU6000_FIFO_SAMPLE_LEN 12u
+/* Whole samples that fit in the 1024-byte FIFO */
+#define MPU6000_FIFO_MAX_LEVEL 1020u
+
+static uint8_t mpu6000_addr, mpu6000_user_ctrl;
+static bool mpu6000_reading;
+static uint64_t mpu6000_fifo_t;
+static uint32_t mpu6000_popped, mpu6000_resets, mpu6000_overflows,
+                mpu6000_reads, mpu6000_samples;
+
+static uint32_t mpu6000_fifo_level(void) {
+    uint64_t level;
+
+    if (!(mpu6000_user_ctrl & 0x40u)) {
+        return 0;
+    }
+
+    level = (hal_sim_cycles() / HARNESS_SAMPLE_CYCLES -
+             mpu6000_fifo_t / HARNESS_SAMPLE_CYCLES) *
+            MPU6000_FIFO_SAMPLE_LEN - mpu6000_popped;
+    if (level > MPU6000_FIFO_MAX_LEVEL) {
+        /* Start again, rather than model the FIFO's wrap-around */
+        mpu6000_overflows++;
+        mpu6000_fifo_t = hal_sim_cycles();
+        mpu6000_popped = 0;
+        level = 0;
+    }
+    return (uint32_t)level;
+}
+
+static uint8_t mpu6000_exchange(void *ctx, uint8_t tx, bool first) {
+    uint8_t value = 0;
+
+    (void)ctx;
+
+    if (first) {
+        mpu6000_addr = tx & 0x7fu;
+        mpu6000_reading = (tx & 0x80u) != 0;
+        if (mpu6000_reading) {
+            mpu6000_reads++;
+        }
+        return 0;
+    }
+
+    if (!mpu6000_reading) {
+        if (mpu6000_addr == 0x6au) {
+            mpu6000_user_ctrl = tx;
+            if (tx & 0x04u) {
+                mpu6000_resets++;
+                mpu6000_fifo_t = hal_sim_cycles();
+                mpu6000_popped = 0;
+            }
+        }
+        mpu6000_addr++;
+    } else if (mpu6000_addr == 0x74u) {
+        if (mpu6000_fifo_level()) {
+            if (mpu6000_popped % MPU6000_FIFO_SAMPLE_LEN == 0) {
+                mpu6000_samples++;
+            }
+            mpu6000_popped++;
+        }
+    } else {
+        if (mpu6000_addr == 0x72u) {
+            value = (uint8_t)(mpu6000_fifo_level() >> 8u);
+        } else if (mpu6000_addr == 0x73u) {
+            value = (uint8_t)mpu6000_fifo_level();
+        } else if (mpu6000_addr == 0x41u) {
+            value = 0x03u; /* 1000 LSB, ~39.4C */
+        } else if (mpu6000_addr == 0x42u) {
+            value = 0xe8u;
+        }
+        mpu6000_addr++;
+    }
+
+    return value;
+}
+
+static const struct hal_sim_spi_slave_t mpu6000 = { mpu6000_exchange, NULL };
+
+/*
+A thermal calibration for the MPU-6000, so the compensation is exercised: a
+gyro X bias of 10 LSB at temp_ref, with a linear temperature term
+*/
+static void harness_write_calibration(void) {
+    struct calibration_store_t store;
+
+    memset(&store, 0, sizeof(store));
+    store.magic = CALIBRATION_MAGIC;
+    store.version = CALIBRATION_VERSION;
+    store.thermal[CALIBRATION_MPU6000].temp_min = -5000;
+    store.thermal[CALIBRATION_MPU6000].temp_max = 5000;
+    store.thermal[CALIBRATION_MPU6000].axis[3].bias[0] = 2560;
+    store.thermal[CALIBRATION_MPU6000].axis[3].bias[1] = 100000;
+    store.crc = fcs_crc32((const uint8_t *)&store,
+                          offsetof(struct calibration_store_t, crc),
+                          0xFFFFFFFFu);
+
+    memcpy(hal_sim_user_page, &store, sizeof(store));
+}
+
+static void harness_report(void) {
+    bool ok;
+
+    fprintf(stderr, "MPU-6000: %u reads, %u FIFO samples, %u resets, "
+            "%u overflows\n", (unsigned int)mpu6000_reads,
+            (unsigned int)mpu6000_samples, (unsigned int)mpu6000_resets,
+            (unsigned int)mpu6000_overflows);
+    fprintf(stderr, "MS5611: %u D1, %u D2, %u early\n",
+            (unsigned int)ms5611_d1, (unsigned int)ms5611_d2,
+            (unsigned int)ms5611_early);
+    fprintf(stderr, "MS4525DO: %u reads\n", (unsigned int)ms4525_reads);
+    fprintf(stderr, "HMC5883L: %u measurements, %u reads\n",
+            (unsigned int)hmc5883_measurements,
+            (unsigned int)hmc5883_reads);
+
+    ok = mpu6000_reads && !mpu6000_overflows && ms5611_d1 && ms5611_d2 &&
+         !ms5611_early && ms4525_reads && hmc5883_reads;
+    fprintf(stderr, "%s\n", ok ? "PASS" : "FAIL");
+    if (!ok) {
+        /* Already exiting, so exit() can't be used */
+        _exit(1);
+    }
+}
+
+void hal_sim_setup(void) {
+    harness_write_calibration();
+
+    hal_sim_attach_i2c(0, &hmc5883);
+    hal_sim_attach_i2c(1, &ms5611);
+    hal_sim_attach_i2c(2, &ms4525);
+    hal_sim_attach_spi(1u, 3u, &mpu6000);
+
+    /* MPU-6000 INT -- a 50us data-ready pulse per sample */
+    hal_sim_gpio_pulse(MPU6000_INT_PIN, HARNESS_SAMPLE_CYCLES,
+                       50u * (CONFIG_MAIN_HZ / 1000000u));
+
+    atexit(harness_report);
+}
@@ -0,0 +1,407 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Host test for inertial.c: runs classic coning and sculling motions through
+the delta integrator, and checks
+- each interval's output against a double-precision model of the same
+  two-sample algorithm, within the fixed-point rounding;
+- the coning and sculling corrections against their analytic values for
+  the motion, which the two-sample algorithm should track closely;
+- that full-scale input over INERTIAL_DELTA_MAX_SAMPLES samples, at the
+  largest gyro scale which keeps the rotation under a radian, leaves
+  headroom in the 64-bit accumulators.
+Exits with status 1 if any check fails.
+*/
+
+#include <asf.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inertial.h"
+
+#define TEST_SAMPLE_HZ 8000.0
+#define TEST_INTERVAL 8u
+#define TEST_INTERVALS 500u
+#define TEST_SAMPLES (TEST_INTERVALS * TEST_INTERVAL)
+#define TEST_ONE ((double)(1 << INERTIAL_DELTA_FRAC_BITS))
+
+/* Motion: 100Hz at 0.02 rad, giving samples of about half full scale */
+#define TEST_ANGLE_LSB 1e-7f
+#define TEST_MOTION_HZ 100.0
+#define TEST_MOTION_AMPLITUDE 0.02
+#define TEST_VELOCITY_AMPLITUDE 15000.0
+
+/*
+Fixed-point output error allowed against the model, in output units: the
+rounding of the corrections, plus the quantization of the Q32 gains
+relative to the size of the corrections
+*/
+#define TEST_ROUNDING 2.0
+#define TEST_GAIN_TOLERANCE 1e-4
+
+/* Analytic correction error allowed, relative to the correction's size */
+#define TEST_MOTION_TOLERANCE 0.01
+
+/* Largest gyro scale which keeps a full-scale interval under a radian */
+#define TEST_HEADROOM_ANGLE_LSB \
+    ((float)(0.99 / (32768.0 * INERTIAL_DELTA_MAX_SAMPLES * sqrt(3.0))))
+/* Minimum accumulator headroom, in bits */
+#define TEST_HEADROOM_BITS 0.5
+
+enum test_motion_t {
+    TEST_CONING = 0,
+    TEST_SCULLING,
+    TEST_MOTIONS
+};
+
+static const char *test_motion_names[TEST_MOTIONS] = {
+    "coning", "sculling"
+};
+
+struct test_model_t {
+    double angle_lsb;
+    double alpha[3];
+    double nu[3];
+    double beta[3];
+    double scul[3];
+    double last_gyro[3];
+    double last_accel[3];
+};
+
+static int16_t test_gyro[TEST_SAMPLES][3];
+static int16_t test_accel[TEST_SAMPLES][3];
+
+void pwm_terminate_flight(void);
+static void test_cross(const double a[3], const double b[3], double out[3]);
+static void test_model_add(struct test_model_t *m, const int16_t gyro[3],
+const int16_t accel[3]);
+static void test_model_end(struct test_model_t *m, double d_angle[3],
+double d_velocity[3]);
+static bool test_compare(const int32_t d_angle[3],
+const int32_t d_velocity[3], const double ref_angle[3],
+const double ref_velocity[3], const double sum_angle[3],
+const double sum_velocity[3], double *max_err);
+static void test_generate(enum test_motion_t motion);
+static void test_analytic(enum test_motion_t motion, uint32_t interval,
+double angle[3], double velocity[3]);
+static bool test_motion(enum test_motion_t motion);
+static bool test_headroom(void);
+
+/* Reached by fcs_assert */
+void pwm_terminate_flight(void) {
+    fprintf(stderr, "fcs_assert failed\n");
+    abort();
+}
+
+static void test_cross(const double a[3], const double b[3], double out[3]) {
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+/*
+Savage's two-sample algorithm, with alpha and nu the sums of the samples so
+far in LSB-sample units, and the corrections in radians times those units:
+  d(beta) = 1/2 (alpha + last_gyro/6) x gyro
+  d(scul) = 1/2 ((alpha + last_gyro/6) x accel + (nu + last_accel/6) x gyro)
+*/
+static void test_model_add(struct test_model_t *m, const int16_t gyro[3],
+const int16_t accel[3]) {
+    double g[3], a[3], a6[3], v6[3], cone[3], scul_a[3], scul_v[3];
+    uint32_t i;
+
+    for (i = 0; i < 3u; i++) {
+        g[i] = gyro[i];
+        a[i] = accel[i];
+        a6[i] = m->alpha[i] + m->last_gyro[i] / 6.0;
+        v6[i] = m->nu[i] + m->last_accel[i] / 6.0;
+    }
+
+    test_cross(a6, g, cone);
+    test_cross(a6, a, scul_a);
+    test_cross(v6, g, scul_v);
+
+    for (i = 0; i < 3u; i++) {
+        m->beta[i] += 0.5 * m->angle_lsb * cone[i];
+        m->scul[i] += 0.5 * m->angle_lsb * (scul_a[i] + scul_v[i]);
+        m->alpha[i] += g[i];
+        m->nu[i] += a[i];
+        m->last_gyro[i] = g[i];
+        m->last_accel[i] = a[i];
+    }
+}
+
+/* The model's outputs, in the integrator's output units */
+static void test_model_end(struct test_model_t *m, double d_angle[3],
+double d_velocity[3]) {
+    double rot[3];
+    uint32_t i;
+
+    test_cross(m->alpha, m->nu, rot);
+    for (i = 0; i < 3u; i++) {
+        d_angle[i] = TEST_ONE * (m->alpha[i] + m->beta[i]);
+        d_velocity[i] = TEST_ONE * (m->nu[i] + m->scul[i] +
+                                    0.5 * m->angle_lsb * rot[i]);
+    }
+
+    memset(m->alpha, 0, sizeof(m->alpha));
+    memset(m->nu, 0, sizeof(m->nu));
+    memset(m->beta, 0, sizeof(m->beta));
+    memset(m->scul, 0, sizeof(m->scul));
+}
+
+/*
+Check an interval's output against the model's; the tolerance scales with
+the size of the corrections, which are what the sums of the samples leave
+*/
+static bool test_compare(const int32_t d_angle[3],
+const int32_t d_velocity[3], const double ref_angle[3],
+const double ref_velocity[3], const double sum_angle[3],
+const double sum_velocity[3], double *max_err) {
+    double err, limit;
+    uint32_t i;
+    bool ok = true;
+
+    for (i = 0; i < 3u; i++) {
+        err = fabs((double)d_angle[i] - ref_angle[i]);
+        limit = TEST_ROUNDING + TEST_GAIN_TOLERANCE *
+                fabs(ref_angle[i] - TEST_ONE * sum_angle[i]);
+        ok = ok && err <= limit;
+        *max_err = fmax(*max_err, err);
+
+        err = fabs((double)d_velocity[i] - ref_velocity[i]);
+        limit = TEST_ROUNDING + TEST_GAIN_TOLERANCE *
+                fabs(ref_velocity[i] - TEST_ONE * sum_velocity[i]);
+        ok = ok && err <= limit;
+        *max_err = fmax(*max_err, err);
+    }
+
+    return ok;
+}
+
+/*
+Classic coning: the body's x axis sweeps a cone, so the rate about y and z
+oscillates in quadrature. Classic sculling: the body rocks about x while
+accelerating along y in phase with the angle. Each sample is the change in
+angle (or velocity) over its period, quantized to LSB; sculling velocity is
+in LSB-sample units, as the accelerometer's scale cancels.
+*/
+static void test_generate(enum test_motion_t motion) {
+    const double w = 2.0 * M_PI * TEST_MOTION_HZ / TEST_SAMPLE_HZ,
+                 a = TEST_MOTION_AMPLITUDE / (double)TEST_ANGLE_LSB,
+                 v = TEST_VELOCITY_AMPLITUDE / w;
+    uint32_t n;
+    double t0, t1;
+
+    memset(test_gyro, 0, sizeof(test_gyro));
+    memset(test_accel, 0, sizeof(test_accel));
+    for (n = 0; n < TEST_SAMPLES; n++) {
+        t0 = w * (double)n;
+        t1 = w * (double)(n + 1u);
+        if (motion == TEST_CONING) {
+            test_gyro[n][1] = (int16_t)lrint(a * (cos(t1) - cos(t0)));
+            test_gyro[n][2] = (int16_t)lrint(a * (sin(t1) - sin(t0)));
+        } else {
+            test_gyro[n][0] = (int16_t)lrint(a * (sin(t1) - sin(t0)));
+            test_accel[n][1] = (int16_t)lrint(v * (cos(t0) - cos(t1)));
+        }
+    }
+}
+
+/*
+The exact corrections over an interval, in output units. For coning,
+integrating 1/2 alpha x omega gives 1/2 a^2 (wT - sin wT) about x; for
+sculling, 1/2 (alpha x f + upsilon x omega) gives 1/2 a v (wT - sin wT)
+along z, and the rotation correction adds 1/2 alpha x upsilon.
+*/
+static void test_analytic(enum test_motion_t motion, uint32_t interval,
+double angle[3], double velocity[3]) {
+    const double w = 2.0 * M_PI * TEST_MOTION_HZ / TEST_SAMPLE_HZ,
+                 a = TEST_MOTION_AMPLITUDE,
+                 v = TEST_VELOCITY_AMPLITUDE / w,
+                 t1 = w * (double)(interval * TEST_INTERVAL),
+                 t2 = w * (double)((interval + 1u) * TEST_INTERVAL),
+                 wt = t2 - t1;
+
+    memset(angle, 0, 3u * sizeof(double));
+    memset(velocity, 0, 3u * sizeof(double));
+    if (motion == TEST_CONING) {
+        angle[0] = TEST_ONE * 0.5 * a * a * (wt - sin(wt)) /
+                   (double)TEST_ANGLE_LSB;
+    } else {
+        velocity[2] = TEST_ONE * 0.5 * a * v *
+                      ((wt - sin(wt)) +
+                       (sin(t2) - sin(t1)) * (cos(t1) - cos(t2)));
+    }
+}
+
+static bool test_motion(enum test_motion_t motion) {
+    struct inertial_delta_t d;
+    struct test_model_t m;
+    int32_t d_angle[3], d_velocity[3];
+    uint32_t n, i, samples;
+    double ref_angle[3], ref_velocity[3], sum_angle[3], sum_velocity[3],
+           exact_angle[3], exact_velocity[3], corr, exact, size,
+           max_err = 0, max_motion_err = 0, max_size = 0;
+    bool ok = true;
+
+    test_generate(motion);
+    inertial_delta_init(&d, TEST_ANGLE_LSB);
+    memset(&m, 0, sizeof(m));
+    m.angle_lsb = (double)TEST_ANGLE_LSB;
+    memset(sum_angle, 0, sizeof(sum_angle));
+    memset(sum_velocity, 0, sizeof(sum_velocity));
+
+    for (n = 0; n < TEST_SAMPLES; n++) {
+        inertial_delta_add(&d, test_gyro[n], test_accel[n]);
+        test_model_add(&m, test_gyro[n], test_accel[n]);
+        for (i = 0; i < 3u; i++) {
+            sum_angle[i] += test_gyro[n][i];
+            sum_velocity[i] += test_accel[n][i];
+        }
+        if (n % TEST_INTERVAL != TEST_INTERVAL - 1u) {
+            continue;
+        }
+
+        samples = inertial_delta_end(&d, d_angle, d_velocity);
+        test_model_end(&m, ref_angle, ref_velocity);
+        ok = ok && samples == TEST_INTERVAL;
+        ok = test_compare(d_angle, d_velocity, ref_angle, ref_velocity,
+                          sum_angle, sum_velocity, &max_err) && ok;
+
+        /*
+        The first interval has no previous sample to go on, so only later
+        ones are held to the analytic corrections
+        */
+        test_analytic(motion, n / TEST_INTERVAL, exact_angle,
+                      exact_velocity);
+        for (i = 0; i < 3u && n >= TEST_INTERVAL; i++) {
+            corr = (double)d_angle[i] - TEST_ONE * sum_angle[i];
+            exact = exact_angle[i];
+            if (motion == TEST_SCULLING) {
+                corr = (double)d_velocity[i] - TEST_ONE * sum_velocity[i];
+                exact = exact_velocity[i];
+            }
+            max_motion_err = fmax(max_motion_err, fabs(corr - exact));
+            max_size = fmax(max_size, fabs(exact));
+        }
+
+        memset(sum_angle, 0, sizeof(sum_angle));
+        memset(sum_velocity, 0, sizeof(sum_velocity));
+    }
+
+    size = max_motion_err / max_size;
+    ok = ok && size <= TEST_MOTION_TOLERANCE;
+    printf("%-9s model error %.2f, correction %.0f with error %.2f%% "
+           "(limit %.1f%%): %s\n", test_motion_names[motion], max_err,
+           max_size, size * 100.0, TEST_MOTION_TOLERANCE * 100.0,
+           ok ? "ok" : "FAIL");
+    return ok;
+}
+
+/*
+Full-scale samples over a whole interval, holding one sign pattern for the
+first half and another for the second, so the cross products are as large
+as they get; every pair of patterns for the gyro and the accelerometer is
+tried, and the largest accumulator value is compared with INT64_MAX.
+*/
+static bool test_headroom(void) {
+    struct inertial_delta_t d;
+    struct test_model_t m;
+    int16_t gyro[2][3], accel[2][3];
+    int32_t d_angle[3], d_velocity[3];
+    uint32_t pattern, n, i, half;
+    double ref_angle[3], ref_velocity[3], sum_angle[3], sum_velocity[3],
+           rot[3], alpha[3], nu[3], peak = 0, max_err = 0, bits;
+    bool ok = true;
+
+    inertial_delta_init(&d, TEST_HEADROOM_ANGLE_LSB);
+    memset(&m, 0, sizeof(m));
+    m.angle_lsb = (double)TEST_HEADROOM_ANGLE_LSB;
+
+    for (pattern = 0; pattern < 4096u; pattern++) {
+        for (half = 0; half < 2u; half++) {
+            for (i = 0; i < 3u; i++) {
+                gyro[half][i] = (pattern >> (half * 3u + i)) & 1u ?
+                                INT16_MIN : INT16_MAX;
+                accel[half][i] = (pattern >> (6u + half * 3u + i)) & 1u ?
+                                 INT16_MIN : INT16_MAX;
+            }
+        }
+
+        inertial_delta_reset(&d);
+        memset(&m, 0, sizeof(m));
+        m.angle_lsb = (double)TEST_HEADROOM_ANGLE_LSB;
+        memset(sum_angle, 0, sizeof(sum_angle));
+        memset(sum_velocity, 0, sizeof(sum_velocity));
+
+        for (n = 0; n < INERTIAL_DELTA_MAX_SAMPLES; n++) {
+            half = n < INERTIAL_DELTA_MAX_SAMPLES / 2u ? 0 : 1u;
+            inertial_delta_add(&d, gyro[half], accel[half]);
+            test_model_add(&m, gyro[half], accel[half]);
+            for (i = 0; i < 3u; i++) {
+                sum_angle[i] += gyro[half][i];
+                sum_velocity[i] += accel[half][i];
+            }
+        }
+
+        /* inertial_delta_end adds rot_gain times alpha x nu to scul */
+        for (i = 0; i < 3u; i++) {
+            alpha[i] = d.alpha[i];
+            nu[i] = d.nu[i];
+        }
+        test_cross(alpha, nu, rot);
+        for (i = 0; i < 3u; i++) {
+            peak = fmax(peak, fabs((double)d.beta[i]));
+            peak = fmax(peak, fabs((double)d.scul[i] +
+                                   rot[i] * (double)d.rot_gain));
+        }
+
+        ok = inertial_delta_end(&d, d_angle, d_velocity) ==
+             INERTIAL_DELTA_MAX_SAMPLES && ok;
+        test_model_end(&m, ref_angle, ref_velocity);
+        ok = test_compare(d_angle, d_velocity, ref_angle, ref_velocity,
+                          sum_angle, sum_velocity, &max_err) && ok;
+    }
+
+    bits = log2((double)INT64_MAX / peak);
+    ok = ok && bits >= TEST_HEADROOM_BITS;
+    printf("headroom  model error %.2f, %.2f bits at %u full-scale samples "
+           "(limit %.1f): %s\n", max_err, bits, INERTIAL_DELTA_MAX_SAMPLES,
+           TEST_HEADROOM_BITS, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+int main(void) {
+    uint32_t motion;
+    bool ok = true;
+
+    for (motion = 0; motion < TEST_MOTIONS; motion++) {
+        ok = test_motion((enum test_motion_t)motion) && ok;
+    }
+    ok = test_headroom() && ok;
+
+    return ok ? 0 : 1;
+}
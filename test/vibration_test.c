@@ -0,0 +1,217 @@
+/*
+Copyright (C) 2014 Ben Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Host test for vibration.c: feeds tones plus noise, on top of a constant
+offset standing in for gravity, through vibration_add and vibration_tick
+once per tick (as mpu6000.c does each frame), and checks each result:
+- the peak frequencies are the tones', largest first, to within a fraction
+  of a bin;
+- each band's mean square, averaged over the results, is that of the tones
+  in it plus the band's share of the noise, computed from the input;
+- the analysis finishes within about 90 ticks of the block being captured,
+  with no block dropped.
+Exits with status 1 if any check fails.
+*/
+
+#include <asf.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vibration.h"
+
+#define TEST_SAMPLE_HZ 1000u
+#define TEST_BLOCKS 32u
+#define TEST_SAMPLES ((TEST_BLOCKS + 1u) * VIBRATION_N)
+#define TEST_NOISE 100 /* uniform, +/- LSB */
+
+/*
+Peak frequency error allowed, in bins: a parabola through the Hann-windowed
+power is off by up to 0.115 bins, and peak_dhz truncates to 0.1Hz
+*/
+#define TEST_PEAK_TOLERANCE 0.15
+/*
+Band mean-square error allowed, averaged over the results: relative to the
+band's expected value, plus the window's leakage and the FFT's rounding
+relative to the input's total mean square
+*/
+#define TEST_BAND_TOLERANCE 0.05
+#define TEST_LEAKAGE 1e-4
+/* Ticks from the end of a block to its result */
+#define TEST_TICK_LIMIT 90u
+
+#define TEST_BIN_HZ ((double)TEST_SAMPLE_HZ / (double)VIBRATION_N)
+
+/* As in mpu6000.c */
+static const uint16_t test_band_edges[VIBRATION_BANDS + 1u] = {
+    5u, 40u, 100u, 200u, 500u
+};
+
+struct test_tone_t {
+    double hz;
+    double amplitude;
+    uint32_t axis;
+};
+
+/* Each case's tones, largest first, each at least 3 bins from a band edge */
+#define TEST_TONES VIBRATION_PEAKS
+struct test_case_t {
+    struct test_tone_t tone[TEST_TONES];
+};
+
+static const struct test_case_t test_cases[] = {
+    {{ { 121.3, 2000.0, 0 }, { 251.7, 500.0, 2u }, { 30.0, 300.0, 1u } }},
+    {{ { 67.1, 4000.0, 1u }, { 318.4, 1500.0, 0 }, { 163.9, 700.0, 2u } }},
+    {{ { 412.6, 8000.0, 2u }, { 21.2, 3000.0, 0 }, { 140.5, 1000.0, 1u } }}
+};
+#define TEST_CASES (sizeof(test_cases) / sizeof(test_cases[0]))
+
+static const int16_t test_offset[3] = { 100, -50, 4096 };
+
+static struct vibration_t test_vibration;
+
+void pwm_terminate_flight(void);
+static double test_band_expected(const struct test_case_t *c, uint32_t band,
+double noise_ms);
+static bool test_case(uint32_t n);
+
+/* Reached by fcs_assert */
+void pwm_terminate_flight(void) {
+    fprintf(stderr, "fcs_assert failed\n");
+    abort();
+}
+
+/*
+The mean square of the tones in band, plus the band's share of the noise,
+which is white and so spread evenly up to the Nyquist frequency
+*/
+static double test_band_expected(const struct test_case_t *c, uint32_t band,
+double noise_ms) {
+    double lo = (double)test_band_edges[band],
+           hi = (double)test_band_edges[band + 1u], ms;
+    uint32_t i;
+
+    ms = noise_ms * (hi - lo) / ((double)TEST_SAMPLE_HZ / 2.0);
+    for (i = 0; i < TEST_TONES; i++) {
+        if (c->tone[i].hz >= lo && c->tone[i].hz < hi) {
+            ms += c->tone[i].amplitude * c->tone[i].amplitude / 2.0;
+        }
+    }
+
+    return ms;
+}
+
+static bool test_case(uint32_t n) {
+    const struct test_case_t *c = &test_cases[n];
+    struct vibration_result_t result;
+    int16_t accel[3];
+    uint32_t t, i, axis, results = 0, ticks = 0, max_ticks = 0,
+             seed = 12345u;
+    int32_t noise;
+    double value[3], band_sum[VIBRATION_BANDS], noise_sq = 0, noise_ms,
+           total_ms, err, expected, limit, max_peak_err = 0,
+           max_band_err = 0;
+    bool ok = true;
+
+    vibration_init(&test_vibration, TEST_SAMPLE_HZ, test_band_edges);
+    memset(band_sum, 0, sizeof(band_sum));
+
+    for (t = 0; t < TEST_SAMPLES; t++) {
+        for (axis = 0; axis < 3u; axis++) {
+            seed = seed * 1664525u + 1013904223u;
+            noise = (int32_t)((seed >> 16u) % (2u * TEST_NOISE + 1u)) -
+                    TEST_NOISE;
+            noise_sq += (double)noise * (double)noise;
+            value[axis] = (double)test_offset[axis] + (double)noise;
+        }
+        for (i = 0; i < TEST_TONES; i++) {
+            value[c->tone[i].axis] += c->tone[i].amplitude *
+                sin(2.0 * M_PI * c->tone[i].hz * (double)t /
+                    (double)TEST_SAMPLE_HZ + (double)i);
+        }
+        for (axis = 0; axis < 3u; axis++) {
+            accel[axis] = (int16_t)lrint(value[axis]);
+        }
+
+        vibration_add(&test_vibration, accel);
+        if (test_vibration.state != VIBRATION_IDLE) {
+            ticks++;
+        }
+        if (!vibration_tick(&test_vibration, &result)) {
+            continue;
+        }
+
+        results++;
+        max_ticks = ticks > max_ticks ? ticks : max_ticks;
+        ticks = 0;
+
+        for (i = 0; i < TEST_TONES; i++) {
+            err = fabs((double)result.peak_dhz[i] / 10.0 - c->tone[i].hz) /
+                  TEST_BIN_HZ;
+            max_peak_err = fmax(max_peak_err, err);
+            ok = ok && err <= TEST_PEAK_TOLERANCE;
+        }
+
+        for (i = 0; i < VIBRATION_BANDS; i++) {
+            band_sum[i] += (double)result.band_ms[i];
+        }
+    }
+
+    /*
+    One block's noise is too short to settle each band's share, so compare
+    the mean over the results. The mean squares are summed over the axes,
+    as vibration.c does.
+    */
+    noise_ms = noise_sq / (double)TEST_SAMPLES;
+    total_ms = noise_ms;
+    for (i = 0; i < TEST_TONES; i++) {
+        total_ms += c->tone[i].amplitude * c->tone[i].amplitude / 2.0;
+    }
+    for (i = 0; i < VIBRATION_BANDS && results; i++) {
+        expected = test_band_expected(c, i, noise_ms);
+        err = fabs(band_sum[i] / (double)results - expected);
+        limit = TEST_BAND_TOLERANCE * expected + TEST_LEAKAGE * total_ms;
+        max_band_err = fmax(max_band_err, err / limit);
+        ok = ok && err <= limit;
+    }
+
+    ok = ok && results == TEST_BLOCKS && max_ticks <= TEST_TICK_LIMIT &&
+         test_vibration.overruns == 0;
+    printf("case %u    %u results, peak error %.3f bins (limit %.2f), band "
+           "error %.2f of the limit, %u ticks (limit %u): %s\n", n, results,
+           max_peak_err, TEST_PEAK_TOLERANCE, max_band_err, max_ticks,
+           TEST_TICK_LIMIT, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+int main(void) {
+    uint32_t n;
+    bool ok = true;
+
+    for (n = 0; n < TEST_CASES; n++) {
+        ok = test_case(n) && ok;
+    }
+
+    return ok ? 0 : 1;
+}